@@ -68,11 +68,11 @@
 #endif
 
 #include "CommandAttributes.h"
-#if defined COMPRESSED_LISTS
-#   define      PAD_LIST    0
-#else
-#   define      PAD_LIST    1
-#endif
+
+/* The TSS always pads the lists, even if COMPRESSED_LISTS is defined, so that
+   CommandCodeToCommandIndex() can index directly by command code rather than searching. */
+
+#define      PAD_LIST    1
 
 // This is the command code attribute array for GetCapability(). Both this array and
 // s_commandAttributes provides command code attributes, but tuned for different purpose
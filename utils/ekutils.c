@@ -66,6 +66,7 @@
 #include <ibmtss/tssutils.h>
 #include <ibmtss/tsscrypto.h>
 #include <ibmtss/tssprint.h>
+#include <ibmtss/tsscapability.h>
 #include <ibmtss/Unmarshal_fp.h>
 
 #include "cryptoutils.h"
@@ -95,40 +96,27 @@ extern int verbose;
 /* readNvBufferMax() determines the maximum NV read/write block size.  The limit is typically set by
    the TPM property TPM_PT_NV_BUFFER_MAX.  However, it's possible that a value could be larger than
    the TSS side structure MAX_NV_BUFFER_SIZE.
+
+   The property is read from the TSS context capability cache, so only the first call per context
+   costs a TPM round trip.
 */
 
 TPM_RC readNvBufferMax(TSS_CONTEXT *tssContext,
 		       uint32_t *nvBufferMax)
 {
     TPM_RC			rc = 0;
-    GetCapability_In 		in;
-    GetCapability_Out		out;
 
-    in.capability = TPM_CAP_TPM_PROPERTIES;
-    in.property = TPM_PT_NV_BUFFER_MAX;
-    in.propertyCount = 1;	/* ask for one property */
-    if (rc == 0) {
-	rc = TSS_Execute(tssContext,
-			 (RESPONSE_PARAMETERS *)&out, 
-			 (COMMAND_PARAMETERS *)&in,
-			 NULL,
-			 TPM_CC_GetCapability,
-			 TPM_RH_NULL, NULL, 0);
-    }
-    /* sanity check that the property name is correct (demo of how to parse the structure) */
     if (rc == 0) {
-	if ((out.capabilityData.data.tpmProperties.count > 0) &&
-	    (out.capabilityData.data.tpmProperties.tpmProperty[0].property ==
-	     TPM_PT_NV_BUFFER_MAX)) {
-	    *nvBufferMax = out.capabilityData.data.tpmProperties.tpmProperty[0].value;
-	}
-	else {
-	    if (verbose) printf("readNvBufferMax: wrong property returned: %08x\n",
-		   out.capabilityData.data.tpmProperties.tpmProperty[0].property);
+	rc = TSS_Capability_GetProperty(tssContext, TPM_PT_NV_BUFFER_MAX, nvBufferMax);
+	if (rc == TSS_RC_NO_CAPABILITY) {
+	    if (verbose) printf("readNvBufferMax: TPM_PT_NV_BUFFER_MAX not reported\n");
 	    /* hard code a value for a back level HW TPM that does not implement
 	       TPM_PT_NV_BUFFER_MAX yet */
 	    *nvBufferMax = 512;
+	    rc = 0;
 	}
+    }
+    if (rc == 0) {
 	if (verbose) printf("readNvBufferMax: TPM max read/write: %u\n", *nvBufferMax);
 	/* in addition, the maximum TSS side structure MAX_NV_BUFFER_SIZE is accounted for.  The TSS
 	   value is typically larger than the TPM value. */
@@ -58,6 +58,23 @@ typedef struct TSS_CONTEXT TSS_CONTEXT;
 #define TPM_DEVICE		7
 #define TPM_ENCRYPT_SESSIONS	8
 #define TPM_SERVER_TYPE		9
+#define TPM_VALIDATE_INPUT	10
+#define TPM_SESSION_CACHE	11
+#define TPM_DATA_STORE		12
+#define TPM_COMMAND_PATH	13
+#define TPM_PLATFORM_PATH	14
+#define TPM_CONNECT_TIMEOUT	15
+#define TPM_SERVER_SELECT	16
+#define TPM_COMMAND_TIMEOUT	17
+#define TPM_RETRY_CODES		18
+#define TPM_RETRY_ATTEMPTS	19
+#define TPM_RETRY_DELAY		20
+#define TPM_RECORD_FILE		21
+#define TPM_REPLAY_FILE		22
+#define TPM_RANDOM_SEED		23
+#define TPM_STATS		24
+#define TPM_STATS_FILE		25
+#define TPM_VIRTUALIZE		26
 
 #ifdef __cplusplus
 extern "C" {
@@ -100,11 +117,31 @@ extern "C" {
 		       TPM_CC commandCode,
 		       ...);
 
+    /* split command / response process, TPM 2.0 only */
+
+    LIB_EXPORT
+    TPM_RC TSS_Execute_Prepare(TSS_CONTEXT *tssContext,
+			       COMMAND_PARAMETERS *in,
+			       EXTRA_PARAMETERS *extra,
+			       TPM_CC commandCode,
+			       ...);
+    LIB_EXPORT
+    TPM_RC TSS_Execute_Submit(TSS_CONTEXT *tssContext);
+
+    LIB_EXPORT
+    TPM_RC TSS_Execute_Complete(TSS_CONTEXT *tssContext,
+				RESPONSE_PARAMETERS *out);
+
     LIB_EXPORT
     TPM_RC TSS_SetProperty(TSS_CONTEXT *tssContext,
 			   int property,
 			   const char *value);
 
+    /* write cached session state to the session files, see TPM_SESSION_CACHE */
+
+    LIB_EXPORT
+    TPM_RC TSS_FlushSessionCache(TSS_CONTEXT *tssContext);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,84 @@
+/********************************************************************************/
+/*										*/
+/*			    TSS TPM Capability Cache				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+#ifndef TSSCAPABILITY_H
+#define TSSCAPABILITY_H
+
+#include <stdint.h>
+
+#include <ibmtss/tss.h>
+
+/* The TPM capability cache.  Each group of capabilities is read from the TPM with
+   TPM2_GetCapability on first use and kept in the TSS context, so that later queries need no round
+   trip.
+
+   The cached groups are the TPM_PT_FIXED properties, the implemented algorithms, the implemented
+   commands, and the PCR allocation.  The cache is discarded after TPM2_Startup, TPM2_Clear, and
+   TPM2_PCR_Allocate, and by TSS_Capability_Invalidate(), e.g., after the TPM is replaced or
+   upgraded behind an open TSS context.
+
+   A capability the TPM does not report returns TSS_RC_NO_CAPABILITY.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    LIB_EXPORT TPM_RC
+    TSS_Capability_GetProperty(TSS_CONTEXT *tssContext,
+			       TPM_PT property,
+			       uint32_t *value);
+    LIB_EXPORT TPM_RC
+    TSS_Capability_GetAlgorithm(TSS_CONTEXT *tssContext,
+				TPM_ALG_ID algorithm,
+				TPMA_ALGORITHM *algorithmAttributes);
+    LIB_EXPORT TPM_RC
+    TSS_Capability_GetCommand(TSS_CONTEXT *tssContext,
+			      TPM_CC commandCode,
+			      TPMA_CC *commandAttributes);
+    LIB_EXPORT TPM_RC
+    TSS_Capability_GetPcrs(TSS_CONTEXT *tssContext,
+			   TPML_PCR_SELECTION *pcrSelection);
+    LIB_EXPORT void
+    TSS_Capability_Invalidate(TSS_CONTEXT *tssContext);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
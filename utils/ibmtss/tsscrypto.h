@@ -70,12 +70,24 @@ extern "C" {
     TPM_RC TSS_HMAC_Generate_valist(TPMT_HA *digest,
 				    const TPM2B_KEY *hmacKey,
 				    va_list ap);
+    LIB_EXPORT
+    TPM_RC TSS_HMAC_KeyNew(void **hmacState,
+			   TPMI_ALG_HASH hashAlg,
+			   const TPM2B_KEY *hmacKey);
+    LIB_EXPORT
+    void TSS_HMAC_KeyFree(void *hmacState);
+    LIB_EXPORT
+    TPM_RC TSS_HMAC_GenerateKeyed_valist(TPMT_HA *digest,
+					 void *hmacState,
+					 va_list ap);
     LIB_EXPORT void TSS_XOR(unsigned char *out,
 			    const unsigned char *in1,
 			    const unsigned char *in2,
 			    size_t length);
     LIB_EXPORT
     TPM_RC TSS_RandBytes(unsigned char *buffer, uint32_t size);
+    LIB_EXPORT
+    TPM_RC TSS_RandSeed(const char *seed);
 
     LIB_EXPORT
     TPM_RC TSS_RSA_padding_add_PKCS1_OAEP(unsigned char *em, uint32_t emLen,
@@ -99,6 +111,15 @@ extern "C" {
 				unsigned char *p,
 				int pl,
 				TPMI_ALG_HASH halg);
+    LIB_EXPORT
+    TPM_RC TSS_RSAPublicEncryptKey(unsigned char* encrypt_data,
+				   size_t encrypt_data_size,
+				   const unsigned char *decrypt_data,
+				   size_t decrypt_data_size,
+				   void *rsa_pub_key,
+				   unsigned char *p,
+				   int pl,
+				   TPMI_ALG_HASH halg);
     /*
       deprecated OpenSSL specific functions
     */
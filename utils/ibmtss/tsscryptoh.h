@@ -76,6 +76,15 @@ extern "C" {
 			   UINT32 sizeInBytes,
 			   ...);
     LIB_EXPORT
+    TPM_RC TSS_HMAC_GenerateKeyed(TPMT_HA *digest,
+				  void *hmacState,
+				  ...);
+    LIB_EXPORT
+    TPM_RC TSS_HMAC_VerifyKeyed(TPMT_HA *expect,
+				void *hmacState,
+				UINT32 sizeInBytes,
+				...);
+    LIB_EXPORT
     TPM_RC TSS_KDFA(uint8_t          *keyStream,
 		    TPM_ALG_ID       hashAlg,
 		    const TPM2B     *key,
@@ -83,6 +92,14 @@ extern "C" {
 		    const TPM2B     *contextU,
 		    const TPM2B     *contextV,
 		    uint32_t         sizeInBits);
+    LIB_EXPORT
+    TPM_RC TSS_KDFA_Keyed(uint8_t          *keyStream,
+			  TPM_ALG_ID       hashAlg,
+			  void             *hmacState,
+			  const char       *label,
+			  const TPM2B      *contextU,
+			  const TPM2B      *contextV,
+			  uint32_t         sizeInBits);
 
     LIB_EXPORT
     TPM_RC TSS_KDFE(uint8_t          *keyStream,
@@ -59,6 +59,9 @@
 #define TSS_RC_MALFORMED_RESPONSE	0x000b000a	/* A response packet was fundamentally malformed */
 #define TSS_RC_NULL_PARAMETER		0x000b000b	/* A required parameter was NULL */
 #define TSS_RC_NOT_IMPLEMENTED		0x000b000c	/* TSS function is not implemented */
+#define TSS_RC_TRANSPORT_FULL		0x000b000d	/* No more transports can be registered */
+#define TSS_RC_COMMAND_TIMEOUT		0x000b000e	/* The TPM did not respond before the deadline */
+#define TSS_RC_REPLAY_NOT_FOUND		0x000b000f	/* The command is not in the replay trace */
 #define	TSS_RC_FILE_OPEN		0x000b0010	/* The file could not be opened */
 #define	TSS_RC_FILE_SEEK		0x000b0011	/* A file seek failed */
 #define	TSS_RC_FILE_FTELL		0x000b0012	/* A file ftell failed */
@@ -66,6 +69,9 @@
 #define	TSS_RC_FILE_CLOSE		0x000b0014	/* A file close failed */
 #define	TSS_RC_FILE_WRITE		0x000b0015	/* A file write failed */
 #define	TSS_RC_FILE_REMOVE		0x000b0016	/* A file remove failed */
+#define	TSS_RC_STORE_OPEN		0x000b0017	/* The metadata store could not be opened */
+#define	TSS_RC_STORE_NOT_FOUND		0x000b0018	/* The metadata store has no entry for the key */
+#define	TSS_RC_STORE_FULL		0x000b0019	/* The metadata store has no free record */
 #define	TSS_RC_RNG_FAILURE		0x000b0020	/* Random number generator failed */
 #define TSS_RC_BAD_PWAP_NONCE		0x000b0030	/* Bad PWAP response nonce */
 #define TSS_RC_BAD_PWAP_ATTRIBUTES	0x000b0031	/* Bad PWAP response attributes */
@@ -109,7 +115,9 @@
 #define TSS_RC_KDFE_FAILED              0x000b0084      /* KDFe function failed */
 #define TSS_RC_EC_EPHEMERAL_FAILURE     0x000b0085      /* Failed while making or using EC ephemeral key */
 #define TSS_RC_FAIL			0x000b0086	/* TSS internal failure */
+#define TSS_RC_COMMAND_PENDING		0x000b0087	/* Execute phase called out of sequence */
 #define TSS_RC_NO_SESSION_SLOT		0x000b0090	/* TSS context has no session slot for handle */
 #define TSS_RC_NO_OBJECTPUBLIC_SLOT	0x000b0091	/* TSS context has no object public slot for handle */
 #define TSS_RC_NO_NVPUBLIC_SLOT		0x000b0092	/* TSS context has no NV public slot for handle */
+#define TSS_RC_NO_CAPABILITY		0x000b0093	/* TPM does not report the capability */
 #endif
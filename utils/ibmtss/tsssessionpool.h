@@ -0,0 +1,87 @@
+/********************************************************************************/
+/*										*/
+/*				TSS Session Pool				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+#ifndef TSSSESSIONPOOL_H
+#define TSSSESSIONPOOL_H
+
+#include <ibmtss/tss.h>
+
+/* The session pool keeps sessions started ahead of use, so that a salted TPM2_StartAuthSession,
+   which costs the TPM an asymmetric decryption, is not on the request path.
+
+   A pool holds the idle sessions for one combination of the StartAuthSession_In tpmKey, bind,
+   sessionType, symmetric, and authHash.  The other members of 'in' are ignored.  bindPassword is
+   the authorization of the bind entity, as in StartAuthSession_Extra.
+
+   TSS_SessionPool_Fill() sets the pool size and starts sessions until the pool is full.
+   TSS_SessionPool_Get() hands out an idle session, or starts one if the pool is empty.
+   TSS_SessionPool_Put() returns a session that is still loaded, restarting the policy of a policy
+   session with TPM2_PolicyRestart.  A session that does not fit in the pool is flushed.  A session
+   flushed by continueSession clear must not be returned.
+
+   The idle sessions are flushed by TSS_SessionPool_Flush() and by TSS_Delete().
+*/
+
+#define TSS_SESSION_POOL_MAX	16	/* maximum sessions in one pool */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    LIB_EXPORT TPM_RC
+    TSS_SessionPool_Fill(TSS_CONTEXT *tssContext,
+			 const StartAuthSession_In *in,
+			 const char *bindPassword,
+			 unsigned int size);
+    LIB_EXPORT TPM_RC
+    TSS_SessionPool_Get(TSS_CONTEXT *tssContext,
+			TPMI_SH_AUTH_SESSION *sessionHandle,
+			const StartAuthSession_In *in,
+			const char *bindPassword);
+    LIB_EXPORT TPM_RC
+    TSS_SessionPool_Put(TSS_CONTEXT *tssContext,
+			TPMI_SH_AUTH_SESSION sessionHandle,
+			const StartAuthSession_In *in);
+    LIB_EXPORT TPM_RC
+    TSS_SessionPool_Flush(TSS_CONTEXT *tssContext);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
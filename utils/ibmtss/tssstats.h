@@ -0,0 +1,129 @@
+/********************************************************************************/
+/*										*/
+/*			     TSS Execute Statistics				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+#ifndef TSSSTATS_H
+#define TSSSTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <ibmtss/tss.h>
+
+/* TSS_Execute() phases timed when the TPM_STATS property is set.  TSS_PHASE_TOTAL is the whole
+   command.  Phases that did not run for a command, such as the session phases of a command with
+   no sessions, are not recorded. */
+
+#define TSS_PHASE_PREPROCESS	0	/* command pre-processor */
+#define TSS_PHASE_MARSHAL	1	/* command parameter marshal */
+#define TSS_PHASE_NAMES		2	/* handle Name lookup */
+#define TSS_PHASE_SESSION_LOAD	3	/* session context load */
+#define TSS_PHASE_HMAC		4	/* nonceCaller, HMAC key, cpHash, command HMAC */
+#define TSS_PHASE_ENCRYPT	5	/* command parameter encryption */
+#define TSS_PHASE_TRANSMIT	6	/* transport send and receive */
+#define TSS_PHASE_VERIFY	7	/* rpHash, response HMAC verify, audit */
+#define TSS_PHASE_DECRYPT	8	/* response parameter decryption */
+#define TSS_PHASE_UNMARSHAL	9	/* response parameter unmarshal */
+#define TSS_PHASE_POSTPROCESS	10	/* response post-processor */
+#define TSS_PHASE_SESSION_SAVE	11	/* session context save */
+#define TSS_PHASE_TOTAL		12	/* TSS_Execute() */
+#define TSS_PHASE_COUNT		13
+
+/* A log linear histogram of nanosecond times.  Each power of two is split into
+   2^TSS_HISTOGRAM_SUB_BITS buckets, so a value is recorded with a relative error of at most 1/8.
+   Values below 2^(TSS_HISTOGRAM_SUB_BITS + 1) have a bucket each.  The range is 2^40 nsec,
+   about 18 minutes.  Larger values are counted in the last bucket. */
+
+#define TSS_HISTOGRAM_SUB_BITS	3
+#define TSS_HISTOGRAM_MAX_BITS	40
+#define TSS_HISTOGRAM_BUCKETS	((TSS_HISTOGRAM_MAX_BITS - TSS_HISTOGRAM_SUB_BITS + 1) << \
+				 TSS_HISTOGRAM_SUB_BITS)
+
+typedef struct TSS_HISTOGRAM {
+    uint64_t 		count;
+    uint64_t 		totalNsec;
+    uint64_t 		minNsec;
+    uint64_t 		maxNsec;
+    uint32_t 		buckets[TSS_HISTOGRAM_BUCKETS];
+} TSS_HISTOGRAM;
+
+/* the histograms of one command code */
+
+typedef struct TSS_COMMAND_STATS {
+    TPM_CC 		commandCode;
+    TSS_HISTOGRAM 	phases[TSS_PHASE_COUNT];
+} TSS_COMMAND_STATS;
+
+/* The TPM_STATS_FILE file.  All integers are big endian.  TSS_Delete() appends a record, so one
+   file can hold the statistics of many processes.
+
+   record:	magic, version, histogram count (uint32_t each), histograms
+   histogram:	commandCode, phase (uint32_t each),
+		count, totalNsec, minNsec, maxNsec (uint64_t each),
+		bucket count (uint32_t), buckets
+   bucket:	index, count (uint32_t each), only for buckets with a non-zero count
+*/
+
+#define TSS_STATS_MAGIC		0x54535354	/* "TSST" */
+#define TSS_STATS_VERSION	1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    LIB_EXPORT TPM_RC
+    TSS_Stats_Snapshot(TSS_CONTEXT *tssContext,
+		       TSS_COMMAND_STATS **stats,	/* freed by caller */
+		       size_t *count);
+    LIB_EXPORT TPM_RC
+    TSS_Stats_Reset(TSS_CONTEXT *tssContext);
+
+    LIB_EXPORT void
+    TSS_Histogram_Record(TSS_HISTOGRAM *histogram, uint64_t nsec);
+    LIB_EXPORT void
+    TSS_Histogram_Add(TSS_HISTOGRAM *target, const TSS_HISTOGRAM *source);
+    LIB_EXPORT uint64_t
+    TSS_Histogram_Percentile(const TSS_HISTOGRAM *histogram, double percentile);
+
+    LIB_EXPORT const char *
+    TSS_Stats_PhaseName(unsigned int phase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -54,9 +54,62 @@
 #define TPM_SEND_COMMAND            8
 #define TPM_SESSION_END             20
 
+/* The TPM_RECORD_FILE trace, read by the replay interface type.  All integers are big endian.
+
+   file header:	magic, version (uint32_t each)
+   record:	commandLength, responseLength, tpmUsec, tssUsec (uint32_t each),
+		command packet, response packet
+
+   tpmUsec is the elapsed time in the transport.  tssUsec is the thread CPU time in TSS_Execute()
+   outside the transport, 0 if not measured.  Records are appended, so one file can hold the
+   commands of many processes. */
+
+#define TSS_RECORD_MAGIC		0x54535452	/* "TSTR" */
+#define TSS_RECORD_VERSION		1
+#define TSS_RECORD_FILE_HEADER_SIZE	(2 * sizeof(uint32_t))
+#define TSS_RECORD_HEADER_SIZE		(4 * sizeof(uint32_t))
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+    /* A TPM transport, selected by the TPM_INTERFACE_TYPE property when the connection is opened.
+
+       open() is called once per connection, before the first command.  It may open the connection
+       or leave that to the first command.  close() is called by TSS_Close().
+
+       transmit() sends a command and receives the response.  send() and receive() optionally
+       split the exchange, and getFd() optionally returns a descriptor that becomes readable when
+       the response is available.  transmitPlatform() optionally sends simulator platform
+       commands.
+
+       Only transmit() is required.  Unused entry points are NULL. */
+
+    typedef struct TSS_TRANSPORT {
+	const char *interfaceType;	/* the TPM_INTERFACE_TYPE value */
+	TPM_RC (*open)(TSS_CONTEXT *tssContext);
+	TPM_RC (*transmit)(TSS_CONTEXT *tssContext,
+			   uint8_t *responseBuffer, uint32_t *read,
+			   const uint8_t *commandBuffer, uint32_t written,
+			   const char *message);
+	TPM_RC (*send)(TSS_CONTEXT *tssContext,
+		       const uint8_t *commandBuffer, uint32_t written,
+		       const char *message);
+	TPM_RC (*receive)(TSS_CONTEXT *tssContext,
+			  uint8_t *responseBuffer, uint32_t *read);
+	TPM_RC (*getFd)(TSS_CONTEXT *tssContext, int *fd);
+	TPM_RC (*transmitPlatform)(TSS_CONTEXT *tssContext,
+				   uint32_t command, const char *message);
+	TPM_RC (*close)(TSS_CONTEXT *tssContext);
+    } TSS_TRANSPORT;
+
+    LIB_EXPORT TPM_RC
+    TSS_RegisterTransport(const TSS_TRANSPORT *transport);
+    LIB_EXPORT TPM_RC
+    TSS_SetTransportData(TSS_CONTEXT *tssContext, void *transportData);
+    LIB_EXPORT void *
+    TSS_GetTransportData(TSS_CONTEXT *tssContext);
+
     LIB_EXPORT TPM_RC
     TSS_TransmitPlatform(TSS_CONTEXT *tssContext,
 			 uint32_t command, const char *message);
@@ -66,6 +119,16 @@ extern "C" {
 		 const uint8_t *commandBuffer, uint32_t written,
 		 const char *message);
 
+    LIB_EXPORT TPM_RC
+    TSS_TransmitSend(TSS_CONTEXT *tssContext,
+		     const uint8_t *commandBuffer, uint32_t written,
+		     const char *message);
+    LIB_EXPORT TPM_RC
+    TSS_TransmitReceive(TSS_CONTEXT *tssContext,
+			uint8_t *responseBuffer, uint32_t *read);
+    LIB_EXPORT TPM_RC
+    TSS_TransmitGetFd(TSS_CONTEXT *tssContext, int *fd);
+
     LIB_EXPORT TPM_RC
     TSS_Close(TSS_CONTEXT *tssContext);
 
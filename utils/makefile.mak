@@ -104,6 +104,7 @@ ALL =
 # default TSS library
 
 TSS_OBJS = 	tssfile.o 		\
+		tssstore.o 		\
 		tsscryptoh.o 		\
 		tsscrypto.o 		\
 		tssprintcmd.o
@@ -165,10 +166,18 @@ tssutils.o: 	$(TSS_HEADERS) tssutils.c
 		$(CC) $(CCFLAGS) $(CCLFLAGS) tssutils.c
 tssfile.o: 	$(TSS_HEADERS) tssfile.c
 		$(CC) $(CCFLAGS) $(CCLFLAGS) tssfile.c
+tssstore.o: 	$(TSS_HEADERS) tssstore.c
+		$(CC) $(CCFLAGS) $(CCLFLAGS) tssstore.c
 tsssocket.o: 	$(TSS_HEADERS) tsssocket.c
 		$(CC) $(CCFLAGS) $(CCLFLAGS) tsssocket.c
 tssdev.o: 	$(TSS_HEADERS) tssdev.c
 		$(CC) $(CCFLAGS) $(CCLFLAGS) tssdev.c
+tssshm.o: 	$(TSS_HEADERS) tssshm.c
+		$(CC) $(CCFLAGS) $(CCLFLAGS) tssshm.c
+tssrecord.o: 	$(TSS_HEADERS) tssrecord.c
+		$(CC) $(CCFLAGS) $(CCLFLAGS) tssrecord.c
+tssstats.o: 	$(TSS_HEADERS) tssstats.c
+		$(CC) $(CCFLAGS) $(CCLFLAGS) tssstats.c
 tsstransmit.o: 	$(TSS_HEADERS) tsstransmit.c
 		$(CC) $(CCFLAGS) $(CCLFLAGS) tsstransmit.c
 tssresponsecode.o: $(TSS_HEADERS) tssresponsecode.c
@@ -194,6 +203,12 @@ tss20.o: 	$(TSS_HEADERS) tss20.c
 		$(CC) $(CCFLAGS) $(CCLFLAGS) tss20.c
 tssauth20.o: 	$(TSS_HEADERS) tssauth20.c
 		$(CC) $(CCFLAGS) $(CCLFLAGS) tssauth20.c
+tsscapability.o: 	$(TSS_HEADERS) tsscapability.c
+		$(CC) $(CCFLAGS) $(CCLFLAGS) tsscapability.c
+tsssessionpool.o: 	$(TSS_HEADERS) tsssessionpool.c
+		$(CC) $(CCFLAGS) $(CCLFLAGS) tsssessionpool.c
+tssvirtual.o: 	$(TSS_HEADERS) tssvirtual.c
+		$(CC) $(CCFLAGS) $(CCLFLAGS) tssvirtual.c
 
 # TSS shared library build
 
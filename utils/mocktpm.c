@@ -0,0 +1,1384 @@
+/********************************************************************************/
+/*										*/
+/*			   Mock TPM for TSS Benchmarking			*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* mocktpm answers TPM 2.0 commands in process for the TSS benchmark.
+
+   Each supported command code has a table entry giving the number of command handles and a
+   function that parses the command parameters and marshals the response parameters.  The common
+   code handles the command and response headers and the authorization areas: command parameter
+   decryption, nonceTPM rolling, response parameter encryption, and the response HMAC.
+
+   The state is per TSS context, allocated at open and freed at close.  All objects created by
+   TPM2_CreatePrimary() share one RSA 2048 key, generated at first use.
+
+   For testing TPM_VIRTUALIZE, MockTpm_SetLimits() reduces the number of loaded objects and
+   sessions and the context gap.  TPM2_ContextSave() of a session leaves the session state in the
+   mock and returns a context holding its sequence, so a session context can be loaded only
+   once.  An object context holds the public area and Name, and can be loaded more than once.
+   The context counter advances at each session save.  TPM2_StartAuthSession() and a session
+   save return TPM_RC_CONTEXT_GAP when the oldest saved session is gapMax saves old.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef TPM_WINDOWS
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#ifdef TPM_POSIX
+#include <netinet/in.h>
+#endif
+
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tsstransmit.h>
+#include <ibmtss/tssmarshal.h>
+#include <ibmtss/Unmarshal_fp.h>
+#include <ibmtss/tsscryptoh.h>
+#include <ibmtss/tsserror.h>
+
+#include "cryptoutils.h"
+#include "mocktpm.h"
+
+#define MOCK_SESSIONS_MAX	16	/* active sessions, loaded or saved */
+#define MOCK_OBJECTS_MAX	3	/* loaded objects */
+#define MOCK_HANDLES_MAX	3
+#define MOCK_RSA_KEY_BITS	2048
+#define MOCK_GAP_MAX		0xffff	/* default context gap */
+
+/* a loaded session */
+
+typedef struct MOCK_SESSION {
+    TPMI_SH_AUTH_SESSION	handle;		/* 0 when the slot is free */
+    TPMI_ALG_HASH		authHashAlg;
+    TPMT_SYM_DEF		symmetric;
+    TPM2B_KEY			sessionKey;	/* also the HMAC key and sessionValue, empty auth */
+    TPM2B_NONCE			nonceTPM;
+    int				loaded;		/* FALSE after TPM2_ContextSave() */
+    uint64_t			sequence;	/* of the saved context */
+} MOCK_SESSION;
+
+/* a loaded object */
+
+typedef struct MOCK_OBJECT {
+    TPM_HANDLE			handle;		/* 0 when the slot is free */
+    TPM2B_PUBLIC		outPublic;
+    TPM2B_NAME			name;
+} MOCK_OBJECT;
+
+typedef struct MOCK_TPM {
+    MOCK_SESSION		sessions[MOCK_SESSIONS_MAX];
+    MOCK_OBJECT			objects[MOCK_OBJECTS_MAX];
+    size_t			objectSlots;	/* loaded objects, at most MOCK_OBJECTS_MAX */
+    size_t			sessionSlots;	/* loaded sessions, at most MOCK_SESSIONS_MAX */
+    uint64_t			gapMax;
+    uint64_t			contextCounter;	/* sequence of the latest session save */
+    uint64_t			objectCounter;	/* sequence of the latest object save */
+    RSA				*rsaKey;	/* shared by all objects, freed at close */
+    uint8_t			command[MAX_COMMAND_SIZE];
+    uint8_t			parameters[MAX_RESPONSE_SIZE];
+} MOCK_TPM;
+
+/* a parsed command */
+
+typedef struct MOCK_COMMAND {
+    TPMI_ST_COMMAND_TAG		tag;
+    TPM_CC			commandCode;
+    TPM_HANDLE			handles[MOCK_HANDLES_MAX];
+    size_t			authCount;
+    TPMS_AUTH_COMMAND		auths[MAX_SESSION_NUM];
+    MOCK_SESSION		*sessions[MAX_SESSION_NUM];	/* NULL for a password session */
+    uint8_t			*parameters;
+    uint32_t			parameterSize;
+} MOCK_COMMAND;
+
+/* the response handle and parameters, filled in by the command function */
+
+typedef struct MOCK_RESPONSE {
+    TPM_HANDLE			handle;		/* 0 if the command has no response handle */
+    uint8_t			*parameters;
+    uint16_t			parameterSize;
+} MOCK_RESPONSE;
+
+typedef TPM_RC (*MockTpm_Function_t)(MOCK_TPM *mockTpm,
+				     MOCK_COMMAND *command,
+				     MOCK_RESPONSE *response);
+
+typedef struct MOCK_COMMAND_TABLE {
+    TPM_CC			commandCode;
+    size_t			handleCount;
+    MockTpm_Function_t		function;
+} MOCK_COMMAND_TABLE;
+
+static TPM_RC MockTpm_Startup(MOCK_TPM *mockTpm, MOCK_COMMAND *command, MOCK_RESPONSE *response);
+static TPM_RC MockTpm_StartAuthSession(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				       MOCK_RESPONSE *response);
+static TPM_RC MockTpm_FlushContext(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				   MOCK_RESPONSE *response);
+static TPM_RC MockTpm_GetRandom(MOCK_TPM *mockTpm, MOCK_COMMAND *command, MOCK_RESPONSE *response);
+static TPM_RC MockTpm_PCR_Extend(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				 MOCK_RESPONSE *response);
+static TPM_RC MockTpm_Hash(MOCK_TPM *mockTpm, MOCK_COMMAND *command, MOCK_RESPONSE *response);
+static TPM_RC MockTpm_CreatePrimary(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				    MOCK_RESPONSE *response);
+static TPM_RC MockTpm_ReadPublic(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				 MOCK_RESPONSE *response);
+static TPM_RC MockTpm_ContextSave(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				  MOCK_RESPONSE *response);
+static TPM_RC MockTpm_ContextLoad(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				  MOCK_RESPONSE *response);
+
+static const MOCK_COMMAND_TABLE mockCommandTable [] = {
+    {TPM_CC_Startup,		0, MockTpm_Startup},
+    {TPM_CC_StartAuthSession,	2, MockTpm_StartAuthSession},
+    {TPM_CC_FlushContext,	0, MockTpm_FlushContext},
+    {TPM_CC_GetRandom,		0, MockTpm_GetRandom},
+    {TPM_CC_PCR_Extend,		1, MockTpm_PCR_Extend},
+    {TPM_CC_Hash,		0, MockTpm_Hash},
+    {TPM_CC_CreatePrimary,	1, MockTpm_CreatePrimary},
+    {TPM_CC_ReadPublic,		1, MockTpm_ReadPublic},
+    {TPM_CC_ContextSave,	1, MockTpm_ContextSave},
+    {TPM_CC_ContextLoad,	0, MockTpm_ContextLoad},
+};
+
+static TPM_RC MockTpm_ParseCommand(MOCK_TPM *mockTpm,
+				   MOCK_COMMAND *command,
+				   const MOCK_COMMAND_TABLE **entry,
+				   uint32_t written);
+static TPM_RC MockTpm_ParamCrypt(MOCK_SESSION *session,
+				 uint8_t *parameters,
+				 uint32_t parameterSize,
+				 TPM2B_NONCE *nonceNewer,
+				 TPM2B_NONCE *nonceOlder,
+				 int encrypt);
+static TPM_RC MockTpm_Marshal(MOCK_COMMAND *command,
+			      MOCK_RESPONSE *response,
+			      uint8_t *responseBuffer,
+			      uint32_t *read);
+static void MockTpm_ErrorResponse(uint8_t *responseBuffer,
+				  uint32_t *read,
+				  TPM_RC responseCode);
+static MOCK_SESSION *MockTpm_GetSession(MOCK_TPM *mockTpm, TPM_HANDLE handle);
+static MOCK_OBJECT *MockTpm_GetObject(MOCK_TPM *mockTpm, TPM_HANDLE handle);
+static MOCK_OBJECT *MockTpm_GetFreeObject(MOCK_TPM *mockTpm);
+static size_t MockTpm_LoadedSessions(MOCK_TPM *mockTpm);
+static TPM_RC MockTpm_CheckGap(MOCK_TPM *mockTpm);
+static const EVP_MD *MockTpm_GetMd(TPMI_ALG_HASH hashAlg);
+
+/* MockTpm_Open() allocates the mock TPM state for the TSS context, if MockTpm_SetLimits() has
+   not already */
+
+TPM_RC MockTpm_Open(TSS_CONTEXT *tssContext)
+{
+    TPM_RC 	rc = 0;
+    MOCK_TPM	*mockTpm = NULL;
+
+    if (TSS_GetTransportData(tssContext) != NULL) {
+	return rc;
+    }
+    if (rc == 0) {
+	mockTpm = calloc(1, sizeof(MOCK_TPM));		/* freed @1 */
+	if (mockTpm == NULL) {
+	    printf("MockTpm_Open: Error allocating %lu bytes\n",
+		   (unsigned long)sizeof(MOCK_TPM));
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	mockTpm->objectSlots = MOCK_OBJECTS_MAX;
+	mockTpm->sessionSlots = MOCK_SESSIONS_MAX;
+	mockTpm->gapMax = MOCK_GAP_MAX;
+	rc = TSS_SetTransportData(tssContext, mockTpm);
+    }
+    return rc;
+}
+
+/* MockTpm_SetLimits() sets the number of objects and sessions that can be loaded at once, and the
+   context gap.  It opens the mock TPM if needed, so it can be called before the first command. */
+
+TPM_RC MockTpm_SetLimits(TSS_CONTEXT *tssContext,
+			 size_t objectSlots,
+			 size_t sessionSlots,
+			 uint64_t gapMax)
+{
+    TPM_RC 	rc = 0;
+    MOCK_TPM	*mockTpm = NULL;
+
+    if (rc == 0) {
+	if ((objectSlots == 0) || (objectSlots > MOCK_OBJECTS_MAX) ||
+	    (sessionSlots == 0) || (sessionSlots > MOCK_SESSIONS_MAX) ||
+	    (gapMax == 0)) {
+	    printf("MockTpm_SetLimits: Error, limits out of range\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    if (rc == 0) {
+	rc = MockTpm_Open(tssContext);
+    }
+    if (rc == 0) {
+	mockTpm = TSS_GetTransportData(tssContext);
+	mockTpm->objectSlots = objectSlots;
+	mockTpm->sessionSlots = sessionSlots;
+	mockTpm->gapMax = gapMax;
+    }
+    return rc;
+}
+
+/* MockTpm_Close() frees the mock TPM state.  Transient objects and sessions are lost, as with a
+   TPM reset. */
+
+TPM_RC MockTpm_Close(TSS_CONTEXT *tssContext)
+{
+    MOCK_TPM	*mockTpm = TSS_GetTransportData(tssContext);
+
+    if (mockTpm != NULL) {
+	RSA_free(mockTpm->rsaKey);
+	free(mockTpm);		/* @1 */
+	TSS_SetTransportData(tssContext, NULL);
+    }
+    return 0;
+}
+
+/* MockTpm_TransmitPlatform() accepts the simulator platform commands (power up, NV on) so that
+   scripts written for the simulator run against the mock. */
+
+TPM_RC MockTpm_TransmitPlatform(TSS_CONTEXT *tssContext,
+				uint32_t command, const char *message)
+{
+    tssContext = tssContext;
+    command = command;
+    message = message;
+    return 0;
+}
+
+/* MockTpm_Transmit() processes one command and returns the response.
+
+   As with the other transports, returns the TPM response code, which is also in the response
+   buffer, or a TSS_RC error with no response for a failure of the mock itself.
+*/
+
+TPM_RC MockTpm_Transmit(TSS_CONTEXT *tssContext,
+			uint8_t *responseBuffer, uint32_t *read,
+			const uint8_t *commandBuffer, uint32_t written,
+			const char *message)
+{
+    TPM_RC 			rc = 0;
+    TPM_RC 			responseCode = 0;
+    MOCK_TPM			*mockTpm = TSS_GetTransportData(tssContext);
+    MOCK_COMMAND		command;
+    MOCK_RESPONSE		response;
+    const MOCK_COMMAND_TABLE	*entry = NULL;
+    size_t 			i;
+
+    message = message;
+    if (mockTpm == NULL) {
+	printf("MockTpm_Transmit: Error, mock TPM not open\n");
+	rc = TSS_RC_NO_CONNECTION;
+    }
+    if ((rc == 0) && (written > sizeof(mockTpm->command))) {
+	printf("MockTpm_Transmit: Error, command size %u too large\n", written);
+	rc = TSS_RC_BAD_CONNECTION;
+    }
+    if (rc == 0) {
+	/* parameters may be decrypted in place */
+	memcpy(mockTpm->command, commandBuffer, written);
+	responseCode = MockTpm_ParseCommand(mockTpm, &command, &entry, written);
+    }
+    /* decrypt the first command parameter */
+    for (i = 0 ; (rc == 0) && (responseCode == 0) && (i < command.authCount) ; i++) {
+	if ((command.sessions[i] != NULL) &&
+	    (command.auths[i].sessionAttributes.val & TPMA_SESSION_DECRYPT)) {
+	    responseCode = MockTpm_ParamCrypt(command.sessions[i],
+					      command.parameters, command.parameterSize,
+					      &command.auths[i].nonce,	/* nonceCaller */
+					      &command.sessions[i]->nonceTPM,
+					      FALSE);
+	}
+    }
+    if ((rc == 0) && (responseCode == 0)) {
+	response.handle = 0;
+	response.parameters = mockTpm->parameters;
+	response.parameterSize = 0;
+	responseCode = entry->function(mockTpm, &command, &response);
+    }
+    if ((rc == 0) && (responseCode == 0)) {
+	responseCode = MockTpm_Marshal(&command, &response, responseBuffer, read);
+    }
+    if ((rc == 0) && (responseCode != 0)) {
+	MockTpm_ErrorResponse(responseBuffer, read, responseCode);
+    }
+    if (rc == 0) {
+	rc = responseCode;
+    }
+    return rc;
+}
+
+/* MockTpm_ParseCommand() parses the command header, handles, and authorization area.  It returns
+   the command table entry and leaves the parameters for the command function. */
+
+static TPM_RC MockTpm_ParseCommand(MOCK_TPM *mockTpm,
+				   MOCK_COMMAND *command,
+				   const MOCK_COMMAND_TABLE **entry,
+				   uint32_t written)
+{
+    TPM_RC 	rc = 0;
+    uint8_t 	*buffer = mockTpm->command;
+    uint32_t 	size = written;
+    uint32_t 	commandSize;
+    uint32_t 	authSize;
+    uint8_t 	*authBuffer;
+    size_t 	i;
+
+    command->authCount = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ST_COMMAND_TAG_Unmarshalu(&command->tag, &buffer, &size);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT32_Unmarshalu(&commandSize, &buffer, &size);
+    }
+    if (rc == 0) {
+	if (commandSize != written) {
+	    rc = TPM_RC_COMMAND_SIZE;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_TPM_CC_Unmarshalu(&command->commandCode, &buffer, &size);
+    }
+    if (rc == 0) {
+	*entry = NULL;
+	for (i = 0 ; i < sizeof(mockCommandTable) / sizeof(MOCK_COMMAND_TABLE) ; i++) {
+	    if (mockCommandTable[i].commandCode == command->commandCode) {
+		*entry = &mockCommandTable[i];
+		break;
+	    }
+	}
+	if (*entry == NULL) {
+	    rc = TPM_RC_COMMAND_CODE;
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < (*entry)->handleCount) ; i++) {
+	rc = TSS_TPM_HANDLE_Unmarshalu(&command->handles[i], &buffer, &size);
+    }
+    if ((rc == 0) && (command->tag == TPM_ST_SESSIONS)) {
+	if (rc == 0) {
+	    rc = TSS_UINT32_Unmarshalu(&authSize, &buffer, &size);
+	}
+	if (rc == 0) {
+	    if (authSize > size) {
+		rc = TPM_RC_AUTHSIZE;
+	    }
+	}
+	/* the authorization area is consumed from a sub-buffer of authSize */
+	if (rc == 0) {
+	    authBuffer = buffer;
+	    buffer += authSize;
+	    size -= authSize;
+	}
+	while ((rc == 0) && (authSize > 0)) {
+	    TPMS_AUTH_COMMAND *auth = &command->auths[command->authCount];
+	    if (command->authCount >= MAX_SESSION_NUM) {
+		rc = TPM_RC_AUTHSIZE;
+	    }
+	    if (rc == 0) {
+		rc = TSS_TPMI_SH_AUTH_SESSION_Unmarshalu(&auth->sessionHandle,
+							 &authBuffer, &authSize, YES);
+	    }
+	    if (rc == 0) {
+		rc = TSS_TPM2B_NONCE_Unmarshalu(&auth->nonce, &authBuffer, &authSize);
+	    }
+	    if (rc == 0) {
+		rc = TSS_TPMA_SESSION_Unmarshalu(&auth->sessionAttributes, &authBuffer, &authSize);
+	    }
+	    if (rc == 0) {
+		rc = TSS_TPM2B_AUTH_Unmarshalu(&auth->hmac, &authBuffer, &authSize);
+	    }
+	    if (rc == 0) {
+		if (auth->sessionHandle == TPM_RS_PW) {
+		    command->sessions[command->authCount] = NULL;
+		}
+		else {
+		    command->sessions[command->authCount] =
+			MockTpm_GetSession(mockTpm, auth->sessionHandle);
+		    if (command->sessions[command->authCount] == NULL) {
+			rc = TPM_RC_HANDLE + TPM_RC_S + (TPM_RC_1 * (command->authCount + 1));
+		    }
+		    /* a saved session must be loaded before use */
+		    else if (!command->sessions[command->authCount]->loaded) {
+			rc = TPM_RC_REFERENCE_S0 + command->authCount;
+		    }
+		}
+	    }
+	    if (rc == 0) {
+		command->authCount++;
+	    }
+	}
+    }
+    if (rc == 0) {
+	command->parameters = buffer;
+	command->parameterSize = size;
+    }
+    return rc;
+}
+
+/* MockTpm_ParamCrypt() decrypts the first command parameter or encrypts the first response
+   parameter in place.  The parameter must be a TPM2B.  The key is the sessionKey, since entity
+   authorization values are empty.
+
+   For a command, nonceNewer is nonceCaller.  For a response, nonceNewer is nonceTPM.
+*/
+
+static TPM_RC MockTpm_ParamCrypt(MOCK_SESSION *session,
+				 uint8_t *parameters,
+				 uint32_t parameterSize,
+				 TPM2B_NONCE *nonceNewer,
+				 TPM2B_NONCE *nonceOlder,
+				 int encrypt)
+{
+    TPM_RC 		rc = 0;
+    uint16_t 		paramSize;
+    uint8_t 		*param;
+    uint8_t		mask[MAX_RESPONSE_SIZE];
+    uint32_t		i;
+
+    /* the TPM2B size is not encrypted */
+    if (rc == 0) {
+	if (parameterSize < sizeof(uint16_t)) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	paramSize = ((uint16_t)parameters[0] << 8) | parameters[1];
+	param = parameters + sizeof(uint16_t);
+	if (paramSize > (parameterSize - sizeof(uint16_t))) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if ((rc == 0) && (session->symmetric.algorithm == TPM_ALG_XOR)) {
+	/* mask = KDFa (hashAlg, sessionValue, "XOR", nonceNewer, nonceOlder, data.size * 8) */
+	if (rc == 0) {
+	    rc = TSS_KDFA(mask,
+			  session->authHashAlg,
+			  &session->sessionKey.b,
+			  "XOR",
+			  &nonceNewer->b,
+			  &nonceOlder->b,
+			  paramSize * 8);
+	}
+	for (i = 0 ; (rc == 0) && (i < paramSize) ; i++) {
+	    param[i] ^= mask[i];
+	}
+    }
+    else if ((rc == 0) && (session->symmetric.algorithm == TPM_ALG_AES)) {
+	/* KDFa (hashAlg, sessionValue, "CFB", nonceNewer, nonceOlder, bits), key then IV */
+	uint16_t		keyBytes = session->symmetric.keyBits.aes / 8;
+	uint8_t			symParmString[MAX_SYM_KEY_BYTES + MAX_SYM_BLOCK_SIZE];
+	const EVP_CIPHER	*cipher = NULL;
+	EVP_CIPHER_CTX		*ctx = NULL;
+	int			outLength;
+
+	if (rc == 0) {
+	    switch (session->symmetric.keyBits.aes) {
+	      case 128:
+		cipher = EVP_aes_128_cfb128();
+		break;
+	      case 192:
+		cipher = EVP_aes_192_cfb128();
+		break;
+	      case 256:
+		cipher = EVP_aes_256_cfb128();
+		break;
+	      default:
+		rc = TPM_RC_SYMMETRIC;
+	    }
+	}
+	if (rc == 0) {
+	    rc = TSS_KDFA(symParmString,
+			  session->authHashAlg,
+			  &session->sessionKey.b,
+			  "CFB",
+			  &nonceNewer->b,
+			  &nonceOlder->b,
+			  (keyBytes + MAX_SYM_BLOCK_SIZE) * 8);
+	}
+	if (rc == 0) {
+	    ctx = EVP_CIPHER_CTX_new();		/* freed @1 */
+	    if (ctx == NULL) {
+		rc = TSS_RC_OUT_OF_MEMORY;
+	    }
+	}
+	if (rc == 0) {
+	    if ((EVP_CipherInit_ex(ctx, cipher, NULL,
+				   symParmString, symParmString + keyBytes, encrypt) != 1) ||
+		(EVP_CipherUpdate(ctx, param, &outLength, param, paramSize) != 1)) {
+		rc = TSS_RC_AES_ENCRYPT_FAILURE;
+	    }
+	}
+	EVP_CIPHER_CTX_free(ctx);		/* @1 */
+    }
+    else if (rc == 0) {
+	rc = TPM_RC_SYMMETRIC;
+    }
+    return rc;
+}
+
+/* MockTpm_Marshal() marshals the response header, handle, and parameters, rolls nonceTPM, and
+   appends the authorization area.
+
+   For an HMAC or policy session:
+
+   rpHash = HauthHash (responseCode || commandCode || parameters)
+   hmac = HMAC (sessionKey || authValue, rpHash || nonceTPM || nonceCaller || sessionAttributes)
+*/
+
+static TPM_RC MockTpm_Marshal(MOCK_COMMAND *command,
+			      MOCK_RESPONSE *response,
+			      uint8_t *responseBuffer,
+			      uint32_t *read)
+{
+    TPM_RC 		rc = 0;
+    uint16_t 		written = 0;
+    uint8_t 		*buffer = responseBuffer;
+    uint32_t 		size = MAX_RESPONSE_SIZE;
+    uint32_t 		responseSize;
+    uint32_t 		parameterSize;
+    TPM_RC		responseCode = TPM_RC_SUCCESS;
+    TPM_CC		commandCodeNbo = htonl(command->commandCode);
+    TPMS_AUTH_RESPONSE	authResponse;
+    TPMT_HA		rpHash;
+    TPMT_HA		hmac;
+    size_t		i;
+
+    /* roll nonceTPM */
+    for (i = 0 ; (rc == 0) && (i < command->authCount) ; i++) {
+	if (command->sessions[i] != NULL) {
+	    if (RAND_bytes(command->sessions[i]->nonceTPM.t.buffer,
+			   command->sessions[i]->nonceTPM.t.size) != 1) {
+		rc = TSS_RC_RNG_FAILURE;
+	    }
+	}
+    }
+    /* encrypt the first response parameter */
+    for (i = 0 ; (rc == 0) && (i < command->authCount) ; i++) {
+	if ((command->sessions[i] != NULL) &&
+	    (command->auths[i].sessionAttributes.val & TPMA_SESSION_ENCRYPT)) {
+	    rc = MockTpm_ParamCrypt(command->sessions[i],
+				    response->parameters, response->parameterSize,
+				    &command->sessions[i]->nonceTPM,
+				    &command->auths[i].nonce,		/* nonceCaller */
+				    TRUE);
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_UINT16_Marshalu(&command->tag, &written, &buffer, &size);
+    }
+    /* responseSize is filled in at the end */
+    if (rc == 0) {
+	responseSize = 0;
+	rc = TSS_UINT32_Marshalu(&responseSize, &written, &buffer, &size);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT32_Marshalu(&responseCode, &written, &buffer, &size);
+    }
+    if ((rc == 0) && (response->handle != 0)) {
+	rc = TSS_UINT32_Marshalu(&response->handle, &written, &buffer, &size);
+    }
+    if ((rc == 0) && (command->tag == TPM_ST_SESSIONS)) {
+	parameterSize = response->parameterSize;
+	rc = TSS_UINT32_Marshalu(&parameterSize, &written, &buffer, &size);
+    }
+    if (rc == 0) {
+	rc = TSS_Array_Marshalu(response->parameters, response->parameterSize,
+				&written, &buffer, &size);
+    }
+    for (i = 0 ; (rc == 0) && (i < command->authCount) ; i++) {
+	MOCK_SESSION *session = command->sessions[i];
+	if (session == NULL) {
+	    authResponse.nonce.t.size = 0;
+	    authResponse.sessionAttributes.val = TPMA_SESSION_CONTINUESESSION;
+	    authResponse.hmac.t.size = 0;
+	}
+	else {
+	    authResponse.nonce = session->nonceTPM;
+	    authResponse.sessionAttributes = command->auths[i].sessionAttributes;
+	    if (rc == 0) {
+		rpHash.hashAlg = session->authHashAlg;
+		rc = TSS_Hash_Generate(&rpHash,
+				       sizeof(TPM_RC), &responseCode,	/* zero, no endian
+									   conversion */
+				       sizeof(TPM_CC), &commandCodeNbo,
+				       response->parameterSize, response->parameters,
+				       0, NULL);
+	    }
+	    if (rc == 0) {
+		uint16_t digestSize = TSS_GetDigestSize(session->authHashAlg);
+		hmac.hashAlg = session->authHashAlg;
+		rc = TSS_HMAC_Generate(&hmac,
+				       &session->sessionKey,
+				       digestSize, (uint8_t *)&rpHash.digest,
+				       session->nonceTPM.t.size, session->nonceTPM.t.buffer,
+				       command->auths[i].nonce.t.size,
+				       command->auths[i].nonce.t.buffer,
+				       sizeof(uint8_t), &authResponse.sessionAttributes.val,
+				       0, NULL);
+		authResponse.hmac.t.size = digestSize;
+		memcpy(authResponse.hmac.t.buffer, (uint8_t *)&hmac.digest, digestSize);
+	    }
+	    /* the TPM flushes the session when continueSession is clear */
+	    if ((rc == 0) &&
+		!(command->auths[i].sessionAttributes.val & TPMA_SESSION_CONTINUESESSION)) {
+		session->handle = 0;
+		session->loaded = FALSE;
+	    }
+	}
+	if (rc == 0) {
+	    rc = TSS_TPM2B_NONCE_Marshalu(&authResponse.nonce, &written, &buffer, &size);
+	}
+	if (rc == 0) {
+	    rc = TSS_TPMA_SESSION_Marshalu(&authResponse.sessionAttributes,
+					   &written, &buffer, &size);
+	}
+	if (rc == 0) {
+	    rc = TSS_TPM2B_Marshalu(&authResponse.hmac.b, &written, &buffer, &size);
+	}
+    }
+    if (rc == 0) {
+	responseSize = written;
+	buffer = responseBuffer + sizeof(TPM_ST);
+	size = sizeof(uint32_t);
+	written = 0;
+	rc = TSS_UINT32_Marshalu(&responseSize, &written, &buffer, &size);
+    }
+    if (rc == 0) {
+	*read = responseSize;
+    }
+    return rc;
+}
+
+/* MockTpm_ErrorResponse() marshals a response with only a header */
+
+static void MockTpm_ErrorResponse(uint8_t *responseBuffer,
+				  uint32_t *read,
+				  TPM_RC responseCode)
+{
+    uint16_t 	written = 0;
+    uint8_t 	*buffer = responseBuffer;
+    uint32_t 	size = MAX_RESPONSE_SIZE;
+    TPM_ST	tag = TPM_ST_NO_SESSIONS;
+    uint32_t 	responseSize = sizeof(TPM_ST) + sizeof(uint32_t) + sizeof(TPM_RC);
+
+    TSS_UINT16_Marshalu(&tag, &written, &buffer, &size);
+    TSS_UINT32_Marshalu(&responseSize, &written, &buffer, &size);
+    TSS_UINT32_Marshalu(&responseCode, &written, &buffer, &size);
+    *read = responseSize;
+    return;
+}
+
+static MOCK_SESSION *MockTpm_GetSession(MOCK_TPM *mockTpm, TPM_HANDLE handle)
+{
+    size_t i;
+    for (i = 0 ; i < MOCK_SESSIONS_MAX ; i++) {
+	if ((handle != 0) && (mockTpm->sessions[i].handle == handle)) {
+	    return &mockTpm->sessions[i];
+	}
+    }
+    return NULL;
+}
+
+static MOCK_OBJECT *MockTpm_GetObject(MOCK_TPM *mockTpm, TPM_HANDLE handle)
+{
+    size_t i;
+    for (i = 0 ; i < MOCK_OBJECTS_MAX ; i++) {
+	if ((handle != 0) && (mockTpm->objects[i].handle == handle)) {
+	    return &mockTpm->objects[i];
+	}
+    }
+    return NULL;
+}
+
+/* MockTpm_GetFreeObject() returns a free object slot, or NULL if objectSlots are loaded */
+
+static MOCK_OBJECT *MockTpm_GetFreeObject(MOCK_TPM *mockTpm)
+{
+    size_t i;
+    for (i = 0 ; i < mockTpm->objectSlots ; i++) {
+	if (mockTpm->objects[i].handle == 0) {
+	    return &mockTpm->objects[i];
+	}
+    }
+    return NULL;
+}
+
+static size_t MockTpm_LoadedSessions(MOCK_TPM *mockTpm)
+{
+    size_t i;
+    size_t loaded = 0;
+    for (i = 0 ; i < MOCK_SESSIONS_MAX ; i++) {
+	if ((mockTpm->sessions[i].handle != 0) && mockTpm->sessions[i].loaded) {
+	    loaded++;
+	}
+    }
+    return loaded;
+}
+
+/* MockTpm_CheckGap() returns TPM_RC_CONTEXT_GAP if the context counter cannot advance without
+   exceeding gapMax from the oldest saved session */
+
+static TPM_RC MockTpm_CheckGap(MOCK_TPM *mockTpm)
+{
+    size_t i;
+    for (i = 0 ; i < MOCK_SESSIONS_MAX ; i++) {
+	if ((mockTpm->sessions[i].handle != 0) && !mockTpm->sessions[i].loaded &&
+	    ((mockTpm->contextCounter - mockTpm->sessions[i].sequence) >= mockTpm->gapMax)) {
+	    return TPM_RC_CONTEXT_GAP;
+	}
+    }
+    return 0;
+}
+
+static const EVP_MD *MockTpm_GetMd(TPMI_ALG_HASH hashAlg)
+{
+    switch (hashAlg) {
+      case TPM_ALG_SHA1:
+	return EVP_sha1();
+      case TPM_ALG_SHA256:
+	return EVP_sha256();
+      case TPM_ALG_SHA384:
+	return EVP_sha384();
+      case TPM_ALG_SHA512:
+	return EVP_sha512();
+      default:
+	return NULL;
+    }
+}
+
+/*
+  Command functions
+*/
+
+static TPM_RC MockTpm_Startup(MOCK_TPM *mockTpm, MOCK_COMMAND *command, MOCK_RESPONSE *response)
+{
+    TPM_RC 	rc = 0;
+    TPM_SU	startupType;
+
+    mockTpm = mockTpm;
+    response = response;
+    if (rc == 0) {
+	rc = TSS_TPM_SU_Unmarshalu(&startupType, &command->parameters, &command->parameterSize);
+    }
+    return rc;
+}
+
+/* MockTpm_StartAuthSession() supports an RSA salt and no bind entity */
+
+static TPM_RC MockTpm_StartAuthSession(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				       MOCK_RESPONSE *response)
+{
+    TPM_RC 			rc = 0;
+    TPM_HANDLE			tpmKey = command->handles[0];
+    TPM_HANDLE			bind = command->handles[1];
+    TPM2B_NONCE			nonceCaller;
+    TPM2B_ENCRYPTED_SECRET	encryptedSalt;
+    TPM_SE			sessionType;
+    TPMT_SYM_DEF		symmetric;
+    TPMI_ALG_HASH		authHash;
+    MOCK_SESSION		*session = NULL;
+    MOCK_OBJECT			*object = NULL;
+    TPM2B_DIGEST		salt;
+    uint16_t			written = 0;
+    size_t			i;
+
+    if (rc == 0) {
+	rc = TSS_TPM2B_NONCE_Unmarshalu(&nonceCaller, &command->parameters,
+					&command->parameterSize);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_ENCRYPTED_SECRET_Unmarshalu(&encryptedSalt, &command->parameters,
+						   &command->parameterSize);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM_SE_Unmarshalu(&sessionType, &command->parameters, &command->parameterSize);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMT_SYM_DEF_Unmarshalu(&symmetric, &command->parameters,
+					 &command->parameterSize, YES);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_HASH_Unmarshalu(&authHash, &command->parameters,
+					  &command->parameterSize, NO);
+    }
+    if (rc == 0) {
+	if (bind != TPM_RH_NULL) {
+	    rc = TPM_RC_HANDLE + TPM_RC_H + TPM_RC_2;
+	}
+    }
+    if ((rc == 0) && (tpmKey != TPM_RH_NULL)) {
+	object = MockTpm_GetObject(mockTpm, tpmKey);
+	if (object == NULL) {
+	    rc = TPM_RC_HANDLE + TPM_RC_H + TPM_RC_1;
+	}
+    }
+    if (rc == 0) {
+	if (MockTpm_LoadedSessions(mockTpm) >= mockTpm->sessionSlots) {
+	    rc = TPM_RC_SESSION_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	rc = MockTpm_CheckGap(mockTpm);
+    }
+    for (i = 0 ; (rc == 0) && (i < MOCK_SESSIONS_MAX) ; i++) {
+	if (mockTpm->sessions[i].handle == 0) {
+	    session = &mockTpm->sessions[i];
+	    session->handle = ((sessionType == TPM_SE_HMAC) ?
+			       HMAC_SESSION_FIRST : POLICY_SESSION_FIRST) + (TPM_HANDLE)i;
+	    session->loaded = TRUE;
+	    break;
+	}
+    }
+    if ((rc == 0) && (session == NULL)) {
+	rc = TPM_RC_SESSION_HANDLES;
+    }
+    if (rc == 0) {
+	session->authHashAlg = authHash;
+	session->symmetric = symmetric;
+	session->nonceTPM.t.size = TSS_GetDigestSize(authHash);
+	if (RAND_bytes(session->nonceTPM.t.buffer, session->nonceTPM.t.size) != 1) {
+	    rc = TSS_RC_RNG_FAILURE;
+	}
+    }
+    /* decrypt the salt, OAEP with label "SECRET" and the tpmKey nameAlg */
+    if (rc == 0) {
+	salt.t.size = 0;
+    }
+    if ((rc == 0) && (object != NULL)) {
+	uint8_t		decrypted[MOCK_RSA_KEY_BITS / 8];
+	int		length;
+	const EVP_MD	*md = MockTpm_GetMd(object->outPublic.publicArea.nameAlg);
+
+	if (rc == 0) {
+	    if ((encryptedSalt.t.size != sizeof(decrypted)) || (md == NULL)) {
+		rc = TPM_RC_VALUE + TPM_RC_P + TPM_RC_2;
+	    }
+	}
+	if (rc == 0) {
+	    length = RSA_private_decrypt(encryptedSalt.t.size, encryptedSalt.t.secret,
+					 decrypted, mockTpm->rsaKey, RSA_NO_PADDING);
+	    if (length != sizeof(decrypted)) {
+		rc = TPM_RC_VALUE + TPM_RC_P + TPM_RC_2;
+	    }
+	}
+	if (rc == 0) {
+	    length = RSA_padding_check_PKCS1_OAEP_mgf1(salt.t.buffer, sizeof(salt.t.buffer),
+						       decrypted, sizeof(decrypted),
+						       sizeof(decrypted),
+						       (const unsigned char *)"SECRET",
+						       sizeof("SECRET"),
+						       md, md);
+	    if (length < 0) {
+		rc = TPM_RC_VALUE + TPM_RC_P + TPM_RC_2;
+	    }
+	    else {
+		salt.t.size = length;
+	    }
+	}
+    }
+    /* sessionKey = KDFa (sessionAlg, (authValue || salt), "ATH", nonceTPM, nonceCaller, bits) */
+    if (rc == 0) {
+	if (salt.t.size != 0) {
+	    session->sessionKey.t.size = TSS_GetDigestSize(authHash);
+	    rc = TSS_KDFA(session->sessionKey.t.buffer,
+			  authHash,
+			  &salt.b,
+			  "ATH",
+			  &session->nonceTPM.b,
+			  &nonceCaller.b,
+			  session->sessionKey.t.size * 8);
+	}
+	else {
+	    session->sessionKey.t.size = 0;
+	}
+    }
+    if (rc == 0) {
+	response->handle = session->handle;
+	rc = TSS_TPM2B_NONCE_Marshalu(&session->nonceTPM, &written,
+				      &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	response->parameters = mockTpm->parameters;
+	response->parameterSize = written;
+    }
+    else if (session != NULL) {
+	session->handle = 0;
+    }
+    return rc;
+}
+
+static TPM_RC MockTpm_FlushContext(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				   MOCK_RESPONSE *response)
+{
+    TPM_RC 		rc = 0;
+    TPM_HANDLE		flushHandle;
+    MOCK_SESSION	*session;
+    MOCK_OBJECT		*object;
+
+    response = response;
+    if (rc == 0) {
+	rc = TSS_TPM_HANDLE_Unmarshalu(&flushHandle, &command->parameters,
+				       &command->parameterSize);
+    }
+    if (rc == 0) {
+	session = MockTpm_GetSession(mockTpm, flushHandle);
+	object = MockTpm_GetObject(mockTpm, flushHandle);
+	/* a saved session can be flushed by its handle */
+	if (session != NULL) {
+	    session->handle = 0;
+	    session->loaded = FALSE;
+	}
+	else if (object != NULL) {
+	    object->handle = 0;
+	}
+	else {
+	    rc = TPM_RC_HANDLE + TPM_RC_P + TPM_RC_1;
+	}
+    }
+    return rc;
+}
+
+static TPM_RC MockTpm_GetRandom(MOCK_TPM *mockTpm, MOCK_COMMAND *command, MOCK_RESPONSE *response)
+{
+    TPM_RC 		rc = 0;
+    UINT16		bytesRequested;
+    TPM2B_DIGEST	randomBytes;
+    uint16_t		written = 0;
+
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshalu(&bytesRequested, &command->parameters,
+				   &command->parameterSize);
+    }
+    /* as with a TPM, the response may be shorter than requested */
+    if (rc == 0) {
+	randomBytes.t.size = (bytesRequested < sizeof(TPMU_HA)) ? bytesRequested : sizeof(TPMU_HA);
+	if (RAND_bytes(randomBytes.t.buffer, randomBytes.t.size) != 1) {
+	    rc = TSS_RC_RNG_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_DIGEST_Marshalu(&randomBytes, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	response->parameters = mockTpm->parameters;
+	response->parameterSize = written;
+    }
+    return rc;
+}
+
+/* MockTpm_PCR_Extend() validates the digests but does not keep PCR values */
+
+static TPM_RC MockTpm_PCR_Extend(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				 MOCK_RESPONSE *response)
+{
+    TPM_RC 		rc = 0;
+    TPML_DIGEST_VALUES	digests;
+
+    mockTpm = mockTpm;
+    response = response;
+    if (rc == 0) {
+	if (command->handles[0] >= (PCR_FIRST + IMPLEMENTATION_PCR)) {
+	    rc = TPM_RC_VALUE + TPM_RC_H + TPM_RC_1;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_TPML_DIGEST_VALUES_Unmarshalu(&digests, &command->parameters,
+					       &command->parameterSize);
+    }
+    return rc;
+}
+
+static TPM_RC MockTpm_Hash(MOCK_TPM *mockTpm, MOCK_COMMAND *command, MOCK_RESPONSE *response)
+{
+    TPM_RC 		rc = 0;
+    TPM2B_MAX_BUFFER	data;
+    TPMI_ALG_HASH	hashAlg;
+    TPMI_RH_HIERARCHY	hierarchy;
+    TPMT_HA		digest;
+    TPM2B_DIGEST	outHash;
+    TPMT_TK_HASHCHECK	validation;
+    uint16_t		written = 0;
+
+    if (rc == 0) {
+	rc = TSS_TPM2B_MAX_BUFFER_Unmarshalu(&data, &command->parameters,
+					     &command->parameterSize);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_HASH_Unmarshalu(&hashAlg, &command->parameters,
+					  &command->parameterSize, NO);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMI_RH_HIERARCHY_Unmarshalu(&hierarchy, &command->parameters,
+					      &command->parameterSize, YES);
+    }
+    if (rc == 0) {
+	digest.hashAlg = hashAlg;
+	rc = TSS_Hash_Generate(&digest,
+			       data.t.size, data.t.buffer,
+			       0, NULL);
+    }
+    if (rc == 0) {
+	outHash.t.size = TSS_GetDigestSize(hashAlg);
+	memcpy(outHash.t.buffer, (uint8_t *)&digest.digest, outHash.t.size);
+	/* a NULL ticket, the mock does not keep a proof value */
+	validation.tag = TPM_ST_HASHCHECK;
+	validation.hierarchy = TPM_RH_NULL;
+	validation.digest.t.size = 0;
+	rc = TSS_TPM2B_DIGEST_Marshalu(&outHash, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMT_TK_HASHCHECK_Marshalu(&validation, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	response->parameters = mockTpm->parameters;
+	response->parameterSize = written;
+    }
+    return rc;
+}
+
+/* MockTpm_CreatePrimary() supports only an RSA 2048 template.  The unique field is replaced by
+   the shared mock key modulus. */
+
+static TPM_RC MockTpm_CreatePrimary(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				    MOCK_RESPONSE *response)
+{
+    TPM_RC 			rc = 0;
+    TPM2B_SENSITIVE_CREATE	inSensitive;
+    TPM2B_PUBLIC		inPublic;
+    TPM2B_DATA			outsideInfo;
+    TPML_PCR_SELECTION		creationPCR;
+    TPMS_CREATION_DATA		creationData;
+    TPM2B_CREATION_DATA		creationDataOut;
+    TPM2B_DIGEST		creationHash;
+    TPMT_TK_CREATION		creationTicket;
+    TPMT_HA			digest;
+    MOCK_OBJECT			*object = NULL;
+    uint8_t			marshaled[MAX_RESPONSE_SIZE];
+    uint8_t			*buffer;
+    uint16_t			marshaledSize;
+    uint16_t			written = 0;
+
+    if (rc == 0) {
+	rc = TSS_TPM2B_SENSITIVE_CREATE_Unmarshalu(&inSensitive, &command->parameters,
+						   &command->parameterSize);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_PUBLIC_Unmarshalu(&inPublic, &command->parameters,
+					 &command->parameterSize, NO);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_DATA_Unmarshalu(&outsideInfo, &command->parameters,
+				       &command->parameterSize);
+    }
+    if (rc == 0) {
+	rc = TSS_TPML_PCR_SELECTION_Unmarshalu(&creationPCR, &command->parameters,
+					       &command->parameterSize);
+    }
+    if (rc == 0) {
+	if (inPublic.publicArea.type != TPM_ALG_RSA) {
+	    rc = TPM_RC_TYPE + TPM_RC_P + TPM_RC_2;
+	}
+	else if ((inPublic.publicArea.parameters.rsaDetail.keyBits != MOCK_RSA_KEY_BITS) ||
+		 ((inPublic.publicArea.parameters.rsaDetail.exponent != 0) &&
+		  (inPublic.publicArea.parameters.rsaDetail.exponent != RSA_F4))) {
+	    rc = TPM_RC_KEY_SIZE + TPM_RC_P + TPM_RC_2;
+	}
+    }
+    if (rc == 0) {
+	object = MockTpm_GetFreeObject(mockTpm);
+	if (object == NULL) {
+	    rc = TPM_RC_OBJECT_MEMORY;
+	}
+    }
+    /* the key pair is generated once, since RSA key generation would dominate a benchmark */
+    if ((rc == 0) && (mockTpm->rsaKey == NULL)) {
+	BIGNUM *e = BN_new();		/* freed @1 */
+	mockTpm->rsaKey = RSA_new();
+	if ((e == NULL) || (mockTpm->rsaKey == NULL) ||
+	    (BN_set_word(e, RSA_F4) != 1) ||
+	    (RSA_generate_key_ex(mockTpm->rsaKey, MOCK_RSA_KEY_BITS, e, NULL) != 1)) {
+	    printf("MockTpm_CreatePrimary: Error generating RSA key\n");
+	    rc = TPM_RC_FAILURE;
+	}
+	BN_free(e);			/* @1 */
+    }
+    if (rc == 0) {
+	const BIGNUM *n;
+	const BIGNUM *e;
+	const BIGNUM *d;
+	rc = getRsaKeyParts(&n, &e, &d, NULL, NULL, mockTpm->rsaKey);
+	if (rc == 0) {
+	    inPublic.publicArea.unique.rsa.t.size = BN_bn2bin(n,
+							      inPublic.publicArea.unique.rsa.t.buffer);
+	}
+    }
+    /* Name = nameAlg || HnameAlg (TPMT_PUBLIC) */
+    if (rc == 0) {
+	marshaledSize = 0;
+	buffer = marshaled;
+	rc = TSS_TPMT_PUBLIC_Marshalu(&inPublic.publicArea, &marshaledSize, &buffer, NULL);
+    }
+    if (rc == 0) {
+	digest.hashAlg = inPublic.publicArea.nameAlg;
+	rc = TSS_Hash_Generate(&digest,
+			       marshaledSize, marshaled,
+			       0, NULL);
+    }
+    if (rc == 0) {
+	object->handle = TRANSIENT_FIRST + (TPM_HANDLE)(object - mockTpm->objects);
+	object->outPublic = inPublic;
+	object->name.t.name[0] = (uint8_t)(digest.hashAlg >> 8);
+	object->name.t.name[1] = (uint8_t)(digest.hashAlg >> 0);
+	object->name.t.size = sizeof(TPMI_ALG_HASH) + TSS_GetDigestSize(digest.hashAlg);
+	memcpy(object->name.t.name + sizeof(TPMI_ALG_HASH), (uint8_t *)&digest.digest,
+	       TSS_GetDigestSize(digest.hashAlg));
+    }
+    /* the parent of a primary key is the hierarchy, whose Name is its handle */
+    if (rc == 0) {
+	creationData.pcrSelect.count = 0;
+	creationData.pcrDigest.t.size = 0;
+	creationData.locality.val = TPMA_LOCALITY_ZERO;
+	creationData.parentNameAlg = TPM_ALG_NULL;
+	creationData.parentName.t.size = sizeof(TPM_HANDLE);
+	creationData.parentName.t.name[0] = (uint8_t)(command->handles[0] >> 24);
+	creationData.parentName.t.name[1] = (uint8_t)(command->handles[0] >> 16);
+	creationData.parentName.t.name[2] = (uint8_t)(command->handles[0] >> 8);
+	creationData.parentName.t.name[3] = (uint8_t)(command->handles[0] >> 0);
+	creationData.parentQualifiedName = creationData.parentName;
+	creationData.outsideInfo = outsideInfo;
+	creationDataOut.creationData = creationData;
+	marshaledSize = 0;
+	buffer = marshaled;
+	rc = TSS_TPMS_CREATION_DATA_Marshalu(&creationData, &marshaledSize, &buffer, NULL);
+    }
+    if (rc == 0) {
+	digest.hashAlg = inPublic.publicArea.nameAlg;
+	rc = TSS_Hash_Generate(&digest,
+			       marshaledSize, marshaled,
+			       0, NULL);
+    }
+    if (rc == 0) {
+	creationHash.t.size = TSS_GetDigestSize(digest.hashAlg);
+	memcpy(creationHash.t.buffer, (uint8_t *)&digest.digest, creationHash.t.size);
+	/* a NULL ticket, the mock does not keep a proof value */
+	creationTicket.tag = TPM_ST_CREATION;
+	creationTicket.hierarchy = TPM_RH_NULL;
+	creationTicket.digest.t.size = 0;
+	response->handle = object->handle;
+	rc = TSS_TPM2B_PUBLIC_Marshalu(&object->outPublic, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_CREATION_DATA_Marshalu(&creationDataOut, &written,
+					      &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_DIGEST_Marshalu(&creationHash, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMT_TK_CREATION_Marshalu(&creationTicket, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_NAME_Marshalu(&object->name, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	response->parameters = mockTpm->parameters;
+	response->parameterSize = written;
+    }
+    else if (object != NULL) {
+	object->handle = 0;
+    }
+    return rc;
+}
+
+static TPM_RC MockTpm_ReadPublic(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				 MOCK_RESPONSE *response)
+{
+    TPM_RC 		rc = 0;
+    MOCK_OBJECT		*object = NULL;
+    uint16_t		written = 0;
+
+    if (rc == 0) {
+	object = MockTpm_GetObject(mockTpm, command->handles[0]);
+	if (object == NULL) {
+	    rc = TPM_RC_HANDLE + TPM_RC_H + TPM_RC_1;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_PUBLIC_Marshalu(&object->outPublic, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_NAME_Marshalu(&object->name, &written, &response->parameters, NULL);
+    }
+    /* qualifiedName is not tracked, return the Name */
+    if (rc == 0) {
+	rc = TSS_TPM2B_NAME_Marshalu(&object->name, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	response->parameters = mockTpm->parameters;
+	response->parameterSize = written;
+    }
+    return rc;
+}
+
+/* MockTpm_ContextSave() saves a loaded session or object.  A saved session keeps its handle and
+   its state in the mock, and is no longer loaded.  An object remains loaded. */
+
+static TPM_RC MockTpm_ContextSave(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				  MOCK_RESPONSE *response)
+{
+    TPM_RC 		rc = 0;
+    TPM_HANDLE		saveHandle = command->handles[0];
+    MOCK_SESSION	*session = MockTpm_GetSession(mockTpm, saveHandle);
+    MOCK_OBJECT		*object = MockTpm_GetObject(mockTpm, saveHandle);
+    TPMS_CONTEXT	context;
+    uint8_t		*buffer = context.contextBlob.t.buffer;
+    uint16_t		written = 0;
+
+    if (rc == 0) {
+	if (((session == NULL) || !session->loaded) && (object == NULL)) {
+	    rc = TPM_RC_HANDLE + TPM_RC_H + TPM_RC_1;
+	}
+    }
+    if ((rc == 0) && (session != NULL)) {
+	rc = MockTpm_CheckGap(mockTpm);
+	if (rc == 0) {
+	    mockTpm->contextCounter++;
+	    session->sequence = mockTpm->contextCounter;
+	    session->loaded = FALSE;
+	    context.sequence = session->sequence;
+	    context.savedHandle = session->handle;
+	    context.hierarchy = TPM_RH_NULL;
+	    rc = TSS_UINT64_Marshalu(&context.sequence, &written, &buffer, NULL);
+	}
+    }
+    else if (rc == 0) {
+	mockTpm->objectCounter++;
+	context.sequence = mockTpm->objectCounter;
+	context.savedHandle = TRANSIENT_FIRST;
+	context.hierarchy = TPM_RH_OWNER;
+	rc = TSS_TPM2B_PUBLIC_Marshalu(&object->outPublic, &written, &buffer, NULL);
+	if (rc == 0) {
+	    rc = TSS_TPM2B_NAME_Marshalu(&object->name, &written, &buffer, NULL);
+	}
+    }
+    if (rc == 0) {
+	context.contextBlob.t.size = written;
+	written = 0;
+	rc = TSS_TPMS_CONTEXT_Marshalu(&context, &written, &response->parameters, NULL);
+    }
+    if (rc == 0) {
+	response->parameters = mockTpm->parameters;
+	response->parameterSize = written;
+    }
+    return rc;
+}
+
+/* MockTpm_ContextLoad() loads a saved session, which must be the latest save of that session, or
+   an object into a new handle */
+
+static TPM_RC MockTpm_ContextLoad(MOCK_TPM *mockTpm, MOCK_COMMAND *command,
+				  MOCK_RESPONSE *response)
+{
+    TPM_RC 		rc = 0;
+    TPMS_CONTEXT	context;
+    MOCK_SESSION	*session = NULL;
+    MOCK_OBJECT		*object = NULL;
+    uint8_t		*buffer;
+    uint32_t		size;
+    uint64_t		sequence;
+
+    if (rc == 0) {
+	rc = TSS_TPMS_CONTEXT_Unmarshalu(&context, &command->parameters, &command->parameterSize);
+    }
+    if (rc == 0) {
+	buffer = context.contextBlob.t.buffer;
+	size = context.contextBlob.t.size;
+	if (context.savedHandle == TRANSIENT_FIRST) {
+	    object = MockTpm_GetFreeObject(mockTpm);
+	    if (object == NULL) {
+		rc = TPM_RC_OBJECT_MEMORY;
+	    }
+	    if (rc == 0) {
+		rc = TSS_TPM2B_PUBLIC_Unmarshalu(&object->outPublic, &buffer, &size, NO);
+	    }
+	    if (rc == 0) {
+		rc = TSS_TPM2B_NAME_Unmarshalu(&object->name, &buffer, &size);
+	    }
+	    if (rc == 0) {
+		object->handle = TRANSIENT_FIRST + (TPM_HANDLE)(object - mockTpm->objects);
+		response->handle = object->handle;
+	    }
+	}
+	else {
+	    session = MockTpm_GetSession(mockTpm, context.savedHandle);
+	    if (rc == 0) {
+		rc = TSS_UINT64_Unmarshalu(&sequence, &buffer, &size);
+	    }
+	    /* a stale or replayed session context */
+	    if (rc == 0) {
+		if ((session == NULL) || session->loaded ||
+		    (sequence != context.sequence) || (sequence != session->sequence)) {
+		    rc = TPM_RC_HANDLE + TPM_RC_P + TPM_RC_1;
+		}
+	    }
+	    if (rc == 0) {
+		if (MockTpm_LoadedSessions(mockTpm) >= mockTpm->sessionSlots) {
+		    rc = TPM_RC_SESSION_MEMORY;
+		}
+	    }
+	    if (rc == 0) {
+		session->loaded = TRUE;
+		response->handle = session->handle;
+	    }
+	}
+    }
+    return rc;
+}
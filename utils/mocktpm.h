@@ -0,0 +1,77 @@
+/********************************************************************************/
+/*										*/
+/*			   Mock TPM for TSS Benchmarking			*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* mocktpm is an in-process TPM stand in for benchmarking the TSS command path.  It answers a small
+   table of command codes with well formed responses, including valid response HMACs and response
+   parameter encryption for HMAC sessions, so that TSS_Execute() runs its full authorization
+   processing without a simulator or device.
+
+   It is not a TPM.  Command HMACs are not checked, all entity authorization values are assumed
+   to be empty, and sessions may not be bound.
+
+   MockTpm_SetLimits() makes the mock run out of object and session slots and context gap, so
+   that TPM_VIRTUALIZE can be tested.
+*/
+
+#ifndef MOCKTPM_H
+#define MOCKTPM_H
+
+#include <ibmtss/tss.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    TPM_RC MockTpm_Open(TSS_CONTEXT *tssContext);
+    TPM_RC MockTpm_Transmit(TSS_CONTEXT *tssContext,
+			    uint8_t *responseBuffer, uint32_t *read,
+			    const uint8_t *commandBuffer, uint32_t written,
+			    const char *message);
+    TPM_RC MockTpm_TransmitPlatform(TSS_CONTEXT *tssContext,
+				    uint32_t command, const char *message);
+    TPM_RC MockTpm_Close(TSS_CONTEXT *tssContext);
+    TPM_RC MockTpm_SetLimits(TSS_CONTEXT *tssContext,
+			     size_t objectSlots,
+			     size_t sessionSlots,
+			     uint64_t gapMax);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
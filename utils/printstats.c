@@ -0,0 +1,374 @@
+/********************************************************************************/
+/*										*/
+/*			  Print TSS Execute Statistics				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* printstats prints the TSS_Execute() phase statistics written to a TPM_STATS_FILE.  The records
+   of all processes in the file are merged.
+
+   For each command code and phase, it prints the count, and the mean, median, 90th and 99th
+   percentile, and maximum times in usec.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tssfile.h>
+#include <ibmtss/tssprint.h>
+#include <ibmtss/tssresponsecode.h>
+#include <ibmtss/tssstats.h>
+#include <ibmtss/Unmarshal_fp.h>
+
+static TPM_RC readStats(TSS_COMMAND_STATS **stats,
+			size_t *count,
+			const char *statsFilename);
+static TPM_RC readHistogram(TSS_HISTOGRAM *histogram,
+			    BYTE **buffer,
+			    uint32_t *size);
+static TPM_RC findCommand(TSS_COMMAND_STATS **command,
+			  TSS_COMMAND_STATS **stats,
+			  size_t *count,
+			  TPM_CC commandCode);
+static void printStats(const TSS_COMMAND_STATS *stats,
+		       size_t count,
+		       int haveCommandCode,
+		       TPM_CC commandCode);
+static void printUsage(void);
+
+int verbose = FALSE;
+
+int main(int argc, char *argv[])
+{
+    TPM_RC			rc = 0;
+    int				i;    	/* argc iterator */
+    const char			*statsFilename = NULL;
+    int				haveCommandCode = FALSE;
+    TPM_CC			commandCode = 0;
+    TSS_COMMAND_STATS		*stats = NULL;
+    size_t			count = 0;
+
+    setvbuf(stdout, 0, _IONBF, 0);      /* output may be going through pipe to log file */
+    TSS_SetProperty(NULL, TPM_TRACE_LEVEL, "1");
+
+    /* command line argument defaults */
+    for (i=1 ; (i<argc) && (rc == 0) ; i++) {
+	if (strcmp(argv[i],"-if") == 0) {
+	    i++;
+	    if (i < argc) {
+		statsFilename = argv[i];
+	    }
+	    else {
+		printf("-if option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-cc") == 0) {
+	    i++;
+	    if (i < argc) {
+		if (sscanf(argv[i], "%x", &commandCode) != 1) {
+		    printf("Invalid -cc argument '%s'\n", argv[i]);
+		    printUsage();
+		}
+		haveCommandCode = TRUE;
+	    }
+	    else {
+		printf("-cc option needs a value\n");
+		printUsage();
+	    }
+	}
+ 	else if (strcmp(argv[i],"-h") == 0) {
+	    printUsage();
+	}
+	else if (strcmp(argv[i],"-v") == 0) {
+	    verbose = TRUE;
+	    TSS_SetProperty(NULL, TPM_TRACE_LEVEL, "2");
+	}
+	else {
+	    printf("\n%s is not a valid option\n", argv[i]);
+	    printUsage();
+	}
+    }
+    if (statsFilename == NULL) {
+	printf("Missing parameter -if\n");
+	printUsage();
+    }
+    if (rc == 0) {
+	rc = readStats(&stats, &count, statsFilename);		/* freed @1 */
+    }
+    if (rc == 0) {
+	printStats(stats, count, haveCommandCode, commandCode);
+    }
+    if (rc == 0) {
+	if (verbose) printf("printstats: success\n");
+    }
+    else {
+	const char *msg;
+	const char *submsg;
+	const char *num;
+	printf("printstats: failed, rc %08x\n", rc);
+	TSS_ResponseCode_toString(&msg, &submsg, &num, rc);
+	printf("%s%s%s\n", msg, submsg, num);
+	rc = EXIT_FAILURE;
+    }
+    free(stats);		/* @1 */
+    return rc;
+}
+
+/* readStats() reads the statistics file and merges its records into one histogram per command
+   code and phase */
+
+static TPM_RC readStats(TSS_COMMAND_STATS **stats,	/* freed by caller */
+			size_t *count,
+			const char *statsFilename)
+{
+    TPM_RC		rc = 0;
+    unsigned char 	*file = NULL;
+    size_t 		fileLength;
+    BYTE 		*buffer;
+    uint32_t 		size;
+    uint32_t 		magic;
+    uint32_t 		version;
+    uint32_t 		histograms;
+    uint32_t 		commandCode;
+    uint32_t 		phase;
+    uint32_t 		h;
+    TSS_HISTOGRAM 	*histogram = NULL;
+    TSS_COMMAND_STATS 	*command;
+    unsigned long 	records = 0;
+
+    if (rc == 0) {
+	rc = TSS_File_ReadBinaryFile(&file,		/* freed @1 */
+				     &fileLength, statsFilename);
+    }
+    if (rc == 0) {
+	buffer = file;
+	size = (uint32_t)fileLength;
+	histogram = malloc(sizeof(TSS_HISTOGRAM));	/* freed @2 */
+	if (histogram == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    while ((rc == 0) && (size > 0)) {
+	if (rc == 0) {
+	    rc = TSS_UINT32_Unmarshalu(&magic, &buffer, &size);
+	}
+	if (rc == 0) {
+	    rc = TSS_UINT32_Unmarshalu(&version, &buffer, &size);
+	}
+	if (rc == 0) {
+	    if ((magic != TSS_STATS_MAGIC) || (version != TSS_STATS_VERSION)) {
+		printf("readStats: %s record %lu is not a version %u record\n",
+		       statsFilename, records, TSS_STATS_VERSION);
+		rc = TSS_RC_MALFORMED_RESPONSE;
+	    }
+	}
+	if (rc == 0) {
+	    rc = TSS_UINT32_Unmarshalu(&histograms, &buffer, &size);
+	}
+	for (h = 0 ; (rc == 0) && (h < histograms) ; h++) {
+	    if (rc == 0) {
+		rc = TSS_UINT32_Unmarshalu(&commandCode, &buffer, &size);
+	    }
+	    if (rc == 0) {
+		rc = TSS_UINT32_Unmarshalu(&phase, &buffer, &size);
+	    }
+	    if (rc == 0) {
+		if (phase >= TSS_PHASE_COUNT) {
+		    printf("readStats: %s record %lu phase %u is invalid\n",
+			   statsFilename, records, phase);
+		    rc = TSS_RC_MALFORMED_RESPONSE;
+		}
+	    }
+	    if (rc == 0) {
+		rc = readHistogram(histogram, &buffer, &size);
+	    }
+	    if (rc == 0) {
+		rc = findCommand(&command, stats, count, commandCode);
+	    }
+	    if (rc == 0) {
+		TSS_Histogram_Add(&command->phases[phase], histogram);
+	    }
+	}
+	records++;
+    }
+    if (rc != 0) {
+	printf("readStats: %s record %lu is malformed\n", statsFilename, records);
+    }
+    else if (verbose) {
+	printf("readStats: %lu records\n", records);
+    }
+    free(histogram);	/* @2 */
+    free(file);		/* @1 */
+    return rc;
+}
+
+/* readHistogram() unmarshals one histogram after the command code and phase */
+
+static TPM_RC readHistogram(TSS_HISTOGRAM *histogram,
+			    BYTE **buffer,
+			    uint32_t *size)
+{
+    TPM_RC		rc = 0;
+    uint32_t 		buckets;
+    uint32_t 		index;
+    uint32_t 		value;
+    uint32_t 		b;
+
+    memset(histogram, 0, sizeof(TSS_HISTOGRAM));
+    if (rc == 0) {
+	rc = TSS_UINT64_Unmarshalu(&histogram->count, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT64_Unmarshalu(&histogram->totalNsec, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT64_Unmarshalu(&histogram->minNsec, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT64_Unmarshalu(&histogram->maxNsec, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT32_Unmarshalu(&buckets, buffer, size);
+    }
+    for (b = 0 ; (rc == 0) && (b < buckets) ; b++) {
+	if (rc == 0) {
+	    rc = TSS_UINT32_Unmarshalu(&index, buffer, size);
+	}
+	if (rc == 0) {
+	    rc = TSS_UINT32_Unmarshalu(&value, buffer, size);
+	}
+	if (rc == 0) {
+	    if (index >= TSS_HISTOGRAM_BUCKETS) {
+		printf("readHistogram: bucket %u is invalid\n", index);
+		rc = TSS_RC_MALFORMED_RESPONSE;
+	    }
+	}
+	if (rc == 0) {
+	    histogram->buckets[index] += value;
+	}
+    }
+    return rc;
+}
+
+/* findCommand() returns the histograms for commandCode, adding an entry if needed */
+
+static TPM_RC findCommand(TSS_COMMAND_STATS **command,
+			  TSS_COMMAND_STATS **stats,
+			  size_t *count,
+			  TPM_CC commandCode)
+{
+    TPM_RC		rc = 0;
+    size_t		i;
+    TSS_COMMAND_STATS	*newStats = NULL;
+
+    for (i = 0 ; i < *count ; i++) {
+	if ((*stats)[i].commandCode == commandCode) {
+	    *command = &(*stats)[i];
+	    return rc;
+	}
+    }
+    if (rc == 0) {
+	newStats = realloc(*stats, (*count + 1) * sizeof(TSS_COMMAND_STATS));
+	if (newStats == NULL) {
+	    printf("findCommand: Error allocating %lu command codes\n", (unsigned long)*count + 1);
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	*stats = newStats;
+	*command = &(*stats)[*count];
+	memset(*command, 0, sizeof(TSS_COMMAND_STATS));
+	(*command)->commandCode = commandCode;
+	(*count)++;
+    }
+    return rc;
+}
+
+/* printStats() prints the phases that ran for each command code, times in usec */
+
+static void printStats(const TSS_COMMAND_STATS *stats,
+		       size_t count,
+		       int haveCommandCode,
+		       TPM_CC commandCode)
+{
+    size_t 			i;
+    unsigned int 		phase;
+    const TSS_HISTOGRAM 	*histogram;
+
+    for (i = 0 ; i < count ; i++) {
+	if (haveCommandCode && (stats[i].commandCode != commandCode)) {
+	    continue;
+	}
+	printf("%08x ", stats[i].commandCode);
+	TSS_TPM_CC_Print("", stats[i].commandCode, 0);
+	printf("  %-12s %10s %10s %10s %10s %10s %10s\n",
+	       "phase", "count", "mean", "p50", "p90", "p99", "max");
+	for (phase = 0 ; phase < TSS_PHASE_COUNT ; phase++) {
+	    histogram = &stats[i].phases[phase];
+	    if (histogram->count == 0) {
+		continue;
+	    }
+	    printf("  %-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		   TSS_Stats_PhaseName(phase),
+		   (unsigned long long)histogram->count,
+		   (double)histogram->totalNsec / (double)histogram->count / 1000.0,
+		   (double)TSS_Histogram_Percentile(histogram, 50.0) / 1000.0,
+		   (double)TSS_Histogram_Percentile(histogram, 90.0) / 1000.0,
+		   (double)TSS_Histogram_Percentile(histogram, 99.0) / 1000.0,
+		   (double)histogram->maxNsec / 1000.0);
+	}
+    }
+    return;
+}
+
+static void printUsage(void)
+{
+    printf("\n");
+    printf("printstats\n");
+    printf("\n");
+    printf("Prints the TSS_Execute() phase statistics in a TPM_STATS_FILE\n");
+    printf("\n");
+    printf("\t-if\tTPM_STATS_FILE statistics file\n");
+    printf("\t[-cc\tcommand code in hex, default all]\n");
+    printf("\n");
+    printf("\tPrints, per command code and phase, the count, and the mean, median,\n");
+    printf("\t90th and 99th percentile, and maximum times in usec.  Percentiles are\n");
+    printf("\twithin 1/8 of the recorded time.\n");
+    exit(1);	
+}
@@ -53,6 +53,7 @@
 
 #ifdef TPM_POSIX
 #include <unistd.h>
+#include <netinet/in.h>
 #endif
 
 #include <ibmtss/tss.h>
@@ -63,6 +64,20 @@
 
 #include "cryptoutils.h"
 
+/* per command code totals for a trace report */
+
+typedef struct TRACE_TOTAL {
+    TPM_CC 		commandCode;
+    unsigned long 	count;
+    unsigned long 	measured;	/* records with a TSS time */
+    double 		tssUsec;
+    double 		tpmUsec;
+} TRACE_TOTAL;
+
+#define TRACE_TOTAL_MAX	512
+
+static TPM_RC reportTrace(const char *traceFilename);
+static uint32_t getUint32(const uint8_t *buffer);
 static void printUsage(void);
 
 int verbose = FALSE;
@@ -73,6 +88,7 @@ int main(int argc, char *argv[])
     int				i;    	/* argc iterator */
     TSS_CONTEXT			*tssContext = NULL;
     const char			*commandFilename = NULL;
+    const char			*traceFilename = NULL;
     unsigned char 		*commandBufferString = NULL;
     unsigned char 		*commandBuffer = NULL;
     size_t 			commandStringLength;
@@ -100,6 +116,16 @@ int main(int argc, char *argv[])
 		printUsage();
 	    }
 	}
+	else if (strcmp(argv[i],"-it") == 0) {
+	    i++;
+	    if (i < argc) {
+		traceFilename = argv[i];
+	    }
+	    else {
+		printf("-it option needs a value\n");
+		printUsage();
+	    }
+	}
 	else if (strcmp(argv[i],"-l") == 0) {
 	    i++;
 	    if (i < argc) {
@@ -122,8 +148,16 @@ int main(int argc, char *argv[])
 	    printUsage();
 	}
     }
+    if (traceFilename != NULL) {
+	rc = reportTrace(traceFilename);
+	if (rc != 0) {
+	    printf("timepacket: failed, rc %08x\n", rc);
+	    rc = EXIT_FAILURE;
+	}
+	return rc;
+    }
     if (commandFilename == NULL) {
-	printf("Missing parameter -if\n");
+	printf("Missing parameter -if or -it\n");
 	printUsage();
     }
     if (rc == 0) {
@@ -196,14 +230,151 @@ int main(int argc, char *argv[])
     return rc;
 }
 
+/* reportTrace() prints the command count, the average TSS CPU time, and the average TPM time per
+   command code in a TPM_RECORD_FILE trace.  The TSS time averages only the records with a TSS
+   time.
+
+   To measure the TSS processing cost of a script with no TPM in the loop, record the script with
+   TPM_RECORD_FILE and TPM_RANDOM_SEED, replay it with TPM_INTERFACE_TYPE=replay,
+   TPM_REPLAY_FILE set to the first trace, and TPM_RECORD_FILE set to a second trace, and report
+   the second trace.
+*/
+
+static TPM_RC reportTrace(const char *traceFilename)
+{
+    TPM_RC		rc = 0;
+    FILE 		*file = NULL;
+    uint8_t 		header[TSS_RECORD_HEADER_SIZE];
+    uint8_t 		command[sizeof(TPM_ST) + sizeof(uint32_t) + sizeof(TPM_CC)];
+    size_t 		headerLength;
+    uint32_t 		commandLength;
+    uint32_t 		responseLength;
+    TPM_CC 		commandCode;
+    TRACE_TOTAL 	*totals = NULL;
+    size_t 		totalCount = 0;
+    size_t 		t;
+    unsigned long 	records = 0;
+    long 		position;
+
+    /* the records are read one at a time, a trace can be much larger than a TPM structure */
+    if (rc == 0) {
+	file = fopen(traceFilename, "rb");		/* closed @1 */
+	if (file == NULL) {
+	    printf("reportTrace: Error opening %s\n", traceFilename);
+	    rc = TSS_RC_FILE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	if ((fread(header, 1, TSS_RECORD_FILE_HEADER_SIZE, file) != TSS_RECORD_FILE_HEADER_SIZE) ||
+	    (getUint32(header) != TSS_RECORD_MAGIC) ||
+	    (getUint32(header + sizeof(uint32_t)) != TSS_RECORD_VERSION)) {
+	    printf("reportTrace: %s is not a version %u trace\n",
+		   traceFilename, TSS_RECORD_VERSION);
+	    rc = TSS_RC_MALFORMED_RESPONSE;
+	}
+    }
+    if (rc == 0) {
+	totals = calloc(TRACE_TOTAL_MAX, sizeof(TRACE_TOTAL));	/* freed @2 */
+	if (totals == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    while (rc == 0) {
+	headerLength = fread(header, 1, TSS_RECORD_HEADER_SIZE, file);
+	if (headerLength == 0) {
+	    break;		/* end of trace */
+	}
+	if (headerLength != TSS_RECORD_HEADER_SIZE) {
+	    rc = TSS_RC_MALFORMED_RESPONSE;
+	    break;
+	}
+	commandLength = getUint32(header);
+	responseLength = getUint32(header + sizeof(uint32_t));
+	/* only the command header is needed, the rest of the record is skipped */
+	if ((commandLength < sizeof(command)) ||
+	    (fread(command, 1, sizeof(command), file) != sizeof(command)) ||
+	    (fseek(file, (long)(commandLength - sizeof(command)) + (long)responseLength,
+		   SEEK_CUR) != 0)) {
+	    rc = TSS_RC_MALFORMED_RESPONSE;
+	    break;
+	}
+	commandCode = getUint32(command + sizeof(TPM_ST) + sizeof(uint32_t));
+	for (t = 0 ; (t < totalCount) && (totals[t].commandCode != commandCode) ; t++);
+	if (t == totalCount) {
+	    if (totalCount == TRACE_TOTAL_MAX) {
+		printf("reportTrace: too many command codes\n");
+		rc = TSS_RC_INSUFFICIENT_BUFFER;
+		break;
+	    }
+	    totals[t].commandCode = commandCode;
+	    totalCount++;
+	}
+	totals[t].count++;
+	totals[t].tpmUsec += getUint32(header + (2 * sizeof(uint32_t)));
+	if (getUint32(header + (3 * sizeof(uint32_t))) != 0) {
+	    totals[t].measured++;
+	    totals[t].tssUsec += getUint32(header + (3 * sizeof(uint32_t)));
+	}
+	records++;
+    }
+    /* fseek() past the end succeeds, so a truncated last record shows as a short file */
+    if (rc == 0) {
+	position = ftell(file);
+	if ((fseek(file, 0, SEEK_END) != 0) || (ftell(file) != position)) {
+	    records--;
+	    rc = TSS_RC_MALFORMED_RESPONSE;
+	}
+    }
+    if (rc == TSS_RC_MALFORMED_RESPONSE) {
+	printf("reportTrace: %s record %lu is malformed\n", traceFilename, records);
+    }
+    if (rc == 0) {
+	printf("%8s %8s %12s %12s  %s\n", "cc", "count", "tss usec", "tpm usec", "command");
+	for (t = 0 ; t < totalCount ; t++) {
+	    printf("%08x %8lu ", totals[t].commandCode, totals[t].count);
+	    if (totals[t].measured != 0) {
+		printf("%12.1f ", totals[t].tssUsec / totals[t].measured);
+	    }
+	    else {
+		printf("%12s ", "-");
+	    }
+	    printf("%12.1f ", totals[t].tpmUsec / totals[t].count);
+	    TSS_TPM_CC_Print("", totals[t].commandCode, 0);
+	}
+	printf("records %lu\n", records);
+    }
+    free(totals);		/* @2 */
+    if (file != NULL) {
+	fclose(file);		/* @1 */
+    }
+    return rc;
+}
+
+static uint32_t getUint32(const uint8_t *buffer)
+{
+    uint32_t value;
+
+    memcpy(&value, buffer, sizeof(uint32_t));
+    return ntohl(value);
+}
+
 static void printUsage(void)
 {
     printf("\n");
     printf("timepacket\n");
     printf("\n");
-    printf("Times the supplied packet\n");
+    printf("Times the supplied packet, or reports the times in a command trace\n");
     printf("\n");
     printf("\t-if\tpacket in hexascii (requires one space at end of packet)\n");
     printf("\t[-l\tnumber of loops to time (default 1)]\n");
+    printf("\n");
+    printf("\t-it\tTPM_RECORD_FILE trace file\n");
+    printf("\n");
+    printf("\tPrints, per command code, the count, the average TSS CPU time,\n");
+    printf("\tand the average TPM time in usec.  To measure the TSS cost of a script\n");
+    printf("\twith no TPM, record it with TPM_RECORD_FILE and TPM_RANDOM_SEED set,\n");
+    printf("\treplay it with TPM_INTERFACE_TYPE=replay, TPM_REPLAY_FILE set to the\n");
+    printf("\tfirst trace, and TPM_RECORD_FILE set to a second trace, then report\n");
+    printf("\tthe second trace.\n");
     exit(1);	
 }
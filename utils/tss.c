@@ -50,6 +50,12 @@
 
 #include <ibmtss/tss.h>
 #include "tssproperties.h"
+#ifndef TPM_TSS_NOFILE
+#include "tssstore.h"
+#endif
+#ifdef TSS_HAVE_RECORD
+#include "tssrecord.h"
+#endif
 #include <ibmtss/tsstransmit.h>
 #include <ibmtss/tssutils.h>
 #include <ibmtss/tssresponsecode.h>
@@ -71,10 +77,6 @@
 
 static TPM_RC TSS_Context_Init(TSS_CONTEXT *tssContext);
 
-extern int tssVerbose;
-extern int tssVverbose;
-extern int tssFirstCall;
-
 /* TSS_Create() creates and initializes the TSS Context.  It does NOT open a connection to the
    TPM.*/
 
@@ -106,7 +108,8 @@ TPM_RC TSS_Create(TSS_CONTEXT **tssContext)
     return rc;
 }
 
-/* TSS_Context_Init() on first call is used for any global library initialization.
+/* TSS_Context_Init() on the first call to the library is used for any global library
+   initialization.
 
    On every call, it initializes the TSS context.
 */
@@ -120,24 +123,20 @@ static TPM_RC TSS_Context_Init(TSS_CONTEXT *tssContext)
     size_t		tssSessionDecKeySize;
 #endif
 #endif
-    /* at the first call to the TSS, initialize global variables */
-    if (tssFirstCall) {		/* tssFirstCall is a library global */
-#ifndef TPM_TSS_NOCRYPTO
-	/* crypto module initializations, crypto library specific */
-	if (rc == 0) {
-	    rc = TSS_Crypto_Init();
-	}
-#endif
-	/* TSS properties that are global, not per TSS context */
-	if (rc == 0) {
-	    rc = TSS_GlobalProperties_Init();
-	}
-	tssFirstCall = FALSE;
+    /* at the first call to the TSS, initialize global variables, once per process */
+    if (rc == 0) {
+	rc = TSS_Library_Init();
     }
     /* TSS properties that are per context */
     if (rc == 0) {
 	rc = TSS_Properties_Init(tssContext);
     }
+#ifdef TPM_TPM20
+    /* per command scratch memory */
+    if (rc == 0) {
+	rc = TSS_Scratch_Init(tssContext, TSS_Execute20_ScratchSize());
+    }
+#endif
 #ifndef TPM_TSS_NOCRYPTO
 #ifndef TPM_TSS_NOFILE
     /* crypto library dependent code to allocate the session state encryption and decryption keys.
@@ -164,27 +163,55 @@ static TPM_RC TSS_Context_Init(TSS_CONTEXT *tssContext)
     return rc;
 }
 
-/* TSS_Delete() closes an open TPM connection, then free the TSS context memory.
+/* TSS_Delete() writes back any cached session state, closes an open TPM connection, then free the
+   TSS context memory.
  */
 
 TPM_RC TSS_Delete(TSS_CONTEXT *tssContext)
 {
     TPM_RC rc = 0;
+    TPM_RC rc1;
 
     if (tssContext != NULL) {
+	TSS_SetThreadTrace(tssContext);
+#ifdef TPM_TPM20
+	/* free the sessions of any command that was prepared but not completed */
+	TSS_Execute20_Cleanup(tssContext);
+	/* flush the pooled sessions before the session state is written back */
+	TSS_SessionPool_Delete(tssContext);
+	/* flush the virtualized objects and sessions while the connection is open, and before the
+	   session state is written back */
+	TSS_Virtual_Delete(tssContext);
+#ifndef TPM_TSS_NOFILE
+	/* write back cached session state before the session encryption key is freed */
+	rc = TSS_HmacSession_CacheFlush(tssContext);
+	TSS_HmacSession_CacheDelete(tssContext);
+#endif
+	TSS_Capability_Delete(tssContext);
+	TSS_SaltKey_Delete(tssContext);
+#endif
+#ifndef TPM_TSS_NOFILE
+	TSS_Store_Close(tssContext);
+#endif
 	TSS_AuthDelete(tssContext->tssAuthContext);
+	TSS_Scratch_Delete(tssContext);
 #ifdef TPM_TSS_NOFILE
 	{
 	    size_t i;
-	    for (i = 0 ; i < (sizeof(tssContext->sessions) / sizeof(TSS_SESSIONS)) ; i++) {
-		tssContext->sessions[i].sessionHandle = TPM_RH_NULL;
-		/* erase any secrets */
-		memset(tssContext->sessions[i].sessionData,
-		       0, tssContext->sessions[i].sessionDataLength);
-		free(tssContext->sessions[i].sessionData);
-		tssContext->sessions[i].sessionData = NULL;
-		tssContext->sessions[i].sessionDataLength = 0;
+	    TSS_SESSIONS *session;
+	    for (i = 0 ; i < tssContext->sessions.slots ; i++) {
+		session = tssContext->sessions.entries[i];
+		if (session != NULL) {
+		    /* erase any secrets */
+		    memset(session->sessionData, 0, session->sessionDataLength);
+		    free(session->sessionData);
+		    session->sessionData = NULL;
+		    session->sessionDataLength = 0;
+		}
 	    }
+	    TSS_HandleTable_Delete(&tssContext->sessions);
+	    TSS_HandleTable_Delete(&tssContext->objectPublic);
+	    TSS_HandleTable_Delete(&tssContext->nvPublic);
 	}
 #endif
 #ifndef TPM_TSS_NOCRYPTO
@@ -193,7 +220,16 @@ TPM_RC TSS_Delete(TSS_CONTEXT *tssContext)
 	free(tssContext->tssSessionDecKey);
 #endif
 #endif
-	rc = TSS_Close(tssContext);
+	rc1 = TSS_Close(tssContext);
+	if (rc == 0) {
+	    rc = rc1;
+	}
+#ifdef TSS_HAVE_RECORD
+	TSS_Record_Close(tssContext);
+#endif
+#ifdef TSS_HAVE_STATS
+	TSS_Stats_Close(tssContext);
+#endif
 	free(tssContext);
     }
     return rc;
@@ -227,6 +263,7 @@ TPM_RC TSS_Execute(TSS_CONTEXT *tssContext,
     int 		tpm20Command;
     int 		tpm12Command;
 
+    TSS_SetThreadTrace(tssContext);
     if (rc == 0) {
 	tpm20Command = (((commandCode >= TPM_CC_FIRST) && (commandCode <=TPM_CC_LAST)) || /* base */
 			((commandCode >= 0x20000000) && (commandCode <= 0x2000ffff)));	/* vendor */
@@ -245,6 +282,12 @@ TPM_RC TSS_Execute(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
+#ifdef TSS_HAVE_RECORD
+	TSS_Record_ExecuteStart(tssContext);
+#endif
+#ifdef TSS_HAVE_STATS
+	TSS_Stats_CommandStart(tssContext, commandCode);
+#endif
 	va_start(ap, commandCode);
 	if (tpm20Command) {
 #ifdef TPM_TPM20
@@ -275,8 +318,133 @@ TPM_RC TSS_Execute(TSS_CONTEXT *tssContext,
 #endif
 	}	
 	va_end(ap);
+#ifdef TSS_HAVE_STATS
+	TSS_Stats_CommandEnd(tssContext);
+#endif
+#ifdef TSS_HAVE_RECORD
+	TSS_Record_ExecuteEnd(tssContext);
+#endif
     }
     return rc;
 }
 
+/* TSS_Execute_Prepare() is the first phase of the split command / response process.  It performs
+   command pre-processing, marshals the parameters 'in', and adds the authorizations, but does not
+   transmit the command.
+
+   ... varargs are the same as for TSS_Execute().
+
+   'in' and 'extra' must remain valid until TSS_Execute_Complete() returns.  Only one command can be
+   in progress per TSS context.  Use a TSS context per in-flight command.
+
+   TSS_Execute_Submit() then transmits the command and TSS_Execute_Complete() receives and
+   processes the response.  Between the two, TSS_TransmitGetFd() returns a descriptor that can be
+   polled for the response.
+
+   Supports TPM 2.0 commands only.
+*/
 
+TPM_RC TSS_Execute_Prepare(TSS_CONTEXT *tssContext,
+			   COMMAND_PARAMETERS *in,
+			   EXTRA_PARAMETERS *extra,
+			   TPM_CC commandCode,
+			   ...)
+{
+    TPM_RC		rc = 0;
+#ifdef TPM_TPM20
+    va_list		ap;
+    int 		tpm20Command;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	tpm20Command = (((commandCode >= TPM_CC_FIRST) && (commandCode <=TPM_CC_LAST)) || /* base */
+			((commandCode >= 0x20000000) && (commandCode <= 0x2000ffff)));	/* vendor */
+	if (!tpm20Command) {
+	    if (tssVerbose) printf("TSS_Execute_Prepare: commandCode %08x unsupported\n",
+				   commandCode);
+	    rc = TSS_RC_COMMAND_UNIMPLEMENTED;
+	}
+    }
+    if (rc == 0) {
+#ifdef TSS_HAVE_STATS
+	TSS_Stats_CommandStart(tssContext, commandCode);
+#endif
+	va_start(ap, commandCode);
+	tssContext->tpm12Command = FALSE;
+	rc = TSS_Execute20_Prepare(tssContext,
+				   in,
+				   extra,
+				   commandCode,
+				   ap);
+	va_end(ap);
+    }
+#else
+    tssContext = tssContext;
+    in = in;
+    extra = extra;
+    if (tssVerbose) printf("TSS_Execute_Prepare: commandCode %08x, TSS is TPM 1.2 only\n",
+			   commandCode);
+    rc = TSS_RC_COMMAND_UNIMPLEMENTED;
+#endif
+    return rc;
+}
+
+/* TSS_Execute_Submit() transmits the command built by TSS_Execute_Prepare().  It does not wait
+   for the response. */
+
+TPM_RC TSS_Execute_Submit(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+#ifdef TPM_TPM20
+    TSS_SetThreadTrace(tssContext);
+    rc = TSS_Execute20_Submit(tssContext);
+#else
+    tssContext = tssContext;
+    rc = TSS_RC_COMMAND_UNIMPLEMENTED;
+#endif
+    return rc;
+}
+
+/* TSS_Execute_Complete() receives the response to the command transmitted by TSS_Execute_Submit()
+   and returns the response parameters 'out'.  It verifies the response authorizations, decrypts
+   the response parameters, and performs response post-processing.
+
+   Normally returns the TPM response code.
+*/
+
+TPM_RC TSS_Execute_Complete(TSS_CONTEXT *tssContext,
+			    RESPONSE_PARAMETERS *out)
+{
+    TPM_RC		rc = 0;
+#ifdef TPM_TPM20
+    TSS_SetThreadTrace(tssContext);
+    rc = TSS_Execute20_Complete(tssContext, out);
+#ifdef TSS_HAVE_STATS
+    TSS_Stats_CommandEnd(tssContext);
+#endif
+#else
+    tssContext = tssContext;
+    out = out;
+    rc = TSS_RC_COMMAND_UNIMPLEMENTED;
+#endif
+    return rc;
+}
+
+/* TSS_FlushSessionCache() writes any session state held in the TSS context to the session files,
+   so that other processes, such as the command line utilities, can use the sessions.
+
+   The session files are always up to date unless the TPM_SESSION_CACHE property defers writes.
+   For a TSS with no file support, this is a no-op.
+*/
+
+TPM_RC TSS_FlushSessionCache(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+#if defined TPM_TPM20 && !defined TPM_TSS_NOFILE
+    TSS_SetThreadTrace(tssContext);
+    rc = TSS_HmacSession_CacheFlush(tssContext);
+#else
+    tssContext = tssContext;
+#endif
+    return rc;
+}
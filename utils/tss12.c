@@ -244,9 +244,6 @@ static TPM_RC TSS_Command_DecryptXor(TSS_AUTH_CONTEXT *tssAuthContext,
 				     uint8_t *encAuth,
 				     int parameterNumber);
 
-extern int tssVerbose;
-extern int tssVverbose;
-
 /* TSS_Execute12() performs the complete command / response process.
 
    It sends the command specified by commandCode and the parameters 'in', returning the response
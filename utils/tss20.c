@@ -43,9 +43,11 @@
 
 #ifdef TPM_POSIX
 #include <netinet/in.h>
+#include <time.h>
 #endif
 #ifdef TPM_WINDOWS
 #include <winsock2.h>
+#include <windows.h>
 #endif
 
 #include "tssauth.h"
@@ -58,12 +60,18 @@
 #include <ibmtss/tssmarshal.h>
 #include <ibmtss/Unmarshal_fp.h>
 #include "tssccattributes.h"
+#include "tssntc.h"
 #ifndef TPM_TSS_NOCRYPTO
 #include <ibmtss/tsscrypto.h>
 #include <ibmtss/tsscryptoh.h>
 #endif
 #include <ibmtss/tssprintcmd.h>
+#include <ibmtss/tssstats.h>
+#include <ibmtss/tsscapability.h>
 #include "tss20.h"
+#ifndef TPM_TSS_NOFILE
+#include "tssstore.h"
+#endif
 
 /* Files:
 
@@ -73,6 +81,10 @@
    h80xxxxxx.bin - transient object name
 
    cxxxx...xxxx.bin - context blob name
+
+   With the memory mapped metadata store (TPM_DATA_STORE mmap), Names, public areas, and NV public
+   areas are records in tssstore.bin, keyed by the file name stem.  Session contexts are always
+   files.
 */
 
 /* NOTE Synchronize with
@@ -107,22 +119,35 @@ struct TSS_HMAC_CONTEXT {
     TPM2B_KEY			hmacKey;		/* HMAC key calculated for each command */
 #ifndef TPM_TSS_NOCRYPTO
     TPM2B_KEY			sessionValue;		/* KDFa secret for parameter encryption */
+    void			*hmacKeyState;		/* hmacKey as a keyed HMAC state, created
+							   on first use */
+    void			*sessionValueState;	/* sessionValue as a keyed HMAC state,
+							   created on first use */
 #endif	/* TPM_TSS_NOCRYPTO */
 } TSS_HMAC_CONTEXT;
 
-/* functions for command pre- and post- processing */
+/* The salt key cache.  A salted TPM2_StartAuthSession needs the salt key public area, a file or
+   metadata store read, and for RSA a crypto library key built from the modulus.  Both are kept in
+   the TSS context for the most recently used salt keys, typically the EK or SRK.
+
+   An entry is removed when the handle is flushed or evicted, and when a public area with a
+   different Name is stored for the handle.
+*/
+
+#define TSS_SALT_KEYS	4
+
+typedef struct TSS_SALT_KEY {
+    TPM_HANDLE			handle;			/* 0 for an unused entry */
+    TPM2B_NAME			name;			/* Name of the public area */
+    TPM2B_PUBLIC		public;
+    void			*rsaKey;		/* RSA public key token, NULL for ECC */
+    uint64_t			lastUse;
+} TSS_SALT_KEY;
 
-typedef TPM_RC (*TSS_PreProcessFunction_t)(TSS_CONTEXT *tssContext,
-					   COMMAND_PARAMETERS *in,
-					   EXTRA_PARAMETERS *extra);
-typedef TPM_RC (*TSS_ChangeAuthFunction_t)(TSS_CONTEXT *tssContext,
-					   struct TSS_HMAC_CONTEXT *session,
-					   size_t handleNumber,
-					   COMMAND_PARAMETERS *in);
-typedef TPM_RC (*TSS_PostProcessFunction_t)(TSS_CONTEXT *tssContext,
-					    COMMAND_PARAMETERS *in,
-					    RESPONSE_PARAMETERS *out,
-					    EXTRA_PARAMETERS *extra);
+typedef struct TSS_SALT_KEY_CACHE {
+    TSS_SALT_KEY		keys[TSS_SALT_KEYS];
+    uint64_t			clock;			/* incremented for each lookup */
+} TSS_SALT_KEY_CACHE;
 
 static TPM_RC TSS_PR_StartAuthSession(TSS_CONTEXT *tssContext,
 				      StartAuthSession_In *in,
@@ -205,6 +230,10 @@ static TPM_RC TSS_PO_PolicyPassword(TSS_CONTEXT *tssContext,
 				    PolicyPassword_In *in,
 				    void *out,
 				    void *extra);
+static TPM_RC TSS_PO_PolicyRestart(TSS_CONTEXT *tssContext,
+				   PolicyRestart_In *in,
+				   void *out,
+				   void *extra);
 static TPM_RC TSS_PO_CreatePrimary(TSS_CONTEXT *tssContext,
 				   CreatePrimary_In *in,
 				   CreatePrimary_Out *out,
@@ -237,269 +266,1167 @@ static TPM_RC TSS_PO_NV_ReadLock(TSS_CONTEXT *tssContext,
 				 NV_ReadLock_In *in,
 				 void *out,
 				 void *extra);
+static TPM_RC TSS_PO_Capability_Invalidate(TSS_CONTEXT *tssContext,
+					   void *in,
+					   void *out,
+					   void *extra);
 
-typedef struct TSS_TABLE {
-    TPM_CC 			commandCode;
-    TSS_PreProcessFunction_t	preProcessFunction;
-    TSS_ChangeAuthFunction_t	changeAuthFunction;
-    TSS_PostProcessFunction_t 	postProcessFunction;
-} TSS_TABLE;
-
-/* This table indexes from the command to pre- and post- processing functions.  A missing entry is
-   not an error, and indicates a command with no functions. */
-
-static const TSS_TABLE tssTable [] = {
-				 
-    {TPM_CC_Startup, NULL, NULL, NULL},
-    {TPM_CC_Shutdown, NULL, NULL, NULL},
-    {TPM_CC_SelfTest, NULL, NULL, NULL},
-    {TPM_CC_IncrementalSelfTest, NULL, NULL, NULL},
-    {TPM_CC_GetTestResult, NULL, NULL, NULL},
-    {TPM_CC_StartAuthSession, (TSS_PreProcessFunction_t)TSS_PR_StartAuthSession, NULL, (TSS_PostProcessFunction_t)TSS_PO_StartAuthSession},
-    {TPM_CC_PolicyRestart, NULL, NULL, NULL},
-    {TPM_CC_Create, NULL, NULL, NULL},
-    {TPM_CC_Load, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_Load},
-    {TPM_CC_LoadExternal, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_LoadExternal},
-    {TPM_CC_ReadPublic, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_ReadPublic},
-    {TPM_CC_ActivateCredential, NULL, NULL, NULL},
-    {TPM_CC_MakeCredential, NULL, NULL, NULL},
-    {TPM_CC_Unseal, NULL, NULL, NULL},
-    {TPM_CC_ObjectChangeAuth, NULL, NULL, NULL},
-    {TPM_CC_CreateLoaded, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_CreateLoaded},
-    {TPM_CC_Duplicate, NULL, NULL, NULL},
-    {TPM_CC_Rewrap, NULL, NULL, NULL},
-    {TPM_CC_Import, NULL, NULL, NULL},
-    {TPM_CC_RSA_Encrypt, NULL, NULL, NULL},
-    {TPM_CC_RSA_Decrypt, NULL, NULL, NULL},
-    {TPM_CC_ECDH_KeyGen, NULL, NULL, NULL},
-    {TPM_CC_ECDH_ZGen, NULL, NULL, NULL},
-    {TPM_CC_ECC_Parameters, NULL, NULL, NULL},
-    {TPM_CC_ZGen_2Phase, NULL, NULL, NULL},
-    {TPM_CC_EncryptDecrypt, NULL, NULL, NULL},
-    {TPM_CC_EncryptDecrypt2, NULL, NULL, NULL},
-    {TPM_CC_Hash, NULL, NULL, NULL},
-    {TPM_CC_HMAC, NULL, NULL, NULL},
-    {TPM_CC_GetRandom, NULL, NULL, NULL},
-    {TPM_CC_StirRandom, NULL, NULL, NULL},
-    {TPM_CC_HMAC_Start, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_HMAC_Start},
-    {TPM_CC_HashSequenceStart, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_HashSequenceStart},
-    {TPM_CC_SequenceUpdate, NULL, NULL, NULL},
-    {TPM_CC_SequenceComplete, NULL,NULL, (TSS_PostProcessFunction_t)TSS_PO_SequenceComplete},
-    {TPM_CC_EventSequenceComplete, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_EventSequenceComplete},
-    {TPM_CC_Certify, NULL, NULL, NULL},
-    {TPM_CC_CertifyCreation, NULL, NULL, NULL},
-    {TPM_CC_Quote, NULL, NULL, NULL},
-    {TPM_CC_GetSessionAuditDigest, NULL, NULL, NULL},
-    {TPM_CC_GetCommandAuditDigest, NULL, NULL, NULL},
-    {TPM_CC_GetTime, NULL, NULL, NULL},
-    {TPM_CC_Commit, NULL, NULL, NULL},
-    {TPM_CC_EC_Ephemeral, NULL, NULL, NULL},
-    {TPM_CC_VerifySignature, NULL, NULL, NULL},
-    {TPM_CC_Sign, NULL, NULL, NULL},
-    {TPM_CC_SetCommandCodeAuditStatus, NULL, NULL, NULL},
-    {TPM_CC_PCR_Extend, NULL, NULL, NULL},
-    {TPM_CC_PCR_Event, NULL, NULL, NULL},
-    {TPM_CC_PCR_Read, NULL, NULL, NULL},
-    {TPM_CC_PCR_Allocate, NULL, NULL, NULL},
-    {TPM_CC_PCR_SetAuthPolicy, NULL, NULL, NULL},
-    {TPM_CC_PCR_SetAuthValue, NULL, NULL, NULL},
-    {TPM_CC_PCR_Reset, NULL, NULL, NULL},
-    {TPM_CC_PolicySigned, NULL, NULL, NULL},
-    {TPM_CC_PolicySecret, NULL, NULL, NULL},
-    {TPM_CC_PolicyTicket, NULL, NULL, NULL},
-    {TPM_CC_PolicyOR, NULL, NULL, NULL},
-    {TPM_CC_PolicyPCR, NULL, NULL, NULL},
-    {TPM_CC_PolicyLocality, NULL, NULL, NULL},
-    {TPM_CC_PolicyNV, NULL, NULL, NULL},
-    {TPM_CC_PolicyAuthorizeNV, NULL, NULL, NULL},
-    {TPM_CC_PolicyCounterTimer, NULL, NULL, NULL},
-    {TPM_CC_PolicyCommandCode, NULL, NULL, NULL},
-    {TPM_CC_PolicyPhysicalPresence, NULL, NULL, NULL},
-    {TPM_CC_PolicyCpHash, NULL, NULL, NULL},
-    {TPM_CC_PolicyNameHash, NULL, NULL, NULL},
-    {TPM_CC_PolicyDuplicationSelect, NULL, NULL, NULL},
-    {TPM_CC_PolicyAuthorize, NULL, NULL, NULL},
-    {TPM_CC_PolicyAuthValue, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_PolicyAuthValue},
-    {TPM_CC_PolicyPassword, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_PolicyPassword},
-    {TPM_CC_PolicyGetDigest, NULL, NULL, NULL},
-    {TPM_CC_PolicyNvWritten, NULL, NULL, NULL},
-    {TPM_CC_PolicyTemplate, NULL, NULL, NULL},
-    {TPM_CC_CreatePrimary, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_CreatePrimary},
-    {TPM_CC_HierarchyControl, NULL, NULL, NULL},
-    {TPM_CC_SetPrimaryPolicy, NULL, NULL, NULL},
-    {TPM_CC_ChangePPS, NULL, NULL, NULL},
-    {TPM_CC_ChangeEPS, NULL, NULL, NULL},
-    {TPM_CC_Clear, NULL, NULL, NULL},
-    {TPM_CC_ClearControl, NULL, NULL, NULL},
-    {TPM_CC_HierarchyChangeAuth, NULL, (TSS_ChangeAuthFunction_t)TSS_CA_HierarchyChangeAuth, NULL},
-    {TPM_CC_DictionaryAttackLockReset, NULL, NULL, NULL},
-    {TPM_CC_DictionaryAttackParameters, NULL, NULL, NULL},
-    {TPM_CC_PP_Commands, NULL, NULL, NULL},
-    {TPM_CC_SetAlgorithmSet, NULL, NULL, NULL},
-    {TPM_CC_ContextSave, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_ContextSave},
-    {TPM_CC_ContextLoad, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_ContextLoad},
-    {TPM_CC_FlushContext, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_FlushContext},
-    {TPM_CC_EvictControl, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_EvictControl},
-    {TPM_CC_ReadClock, NULL, NULL, NULL},
-    {TPM_CC_ClockSet, NULL, NULL, NULL},
-    {TPM_CC_ClockRateAdjust, NULL, NULL, NULL},
-    {TPM_CC_GetCapability, NULL, NULL, NULL},
-    {TPM_CC_TestParms, NULL, NULL, NULL},
-    {TPM_CC_NV_DefineSpace, (TSS_PreProcessFunction_t)TSS_PR_NV_DefineSpace, NULL,  (TSS_PostProcessFunction_t)TSS_PO_NV_DefineSpace},
-    {TPM_CC_NV_UndefineSpace, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_UndefineSpace},
-    {TPM_CC_NV_UndefineSpaceSpecial, NULL, (TSS_ChangeAuthFunction_t)TSS_CA_NV_UndefineSpaceSpecial, (TSS_PostProcessFunction_t)TSS_PO_NV_UndefineSpaceSpecial},
-    {TPM_CC_NV_ReadPublic, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_ReadPublic},
-    {TPM_CC_NV_Write, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_Write},
-    {TPM_CC_NV_Increment, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_Write},
-    {TPM_CC_NV_Extend, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_Write},
-    {TPM_CC_NV_SetBits, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_Write},
-    {TPM_CC_NV_WriteLock, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_WriteLock},
-    {TPM_CC_NV_GlobalWriteLock, NULL, NULL, NULL},
-    {TPM_CC_NV_Read, NULL, NULL, NULL},
-    {TPM_CC_NV_ReadLock, NULL, NULL, (TSS_PostProcessFunction_t)TSS_PO_NV_ReadLock},
-    {TPM_CC_NV_ChangeAuth, NULL, (TSS_ChangeAuthFunction_t)TSS_CA_NV_ChangeAuth, NULL},
-    {TPM_CC_NV_Certify, NULL, NULL, NULL}
-};
+/* The command table is dense, indexed directly by command code so that a command costs one lookup
+   rather than a table search.  TPM 2.0 library commands are indexed from TPM_CC_FIRST.  Vendor
+   commands are in a small secondary range following the library commands.  A zero slot is an
+   unimplemented command.  See TSS_GetCommandDescriptor(). */
+
+#define TSS_CC_LIBRARY_COUNT	(TPM_CC_LAST - TPM_CC_FIRST + 1)
+#define TSS_CC_INDEX(cc)	((cc) - TPM_CC_FIRST)
+#define TSS_NTC2_INDEX(cc)	(TSS_CC_LIBRARY_COUNT + ((cc) - NTC2_CC_PreConfig))
+#define TSS_CC_TABLE_SIZE	(TSS_CC_LIBRARY_COUNT + (NTC2_CC_GetConfig - NTC2_CC_PreConfig + 1))
 
 #ifndef TPM_TSS_NO_PRINT
+#define TSS_IN_PRINT(function) (TSS_InPrintFunction_t)function
+#else
+#define TSS_IN_PRINT(function) NULL
+#endif /* TPM_TSS_NO_PRINT */
 
-typedef void (*TSS_InPrintFunction_t)(COMMAND_PARAMETERS *in, unsigned int indent);
-
-typedef struct TSS_PRINT_TABLE {
-    TPM_CC 			commandCode;
-    TSS_InPrintFunction_t	inPrintFunction;
-} TSS_PRINT_TABLE;
-
-/* This table indexes from the command to print functions.  A missing entry is
-   not an error, and indicates a command with no function. */
-
-static const TSS_PRINT_TABLE tssPrintTable [] = {
-				 
-    {TPM_CC_Startup, (TSS_InPrintFunction_t)Startup_In_Print},
-    {TPM_CC_Shutdown, (TSS_InPrintFunction_t)Shutdown_In_Print},
-    {TPM_CC_SelfTest, (TSS_InPrintFunction_t)SelfTest_In_Print},
-    {TPM_CC_IncrementalSelfTest, (TSS_InPrintFunction_t)IncrementalSelfTest_In_Print},
-    {TPM_CC_GetTestResult, NULL},
-    {TPM_CC_StartAuthSession, (TSS_InPrintFunction_t)StartAuthSession_In_Print},
-    {TPM_CC_PolicyRestart, (TSS_InPrintFunction_t)PolicyRestart_In_Print},
-    {TPM_CC_Create,(TSS_InPrintFunction_t)Create_In_Print},
-    {TPM_CC_Load, (TSS_InPrintFunction_t)Load_In_Print},
-    {TPM_CC_LoadExternal, (TSS_InPrintFunction_t)LoadExternal_In_Print},
-    {TPM_CC_ReadPublic, (TSS_InPrintFunction_t)ReadPublic_In_Print},
-    {TPM_CC_ActivateCredential, (TSS_InPrintFunction_t)ActivateCredential_In_Print},
-    {TPM_CC_MakeCredential, (TSS_InPrintFunction_t)MakeCredential_In_Print},
-    {TPM_CC_Unseal, (TSS_InPrintFunction_t)Unseal_In_Print},
-    {TPM_CC_ObjectChangeAuth, (TSS_InPrintFunction_t)ObjectChangeAuth_In_Print},
-    {TPM_CC_CreateLoaded, (TSS_InPrintFunction_t)CreateLoaded_In_Print},
-    {TPM_CC_Duplicate, (TSS_InPrintFunction_t)Duplicate_In_Print},
-    {TPM_CC_Rewrap, (TSS_InPrintFunction_t)Rewrap_In_Print},
-    {TPM_CC_Import, (TSS_InPrintFunction_t)Import_In_Print},
-    {TPM_CC_RSA_Encrypt, (TSS_InPrintFunction_t)RSA_Encrypt_In_Print},
-    {TPM_CC_RSA_Decrypt, (TSS_InPrintFunction_t)RSA_Decrypt_In_Print},
-    {TPM_CC_ECDH_KeyGen, (TSS_InPrintFunction_t)ECDH_KeyGen_In_Print},
-    {TPM_CC_ECDH_ZGen, (TSS_InPrintFunction_t)ECDH_ZGen_In_Print},
-    {TPM_CC_ECC_Parameters, (TSS_InPrintFunction_t)ECC_Parameters_In_Print},
-    {TPM_CC_ZGen_2Phase, (TSS_InPrintFunction_t)ZGen_2Phase_In_Print},
-    {TPM_CC_EncryptDecrypt, (TSS_InPrintFunction_t)EncryptDecrypt_In_Print},
-    {TPM_CC_EncryptDecrypt2, (TSS_InPrintFunction_t)EncryptDecrypt2_In_Print},
-    {TPM_CC_Hash, (TSS_InPrintFunction_t)Hash_In_Print},
-    {TPM_CC_HMAC, (TSS_InPrintFunction_t)HMAC_In_Print},
-    {TPM_CC_GetRandom, (TSS_InPrintFunction_t)GetRandom_In_Print},
-    {TPM_CC_StirRandom, (TSS_InPrintFunction_t)StirRandom_In_Print},
-    {TPM_CC_HMAC_Start, (TSS_InPrintFunction_t)HMAC_Start_In_Print},
-    {TPM_CC_HashSequenceStart, (TSS_InPrintFunction_t)HashSequenceStart_In_Print},
-    {TPM_CC_SequenceUpdate, (TSS_InPrintFunction_t)SequenceUpdate_In_Print},
-    {TPM_CC_SequenceComplete, (TSS_InPrintFunction_t)SequenceComplete_In_Print},
-    {TPM_CC_EventSequenceComplete, (TSS_InPrintFunction_t)EventSequenceComplete_In_Print},
-    {TPM_CC_Certify, (TSS_InPrintFunction_t)Certify_In_Print},
-    {TPM_CC_CertifyCreation, (TSS_InPrintFunction_t)CertifyCreation_In_Print},
-    {TPM_CC_Quote, (TSS_InPrintFunction_t)Quote_In_Print},
-    {TPM_CC_GetSessionAuditDigest, (TSS_InPrintFunction_t)GetSessionAuditDigest_In_Print},
-    {TPM_CC_GetCommandAuditDigest, (TSS_InPrintFunction_t)GetCommandAuditDigest_In_Print},
-    {TPM_CC_GetTime, (TSS_InPrintFunction_t)GetTime_In_Print},
-    {TPM_CC_Commit, (TSS_InPrintFunction_t)Commit_In_Print},
-    {TPM_CC_EC_Ephemeral, (TSS_InPrintFunction_t)EC_Ephemeral_In_Print},
-    {TPM_CC_VerifySignature, (TSS_InPrintFunction_t)VerifySignature_In_Print},
-    {TPM_CC_Sign, (TSS_InPrintFunction_t)Sign_In_Print},
-    {TPM_CC_SetCommandCodeAuditStatus, (TSS_InPrintFunction_t)SetCommandCodeAuditStatus_In_Print},
-    {TPM_CC_PCR_Extend, (TSS_InPrintFunction_t)PCR_Extend_In_Print},
-    {TPM_CC_PCR_Event, (TSS_InPrintFunction_t)PCR_Event_In_Print},
-    {TPM_CC_PCR_Read, (TSS_InPrintFunction_t)PCR_Read_In_Print},
-    {TPM_CC_PCR_Allocate, (TSS_InPrintFunction_t)PCR_Allocate_In_Print},
-    {TPM_CC_PCR_SetAuthPolicy, (TSS_InPrintFunction_t)PCR_SetAuthPolicy_In_Print},
-    {TPM_CC_PCR_SetAuthValue, (TSS_InPrintFunction_t)PCR_SetAuthValue_In_Print},
-    {TPM_CC_PCR_Reset, (TSS_InPrintFunction_t)PCR_Reset_In_Print},
-    {TPM_CC_PolicySigned, (TSS_InPrintFunction_t)PolicySigned_In_Print},
-    {TPM_CC_PolicySecret, (TSS_InPrintFunction_t)PolicySecret_In_Print},
-    {TPM_CC_PolicyTicket, (TSS_InPrintFunction_t)PolicyTicket_In_Print},
-    {TPM_CC_PolicyOR, (TSS_InPrintFunction_t)PolicyOR_In_Print},
-    {TPM_CC_PolicyPCR, (TSS_InPrintFunction_t)PolicyPCR_In_Print},
-    {TPM_CC_PolicyLocality, (TSS_InPrintFunction_t)PolicyLocality_In_Print},
-    {TPM_CC_PolicyNV, (TSS_InPrintFunction_t)PolicyNV_In_Print},
-    {TPM_CC_PolicyAuthorizeNV, (TSS_InPrintFunction_t)PolicyAuthorizeNV_In_Print},
-    {TPM_CC_PolicyCounterTimer, (TSS_InPrintFunction_t)PolicyCounterTimer_In_Print},
-    {TPM_CC_PolicyCommandCode, (TSS_InPrintFunction_t)PolicyCommandCode_In_Print},
-    {TPM_CC_PolicyPhysicalPresence, (TSS_InPrintFunction_t)PolicyPhysicalPresence_In_Print},
-    {TPM_CC_PolicyCpHash, (TSS_InPrintFunction_t)PolicyCpHash_In_Print},
-    {TPM_CC_PolicyNameHash, (TSS_InPrintFunction_t)PolicyNameHash_In_Print},
-    {TPM_CC_PolicyDuplicationSelect, (TSS_InPrintFunction_t)PolicyDuplicationSelect_In_Print},
-    {TPM_CC_PolicyAuthorize, (TSS_InPrintFunction_t)PolicyAuthorize_In_Print},
-    {TPM_CC_PolicyAuthValue, (TSS_InPrintFunction_t)PolicyAuthValue_In_Print},
-    {TPM_CC_PolicyPassword, (TSS_InPrintFunction_t)PolicyPassword_In_Print},
-    {TPM_CC_PolicyGetDigest, (TSS_InPrintFunction_t)PolicyGetDigest_In_Print},
-    {TPM_CC_PolicyNvWritten, (TSS_InPrintFunction_t)PolicyNvWritten_In_Print},
-    {TPM_CC_PolicyTemplate, (TSS_InPrintFunction_t)PolicyTemplate_In_Print},
-    {TPM_CC_CreatePrimary, (TSS_InPrintFunction_t)CreatePrimary_In_Print},
-    {TPM_CC_HierarchyControl, (TSS_InPrintFunction_t)HierarchyControl_In_Print},
-    {TPM_CC_SetPrimaryPolicy, (TSS_InPrintFunction_t)SetPrimaryPolicy_In_Print},
-    {TPM_CC_ChangePPS, (TSS_InPrintFunction_t)ChangePPS_In_Print},
-    {TPM_CC_ChangeEPS, (TSS_InPrintFunction_t)ChangeEPS_In_Print},
-    {TPM_CC_Clear, (TSS_InPrintFunction_t)Clear_In_Print},
-    {TPM_CC_ClearControl, (TSS_InPrintFunction_t)ClearControl_In_Print},
-    {TPM_CC_HierarchyChangeAuth, (TSS_InPrintFunction_t)HierarchyChangeAuth_In_Print},
-    {TPM_CC_DictionaryAttackLockReset, (TSS_InPrintFunction_t)DictionaryAttackLockReset_In_Print},
-    {TPM_CC_DictionaryAttackParameters, (TSS_InPrintFunction_t)DictionaryAttackParameters_In_Print},
-    {TPM_CC_PP_Commands, (TSS_InPrintFunction_t)PP_Commands_In_Print},
-    {TPM_CC_SetAlgorithmSet, (TSS_InPrintFunction_t)SetAlgorithmSet_In_Print},
-    {TPM_CC_ContextSave, (TSS_InPrintFunction_t)ContextSave_In_Print},
-    {TPM_CC_ContextLoad, (TSS_InPrintFunction_t)ContextLoad_In_Print},
-    {TPM_CC_FlushContext, (TSS_InPrintFunction_t)FlushContext_In_Print},
-    {TPM_CC_EvictControl, (TSS_InPrintFunction_t)EvictControl_In_Print},
-    {TPM_CC_ReadClock, (TSS_InPrintFunction_t)NULL},
-    {TPM_CC_ClockSet, (TSS_InPrintFunction_t)ClockSet_In_Print},
-    {TPM_CC_ClockRateAdjust, (TSS_InPrintFunction_t)ClockRateAdjust_In_Print},
-    {TPM_CC_GetCapability, (TSS_InPrintFunction_t)GetCapability_In_Print},
-    {TPM_CC_TestParms, (TSS_InPrintFunction_t)TestParms_In_Print},
-    {TPM_CC_NV_DefineSpace, (TSS_InPrintFunction_t)NV_DefineSpace_In_Print},
-    {TPM_CC_NV_UndefineSpace, (TSS_InPrintFunction_t)NV_UndefineSpace_In_Print},
-    {TPM_CC_NV_UndefineSpaceSpecial, (TSS_InPrintFunction_t)NV_UndefineSpaceSpecial_In_Print},
-    {TPM_CC_NV_ReadPublic, (TSS_InPrintFunction_t)NV_ReadPublic_In_Print},
-    {TPM_CC_NV_Write, (TSS_InPrintFunction_t)NV_Write_In_Print},
-    {TPM_CC_NV_Increment, (TSS_InPrintFunction_t)NV_Increment_In_Print},
-    {TPM_CC_NV_Extend, (TSS_InPrintFunction_t)NV_Extend_In_Print},
-    {TPM_CC_NV_SetBits, (TSS_InPrintFunction_t)NV_SetBits_In_Print},
-    {TPM_CC_NV_WriteLock, (TSS_InPrintFunction_t)NV_WriteLock_In_Print},
-    {TPM_CC_NV_GlobalWriteLock, (TSS_InPrintFunction_t)NV_GlobalWriteLock_In_Print},
-    {TPM_CC_NV_Read, (TSS_InPrintFunction_t)NV_Read_In_Print},
-    {TPM_CC_NV_ReadLock, (TSS_InPrintFunction_t)NV_ReadLock_In_Print},
-    {TPM_CC_NV_ChangeAuth, (TSS_InPrintFunction_t)NV_ChangeAuth_In_Print},
-    {TPM_CC_NV_Certify, (TSS_InPrintFunction_t)NV_Certify_In_Print}
+/* This table indexes from the command to the marshal, unmarshal, pre- and post- processing, and
+   print functions.  A NULL function is not an error, and indicates a command with no function. */
+
+static const TSS_COMMAND_DESCRIPTOR tssCommandTable [TSS_CC_TABLE_SIZE] = {
+
+    [TSS_CC_INDEX(TPM_CC_Startup)] =
+    {TPM_CC_Startup, "TPM2_Startup",
+     (MarshalInFunction_t)TSS_Startup_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)Startup_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_Capability_Invalidate,
+     TSS_IN_PRINT(Startup_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Shutdown)] =
+    {TPM_CC_Shutdown, "TPM2_Shutdown",
+     (MarshalInFunction_t)TSS_Shutdown_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)Shutdown_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Shutdown_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_SelfTest)] =
+    {TPM_CC_SelfTest, "TPM2_SelfTest",
+     (MarshalInFunction_t)TSS_SelfTest_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)SelfTest_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(SelfTest_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_IncrementalSelfTest)] =
+    {TPM_CC_IncrementalSelfTest, "TPM2_IncrementalSelfTest",
+     (MarshalInFunction_t)TSS_IncrementalSelfTest_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_IncrementalSelfTest_Out_Unmarshalu,
+     (UnmarshalInFunction_t)IncrementalSelfTest_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(IncrementalSelfTest_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_GetTestResult)] =
+    {TPM_CC_GetTestResult, "TPM2_GetTestResult",
+     NULL,
+     (UnmarshalOutFunction_t)TSS_GetTestResult_Out_Unmarshalu,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL},
+
+    [TSS_CC_INDEX(TPM_CC_StartAuthSession)] =
+    {TPM_CC_StartAuthSession, "TPM2_StartAuthSession",
+     (MarshalInFunction_t)TSS_StartAuthSession_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_StartAuthSession_Out_Unmarshalu,
+     (UnmarshalInFunction_t)StartAuthSession_In_Unmarshal,
+     (TSS_PreProcessFunction_t)TSS_PR_StartAuthSession,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_StartAuthSession,
+     TSS_IN_PRINT(StartAuthSession_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyRestart)] =
+    {TPM_CC_PolicyRestart, "TPM2_PolicyRestart",
+     (MarshalInFunction_t)TSS_PolicyRestart_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyRestart_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_PolicyRestart,
+     TSS_IN_PRINT(PolicyRestart_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Create)] =
+    {TPM_CC_Create, "TPM2_Create",
+     (MarshalInFunction_t)TSS_Create_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Create_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Create_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Create_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Load)] =
+    {TPM_CC_Load, "TPM2_Load",
+     (MarshalInFunction_t)TSS_Load_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Load_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Load_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_Load,
+     TSS_IN_PRINT(Load_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_LoadExternal)] =
+    {TPM_CC_LoadExternal, "TPM2_LoadExternal",
+     (MarshalInFunction_t)TSS_LoadExternal_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_LoadExternal_Out_Unmarshalu,
+     (UnmarshalInFunction_t)LoadExternal_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_LoadExternal,
+     TSS_IN_PRINT(LoadExternal_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ReadPublic)] =
+    {TPM_CC_ReadPublic, "TPM2_ReadPublic",
+     (MarshalInFunction_t)TSS_ReadPublic_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ReadPublic_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ReadPublic_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_ReadPublic,
+     TSS_IN_PRINT(ReadPublic_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ActivateCredential)] =
+    {TPM_CC_ActivateCredential, "TPM2_ActivateCredential",
+     (MarshalInFunction_t)TSS_ActivateCredential_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ActivateCredential_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ActivateCredential_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ActivateCredential_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_MakeCredential)] =
+    {TPM_CC_MakeCredential, "TPM2_MakeCredential",
+     (MarshalInFunction_t)TSS_MakeCredential_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_MakeCredential_Out_Unmarshalu,
+     (UnmarshalInFunction_t)MakeCredential_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(MakeCredential_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Unseal)] =
+    {TPM_CC_Unseal, "TPM2_Unseal",
+     (MarshalInFunction_t)TSS_Unseal_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Unseal_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Unseal_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Unseal_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ObjectChangeAuth)] =
+    {TPM_CC_ObjectChangeAuth, "TPM2_ObjectChangeAuth",
+     (MarshalInFunction_t)TSS_ObjectChangeAuth_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ObjectChangeAuth_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ObjectChangeAuth_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ObjectChangeAuth_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_CreateLoaded)] =
+    {TPM_CC_CreateLoaded, "TPM2_CreateLoaded",
+     (MarshalInFunction_t)TSS_CreateLoaded_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_CreateLoaded_Out_Unmarshalu,
+     (UnmarshalInFunction_t)CreateLoaded_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_CreateLoaded,
+     TSS_IN_PRINT(CreateLoaded_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Duplicate)] =
+    {TPM_CC_Duplicate, "TPM2_Duplicate",
+     (MarshalInFunction_t)TSS_Duplicate_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Duplicate_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Duplicate_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Duplicate_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Rewrap)] =
+    {TPM_CC_Rewrap, "TPM2_Rewrap",
+     (MarshalInFunction_t)TSS_Rewrap_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Rewrap_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Rewrap_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Rewrap_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Import)] =
+    {TPM_CC_Import, "TPM2_Import",
+     (MarshalInFunction_t)TSS_Import_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Import_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Import_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Import_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_RSA_Encrypt)] =
+    {TPM_CC_RSA_Encrypt, "TPM2_RSA_Encrypt",
+     (MarshalInFunction_t)TSS_RSA_Encrypt_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_RSA_Encrypt_Out_Unmarshalu,
+     (UnmarshalInFunction_t)RSA_Encrypt_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(RSA_Encrypt_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_RSA_Decrypt)] =
+    {TPM_CC_RSA_Decrypt, "TPM2_RSA_Decrypt",
+     (MarshalInFunction_t)TSS_RSA_Decrypt_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_RSA_Decrypt_Out_Unmarshalu,
+     (UnmarshalInFunction_t)RSA_Decrypt_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(RSA_Decrypt_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ECDH_KeyGen)] =
+    {TPM_CC_ECDH_KeyGen, "TPM2_ECDH_KeyGen",
+     (MarshalInFunction_t)TSS_ECDH_KeyGen_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ECDH_KeyGen_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ECDH_KeyGen_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ECDH_KeyGen_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ECDH_ZGen)] =
+    {TPM_CC_ECDH_ZGen, "TPM2_ECDH_ZGen",
+     (MarshalInFunction_t)TSS_ECDH_ZGen_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ECDH_ZGen_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ECDH_ZGen_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ECDH_ZGen_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ECC_Parameters)] =
+    {TPM_CC_ECC_Parameters, "TPM2_ECC_Parameters",
+     (MarshalInFunction_t)TSS_ECC_Parameters_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ECC_Parameters_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ECC_Parameters_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ECC_Parameters_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ZGen_2Phase)] =
+    {TPM_CC_ZGen_2Phase, "TPM2_ZGen_2Phase",
+     (MarshalInFunction_t)TSS_ZGen_2Phase_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ZGen_2Phase_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ZGen_2Phase_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ZGen_2Phase_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_EncryptDecrypt)] =
+    {TPM_CC_EncryptDecrypt, "TPM2_EncryptDecrypt",
+     (MarshalInFunction_t)TSS_EncryptDecrypt_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_EncryptDecrypt_Out_Unmarshalu,
+     (UnmarshalInFunction_t)EncryptDecrypt_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(EncryptDecrypt_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_EncryptDecrypt2)] =
+    {TPM_CC_EncryptDecrypt2, "TPM2_EncryptDecrypt2",
+     (MarshalInFunction_t)TSS_EncryptDecrypt2_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_EncryptDecrypt2_Out_Unmarshalu,
+     (UnmarshalInFunction_t)EncryptDecrypt2_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(EncryptDecrypt2_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Hash)] =
+    {TPM_CC_Hash, "TPM2_Hash",
+     (MarshalInFunction_t)TSS_Hash_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Hash_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Hash_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Hash_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_HMAC)] =
+    {TPM_CC_HMAC, "TPM2_HMAC",
+     (MarshalInFunction_t)TSS_HMAC_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_HMAC_Out_Unmarshalu,
+     (UnmarshalInFunction_t)HMAC_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(HMAC_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_GetRandom)] =
+    {TPM_CC_GetRandom, "TPM2_GetRandom",
+     (MarshalInFunction_t)TSS_GetRandom_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_GetRandom_Out_Unmarshalu,
+     (UnmarshalInFunction_t)GetRandom_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(GetRandom_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_StirRandom)] =
+    {TPM_CC_StirRandom, "TPM2_StirRandom",
+     (MarshalInFunction_t)TSS_StirRandom_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)StirRandom_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(StirRandom_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_HMAC_Start)] =
+    {TPM_CC_HMAC_Start, "TPM2_HMAC_Start",
+     (MarshalInFunction_t)TSS_HMAC_Start_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_HMAC_Start_Out_Unmarshalu,
+     (UnmarshalInFunction_t)HMAC_Start_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_HMAC_Start,
+     TSS_IN_PRINT(HMAC_Start_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_HashSequenceStart)] =
+    {TPM_CC_HashSequenceStart, "TPM2_HashSequenceStart",
+     (MarshalInFunction_t)TSS_HashSequenceStart_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_HashSequenceStart_Out_Unmarshalu,
+     (UnmarshalInFunction_t)HashSequenceStart_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_HashSequenceStart,
+     TSS_IN_PRINT(HashSequenceStart_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_SequenceUpdate)] =
+    {TPM_CC_SequenceUpdate, "TPM2_SequenceUpdate",
+     (MarshalInFunction_t)TSS_SequenceUpdate_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)SequenceUpdate_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(SequenceUpdate_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_SequenceComplete)] =
+    {TPM_CC_SequenceComplete, "TPM2_SequenceComplete",
+     (MarshalInFunction_t)TSS_SequenceComplete_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_SequenceComplete_Out_Unmarshalu,
+     (UnmarshalInFunction_t)SequenceComplete_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_SequenceComplete,
+     TSS_IN_PRINT(SequenceComplete_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_EventSequenceComplete)] =
+    {TPM_CC_EventSequenceComplete, "TPM2_EventSequenceComplete",
+     (MarshalInFunction_t)TSS_EventSequenceComplete_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_EventSequenceComplete_Out_Unmarshalu,
+     (UnmarshalInFunction_t)EventSequenceComplete_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_EventSequenceComplete,
+     TSS_IN_PRINT(EventSequenceComplete_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Certify)] =
+    {TPM_CC_Certify, "TPM2_Certify",
+     (MarshalInFunction_t)TSS_Certify_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Certify_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Certify_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Certify_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_CertifyCreation)] =
+    {TPM_CC_CertifyCreation, "TPM2_CertifyCreation",
+     (MarshalInFunction_t)TSS_CertifyCreation_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_CertifyCreation_Out_Unmarshalu,
+     (UnmarshalInFunction_t)CertifyCreation_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(CertifyCreation_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Quote)] =
+    {TPM_CC_Quote, "TPM2_Quote",
+     (MarshalInFunction_t)TSS_Quote_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Quote_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Quote_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Quote_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_GetSessionAuditDigest)] =
+    {TPM_CC_GetSessionAuditDigest, "TPM2_GetSessionAuditDigest",
+     (MarshalInFunction_t)TSS_GetSessionAuditDigest_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_GetSessionAuditDigest_Out_Unmarshalu,
+     (UnmarshalInFunction_t)GetSessionAuditDigest_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(GetSessionAuditDigest_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_GetCommandAuditDigest)] =
+    {TPM_CC_GetCommandAuditDigest, "TPM2_GetCommandAuditDigest",
+     (MarshalInFunction_t)TSS_GetCommandAuditDigest_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_GetCommandAuditDigest_Out_Unmarshalu,
+     (UnmarshalInFunction_t)GetCommandAuditDigest_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(GetCommandAuditDigest_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_GetTime)] =
+    {TPM_CC_GetTime, "TPM2_GetTime",
+     (MarshalInFunction_t)TSS_GetTime_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_GetTime_Out_Unmarshalu,
+     (UnmarshalInFunction_t)GetTime_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(GetTime_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Commit)] =
+    {TPM_CC_Commit, "TPM2_Commit",
+     (MarshalInFunction_t)TSS_Commit_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Commit_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Commit_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Commit_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_EC_Ephemeral)] =
+    {TPM_CC_EC_Ephemeral, "TPM2_EC_Ephemeral",
+     (MarshalInFunction_t)TSS_EC_Ephemeral_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_EC_Ephemeral_Out_Unmarshalu,
+     (UnmarshalInFunction_t)EC_Ephemeral_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(EC_Ephemeral_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_VerifySignature)] =
+    {TPM_CC_VerifySignature, "TPM2_VerifySignature",
+     (MarshalInFunction_t)TSS_VerifySignature_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_VerifySignature_Out_Unmarshalu,
+     (UnmarshalInFunction_t)VerifySignature_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(VerifySignature_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Sign)] =
+    {TPM_CC_Sign, "TPM2_Sign",
+     (MarshalInFunction_t)TSS_Sign_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_Sign_Out_Unmarshalu,
+     (UnmarshalInFunction_t)Sign_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(Sign_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_SetCommandCodeAuditStatus)] =
+    {TPM_CC_SetCommandCodeAuditStatus, "TPM2_SetCommandCodeAuditStatus",
+     (MarshalInFunction_t)TSS_SetCommandCodeAuditStatus_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)SetCommandCodeAuditStatus_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(SetCommandCodeAuditStatus_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PCR_Extend)] =
+    {TPM_CC_PCR_Extend, "TPM2_PCR_Extend",
+     (MarshalInFunction_t)TSS_PCR_Extend_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PCR_Extend_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PCR_Extend_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PCR_Event)] =
+    {TPM_CC_PCR_Event, "TPM2_PCR_Event",
+     (MarshalInFunction_t)TSS_PCR_Event_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_PCR_Event_Out_Unmarshalu,
+     (UnmarshalInFunction_t)PCR_Event_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PCR_Event_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PCR_Read)] =
+    {TPM_CC_PCR_Read, "TPM2_PCR_Read",
+     (MarshalInFunction_t)TSS_PCR_Read_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_PCR_Read_Out_Unmarshalu,
+     (UnmarshalInFunction_t)PCR_Read_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PCR_Read_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PCR_Allocate)] =
+    {TPM_CC_PCR_Allocate, "TPM2_PCR_Allocate",
+     (MarshalInFunction_t)TSS_PCR_Allocate_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_PCR_Allocate_Out_Unmarshalu,
+     (UnmarshalInFunction_t)PCR_Allocate_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_Capability_Invalidate,
+     TSS_IN_PRINT(PCR_Allocate_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PCR_SetAuthPolicy)] =
+    {TPM_CC_PCR_SetAuthPolicy, "TPM2_PCR_SetAuthPolicy",
+     (MarshalInFunction_t)TSS_PCR_SetAuthPolicy_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PCR_SetAuthPolicy_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PCR_SetAuthPolicy_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PCR_SetAuthValue)] =
+    {TPM_CC_PCR_SetAuthValue, "TPM2_PCR_SetAuthValue",
+     (MarshalInFunction_t)TSS_PCR_SetAuthValue_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PCR_SetAuthValue_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PCR_SetAuthValue_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PCR_Reset)] =
+    {TPM_CC_PCR_Reset, "TPM2_PCR_Reset",
+     (MarshalInFunction_t)TSS_PCR_Reset_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PCR_Reset_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PCR_Reset_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicySigned)] =
+    {TPM_CC_PolicySigned, "TPM2_PolicySigned",
+     (MarshalInFunction_t)TSS_PolicySigned_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_PolicySigned_Out_Unmarshalu,
+     (UnmarshalInFunction_t)PolicySigned_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicySigned_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicySecret)] =
+    {TPM_CC_PolicySecret, "TPM2_PolicySecret",
+     (MarshalInFunction_t)TSS_PolicySecret_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_PolicySecret_Out_Unmarshalu,
+     (UnmarshalInFunction_t)PolicySecret_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicySecret_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyTicket)] =
+    {TPM_CC_PolicyTicket, "TPM2_PolicyTicket",
+     (MarshalInFunction_t)TSS_PolicyTicket_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyTicket_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyTicket_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyOR)] =
+    {TPM_CC_PolicyOR, "TPM2_PolicyOR",
+     (MarshalInFunction_t)TSS_PolicyOR_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyOR_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyOR_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyPCR)] =
+    {TPM_CC_PolicyPCR, "TPM2_PolicyPCR",
+     (MarshalInFunction_t)TSS_PolicyPCR_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyPCR_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyPCR_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyLocality)] =
+    {TPM_CC_PolicyLocality, "TPM2_PolicyLocality",
+     (MarshalInFunction_t)TSS_PolicyLocality_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyLocality_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyLocality_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyNV)] =
+    {TPM_CC_PolicyNV, "TPM2_PolicyNV",
+     (MarshalInFunction_t)TSS_PolicyNV_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyNV_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyNV_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyAuthorizeNV)] =
+    {TPM_CC_PolicyAuthorizeNV, "TPM2_PolicyAuthorizeNV",
+     (MarshalInFunction_t)TSS_PolicyAuthorizeNV_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyAuthorizeNV_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyAuthorizeNV_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyCounterTimer)] =
+    {TPM_CC_PolicyCounterTimer, "TPM2_PolicyCounterTimer",
+     (MarshalInFunction_t)TSS_PolicyCounterTimer_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyCounterTimer_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyCounterTimer_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyCommandCode)] =
+    {TPM_CC_PolicyCommandCode, "TPM2_PolicyCommandCode",
+     (MarshalInFunction_t)TSS_PolicyCommandCode_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyCommandCode_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyCommandCode_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyPhysicalPresence)] =
+    {TPM_CC_PolicyPhysicalPresence, "TPM2_PolicyPhysicalPresence",
+     (MarshalInFunction_t)TSS_PolicyPhysicalPresence_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyPhysicalPresence_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyPhysicalPresence_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyCpHash)] =
+    {TPM_CC_PolicyCpHash, "TPM2_PolicyCpHash",
+     (MarshalInFunction_t)TSS_PolicyCpHash_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyCpHash_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyCpHash_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyNameHash)] =
+    {TPM_CC_PolicyNameHash, "TPM2_PolicyNameHash",
+     (MarshalInFunction_t)TSS_PolicyNameHash_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyNameHash_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyNameHash_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyDuplicationSelect)] =
+    {TPM_CC_PolicyDuplicationSelect, "TPM2_PolicyDuplicationSelect",
+     (MarshalInFunction_t)TSS_PolicyDuplicationSelect_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyDuplicationSelect_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyDuplicationSelect_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyAuthorize)] =
+    {TPM_CC_PolicyAuthorize, "TPM2_PolicyAuthorize",
+     (MarshalInFunction_t)TSS_PolicyAuthorize_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyAuthorize_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyAuthorize_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyAuthValue)] =
+    {TPM_CC_PolicyAuthValue, "TPM2_PolicyAuthValue",
+     (MarshalInFunction_t)TSS_PolicyAuthValue_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyAuthValue_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_PolicyAuthValue,
+     TSS_IN_PRINT(PolicyAuthValue_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyPassword)] =
+    {TPM_CC_PolicyPassword, "TPM2_PolicyPassword",
+     (MarshalInFunction_t)TSS_PolicyPassword_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyPassword_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_PolicyPassword,
+     TSS_IN_PRINT(PolicyPassword_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyGetDigest)] =
+    {TPM_CC_PolicyGetDigest, "TPM2_PolicyGetDigest",
+     (MarshalInFunction_t)TSS_PolicyGetDigest_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_PolicyGetDigest_Out_Unmarshalu,
+     (UnmarshalInFunction_t)PolicyGetDigest_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyGetDigest_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyNvWritten)] =
+    {TPM_CC_PolicyNvWritten, "TPM2_PolicyNvWritten",
+     (MarshalInFunction_t)TSS_PolicyNvWritten_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyNvWritten_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyNvWritten_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PolicyTemplate)] =
+    {TPM_CC_PolicyTemplate, "TPM2_PolicyTemplate",
+     (MarshalInFunction_t)TSS_PolicyTemplate_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PolicyTemplate_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PolicyTemplate_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_CreatePrimary)] =
+    {TPM_CC_CreatePrimary, "TPM2_CreatePrimary",
+     (MarshalInFunction_t)TSS_CreatePrimary_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_CreatePrimary_Out_Unmarshalu,
+     (UnmarshalInFunction_t)CreatePrimary_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_CreatePrimary,
+     TSS_IN_PRINT(CreatePrimary_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_HierarchyControl)] =
+    {TPM_CC_HierarchyControl, "TPM2_HierarchyControl",
+     (MarshalInFunction_t)TSS_HierarchyControl_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)HierarchyControl_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(HierarchyControl_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_SetPrimaryPolicy)] =
+    {TPM_CC_SetPrimaryPolicy, "TPM2_SetPrimaryPolicy",
+     (MarshalInFunction_t)TSS_SetPrimaryPolicy_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)SetPrimaryPolicy_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(SetPrimaryPolicy_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ChangePPS)] =
+    {TPM_CC_ChangePPS, "TPM2_ChangePPS",
+     (MarshalInFunction_t)TSS_ChangePPS_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)ChangePPS_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ChangePPS_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ChangeEPS)] =
+    {TPM_CC_ChangeEPS, "TPM2_ChangeEPS",
+     (MarshalInFunction_t)TSS_ChangeEPS_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)ChangeEPS_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ChangeEPS_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_Clear)] =
+    {TPM_CC_Clear, "TPM2_Clear",
+     (MarshalInFunction_t)TSS_Clear_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)Clear_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_Capability_Invalidate,
+     TSS_IN_PRINT(Clear_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ClearControl)] =
+    {TPM_CC_ClearControl, "TPM2_ClearControl",
+     (MarshalInFunction_t)TSS_ClearControl_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)ClearControl_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ClearControl_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_HierarchyChangeAuth)] =
+    {TPM_CC_HierarchyChangeAuth, "TPM2_HierarchyChangeAuth",
+     (MarshalInFunction_t)TSS_HierarchyChangeAuth_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)HierarchyChangeAuth_In_Unmarshal,
+     NULL,
+     (TSS_ChangeAuthFunction_t)TSS_CA_HierarchyChangeAuth,
+     NULL,
+     TSS_IN_PRINT(HierarchyChangeAuth_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_DictionaryAttackLockReset)] =
+    {TPM_CC_DictionaryAttackLockReset, "TPM2_DictionaryAttackLockReset",
+     (MarshalInFunction_t)TSS_DictionaryAttackLockReset_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)DictionaryAttackLockReset_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(DictionaryAttackLockReset_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_DictionaryAttackParameters)] =
+    {TPM_CC_DictionaryAttackParameters, "TPM2_DictionaryAttackParameters",
+     (MarshalInFunction_t)TSS_DictionaryAttackParameters_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)DictionaryAttackParameters_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(DictionaryAttackParameters_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_PP_Commands)] =
+    {TPM_CC_PP_Commands, "TPM2_PP_Commands",
+     (MarshalInFunction_t)TSS_PP_Commands_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)PP_Commands_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(PP_Commands_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_SetAlgorithmSet)] =
+    {TPM_CC_SetAlgorithmSet, "TPM2_SetAlgorithmSet",
+     (MarshalInFunction_t)TSS_SetAlgorithmSet_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)SetAlgorithmSet_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(SetAlgorithmSet_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ContextSave)] =
+    {TPM_CC_ContextSave, "TPM2_ContextSave",
+     (MarshalInFunction_t)TSS_ContextSave_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ContextSave_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ContextSave_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_ContextSave,
+     TSS_IN_PRINT(ContextSave_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ContextLoad)] =
+    {TPM_CC_ContextLoad, "TPM2_ContextLoad",
+     (MarshalInFunction_t)TSS_ContextLoad_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_ContextLoad_Out_Unmarshalu,
+     (UnmarshalInFunction_t)ContextLoad_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_ContextLoad,
+     TSS_IN_PRINT(ContextLoad_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_FlushContext)] =
+    {TPM_CC_FlushContext, "TPM2_FlushContext",
+     (MarshalInFunction_t)TSS_FlushContext_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)FlushContext_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_FlushContext,
+     TSS_IN_PRINT(FlushContext_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_EvictControl)] =
+    {TPM_CC_EvictControl, "TPM2_EvictControl",
+     (MarshalInFunction_t)TSS_EvictControl_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)EvictControl_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_EvictControl,
+     TSS_IN_PRINT(EvictControl_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ReadClock)] =
+    {TPM_CC_ReadClock, "TPM2_ReadClock",
+     NULL,
+     (UnmarshalOutFunction_t)TSS_ReadClock_Out_Unmarshalu,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL},
+
+    [TSS_CC_INDEX(TPM_CC_ClockSet)] =
+    {TPM_CC_ClockSet, "TPM2_ClockSet",
+     (MarshalInFunction_t)TSS_ClockSet_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)ClockSet_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ClockSet_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_ClockRateAdjust)] =
+    {TPM_CC_ClockRateAdjust, "TPM2_ClockRateAdjust",
+     (MarshalInFunction_t)TSS_ClockRateAdjust_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)ClockRateAdjust_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(ClockRateAdjust_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_GetCapability)] =
+    {TPM_CC_GetCapability, "TPM2_GetCapability",
+     (MarshalInFunction_t)TSS_GetCapability_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_GetCapability_Out_Unmarshalu,
+     (UnmarshalInFunction_t)GetCapability_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(GetCapability_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_TestParms)] =
+    {TPM_CC_TestParms, "TPM2_TestParms",
+     (MarshalInFunction_t)TSS_TestParms_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)TestParms_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(TestParms_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_DefineSpace)] =
+    {TPM_CC_NV_DefineSpace, "TPM2_NV_DefineSpace",
+     (MarshalInFunction_t)TSS_NV_DefineSpace_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_DefineSpace_In_Unmarshal,
+     (TSS_PreProcessFunction_t)TSS_PR_NV_DefineSpace,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_DefineSpace,
+     TSS_IN_PRINT(NV_DefineSpace_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_UndefineSpace)] =
+    {TPM_CC_NV_UndefineSpace, "TPM2_NV_UndefineSpace",
+     (MarshalInFunction_t)TSS_NV_UndefineSpace_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_UndefineSpace_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_UndefineSpace,
+     TSS_IN_PRINT(NV_UndefineSpace_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_UndefineSpaceSpecial)] =
+    {TPM_CC_NV_UndefineSpaceSpecial, "TPM2_NV_UndefineSpaceSpecial",
+     (MarshalInFunction_t)TSS_NV_UndefineSpaceSpecial_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_UndefineSpaceSpecial_In_Unmarshal,
+     NULL,
+     (TSS_ChangeAuthFunction_t)TSS_CA_NV_UndefineSpaceSpecial,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_UndefineSpaceSpecial,
+     TSS_IN_PRINT(NV_UndefineSpaceSpecial_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_ReadPublic)] =
+    {TPM_CC_NV_ReadPublic, "TPM2_NV_ReadPublic",
+     (MarshalInFunction_t)TSS_NV_ReadPublic_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_NV_ReadPublic_Out_Unmarshalu,
+     (UnmarshalInFunction_t)NV_ReadPublic_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_ReadPublic,
+     TSS_IN_PRINT(NV_ReadPublic_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_Write)] =
+    {TPM_CC_NV_Write, "TPM2_NV_Write",
+     (MarshalInFunction_t)TSS_NV_Write_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_Write_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_Write,
+     TSS_IN_PRINT(NV_Write_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_Increment)] =
+    {TPM_CC_NV_Increment, "TPM2_NV_Increment",
+     (MarshalInFunction_t)TSS_NV_Increment_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_Increment_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_Write,
+     TSS_IN_PRINT(NV_Increment_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_Extend)] =
+    {TPM_CC_NV_Extend, "TPM2_NV_Extend",
+     (MarshalInFunction_t)TSS_NV_Extend_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_Extend_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_Write,
+     TSS_IN_PRINT(NV_Extend_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_SetBits)] =
+    {TPM_CC_NV_SetBits, "TPM2_NV_SetBits",
+     (MarshalInFunction_t)TSS_NV_SetBits_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_SetBits_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_Write,
+     TSS_IN_PRINT(NV_SetBits_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_WriteLock)] =
+    {TPM_CC_NV_WriteLock, "TPM2_NV_WriteLock",
+     (MarshalInFunction_t)TSS_NV_WriteLock_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_WriteLock_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_WriteLock,
+     TSS_IN_PRINT(NV_WriteLock_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_GlobalWriteLock)] =
+    {TPM_CC_NV_GlobalWriteLock, "TPM2_NV_GlobalWriteLock",
+     (MarshalInFunction_t)TSS_NV_GlobalWriteLock_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_GlobalWriteLock_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(NV_GlobalWriteLock_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_Read)] =
+    {TPM_CC_NV_Read, "TPM2_NV_Read",
+     (MarshalInFunction_t)TSS_NV_Read_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_NV_Read_Out_Unmarshalu,
+     (UnmarshalInFunction_t)NV_Read_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(NV_Read_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_ReadLock)] =
+    {TPM_CC_NV_ReadLock, "TPM2_NV_ReadLock",
+     (MarshalInFunction_t)TSS_NV_ReadLock_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_ReadLock_In_Unmarshal,
+     NULL,
+     NULL,
+     (TSS_PostProcessFunction_t)TSS_PO_NV_ReadLock,
+     TSS_IN_PRINT(NV_ReadLock_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_ChangeAuth)] =
+    {TPM_CC_NV_ChangeAuth, "TPM2_NV_ChangeAuth",
+     (MarshalInFunction_t)TSS_NV_ChangeAuth_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)NV_ChangeAuth_In_Unmarshal,
+     NULL,
+     (TSS_ChangeAuthFunction_t)TSS_CA_NV_ChangeAuth,
+     NULL,
+     TSS_IN_PRINT(NV_ChangeAuth_In_Print)},
+
+    [TSS_CC_INDEX(TPM_CC_NV_Certify)] =
+    {TPM_CC_NV_Certify, "TPM2_NV_Certify",
+     (MarshalInFunction_t)TSS_NV_Certify_In_Marshalu,
+     (UnmarshalOutFunction_t)TSS_NV_Certify_Out_Unmarshalu,
+     (UnmarshalInFunction_t)NV_Certify_In_Unmarshal,
+     NULL,
+     NULL,
+     NULL,
+     TSS_IN_PRINT(NV_Certify_In_Print)},
+
+    [TSS_NTC2_INDEX(NTC2_CC_PreConfig)] =
+    {NTC2_CC_PreConfig, "NTC2_CC_PreConfig",
+     (MarshalInFunction_t)TSS_NTC2_PreConfig_In_Marshalu,
+     NULL,
+     (UnmarshalInFunction_t)TSS_NTC2_PreConfig_In_Unmarshalu,
+     NULL,
+     NULL,
+     NULL,
+     NULL},
+
+    [TSS_NTC2_INDEX(NTC2_CC_LockPreConfig)] =
+    {NTC2_CC_LockPreConfig, "NTC2_CC_LockPreConfig",
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL},
+
+    [TSS_NTC2_INDEX(NTC2_CC_GetConfig)] =
+    {NTC2_CC_GetConfig, "NTC2_CC_GetConfig",
+     NULL,
+     (UnmarshalOutFunction_t)TSS_NTC2_GetConfig_Out_Unmarshalu,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL}
 };
 
-#endif /* TPM_TSS_NO_PRINT */
-
 /* local prototypes */
 
-static TPM_RC TSS_Execute_valist(TSS_CONTEXT *tssContext,
-				 COMMAND_PARAMETERS *in,
-				 va_list ap);
-
+static TPM_RC TSS_Execute_Authorize(TSS_CONTEXT *tssContext,
+				    va_list ap);
+static TPM_RC TSS_Execute_Verify(TSS_CONTEXT *tssContext);
+static int TSS_Execute_HasSessions(const TSS_EXECUTE_STATE *state,
+				   unsigned int sessionAttributes);
 
 static TPM_RC TSS_PwapSession_Set(TPMS_AUTH_COMMAND *authCommand,
 				  const char *password);
 static TPM_RC TSS_PwapSession_Verify(TPMS_AUTH_RESPONSE *authResponse);
 
-static TPM_RC TSS_HmacSession_GetContext(struct TSS_HMAC_CONTEXT **session);
+static TPM_RC TSS_HmacSession_GetContext(TSS_CONTEXT *tssContext,
+					 struct TSS_HMAC_CONTEXT **session);
 static void   TSS_HmacSession_InitContext(struct TSS_HMAC_CONTEXT *session);
 static void   TSS_HmacSession_FreeContext(struct TSS_HMAC_CONTEXT *session);
 
@@ -515,6 +1442,10 @@ static TPM_RC TSS_HmacSession_SetHmacKey(TSS_CONTEXT *tssContext,
 					 struct TSS_HMAC_CONTEXT *session,
 					 size_t handleNumber,
 					 const char *password);
+static TPM_RC TSS_HmacSession_GetKeyState(void **keyState,
+					  TPMI_ALG_HASH hashAlg,
+					  const TPM2B_KEY *key);
+static void   TSS_HmacSession_FreeKeyStates(struct TSS_HMAC_CONTEXT *session);
 #endif	/* TPM_TSS_NOCRYPTO */
 static TPM_RC TSS_HmacSession_SetHMAC(TSS_AUTH_CONTEXT *tssAuthContext,
 				      struct TSS_HMAC_CONTEXT *session[],
@@ -540,6 +1471,28 @@ static TPM_RC TSS_HmacSession_SaveSession(TSS_CONTEXT *tssContext,
 static TPM_RC TSS_HmacSession_LoadSession(TSS_CONTEXT *tssContext,
 					  struct TSS_HMAC_CONTEXT *session,
 					  TPMI_SH_AUTH_SESSION	sessionHandle);
+#ifndef TPM_TSS_NOFILE
+static TPM_RC TSS_HmacSession_WriteFile(TSS_CONTEXT *tssContext,
+					TPMI_SH_AUTH_SESSION sessionHandle,
+					uint16_t written,
+					uint8_t *buffer);
+static TPM_RC TSS_HmacSession_ReadFile(TSS_CONTEXT *tssContext,
+				       uint8_t **inData,
+				       uint32_t *inLength,
+				       TPMI_SH_AUTH_SESSION sessionHandle);
+static TPM_RC TSS_HmacSession_CacheStore(TSS_CONTEXT *tssContext,
+					 TPMI_SH_AUTH_SESSION sessionHandle,
+					 uint16_t length,
+					 uint8_t *data,
+					 int dirty);
+static void   TSS_HmacSession_CacheWritten(TSS_CONTEXT *tssContext,
+					   TPMI_SH_AUTH_SESSION sessionHandle);
+static int    TSS_HmacSession_CacheRemove(TSS_CONTEXT *tssContext,
+					  TPMI_SH_AUTH_SESSION sessionHandle);
+static TPM_RC TSS_HmacSession_CacheGetSlot(TSS_CONTEXT *tssContext,
+					   size_t *slotIndex,
+					   TPMI_SH_AUTH_SESSION sessionHandle);
+#endif
 #ifdef TPM_TSS_NOFILE
 static TPM_RC TSS_HmacSession_SaveData(TSS_CONTEXT *tssContext,
 				       TPMI_SH_AUTH_SESSION sessionHandle,
@@ -551,7 +1504,7 @@ static TPM_RC TSS_HmacSession_LoadData(TSS_CONTEXT *tssContext,
 static TPM_RC TSS_HmacSession_DeleteData(TSS_CONTEXT *tssContext,
 					 TPMI_SH_AUTH_SESSION sessionHandle);
 static TPM_RC TSS_HmacSession_GetSlotForHandle(TSS_CONTEXT *tssContext,
-					       size_t *slotIndex,
+					       TSS_SESSIONS **slot,
 					       TPMI_SH_AUTH_SESSION sessionHandle);
 #endif
 static TPM_RC TSS_HmacSession_Marshal(struct TSS_HMAC_CONTEXT *source,
@@ -592,13 +1545,15 @@ static TPM_RC TSS_Public_Copy(TSS_CONTEXT *tssContext,
 			      const char *inString);
 #ifdef TPM_TSS_NOFILE
 static TPM_RC TSS_ObjectPublic_GetSlotForHandle(TSS_CONTEXT *tssContext,
-						size_t *slotIndex,
+						TSS_OBJECT_PUBLIC **slot,
+						TPM_HANDLE handle);
+static TPM_RC TSS_ObjectPublic_AddSlotForHandle(TSS_CONTEXT *tssContext,
+						TSS_OBJECT_PUBLIC **slot,
 						TPM_HANDLE handle);
 static TPM_RC TSS_ObjectPublic_DeleteData(TSS_CONTEXT *tssContext, TPM_HANDLE handle);
 #endif
-static TPM_RC TSS_DeleteHandle(TSS_CONTEXT *tssContext,
-			       TPM_HANDLE handle);
-static TPM_RC TSS_ObjectPublic_GetName(TPM2B_NAME *name,
+static TPM_RC TSS_ObjectPublic_GetName(TSS_CONTEXT *tssContext,
+				       TPM2B_NAME *name,
 				       TPMT_PUBLIC *tpmtPublic);
 
 #ifndef TPM_TSS_NOCRYPTO
@@ -613,7 +1568,10 @@ static TPM_RC TSS_NVPublic_Delete(TSS_CONTEXT *tssContext,
 				  TPMI_RH_NV_INDEX nvIndex);
 #ifdef TPM_TSS_NOFILE
 static TPM_RC TSS_NvPublic_GetSlotForHandle(TSS_CONTEXT *tssContext,
-					    size_t *slotIndex,
+					    TSS_NVPUBLIC **slot,
+					    TPMI_RH_NV_INDEX nvIndex);
+static TPM_RC TSS_NvPublic_AddSlotForHandle(TSS_CONTEXT *tssContext,
+					    TSS_NVPUBLIC **slot,
 					    TPMI_RH_NV_INDEX nvIndex);
 #endif
 
@@ -644,8 +1602,11 @@ static TPM_RC TSS_Command_ChangeAuthProcessor(TSS_CONTEXT *tssContext,
 					      COMMAND_PARAMETERS *in);
 #endif	/* TPM_TSS_NOCRYPTO */
 
+static int TSS_Execute20_Retryable(TSS_CONTEXT *tssContext, TPM_RC rc);
+static void TSS_Execute20_Backoff(TSS_CONTEXT *tssContext, unsigned int delay);
+static const TSS_COMMAND_DESCRIPTOR *TSS_GetCommandDescriptor(TPM_CC commandCode);
 static TPM_RC TSS_Command_PreProcessor(TSS_CONTEXT *tssContext,
-				       TPM_CC commandCode,
+				       const TSS_COMMAND_DESCRIPTOR *descriptor,
 				       COMMAND_PARAMETERS *in,
 				       EXTRA_PARAMETERS *extra);
 static TPM_RC TSS_Response_PostProcessor(TSS_CONTEXT *tssContext,
@@ -669,13 +1630,30 @@ static TPM_RC TSS_HashToString(char *str, uint8_t *digest);
 #ifndef TPM_TSS_NORSA
 static TPM_RC TSS_RSA_Salt(TPM2B_DIGEST 		*salt,
 			   TPM2B_ENCRYPTED_SECRET	*encryptedSalt,
-			   TPMT_PUBLIC			*publicArea);
+			   TPMT_PUBLIC			*publicArea,
+			   void				*rsaKey);
 #endif /* TPM_TSS_NORSA */
+static TPM_RC TSS_SaltKey_Get(TSS_CONTEXT *tssContext,
+			      TSS_SALT_KEY **saltKey,
+			      TPM_HANDLE handle);
+static void TSS_SaltKey_Free(TSS_SALT_KEY *saltKey);
 #endif /* TPM_TSS_NOCRYPTO */
-extern int tssVerbose;
-extern int tssVverbose;
-extern int tssFirstCall;
+static void TSS_SaltKey_Invalidate(TSS_CONTEXT *tssContext,
+				   TPM_HANDLE handle,
+				   TPMT_PUBLIC *publicArea);
+
+/* TSS_Execute20() performs the complete TPM 2.0 command / response process by running the
+   prepare, submit, and complete phases in sequence.
 
+   If the TPM returns one of the tssRetryCodes warnings, the TPM did not execute the command and
+   did not roll the session nonces.  The phases are run again, up to tssRetryAttempts in all, with
+   an exponential backoff between attempts.  Each attempt prepares the command from the start, so
+   that nonceCaller is rolled and the HMACs and parameter encryption are recalculated.
+
+   With TPM_VIRTUALIZE, TPM_RC_OBJECT_MEMORY evicts an object, TPM_RC_SESSION_MEMORY saves a
+   session, and TPM_RC_CONTEXT_GAP refreshes the oldest saved session, and the command is run
+   again.  This is not counted as a retry, and TSS_Virtual_Recover() limits the number of reruns.
+*/
 
 TPM_RC TSS_Execute20(TSS_CONTEXT *tssContext,
 		     RESPONSE_PARAMETERS *out,
@@ -685,115 +1663,381 @@ TPM_RC TSS_Execute20(TSS_CONTEXT *tssContext,
 		     va_list ap)
 {
     TPM_RC		rc = 0;
+    unsigned int	attempt;
+    unsigned int	recoveries = 0;
+    unsigned int	delay = tssContext->tssRetryDelay;
+    va_list		apAttempt;
 	
+    for (attempt = 1 ; ; attempt++) {
+	rc = 0;
+	/* each attempt consumes the session varargs */
+	va_copy(apAttempt, ap);
+	if (rc == 0) {
+	    rc = TSS_Execute20_Prepare(tssContext, in, extra, commandCode, apAttempt);
+	}
+	va_end(apAttempt);
+	if (rc == 0) {
+	    rc = TSS_Execute20_Submit(tssContext);
+	}
+	if (rc == 0) {
+	    rc = TSS_Execute20_Complete(tssContext, out);
+	}
+	/* with virtualization, make room for the object or session and run the command again */
+	if ((rc != 0) && (TSS_Virtual_Recover(tssContext, rc, recoveries) == 0)) {
+	    if (tssVverbose) printf("TSS_Execute20: Command %08x rc %08x rerun after recovery\n",
+				    commandCode, rc);
+	    recoveries++;
+	    attempt--;		/* not a retry */
+	    continue;
+	}
+	if ((attempt >= tssContext->tssRetryAttempts) || !TSS_Execute20_Retryable(tssContext, rc)) {
+	    break;
+	}
+	if (tssVerbose) printf("TSS_Execute20: Command %08x rc %08x, retry %u after %u msec\n",
+			       commandCode, rc, attempt, delay);
+	TSS_Execute20_Backoff(tssContext, delay);
+	delay *= 2;
+    }
+    return rc;
+}
+
+/* TSS_Execute20_Retryable() returns TRUE if rc is a TPM warning selected by tssRetryCodes */
+
+static int TSS_Execute20_Retryable(TSS_CONTEXT *tssContext, TPM_RC rc)
+{
+    unsigned int code;
+
+    switch (rc) {
+      case TPM_RC_RETRY:
+	code = TSS_RETRY_RETRY;
+	break;
+      case TPM_RC_YIELDED:
+	code = TSS_RETRY_YIELDED;
+	break;
+      case TPM_RC_TESTING:
+	code = TSS_RETRY_TESTING;
+	break;
+      case TPM_RC_NV_RATE:
+	code = TSS_RETRY_NV_RATE;
+	break;
+      default:
+	code = 0;
+    }
+    return (tssContext->tssRetryCodes & code) != 0;
+}
+
+/* TSS_Execute20_Backoff() waits a random time between half and all of 'delay' milliseconds.  The
+   jitter keeps clients that hit the same busy TPM from retrying together.
+*/
+
+static void TSS_Execute20_Backoff(TSS_CONTEXT *tssContext, unsigned int delay)
+{
+    uint32_t 	x = tssContext->tssRetryJitter;
+
+    /* xorshift32, not for cryptographic use */
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tssContext->tssRetryJitter = x;
+    delay = (delay / 2) + (x % ((delay / 2) + 1));
+#if !defined(__ULTRAVISOR__) && !defined(TPM_SKIBOOT)
+#ifdef TPM_POSIX
+    {
+	struct timespec ts;
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = (long)(delay % 1000) * 1000000;
+	while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR));
+    }
+#endif
+#ifdef TPM_WINDOWS
+    Sleep(delay);
+#endif
+#endif
+    return;
+}
+
+/* TSS_Execute20_Prepare() runs the command pre-processor, marshals the command, and adds the
+   authorizations, leaving an authorized command packet in the TSS authorization context.
+
+   varargs are TPMI_SH_AUTH_SESSION sessionHandle, const char *password, unsigned int
+   sessionAttributes, terminated with sessionHandle TPM_RH_NULL.
+
+   'in' and 'extra' are retained and must remain valid until TSS_Execute20_Complete() returns.
+*/
+
+TPM_RC TSS_Execute20_Prepare(TSS_CONTEXT *tssContext,
+			     COMMAND_PARAMETERS *in,
+			     EXTRA_PARAMETERS *extra,
+			     TPM_CC commandCode,
+			     va_list ap)
+{
+    TPM_RC		rc = 0;
+    TSS_EXECUTE_STATE 	*state = &tssContext->tssExecuteState;
+    uint64_t 		statsStart;
+
+    /* only one command can be in progress per TSS context */
+    if (rc == 0) {
+	if (state->phase != TSS_EXECUTE_IDLE) {
+	    if (tssVerbose) printf("TSS_Execute20_Prepare: Error, command %08x in progress\n",
+				   state->commandCode);
+	    rc = TSS_RC_COMMAND_PENDING;
+	}
+    }
+    if (rc == 0) {
+	state->commandCode = commandCode;
+	state->in = in;
+	state->extra = extra;
+    }
+    /* index from the command code to the command table */
+    if (rc == 0) {
+	state->descriptor = TSS_GetCommandDescriptor(commandCode);
+	if (state->descriptor == NULL) {
+	    if (tssVerbose) printf("TSS_Execute20_Prepare: "
+				   "commandCode %08x not found in command table\n",
+				   commandCode);
+	    rc = TSS_RC_COMMAND_UNIMPLEMENTED;
+	}
+    }
+    /* release any per command memory left by an earlier failure */
+    if (rc == 0) {
+	TSS_Scratch_Reset(tssContext);
+    }
     /* create a TSS authorization context */
     if (rc == 0) {
 	TSS_InitAuthContext(tssContext->tssAuthContext);
     }
     /* handle any command specific command pre-processing */
     if (rc == 0) {
+	statsStart = TSS_Stats_Start(tssContext);
 	rc = TSS_Command_PreProcessor(tssContext,
-				      commandCode,
+				      state->descriptor,
 				      in,
 				      extra);
+	TSS_Stats_End(tssContext, TSS_PHASE_PREPROCESS, statsStart);
+    }
+    /* marshal input parameters, optionally unmarshaling into scratch memory to validate them */
+    if (rc == 0) {
+	COMMAND_PARAMETERS *target = NULL;
+	int validate = (tssContext->tssValidateInput == TSS_VALIDATE_ALWAYS) ||
+		       ((tssContext->tssValidateInput == TSS_VALIDATE_TRACE) && tssVverbose);
+	if (tssVverbose) printf("TSS_Execute20_Prepare: Command %08x marshal\n", commandCode);
+	if (validate && (state->descriptor->unmarshalInFunction != NULL)) {
+	    rc = TSS_Scratch_Alloc(tssContext, (void **)&target, sizeof(COMMAND_PARAMETERS));
+	}
+	if (rc == 0) {
+	    statsStart = TSS_Stats_Start(tssContext);
+	    rc = TSS_Marshal(tssContext->tssAuthContext,
+			     in,
+			     state->descriptor,
+			     target);
+	    TSS_Stats_End(tssContext, TSS_PHASE_MARSHAL, statsStart);
+	}
+    }
+    /* add the command authorizations */
+    if (rc == 0) {
+	rc = TSS_Execute_Authorize(tssContext, ap);
+    }
+    /* load evicted objects and sessions and replace virtual handles with TPM handles */
+    if (rc == 0) {
+	rc = TSS_Virtual_Command(tssContext);
+    }
+    if (rc == 0) {
+	state->phase = TSS_EXECUTE_PREPARED;
+    }
+    else {
+	TSS_Execute20_Cleanup(tssContext);
+    }
+    return rc;
+}
+
+/* TSS_Execute20_Submit() transmits the command packet built by TSS_Execute20_Prepare().  It does
+   not wait for the response. */
+
+TPM_RC TSS_Execute20_Submit(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+    TSS_EXECUTE_STATE 	*state = &tssContext->tssExecuteState;
+    uint64_t 		statsStart;
+
+    if (rc == 0) {
+	if (state->phase != TSS_EXECUTE_PREPARED) {
+	    if (tssVerbose) printf("TSS_Execute20_Submit: Error, no prepared command\n");
+	    rc = TSS_RC_COMMAND_PENDING;
+	}
     }
-    /* marshal input parameters */
+    /* Step 8: process the command, send */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute20: Command %08x marshal\n", commandCode);
-	rc = TSS_Marshal(tssContext->tssAuthContext,
-			 in,
-			 commandCode);
+	if (tssVverbose) printf("TSS_Execute20_Submit: Step 8: submit the command\n");
+	statsStart = TSS_Stats_Start(tssContext);
+	rc = TSS_AuthSubmit(tssContext);
+	TSS_Stats_End(tssContext, TSS_PHASE_TRANSMIT, statsStart);
+	if (rc == 0) {
+	    state->phase = TSS_EXECUTE_SUBMITTED;
+	}
+	else {
+	    TSS_Execute20_Cleanup(tssContext);
+	}
     }
-    /* execute the command */
+    return rc;
+}
+
+/* TSS_Execute20_Complete() receives the response to the command transmitted by
+   TSS_Execute20_Submit(), validates the response authorizations, decrypts and unmarshals the
+   response parameters, and runs the response post-processor.
+
+   Normally returns the TPM response code.
+*/
+
+TPM_RC TSS_Execute20_Complete(TSS_CONTEXT *tssContext,
+			      RESPONSE_PARAMETERS *out)
+{
+    TPM_RC		rc = 0;
+    TSS_EXECUTE_STATE 	*state = &tssContext->tssExecuteState;
+    uint64_t 		statsStart;
+
+    if (rc == 0) {
+	if (state->phase != TSS_EXECUTE_SUBMITTED) {
+	    if (tssVerbose) printf("TSS_Execute20_Complete: Error, no submitted command\n");
+	    rc = TSS_RC_COMMAND_PENDING;
+	}
+    }
+    /* Step 8: process the command, receive.  Normally returns the TPM response code. */
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_Execute20_Complete: Step 8: receive the response\n");
+	statsStart = TSS_Stats_Start(tssContext);
+	rc = TSS_AuthReceive(tssContext);
+	TSS_Stats_End(tssContext, TSS_PHASE_TRANSMIT, statsStart);
+    }
+    /* verify the response authorizations and decrypt the response parameters */
     if (rc == 0) {
-	rc = TSS_Execute_valist(tssContext, in, ap);
+	rc = TSS_Execute_Verify(tssContext);
+    }
+    /* the sessions are no longer needed */
+    if (state->phase != TSS_EXECUTE_IDLE) {
+	TSS_Execute20_Cleanup(tssContext);
+    }
+    /* replace a TPM object handle with a virtual handle */
+    if (rc == 0) {
+	rc = TSS_Virtual_Response(tssContext);
     }
     /* unmarshal the response parameters */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute20: Command %08x unmarshal\n", commandCode);
+	if (tssVverbose) printf("TSS_Execute20_Complete: Command %08x unmarshal\n",
+				state->commandCode);
+	statsStart = TSS_Stats_Start(tssContext);
 	rc = TSS_Unmarshal(tssContext->tssAuthContext, out);
+	TSS_Stats_End(tssContext, TSS_PHASE_UNMARSHAL, statsStart);
     }
     /* handle any command specific response post-processing */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute20: Command %08x post processor\n", commandCode);
+	if (tssVverbose) printf("TSS_Execute20_Complete: Command %08x post processor\n",
+				state->commandCode);
+	statsStart = TSS_Stats_Start(tssContext);
 	rc = TSS_Response_PostProcessor(tssContext,
-					in,
+					state->in,
 					out,
-					extra);
+					state->extra);
+	TSS_Stats_End(tssContext, TSS_PHASE_POSTPROCESS, statsStart);
     }
     return rc;
 }
 
-/* TSS_Execute_valist() transmits the marshaled command and receives the marshaled response.
+/* TSS_Execute20_Cleanup() releases the per command session state and returns the context to the
+   idle phase.  It is safe to call when no command is in progress. */
+
+void TSS_Execute20_Cleanup(TSS_CONTEXT *tssContext)
+{
+    TSS_EXECUTE_STATE 	*state = &tssContext->tssExecuteState;
+    size_t		i;
+
+    for (i = 0 ; i < MAX_SESSION_NUM ; i++) {
+	TSS_HmacSession_FreeContext(state->session[i]);
+	state->session[i] = NULL;
+	state->authCommand[i] = NULL;
+	state->authResponse[i] = NULL;
+	state->names[i] = NULL;
+    }
+    /* release the per command memory, erasing any secrets */
+    TSS_Scratch_Reset(tssContext);
+    state->phase = TSS_EXECUTE_IDLE;
+    return;
+}
+
+/* TSS_Execute20_ScratchSize() returns the size of the scratch arena needed by one command:
+
+   per session, the authorization command and response, the handle name, and the session context
+   a session context for a post processor
+   the command parameter validation unmarshal target
+   the object public area marshal buffer for a post processor Name calculation
+*/
+
+size_t TSS_Execute20_ScratchSize(void)
+{
+    size_t size = 0;
+
+    size += MAX_SESSION_NUM * (TSS_SCRATCH_ROUND(sizeof(TPMS_AUTH_COMMAND)) +
+			       TSS_SCRATCH_ROUND(sizeof(TPMS_AUTH_RESPONSE)) +
+			       TSS_SCRATCH_ROUND(sizeof(TPM2B_NAME)) +
+			       TSS_SCRATCH_ROUND(sizeof(TSS_HMAC_CONTEXT)));
+    size += TSS_SCRATCH_ROUND(sizeof(TSS_HMAC_CONTEXT));
+    size += TSS_SCRATCH_ROUND(sizeof(COMMAND_PARAMETERS));
+    size += TSS_SCRATCH_ROUND(MAX_RESPONSE_SIZE);
+    return size;
+}
+
+/* TSS_Execute_Authorize() adds the command authorizations to the marshaled command.
 
    varargs are TPMI_SH_AUTH_SESSION sessionHandle, const char *password, unsigned int
    sessionAttributes
 
    Terminates with sessionHandle TPM_RH_NULL
 
-   Processes up to MAX_SESSION_NUM sessions.  It handles HMAC generation and command and response
-   parameter encryption.  It loads each session context, rolls nonces, and saves or deletes the
-   session context.
+   Processes up to MAX_SESSION_NUM sessions.  It handles HMAC generation and command parameter
+   encryption.  It loads each session context and rolls nonceCaller.  The session contexts are
+   retained in the TSS context for TSS_Execute_Verify().
 */
 
-static TPM_RC TSS_Execute_valist(TSS_CONTEXT *tssContext,
-				 COMMAND_PARAMETERS *in,
-				 va_list ap)
+static TPM_RC TSS_Execute_Authorize(TSS_CONTEXT *tssContext,
+				    va_list ap)
 {
     TPM_RC		rc = 0;
     int 		done;
     int 		haveNames = FALSE;	/* names are common to all HMAC sessions */
     size_t		i = 0;
-
-    /* the vararg parameters */
-    TPMI_SH_AUTH_SESSION sessionHandle[MAX_SESSION_NUM];
-    const char 		*password[MAX_SESSION_NUM];
-    unsigned int	sessionAttributes[MAX_SESSION_NUM]; 
-
-    /* structures filled in */
-    TPMS_AUTH_COMMAND 	*authCommand[MAX_SESSION_NUM];
-    TPMS_AUTH_RESPONSE 	*authResponse[MAX_SESSION_NUM];
-    
-    /* pointer to the above structures as used */
-    TPMS_AUTH_COMMAND 	*authC[MAX_SESSION_NUM];
-    TPMS_AUTH_RESPONSE 	*authR[MAX_SESSION_NUM];
-
-    /* TSS sessions */
-    struct TSS_HMAC_CONTEXT *session[MAX_SESSION_NUM];
-    TPM2B_NAME *names[MAX_SESSION_NUM];
-	
+    TSS_EXECUTE_STATE 	*state = &tssContext->tssExecuteState;
+    uint64_t 		statsStart;
     
     for (i = 0 ; i < MAX_SESSION_NUM ; i++) {
-	authCommand[i] = NULL;		/* for safe free */
-	authResponse[i] = NULL;		/* for safe free */
- 	names[i] = NULL;		/* for safe free */
-	authC[i] = NULL;		/* array of TPMS_AUTH_COMMAND structures, NULL for
+	state->authCommand[i] = NULL;
+	state->authResponse[i] = NULL;
+ 	state->names[i] = NULL;
+	state->authC[i] = NULL;		/* array of TPMS_AUTH_COMMAND structures, NULL for
 					   TSS_SetCmdAuths */
-	authR[i] = NULL;		/* array of TPMS_AUTH_RESPONSE structures, NULL for
+	state->authR[i] = NULL;		/* array of TPMS_AUTH_RESPONSE structures, NULL for
 					   TSS_GetRspAuths */
-	session[i] = NULL;		/* for free, used for HMAC and encrypt/decrypt sessions */
+	state->session[i] = NULL;	/* for free, used for HMAC and encrypt/decrypt sessions */
 	/* the varargs list inputs */
-	sessionHandle[i] = TPM_RH_NULL;
-	password[i] = NULL;
-	sessionAttributes[i] = 0;
+	state->sessionHandle[i] = TPM_RH_NULL;
+	state->password[i] = NULL;
+	state->sessionAttributes[i] = 0;
     }
     /* Step 1: initialization */
-    if (tssVverbose) printf("TSS_Execute_valist: Step 1: initialization\n");
+    if (tssVverbose) printf("TSS_Execute_Authorize: Step 1: initialization\n");
     for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) ; i++) {
 	if (rc == 0) {
-	    rc = TSS_Malloc((unsigned char **)&authCommand[i],	/* freed @1 */
-			    sizeof(TPMS_AUTH_COMMAND));
+	    rc = TSS_Scratch_Alloc(tssContext, (void **)&state->authCommand[i],
+				   sizeof(TPMS_AUTH_COMMAND));
 	}
 	if (rc == 0) {
-	    rc = TSS_Malloc((unsigned char **)&authResponse[i],	/* freed @2 */
-			    sizeof(TPMS_AUTH_RESPONSE));
+	    rc = TSS_Scratch_Alloc(tssContext, (void **)&state->authResponse[i],
+				   sizeof(TPMS_AUTH_RESPONSE));
 	}
 	if (rc == 0) {
-	    rc = TSS_Malloc((unsigned char **)&names[i],	/* freed @3 */
-			    sizeof(TPM2B_NAME));
+	    rc = TSS_Scratch_Alloc(tssContext, (void **)&state->names[i],
+				   sizeof(TPM2B_NAME));
 	}
 	if (rc == 0) {
-	    names[i]->b.size = 0;	/* to ignore unused names in cpHash calculation */
+	    state->names[i]->b.size = 0;	/* to ignore unused names in cpHash calculation */
 	}
     }
     /* Step 2: gather the command authorizations
@@ -803,152 +2047,186 @@ static TPM_RC TSS_Execute_valist(TSS_CONTEXT *tssContext,
     */
     done = FALSE;
     for (i = 0 ; (rc == 0) && !done && (i < MAX_SESSION_NUM) ; i++) {
- 	sessionHandle[i] = va_arg(ap, TPMI_SH_AUTH_SESSION);	/* first vararg is the session
-								   handle */
-	password[i]= va_arg(ap, const char *);			/* second vararg is the password */
-	sessionAttributes[i] = va_arg(ap, unsigned int);	/* third argument is
+ 	state->sessionHandle[i] = va_arg(ap, TPMI_SH_AUTH_SESSION);	/* first vararg is the
+									   session handle */
+	state->password[i]= va_arg(ap, const char *);		/* second vararg is the password */
+	state->sessionAttributes[i] = va_arg(ap, unsigned int);	/* third argument is
 								   sessionAttributes */
-	sessionAttributes[i] &= 0xff;				/* is uint8_t */
+	state->sessionAttributes[i] &= 0xff;			/* is uint8_t */
 
-	if (sessionHandle[i] != TPM_RH_NULL) {			/* varargs termination value */ 
+	if (state->sessionHandle[i] != TPM_RH_NULL) {		/* varargs termination value */ 
 
-	    if (tssVverbose) printf("TSS_Execute_valist: Step 2: authorization %u\n",
+	    if (tssVverbose) printf("TSS_Execute_Authorize: Step 2: authorization %u\n",
 				    (unsigned int)i);
-	    if (tssVverbose) printf("TSS_Execute_valist: session %u handle %08x\n",
-				    (unsigned int)i, sessionHandle[i]);
+	    if (tssVverbose) printf("TSS_Execute_Authorize: session %u handle %08x\n",
+				    (unsigned int)i, state->sessionHandle[i]);
 	    /* make used, non-NULL for command and response varargs */
-	    authC[i] = authCommand[i];
-	    authR[i] = authResponse[i];
+	    state->authC[i] = state->authCommand[i];
+	    state->authR[i] = state->authResponse[i];
 
 	    /* if password session, populate authC with password, etc. immediately */
-	    if (sessionHandle[i] == TPM_RS_PW) {
-		rc = TSS_PwapSession_Set(authC[i], password[i]);
+	    if (state->sessionHandle[i] == TPM_RS_PW) {
+		rc = TSS_PwapSession_Set(state->authC[i], state->password[i]);
 	    }
 	    /* if HMAC or encrypt/decrypt session  */
 	    else {
 		/* if there is at least one HMAC session, get the names corresponding to the
 		   handles */
 		if ((rc == 0) && !haveNames) {
-		    rc = TSS_Name_GetAllNames(tssContext, names);
+		    statsStart = TSS_Stats_Start(tssContext);
+		    rc = TSS_Name_GetAllNames(tssContext, state->names);
+		    TSS_Stats_End(tssContext, TSS_PHASE_NAMES, statsStart);
 		    haveNames = TRUE;	/* get only once, minor optimization */
 		}
+		statsStart = TSS_Stats_Start(tssContext);
 		/* initialize a TSS HMAC session */
 		if (rc == 0) {
-		    rc = TSS_HmacSession_GetContext(&session[i]);
+		    rc = TSS_HmacSession_GetContext(tssContext, &state->session[i]);
 		}
 		/* load the session created by startauthsession */
 		if (rc == 0) {
-		    rc = TSS_HmacSession_LoadSession(tssContext, session[i], sessionHandle[i]);
+		    rc = TSS_HmacSession_LoadSession(tssContext, state->session[i],
+						     state->sessionHandle[i]);
 		}
+		TSS_Stats_End(tssContext, TSS_PHASE_SESSION_LOAD, statsStart);
 	    }
 	}
 	else {
 	    done = TRUE;
 	}
     }
+    statsStart = haveNames ? TSS_Stats_Start(tssContext) : 0;
     /* Step 3: Roll nonceCaller, save in the session context for the response */
-    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) && (sessionHandle[i] != TPM_RH_NULL) ; i++) {
-	if (sessionHandle[i] != TPM_RS_PW) {		/* no nonce for password sessions */
+    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) &&
+	     (state->sessionHandle[i] != TPM_RH_NULL) ; i++) {
+	if (state->sessionHandle[i] != TPM_RS_PW) {	/* no nonce for password sessions */
 	    if (tssVverbose)
-		printf("TSS_Execute_valist: Step 3: nonceCaller %08x\n", sessionHandle[i]);
+		printf("TSS_Execute_Authorize: Step 3: nonceCaller %08x\n",
+		       state->sessionHandle[i]);
 #ifndef TPM_TSS_NOCRYPTO
-	    rc = TSS_HmacSession_SetNonceCaller(session[i], authC[i]);
+	    rc = TSS_HmacSession_SetNonceCaller(state->session[i], state->authC[i]);
 #else
-	    authC[i]->nonce.b.size = 16;
-	    memset(&authC[i]->nonce.b.buffer, 0, 16);
+	    state->authC[i]->nonce.b.size = 16;
+	    memset(&state->authC[i]->nonce.b.buffer, 0, 16);
 #endif	/* TPM_TSS_NOCRYPTO */
 	}
     }
     
 #ifndef TPM_TSS_NOCRYPTO
     /* Step 4: Calculate the HMAC key */
-    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) && (sessionHandle[i] != TPM_RH_NULL) ; i++) {
-	if (sessionHandle[i] != TPM_RS_PW) {		/* no HMAC key for password sessions */
-	    if (tssVverbose) printf("TSS_Execute_valist: Step 4: Session %u HMAC key for %08x\n",
-				    (unsigned int)i, sessionHandle[i]);
-	    rc = TSS_HmacSession_SetHmacKey(tssContext, session[i], i, password[i]);
+    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) &&
+	     (state->sessionHandle[i] != TPM_RH_NULL) ; i++) {
+	if (state->sessionHandle[i] != TPM_RS_PW) {	/* no HMAC key for password sessions */
+	    if (tssVverbose) printf("TSS_Execute_Authorize: Step 4: Session %u HMAC key for %08x\n",
+				    (unsigned int)i, state->sessionHandle[i]);
+	    rc = TSS_HmacSession_SetHmacKey(tssContext, state->session[i], i,
+					    state->password[i]);
 	}
     }
 #endif	/* TPM_TSS_NOCRYPTO */
+    TSS_Stats_End(tssContext, TSS_PHASE_HMAC, statsStart);
     /* Step 5: command parameter encryption */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute_valist: Step 5: command encrypt\n");
+	if (tssVverbose) printf("TSS_Execute_Authorize: Step 5: command encrypt\n");
+	statsStart = TSS_Execute_HasSessions(state, TPMA_SESSION_DECRYPT) ?
+		     TSS_Stats_Start(tssContext) : 0;
 	rc = TSS_Command_Decrypt(tssContext->tssAuthContext,
-				 session,
-				 sessionHandle,
-				 sessionAttributes);
+				 state->session,
+				 state->sessionHandle,
+				 state->sessionAttributes);
+	TSS_Stats_End(tssContext, TSS_PHASE_ENCRYPT, statsStart);
     }
+    statsStart = haveNames ? TSS_Stats_Start(tssContext) : 0;
     /* Step 6: for each HMAC session, calculate cpHash, calculate the HMAC, and set it in
        TPMS_AUTH_COMMAND */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute_valist: Step 6 calculate HMACs\n");
+	if (tssVverbose) printf("TSS_Execute_Authorize: Step 6 calculate HMACs\n");
 	rc = TSS_HmacSession_SetHMAC(tssContext->tssAuthContext,	/* TSS auth context */
-				     session,		/* TSS session contexts */
-				     authC,		/* output: command authorizations */
-				     sessionHandle,	/* list of session handles for the command */
-				     sessionAttributes, /* attributes for this command */
-				     password,		/* for plaintext password sessions */
-				     names[0],		/* Name */
-				     names[1],		/* Name */
-				     names[2]);		/* Name */
+				     state->session,	/* TSS session contexts */
+				     state->authC,	/* output: command authorizations */
+				     state->sessionHandle, /* list of session handles for the
+							      command */
+				     state->sessionAttributes, /* attributes for this command */
+				     state->password,	/* for plaintext password sessions */
+				     state->names[0],	/* Name */
+				     state->names[1],	/* Name */
+				     state->names[2]);	/* Name */
     }
     /* Step 7: set the command authorizations in the TSS command stream */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute_valist: Step 7 set command authorizations\n");
+	if (tssVverbose) printf("TSS_Execute_Authorize: Step 7 set command authorizations\n");
 	rc = TSS_SetCmdAuths(tssContext->tssAuthContext,
-			     authC[0],
-			     authC[1],
-			     authC[2],
+			     state->authC[0],
+			     state->authC[1],
+			     state->authC[2],
 			     NULL);
     }
-    /* Step 8: process the command.  Normally returns the TPM response code. */
-    if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute_valist: Step 8: process the command\n");
-	rc = TSS_AuthExecute(tssContext);
-    }
+    TSS_Stats_End(tssContext, TSS_PHASE_HMAC, statsStart);
+    return rc;
+}
+
+/* TSS_Execute_Verify() processes the response authorizations for the sessions gathered by
+   TSS_Execute_Authorize().
+
+   It validates the response HMAC, rolls nonceTPM, saves or deletes each session context, and
+   handles response parameter decryption.
+*/
+
+static TPM_RC TSS_Execute_Verify(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+    size_t		i = 0;
+    TSS_EXECUTE_STATE 	*state = &tssContext->tssExecuteState;
+    uint64_t 		statsStart;
+
+    statsStart = (state->sessionHandle[0] != TPM_RH_NULL) ? TSS_Stats_Start(tssContext) : 0;
     /* Step 9: get the response authorizations from the TSS response stream */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute_valist: Step 9 get response authorizations\n");
+	if (tssVverbose) printf("TSS_Execute_Verify: Step 9 get response authorizations\n");
 	rc = TSS_GetRspAuths(tssContext->tssAuthContext,
-			     authR[0],
-			     authR[1],
-			     authR[2],
+			     state->authR[0],
+			     state->authR[1],
+			     state->authR[2],
 			     NULL);
     }
     /* Step 10: process the response authorizations, validate the HMAC */
-    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) && (sessionHandle[i] != TPM_RH_NULL) ; i++) {
+    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) &&
+	     (state->sessionHandle[i] != TPM_RH_NULL) ; i++) {
 	if (tssVverbose)
-	    printf("TSS_Execute_valist: Step 10: process response authorization %08x\n",
-		   sessionHandle[i]);
-	if (sessionHandle[i] == TPM_RS_PW) {
-	    rc = TSS_PwapSession_Verify(authR[i]);
+	    printf("TSS_Execute_Verify: Step 10: process response authorization %08x\n",
+		   state->sessionHandle[i]);
+	if (state->sessionHandle[i] == TPM_RS_PW) {
+	    rc = TSS_PwapSession_Verify(state->authR[i]);
 	}
 	/* HMAC session */
 	else {
 #ifndef TPM_TSS_NOCRYPTO
 	    /* save nonceTPM in the session context */
 	    if (rc == 0) {
-		rc = TSS_TPM2B_Copy(&session[i]->nonceTPM.b, &authR[i]->nonce.b, sizeof(TPMU_HA));
+		rc = TSS_TPM2B_Copy(&state->session[i]->nonceTPM.b,
+				    &state->authR[i]->nonce.b, sizeof(TPMU_HA));
 	    }
 #endif	/* TPM_TSS_NOCRYPTO */
 	    /* the HMAC key is already part of the TSS session context.  For policy sessions with
 	       policy password, the response hmac is empty. */
-	    if ((session[i]->sessionType == TPM_SE_HMAC) ||
-		((session[i]->sessionType == TPM_SE_POLICY) && (session[i]->isAuthValueNeeded))) {
+	    if ((state->session[i]->sessionType == TPM_SE_HMAC) ||
+		((state->session[i]->sessionType == TPM_SE_POLICY) &&
+		 (state->session[i]->isAuthValueNeeded))) {
 #ifndef TPM_TSS_NOCRYPTO
 		if (rc == 0) {
-		    rc = TSS_Command_ChangeAuthProcessor(tssContext, session[i], i, in);
+		    rc = TSS_Command_ChangeAuthProcessor(tssContext, state->session[i], i,
+							 state->in);
 		}
 		if (rc == 0) {
 		    rc = TSS_HmacSession_Verify(tssContext->tssAuthContext, /* authorization
 									       context */
-						session[i],	/* TSS session context */
-						authR[i]);	/* input: response authorization */
+						state->session[i],	/* TSS session context */
+						state->authR[i]);	/* input: response
+									   authorization */
 		}
 #else
-		in = in;
 		if (tssVerbose)
-		    printf("TSS_Execute_valist: "
+		    printf("TSS_Execute_Verify: "
 			   "Error, HMAC verify with no crypto not implemented\n");
 		rc = TSS_RC_NOT_IMPLEMENTED;
 #endif	/* TPM_TSS_NOCRYPTO */
@@ -956,42 +2234,63 @@ static TPM_RC TSS_Execute_valist(TSS_CONTEXT *tssContext,
 	}
     }
     /* Step 11: process the audit flag */
-    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) && (sessionHandle[i] != TPM_RH_NULL) ; i++) {
-	if ((sessionHandle[i] != TPM_RS_PW) &&
-	    (session[i]->bind != TPM_RH_NULL) &&
-	    (authR[i]->sessionAttributes.val & TPMA_SESSION_AUDIT)) {
-	    if (tssVverbose) printf("TSS_Execute_valist: Step 11: process bind audit flag %08x\n",
-				    sessionHandle[i]);
+    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) &&
+	     (state->sessionHandle[i] != TPM_RH_NULL) ; i++) {
+	if ((state->sessionHandle[i] != TPM_RS_PW) &&
+	    (state->session[i]->bind != TPM_RH_NULL) &&
+	    (state->authR[i]->sessionAttributes.val & TPMA_SESSION_AUDIT)) {
+	    if (tssVverbose) printf("TSS_Execute_Verify: Step 11: process bind audit flag %08x\n",
+				    state->sessionHandle[i]);
 	    /* if bind audit session, bind value is lost and further use requires authValue */
-	    session[i]->bind = TPM_RH_NULL;
+	    state->session[i]->bind = TPM_RH_NULL;
 	}
     }
+    TSS_Stats_End(tssContext, TSS_PHASE_VERIFY, statsStart);
+    statsStart = TSS_Execute_HasSessions(state, 0) ? TSS_Stats_Start(tssContext) : 0;
     /* Step 12: process the response continue flag */
-    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) && (sessionHandle[i] != TPM_RH_NULL) ; i++) {
-	if (sessionHandle[i] != TPM_RS_PW) {
-	    if (tssVverbose) printf("TSS_Execute_valist: Step 12: process continue flag %08x\n",
-				    sessionHandle[i]);
-	    rc = TSS_HmacSession_Continue(tssContext, session[i], authR[i]);
+    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) &&
+	     (state->sessionHandle[i] != TPM_RH_NULL) ; i++) {
+	if (state->sessionHandle[i] != TPM_RS_PW) {
+	    if (tssVverbose) printf("TSS_Execute_Verify: Step 12: process continue flag %08x\n",
+				    state->sessionHandle[i]);
+	    rc = TSS_HmacSession_Continue(tssContext, state->session[i], state->authR[i]);
 	}
     }
+    TSS_Stats_End(tssContext, TSS_PHASE_SESSION_SAVE, statsStart);
     /* Step 13: response parameter decryption */
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Execute_valist: Step 13: response decryption\n");
+	if (tssVverbose) printf("TSS_Execute_Verify: Step 13: response decryption\n");
+	statsStart = TSS_Execute_HasSessions(state, TPMA_SESSION_ENCRYPT) ?
+		     TSS_Stats_Start(tssContext) : 0;
 	rc = TSS_Response_Encrypt(tssContext->tssAuthContext,
-				  session,
-				  sessionHandle,
-				  sessionAttributes);
-    }
-    /* cleanup */
-    for (i = 0 ; i < MAX_SESSION_NUM ; i++) {
-	TSS_HmacSession_FreeContext(session[i]);
-	free(authCommand[i]);		/* @1 */
- 	free(authResponse[i]);		/* @2 */
-	free(names[i]);			/* @3 */
+				  state->session,
+				  state->sessionHandle,
+				  state->sessionAttributes);
+	TSS_Stats_End(tssContext, TSS_PHASE_DECRYPT, statsStart);
     }
     return rc;
 }
 
+/* TSS_Execute_HasSessions() returns TRUE if the command in progress has an HMAC or policy session
+   and, if sessionAttributes is not 0, one of those sessions has one of the sessionAttributes.
+
+   It is used to time only the phases that do work for the command.
+*/
+
+static int TSS_Execute_HasSessions(const TSS_EXECUTE_STATE *state,
+				   unsigned int sessionAttributes)
+{
+    size_t	i;
+
+    for (i = 0 ; (i < MAX_SESSION_NUM) && (state->sessionHandle[i] != TPM_RH_NULL) ; i++) {
+	if ((state->sessionHandle[i] != TPM_RS_PW) &&
+	    ((sessionAttributes == 0) || (state->sessionAttributes[i] & sessionAttributes))) {
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
 /*
   PWAP - Password Session
 */
@@ -1053,12 +2352,16 @@ static TPM_RC TSS_PwapSession_Verify(TPMS_AUTH_RESPONSE *authResponse)
   HMAC Session
 */
 
-static TPM_RC TSS_HmacSession_GetContext(struct TSS_HMAC_CONTEXT **session)
+/* TSS_HmacSession_GetContext() allocates a session context from the scratch arena.  It is valid
+   for the duration of the command. */
+
+static TPM_RC TSS_HmacSession_GetContext(TSS_CONTEXT *tssContext,
+					 struct TSS_HMAC_CONTEXT **session)
 {
     TPM_RC rc = 0;
 
     if (rc == 0) {
-        rc = TSS_Malloc((uint8_t **)session, sizeof(TSS_HMAC_CONTEXT));
+        rc = TSS_Scratch_Alloc(tssContext, (void **)session, sizeof(TSS_HMAC_CONTEXT));
     }
     if (rc == 0) {
 	TSS_HmacSession_InitContext(*session);
@@ -1093,14 +2396,21 @@ static void TSS_HmacSession_InitContext(struct TSS_HMAC_CONTEXT *session)
 #ifndef TPM_TSS_NOCRYPTO
     memset(session->sessionValue.t.buffer, 0, sizeof(TPMU_HA) + sizeof(TPMU_HA));
     session->sessionValue.b.size = 0;
+    session->hmacKeyState = NULL;
+    session->sessionValueState = NULL;
 #endif
 }
 
+/* TSS_HmacSession_FreeContext() erases the secrets in a session context and frees the keyed HMAC
+   states.  The memory itself is released by the scratch arena reset. */
+
 void TSS_HmacSession_FreeContext(struct TSS_HMAC_CONTEXT *session)
 {
     if (session != NULL) {
+#ifndef TPM_TSS_NOCRYPTO
+	TSS_HmacSession_FreeKeyStates(session);
+#endif
 	TSS_HmacSession_InitContext(session);
-	free(session);
     }
     return;
 }
@@ -1180,6 +2490,9 @@ static TPM_RC TSS_HmacSession_SetSessionKey(TSS_CONTEXT *tssContext,
 
    The initial session from startauthsession
    The updated session a TPM response
+
+   For a TSS with file support, the session file is written unless the context session cache
+   defers the write.
 */
 
 
@@ -1190,9 +2503,7 @@ static TPM_RC TSS_HmacSession_SaveSession(TSS_CONTEXT *tssContext,
     uint8_t 	*buffer = NULL;		/* marshaled TSS_HMAC_CONTEXT */
     uint16_t	written = 0;
 #ifndef TPM_TSS_NOFILE
-    char	sessionFilename[TPM_DATA_DIR_PATH_LENGTH];
-    uint8_t *outBuffer = NULL;
-    uint32_t outLength;
+    int		writeFile = TRUE;
 #endif
     
     if (tssVverbose) printf("TSS_HmacSession_SaveSession: handle %08x\n", session->sessionHandle);
@@ -1203,12 +2514,135 @@ static TPM_RC TSS_HmacSession_SaveSession(TSS_CONTEXT *tssContext,
 				   (MarshalFunction_t)TSS_HmacSession_Marshal);
     }
 #ifndef TPM_TSS_NOFILE
+    if (rc == 0) {
+	if (tssContext->tssSessionCache != TSS_SESSION_CACHE_NONE) {
+	    TPM_RC rc1;
+	    int writeBack = (tssContext->tssSessionCache == TSS_SESSION_CACHE_WRITEBACK);
+	    rc1 = TSS_HmacSession_CacheStore(tssContext,
+					     session->sessionHandle,
+					     written, buffer,
+					     writeBack);
+	    /* if the cache is full, fall back to the session file */
+	    writeFile = !writeBack || (rc1 != 0);
+	}
+	/* a stale entry remains if the policy was changed after the session was cached */
+	else {
+	    TSS_HmacSession_CacheRemove(tssContext, session->sessionHandle);
+	}
+    }
+    if ((rc == 0) && writeFile) {
+	rc = TSS_HmacSession_WriteFile(tssContext,
+				       session->sessionHandle,
+				       written, buffer);
+    }
+    if ((rc == 0) && writeFile) {
+	TSS_HmacSession_CacheWritten(tssContext, session->sessionHandle);
+    }
+#else		/* no file support, save to context */
+    if (rc == 0) {
+	rc = TSS_HmacSession_SaveData(tssContext,
+				      session->sessionHandle,
+				      written, buffer);
+    }
+#endif
+    free(buffer);	/* @1 */
+    return rc;
+}
+
+/* TSS_HmacSession_LoadSession() loads an existing HMAC session context saved by:
+
+   startauthsession
+   an update after a TPM response
+
+   For a TSS with file support, the session is loaded from the context session cache if present,
+   and otherwise from the session file.
+*/
+
+static TPM_RC TSS_HmacSession_LoadSession(TSS_CONTEXT *tssContext,
+					  struct TSS_HMAC_CONTEXT *session,
+					  TPMI_SH_AUTH_SESSION	sessionHandle)
+{
+    TPM_RC		rc = 0;
+    uint8_t 		*buffer1 = NULL;
+#ifndef TPM_TSS_NOFILE
+    uint8_t 		*buffer = NULL;		/* session file plaintext */
+    size_t		slotIndex;
+#endif    
+    unsigned char 	*inData = NULL;		/* output */
+    uint32_t 		inLength;		/* output */
+
+    if (tssVverbose) printf("TSS_HmacSession_LoadSession: handle %08x\n", sessionHandle);
+#ifndef TPM_TSS_NOFILE
+    if (rc == 0) {
+	/* use the cached session if present */
+	if (TSS_HmacSession_CacheGetSlot(tssContext, &slotIndex, sessionHandle) == 0) {
+	    inLength = tssContext->sessionCache[slotIndex].sessionDataLength;
+	    inData = tssContext->sessionCache[slotIndex].sessionData;
+	}
+	else {
+	    rc = TSS_HmacSession_ReadFile(tssContext,
+					  &buffer,	/* freed @1 */
+					  &inLength,
+					  sessionHandle);
+	    if (rc == 0) {
+		inData = buffer;
+		/* cache the session for the next command.  A full cache is not an error. */
+		if (tssContext->tssSessionCache != TSS_SESSION_CACHE_NONE) {
+		    if (TSS_HmacSession_CacheStore(tssContext, sessionHandle,
+						   (uint16_t)inLength, inData, FALSE) == 0) {
+			TSS_HmacSession_CacheWritten(tssContext, sessionHandle);
+		    }
+		}
+	    }
+	}
+    }
+#else		/* no file support, load from context */
+    if (rc == 0) {
+	rc = TSS_HmacSession_LoadData(tssContext,
+				      &inLength, &inData,
+				      sessionHandle);
+    }
+#endif
+    if (rc == 0) {
+	uint32_t ilength = inLength;
+	buffer1 = inData;
+	rc = TSS_HmacSession_Unmarshal(session, &buffer1, &ilength);
+    }
+#ifndef TPM_TSS_NOFILE
+    if (buffer != NULL) {
+	/* erase any secrets */
+	memset(buffer, 0, inLength);
+	free(buffer);	/* @1 */
+    }
+#endif
+    return rc;
+}
+
+#ifndef TPM_TSS_NOFILE
+
+/* TSS_HmacSession_WriteFile() writes the marshaled session to the session file, encrypting it if
+   the context property is set.
+
+   The session is saved in a hard coded file name hxxxxxxxx.bin where xxxxxxxx is the session
+   handle.
+*/
+
+static TPM_RC TSS_HmacSession_WriteFile(TSS_CONTEXT *tssContext,
+					TPMI_SH_AUTH_SESSION sessionHandle,
+					uint16_t written,
+					uint8_t *buffer)
+{
+    TPM_RC	rc = 0;
+    char	sessionFilename[TPM_DATA_DIR_PATH_LENGTH];
+    uint8_t 	*outBuffer = NULL;
+    uint32_t 	outLength;
+
     if (rc == 0) {
 #ifndef TPM_TSS_NOCRYPTO
 	/* if the flag is set, encrypt the session state before store */
 	if (tssContext->tssEncryptSessions) {
 	    rc = TSS_AES_Encrypt(tssContext->tssSessionEncKey,
-				 &outBuffer,   	/* output, freed @2 */
+				 &outBuffer,   	/* output, freed @1 */
 				 &outLength,	/* output */
 				 buffer,	/* input */
 				 written);	/* input */
@@ -1222,11 +2656,9 @@ static TPM_RC TSS_HmacSession_SaveSession(TSS_CONTEXT *tssContext,
 	}
 #endif	/* TPM_TSS_NOCRYPTO */
     }
-    /* save the session in a hard coded file name hxxxxxxxx.bin where xxxxxxxx is the session
-       handle */
     if (rc == 0) {
 	sprintf(sessionFilename, "%s/h%08x.bin",
-		tssContext->tssDataDirectory, session->sessionHandle);
+		tssContext->tssDataDirectory, sessionHandle);
     }
     if (rc == 0) {
 	rc = TSS_File_WriteBinaryFile(outBuffer,
@@ -1234,41 +2666,25 @@ static TPM_RC TSS_HmacSession_SaveSession(TSS_CONTEXT *tssContext,
 				      sessionFilename);
     }
     if (tssContext->tssEncryptSessions) {
-	free(outBuffer);	/* @2 */
-    }
-#else		/* no file support, save to context */
-    if (rc == 0) {
-	rc = TSS_HmacSession_SaveData(tssContext,
-				      session->sessionHandle,
-				      written, buffer);
+	free(outBuffer);	/* @1 */
     }
-#endif
-    free(buffer);	/* @1 */
     return rc;
 }
 
-/* TSS_HmacSession_LoadSession() loads an existing HMAC session context saved by:
-
-   startauthsession
-   an update after a TPM response
+/* TSS_HmacSession_ReadFile() reads the session file, decrypting it if the context property is
+   set.  It returns the marshaled session in an allocated buffer that the caller must free.
 */
 
-static TPM_RC TSS_HmacSession_LoadSession(TSS_CONTEXT *tssContext,
-					  struct TSS_HMAC_CONTEXT *session,
-					  TPMI_SH_AUTH_SESSION	sessionHandle)
+static TPM_RC TSS_HmacSession_ReadFile(TSS_CONTEXT *tssContext,
+				       uint8_t **inData,		/* freed by caller */
+				       uint32_t *inLength,
+				       TPMI_SH_AUTH_SESSION sessionHandle)
 {
     TPM_RC		rc = 0;
     uint8_t 		*buffer = NULL;
-    uint8_t 		*buffer1 = NULL;
-#ifndef TPM_TSS_NOFILE
     size_t 		length = 0;
     char		sessionFilename[TPM_DATA_DIR_PATH_LENGTH];
-#endif    
-    unsigned char 	*inData = NULL;		/* output */
-    uint32_t 		inLength;		/* output */
 
-    if (tssVverbose) printf("TSS_HmacSession_LoadSession: handle %08x\n", sessionHandle);
-#ifndef TPM_TSS_NOFILE
     /* load the session from a hard coded file name hxxxxxxxx.bin where xxxxxxxx is the session
        handle */
     if (rc == 0) {
@@ -1282,41 +2698,189 @@ static TPM_RC TSS_HmacSession_LoadSession(TSS_CONTEXT *tssContext,
 	/* if the flag is set, decrypt the session state before unmarshal */
 	if (tssContext->tssEncryptSessions) {
 	    rc = TSS_AES_Decrypt(tssContext->tssSessionDecKey,
-				 &inData,   	/* output, freed @2 */
-				 &inLength,	/* output */
+				 inData,   	/* output, freed by caller */
+				 inLength,	/* output */
 				 buffer,	/* input */
 				 length);	/* input */
+	    free(buffer);	/* @1 */
 	}
 	/* else the session was loaded in plaintext */
 	else {
 #endif	/* TPM_TSS_NOCRYPTO */
-	    inData = buffer;
-	    inLength = length;
+	    *inData = buffer;	/* freed by caller */
+	    *inLength = length;
 #ifndef TPM_TSS_NOCRYPTO
 	}
 #endif	/* TPM_TSS_NOCRYPTO */
     }
-#else		/* no file support, load from context */
+    return rc;
+}
+
+/* TSS_HmacSession_CacheStore() stores the marshaled session in the context session cache,
+   replacing any previous entry for the handle.
+
+   'dirty' is TRUE if the session file will not be written, making it out of date.
+
+   Returns non-zero if the cache is full.
+*/
+
+static TPM_RC TSS_HmacSession_CacheStore(TSS_CONTEXT *tssContext,
+					 TPMI_SH_AUTH_SESSION sessionHandle,
+					 uint16_t length,
+					 uint8_t *data,
+					 int dirty)
+{
+    TPM_RC	rc = 0;
+    size_t	slotIndex;
+    int		newSlot = FALSE;
+
+    /* if this handle is already cached, overwrite the slot */
     if (rc == 0) {
-	rc = TSS_HmacSession_LoadData(tssContext,
-				      &inLength, &inData,
-				      sessionHandle);
+	rc = TSS_HmacSession_CacheGetSlot(tssContext, &slotIndex, sessionHandle);
+	if (rc != 0) {
+	    rc = TSS_HmacSession_CacheGetSlot(tssContext, &slotIndex, TPM_RH_NULL);
+	    newSlot = TRUE;
+	    if ((rc != 0) && tssVverbose) {
+		printf("TSS_HmacSession_CacheStore: no cache slot available for handle %08x\n",
+		       sessionHandle);
+	    }
+	}
+    }
+    /* the new data is typically the same length, but erase any secrets before reallocating */
+    if ((rc == 0) && !newSlot) {
+	memset(tssContext->sessionCache[slotIndex].sessionData, 0,
+	       tssContext->sessionCache[slotIndex].sessionDataLength);
     }
-#endif
     if (rc == 0) {
-	uint32_t ilength = inLength;
-	buffer1 = inData;
-	rc = TSS_HmacSession_Unmarshal(session, &buffer1, &ilength);
+	rc = TSS_Realloc(&tssContext->sessionCache[slotIndex].sessionData, length);
     }
-#ifndef TPM_TSS_NOFILE
-    if (tssContext->tssEncryptSessions) {
-	free(inData);	/* @2 */
+    if (rc == 0) {
+	if (newSlot) {
+	    tssContext->sessionCache[slotIndex].sessionHandle = sessionHandle;
+	    tssContext->sessionCache[slotIndex].inFile = FALSE;
+	}
+	tssContext->sessionCache[slotIndex].sessionDataLength = length;
+	tssContext->sessionCache[slotIndex].dirty = dirty;
+	memcpy(tssContext->sessionCache[slotIndex].sessionData, data, length);
     }
-#endif
-    free(buffer);	/* @1 */
     return rc;
 }
 
+/* TSS_HmacSession_CacheWritten() records that the session file for a cached session exists and is
+   up to date.
+*/
+
+static void TSS_HmacSession_CacheWritten(TSS_CONTEXT *tssContext,
+					 TPMI_SH_AUTH_SESSION sessionHandle)
+{
+    size_t	slotIndex;
+
+    if (TSS_HmacSession_CacheGetSlot(tssContext, &slotIndex, sessionHandle) == 0) {
+	tssContext->sessionCache[slotIndex].dirty = FALSE;
+	tssContext->sessionCache[slotIndex].inFile = TRUE;
+    }
+    return;
+}
+
+/* TSS_HmacSession_CacheRemove() removes a session from the context session cache without writing
+   the session file.
+
+   Returns TRUE if the session was cached and no session file was ever written for it.
+*/
+
+static int TSS_HmacSession_CacheRemove(TSS_CONTEXT *tssContext,
+				       TPMI_SH_AUTH_SESSION sessionHandle)
+{
+    int		noFile = FALSE;
+    size_t	slotIndex;
+
+    if (TSS_HmacSession_CacheGetSlot(tssContext, &slotIndex, sessionHandle) == 0) {
+	noFile = !tssContext->sessionCache[slotIndex].inFile;
+	tssContext->sessionCache[slotIndex].sessionHandle = TPM_RH_NULL;
+	/* erase any secrets */
+	memset(tssContext->sessionCache[slotIndex].sessionData, 0,
+	       tssContext->sessionCache[slotIndex].sessionDataLength);
+	free(tssContext->sessionCache[slotIndex].sessionData);
+	tssContext->sessionCache[slotIndex].sessionData = NULL;
+	tssContext->sessionCache[slotIndex].sessionDataLength = 0;
+	tssContext->sessionCache[slotIndex].dirty = FALSE;
+	tssContext->sessionCache[slotIndex].inFile = FALSE;
+    }
+    return noFile;
+}
+
+/* TSS_HmacSession_CacheGetSlot() finds the session cache slot corresponding to the session handle.
+
+   Returns non-zero if no slot is found.
+*/
+
+static TPM_RC TSS_HmacSession_CacheGetSlot(TSS_CONTEXT *tssContext,
+					   size_t *slotIndex,
+					   TPMI_SH_AUTH_SESSION sessionHandle)
+{
+    size_t 	i;
+
+    /* search all slots for handle */
+    for (i = 0 ; i < (sizeof(tssContext->sessionCache) / sizeof(TSS_SESSION_CACHE)) ; i++) {
+	if (tssContext->sessionCache[i].sessionHandle == sessionHandle) {
+	    *slotIndex = i;
+	    return 0;
+	}
+    }
+    return TSS_RC_NO_SESSION_SLOT;
+}
+
+/* TSS_HmacSession_CacheFlush() writes the session file for each cached session that is out of
+   date.  The sessions remain cached.
+
+   All sessions are attempted.  The first error is returned.
+*/
+
+TPM_RC TSS_HmacSession_CacheFlush(TSS_CONTEXT *tssContext)
+{
+    TPM_RC	rc = 0;
+    TPM_RC	rc1;
+    size_t 	i;
+
+    for (i = 0 ; i < (sizeof(tssContext->sessionCache) / sizeof(TSS_SESSION_CACHE)) ; i++) {
+	if ((tssContext->sessionCache[i].sessionHandle != TPM_RH_NULL) &&
+	    tssContext->sessionCache[i].dirty) {
+	    if (tssVverbose) printf("TSS_HmacSession_CacheFlush: handle %08x\n",
+				    tssContext->sessionCache[i].sessionHandle);
+	    rc1 = TSS_HmacSession_WriteFile(tssContext,
+					    tssContext->sessionCache[i].sessionHandle,
+					    tssContext->sessionCache[i].sessionDataLength,
+					    tssContext->sessionCache[i].sessionData);
+	    if (rc1 == 0) {
+		tssContext->sessionCache[i].dirty = FALSE;
+		tssContext->sessionCache[i].inFile = TRUE;
+	    }
+	    else if (rc == 0) {
+		rc = rc1;
+	    }
+	}
+    }
+    return rc;
+}
+
+/* TSS_HmacSession_CacheDelete() erases and frees all cached sessions without writing the session
+   files.
+*/
+
+void TSS_HmacSession_CacheDelete(TSS_CONTEXT *tssContext)
+{
+    size_t 	i;
+
+    for (i = 0 ; i < (sizeof(tssContext->sessionCache) / sizeof(TSS_SESSION_CACHE)) ; i++) {
+	if (tssContext->sessionCache[i].sessionHandle != TPM_RH_NULL) {
+	    TSS_HmacSession_CacheRemove(tssContext, tssContext->sessionCache[i].sessionHandle);
+	}
+    }
+    return;
+}
+
+#endif	/* TPM_TSS_NOFILE */
+
 #ifdef TPM_TSS_NOFILE
 
 static TPM_RC TSS_HmacSession_SaveData(TSS_CONTEXT *tssContext,
@@ -1325,30 +2889,24 @@ static TPM_RC TSS_HmacSession_SaveData(TSS_CONTEXT *tssContext,
 				       uint8_t *outBuffer)
 {
     TPM_RC	rc = 0;
-    size_t	slotIndex;
+    TSS_SESSIONS *slot = NULL;
 
     /* if this handle is already used, overwrite the slot */
     if (rc == 0) {
-	rc = TSS_HmacSession_GetSlotForHandle(tssContext, &slotIndex, sessionHandle);
+	rc = TSS_HandleTable_Add(&tssContext->sessions, (void **)&slot, sessionHandle);
 	if (rc != 0) {
-	    rc = TSS_HmacSession_GetSlotForHandle(tssContext, &slotIndex, TPM_RH_NULL);
-	    if (rc == 0) {
-		tssContext->sessions[slotIndex].sessionHandle = sessionHandle;
-	    }
-	    else {
-		if (tssVerbose)
-		    printf("TSS_HmacSession_SaveData: Error, no slot available for handle %08x\n",
-			   sessionHandle);
-	    }
+	    if (tssVerbose)
+		printf("TSS_HmacSession_SaveData: Error, no slot available for handle %08x\n",
+		       sessionHandle);
 	}
     }
     /* reallocate memory and adjust the size */
     if (rc == 0) {
-	rc = TSS_Realloc(&tssContext->sessions[slotIndex].sessionData, outLength);
+	rc = TSS_Realloc(&slot->sessionData, outLength);
     }
     if (rc == 0) {
-	tssContext->sessions[slotIndex].sessionDataLength = outLength;
-	memcpy(tssContext->sessions[slotIndex].sessionData, outBuffer, outLength);
+	slot->sessionDataLength = outLength;
+	memcpy(slot->sessionData, outBuffer, outLength);
     }
     return rc;
 }
@@ -1358,10 +2916,10 @@ static TPM_RC TSS_HmacSession_LoadData(TSS_CONTEXT *tssContext,
 				       TPMI_SH_AUTH_SESSION sessionHandle)
 {
     TPM_RC	rc = 0;
-    size_t	slotIndex;
+    TSS_SESSIONS *slot = NULL;
 
     if (rc == 0) {
-	rc = TSS_HmacSession_GetSlotForHandle(tssContext, &slotIndex, sessionHandle);
+	rc = TSS_HmacSession_GetSlotForHandle(tssContext, &slot, sessionHandle);
 	if (rc != 0) {
 	    if (tssVerbose)
 		printf("TSS_HmacSession_LoadData: Error, no slot found for handle %08x\n",
@@ -1369,8 +2927,8 @@ static TPM_RC TSS_HmacSession_LoadData(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	*inLength = tssContext->sessions[slotIndex].sessionDataLength;
-	*inData = tssContext->sessions[slotIndex].sessionData;
+	*inLength = slot->sessionDataLength;
+	*inData = slot->sessionData;
     }
     return rc;
 }
@@ -1379,10 +2937,10 @@ static TPM_RC TSS_HmacSession_DeleteData(TSS_CONTEXT *tssContext,
 					 TPMI_SH_AUTH_SESSION sessionHandle)
 {
     TPM_RC	rc = 0;
-    size_t	slotIndex;
+    TSS_SESSIONS *slot = NULL;
 
     if (rc == 0) {
-	rc = TSS_HmacSession_GetSlotForHandle(tssContext, &slotIndex, sessionHandle);
+	rc = TSS_HmacSession_GetSlotForHandle(tssContext, &slot, sessionHandle);
 	if (rc != 0) {
 	    if (tssVerbose)
 		printf("TSS_HmacSession_DeleteData: Error, no slot found for handle %08x\n",
@@ -1390,13 +2948,12 @@ static TPM_RC TSS_HmacSession_DeleteData(TSS_CONTEXT *tssContext,
 	}
     }    
     if (rc == 0) {
-	tssContext->sessions[slotIndex].sessionHandle = TPM_RH_NULL;
 	/* erase any secrets */
-	memset(tssContext->sessions[slotIndex].sessionData, 0,
-	       tssContext->sessions[slotIndex].sessionDataLength);
-	free(tssContext->sessions[slotIndex].sessionData);
-	tssContext->sessions[slotIndex].sessionData = NULL;
-	tssContext->sessions[slotIndex].sessionDataLength = 0;
+	memset(slot->sessionData, 0, slot->sessionDataLength);
+	free(slot->sessionData);
+	slot->sessionData = NULL;
+	slot->sessionDataLength = 0;
+	TSS_HandleTable_Remove(&tssContext->sessions, sessionHandle);
     }
     return rc;
 }
@@ -1407,19 +2964,14 @@ static TPM_RC TSS_HmacSession_DeleteData(TSS_CONTEXT *tssContext,
 */
 
 static TPM_RC TSS_HmacSession_GetSlotForHandle(TSS_CONTEXT *tssContext,
-					       size_t *slotIndex,
+					       TSS_SESSIONS **slot,
 					       TPMI_SH_AUTH_SESSION sessionHandle)
-{
-    size_t 	i;
-
-    /* search all slots for handle */
-    for (i = 0 ; i < (sizeof(tssContext->sessions) / sizeof(TSS_SESSIONS)) ; i++) {
-	if (tssContext->sessions[i].sessionHandle == sessionHandle) {
-	    *slotIndex = i;
-	    return 0;
-	}
+{
+    *slot = TSS_HandleTable_Find(&tssContext->sessions, sessionHandle);
+    if (*slot == NULL) {
+	return TSS_RC_NO_SESSION_SLOT;
     }
-    return TSS_RC_NO_SESSION_SLOT;
+    return 0;
 }
 
 #endif
@@ -1611,11 +3163,11 @@ static TPM_RC TSS_Name_GetName(TSS_CONTEXT *tssContext,
     return rc;
 }
 
-/* TSS_Name_Store() stores the 'name' parameter in a file.
+/* TSS_Name_Store() stores the 'name' parameter in a file or the metadata store.
 
-   If handle is not 0, the handle is used as the file name.
+   If handle is not 0, the handle is used as the file name or key.
 
-   If 'string' is not NULL, the string is used as the file name.
+   If 'string' is not NULL, the string is used as the file name or key.
 */
 
 #ifndef TPM_TSS_NOFILE
@@ -1626,12 +3178,13 @@ static TPM_RC TSS_Name_Store(TSS_CONTEXT *tssContext,
 			     const char *string)
 {
     TPM_RC 	rc = 0;
+    char 	key[TSS_STORE_KEY_SIZE];
     char 	nameFilename[TPM_DATA_DIR_PATH_LENGTH];
 
     if (rc == 0) {
 	if (string == NULL) {
 	    if (handle != 0) {
-		sprintf(nameFilename, "%s/h%08x.bin", tssContext->tssDataDirectory, handle);
+		sprintf(key, "h%08x", handle);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Name_Store: handle and string are both null");
@@ -1640,7 +3193,7 @@ static TPM_RC TSS_Name_Store(TSS_CONTEXT *tssContext,
 	}
 	else {
 	    if (handle == 0) {
-		sprintf(nameFilename, "%s/h%s.bin", tssContext->tssDataDirectory, string);
+		sprintf(key, "h%s", string);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Name_Store: handle and string are both not null");
@@ -1649,19 +3202,26 @@ static TPM_RC TSS_Name_Store(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Name_Store: File %s\n", nameFilename);
-	rc = TSS_File_WriteBinaryFile(name->b.buffer, name->b.size, nameFilename);
+	if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+	    if (tssVverbose) printf("TSS_Name_Store: Key %s\n", key);
+	    rc = TSS_Store_WriteBuffer(tssContext, name->b.buffer, name->b.size, key);
+	}
+	else {
+	    sprintf(nameFilename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    if (tssVverbose) printf("TSS_Name_Store: File %s\n", nameFilename);
+	    rc = TSS_File_WriteBinaryFile(name->b.buffer, name->b.size, nameFilename);
+	}
     }
     return rc;
 }
 
 #endif
 
-/* TSS_Name_Load() loads the 'name' from a file.
+/* TSS_Name_Load() loads the 'name' from a file or the metadata store.
 
-   If handle is not 0, the handle is used as the file name.
+   If handle is not 0, the handle is used as the file name or key.
 
-   If 'string' is not NULL, the string is used as the file name.
+   If 'string' is not NULL, the string is used as the file name or key.
 */
    
 #ifndef TPM_TSS_NOFILE
@@ -1672,12 +3232,13 @@ static TPM_RC TSS_Name_Load(TSS_CONTEXT *tssContext,
 			    const char *string)
 {
     TPM_RC 		rc = 0;
+    char 		key[TSS_STORE_KEY_SIZE];
     char 		nameFilename[TPM_DATA_DIR_PATH_LENGTH];
 		
     if (rc == 0) {
 	if (string == NULL) {
 	    if (handle != 0) {
-		sprintf(nameFilename, "%s/h%08x.bin", tssContext->tssDataDirectory, handle);
+		sprintf(key, "h%08x", handle);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Name_Load: handle and string are both null\n");
@@ -1686,7 +3247,7 @@ static TPM_RC TSS_Name_Load(TSS_CONTEXT *tssContext,
 	}
 	else {
 	    if (handle == 0) {
-		sprintf(nameFilename, "%s/h%s.bin", tssContext->tssDataDirectory, string);
+		sprintf(key, "h%s", string);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Name_Load: handle and string are both not null\n");
@@ -1695,10 +3256,20 @@ static TPM_RC TSS_Name_Load(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Name_Load: File %s\n", nameFilename);
-	rc = TSS_File_Read2B(&name->b,
-			     sizeof(name->t.name),
-			     nameFilename);
+	if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+	    if (tssVverbose) printf("TSS_Name_Load: Key %s\n", key);
+	    rc = TSS_Store_Read2B(tssContext,
+				  &name->b,
+				  sizeof(name->t.name),
+				  key);
+	}
+	else {
+	    sprintf(nameFilename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    if (tssVverbose) printf("TSS_Name_Load: File %s\n", nameFilename);
+	    rc = TSS_File_Read2B(&name->b,
+				 sizeof(name->t.name),
+				 nameFilename);
+	}
     }
     return rc;
 }
@@ -1718,7 +3289,8 @@ static TPM_RC TSS_Name_Store(TSS_CONTEXT *tssContext,
 {
     TPM_RC 	rc = 0;
     TPM_HT 	handleType;
-    size_t	slotIndex;
+    TSS_NVPUBLIC *nvSlot = NULL;
+    TSS_OBJECT_PUBLIC *objectSlot = NULL;
 
     if (tssVverbose) printf("TSS_Name_Store: Handle %08x\n", handle);
     handleType = (TPM_HT) ((handle & HR_RANGE_MASK) >> HR_SHIFT);
@@ -1726,19 +3298,13 @@ static TPM_RC TSS_Name_Store(TSS_CONTEXT *tssContext,
     switch (handleType) {
       case TPM_HT_NV_INDEX:
 	/* for NV, the Name was returned at creation */
-	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slotIndex, handle);
+	rc = TSS_NvPublic_AddSlotForHandle(tssContext, &nvSlot, handle);
 	if (rc != 0) {
-	    rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slotIndex, TPM_RH_NULL);
-	    if (rc == 0) {
-		tssContext->nvPublic[slotIndex].nvIndex = handle;
-	    }
-	    else {
-		if (tssVerbose)
-		    printf("TSS_Name_Store: Error, no slot available for handle %08x\n", handle);
-	    }
+	    if (tssVerbose)
+		printf("TSS_Name_Store: Error, no slot available for handle %08x\n", handle);
 	}
 	if (rc == 0) {
-	    tssContext->nvPublic[slotIndex].name = *name;
+	    nvSlot->name = *name;
 	}
 	break;
       case TPM_HT_TRANSIENT:
@@ -1747,18 +3313,12 @@ static TPM_RC TSS_Name_Store(TSS_CONTEXT *tssContext,
 	    if (string == NULL) {
 		if (handle != 0) {
 		    /* if this handle is already used, overwrite the slot */
-		    rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slotIndex, handle);
+		    rc = TSS_ObjectPublic_AddSlotForHandle(tssContext, &objectSlot, handle);
 		    if (rc != 0) {
-			rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slotIndex, TPM_RH_NULL);
-			if (rc == 0) {
-			    tssContext->objectPublic[slotIndex].objectHandle = handle;
-			}
-			else {
-			    if (tssVerbose)
-				printf("TSS_Name_Store: "
-				       "Error, no slot available for handle %08x\n",
-				       handle);
-			}
+			if (tssVerbose)
+			    printf("TSS_Name_Store: "
+				   "Error, no slot available for handle %08x\n",
+				   handle);
 		    }
 		}
 		else {
@@ -1778,7 +3338,7 @@ static TPM_RC TSS_Name_Store(TSS_CONTEXT *tssContext,
 	    }
 	}
 	if (rc == 0) {
-	    tssContext->objectPublic[slotIndex].name = *name;
+	    objectSlot->name = *name;
 	}
 	break;
       default:
@@ -1803,7 +3363,8 @@ static TPM_RC TSS_Name_Load(TSS_CONTEXT *tssContext,
 {
     TPM_RC 	rc = 0;
     TPM_HT 	handleType;
-    size_t	slotIndex;
+    TSS_NVPUBLIC *nvSlot = NULL;
+    TSS_OBJECT_PUBLIC *objectSlot = NULL;
 
     string = string;
     
@@ -1812,24 +3373,24 @@ static TPM_RC TSS_Name_Load(TSS_CONTEXT *tssContext,
 
     switch (handleType) {
       case TPM_HT_NV_INDEX:
-	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slotIndex, handle);
+	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &nvSlot, handle);
 	if (rc != 0) {
 	    if (tssVerbose)
 		printf("TSS_Name_Load: Error, no slot found for handle %08x\n", handle);
 	}
 	if (rc == 0) {
-	    *name = tssContext->nvPublic[slotIndex].name;
+	    *name = nvSlot->name;
 	}
 	break;
       case TPM_HT_TRANSIENT:
       case TPM_HT_PERSISTENT:
-	rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slotIndex, handle);
+	rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &objectSlot, handle);
 	if (rc != 0) {
 	    if (tssVerbose)
 		printf("TSS_Name_Load: Error, no slot found for handle %08x\n", handle);
 	}
 	if (rc == 0) {
-	    *name = tssContext->objectPublic[slotIndex].name;
+	    *name = objectSlot->name;
 	}
 	break;
       default:
@@ -1863,11 +3424,11 @@ static TPM_RC TSS_Name_Copy(TSS_CONTEXT *tssContext,
     return rc;
 }
 
-/* TSS_Public_Store() stores the 'public' parameter in a file.
+/* TSS_Public_Store() stores the 'public' parameter in a file or the metadata store.
 
-   If handle is not 0, the handle is used as the file name.
+   If handle is not 0, the handle is used as the file name or key.
 
-   If 'string' is not NULL, the string is used as the file name.
+   If 'string' is not NULL, the string is used as the file name or key.
 */
 
 #ifndef TPM_TSS_NOFILE
@@ -1878,12 +3439,13 @@ static TPM_RC TSS_Public_Store(TSS_CONTEXT *tssContext,
 			       const char *string)
 {
     TPM_RC 	rc = 0;
+    char 	key[TSS_STORE_KEY_SIZE];
     char 	publicFilename[TPM_DATA_DIR_PATH_LENGTH];
 
     if (rc == 0) {
 	if (string == NULL) {
 	    if (handle != 0) {		/* store by handle */
-		sprintf(publicFilename, "%s/hp%08x.bin", tssContext->tssDataDirectory, handle);
+		sprintf(key, "hp%08x", handle);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Public_Store: handle and string are both null");
@@ -1892,7 +3454,7 @@ static TPM_RC TSS_Public_Store(TSS_CONTEXT *tssContext,
 	}
 	else {
 	    if (handle == 0) {		/* store by string */
-		sprintf(publicFilename, "%s/hp%s.bin", tssContext->tssDataDirectory, string);
+		sprintf(key, "hp%s", string);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Public_Store: handle and string are both not null");
@@ -1901,21 +3463,35 @@ static TPM_RC TSS_Public_Store(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Public_Store: File %s\n", publicFilename);
-	rc = TSS_File_WriteStructure(public,
-				     (MarshalFunction_t)TSS_TPM2B_PUBLIC_Marshal,
-				     publicFilename);
+	if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+	    if (tssVverbose) printf("TSS_Public_Store: Key %s\n", key);
+	    rc = TSS_Store_WriteStructure(tssContext,
+					  public,
+					  (MarshalFunction_t)TSS_TPM2B_PUBLIC_Marshal,
+					  key);
+	}
+	else {
+	    sprintf(publicFilename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    if (tssVverbose) printf("TSS_Public_Store: File %s\n", publicFilename);
+	    rc = TSS_File_WriteStructure(public,
+					 (MarshalFunction_t)TSS_TPM2B_PUBLIC_Marshal,
+					 publicFilename);
+	}
+    }
+    /* a cached salt key for the handle may be stale */
+    if ((rc == 0) && (handle != 0)) {
+	TSS_SaltKey_Invalidate(tssContext, handle, &public->publicArea);
     }
     return rc;
 }
 
 #endif
 
-/* TSS_Public_Load() loads the 'public' parameter from a file.
+/* TSS_Public_Load() loads the 'public' parameter from a file or the metadata store.
 
-   If handle is not 0, the handle is used as the file name.
+   If handle is not 0, the handle is used as the file name or key.
 
-   If 'string' is not NULL, the string is used as the file name.
+   If 'string' is not NULL, the string is used as the file name or key.
 */
    
 #ifndef TPM_TSS_NOFILE
@@ -1926,12 +3502,13 @@ static TPM_RC TSS_Public_Load(TSS_CONTEXT *tssContext,
 			      const char *string)
 {
     TPM_RC 	rc = 0;
+    char 	key[TSS_STORE_KEY_SIZE];
     char 	publicFilename[TPM_DATA_DIR_PATH_LENGTH];
 		
     if (rc == 0) {
 	if (string == NULL) {
 	    if (handle != 0) {
-		sprintf(publicFilename, "%s/hp%08x.bin", tssContext->tssDataDirectory, handle);
+		sprintf(key, "hp%08x", handle);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Public_Load: handle and string are both null\n");
@@ -1940,7 +3517,7 @@ static TPM_RC TSS_Public_Load(TSS_CONTEXT *tssContext,
 	}
 	else {
 	    if (handle == 0) {
-		sprintf(publicFilename, "%s/hp%s.bin", tssContext->tssDataDirectory, string);
+		sprintf(key, "hp%s", string);
 	    }
 	    else {
 		if (tssVerbose) printf("TSS_Public_Load: handle and string are both not null\n");
@@ -1949,11 +3526,22 @@ static TPM_RC TSS_Public_Load(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	if (tssVverbose) printf("TSS_Public_Load: File %s\n", publicFilename);
-	rc = TSS_File_ReadStructureFlag(public,
-					(UnmarshalFunctionFlag_t)TSS_TPM2B_PUBLIC_Unmarshalu,
-					TRUE,			/* NULL permitted */
-					publicFilename);
+	if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+	    if (tssVverbose) printf("TSS_Public_Load: Key %s\n", key);
+	    rc = TSS_Store_ReadStructureFlag(tssContext,
+					     public,
+					     (UnmarshalFunctionFlag_t)TSS_TPM2B_PUBLIC_Unmarshalu,
+					     TRUE,		/* NULL permitted */
+					     key);
+	}
+	else {
+	    sprintf(publicFilename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    if (tssVverbose) printf("TSS_Public_Load: File %s\n", publicFilename);
+	    rc = TSS_File_ReadStructureFlag(public,
+					    (UnmarshalFunctionFlag_t)TSS_TPM2B_PUBLIC_Unmarshalu,
+					    TRUE,			/* NULL permitted */
+					    publicFilename);
+	}
     }
     return rc;
 }
@@ -1992,23 +3580,17 @@ static TPM_RC TSS_Public_Store(TSS_CONTEXT *tssContext,
 			       const char *string)
 {
     TPM_RC 	rc = 0;
-    size_t	slotIndex;
+    TSS_OBJECT_PUBLIC *slot = NULL;
 
     if (rc == 0) {
 	if (string == NULL) {
 	    if (handle != 0) {
 		/* if this handle is already used, overwrite the slot */
-		rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slotIndex, handle);
+		rc = TSS_ObjectPublic_AddSlotForHandle(tssContext, &slot, handle);
 		if (rc != 0) {
-		    rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slotIndex, TPM_RH_NULL);
-		    if (rc == 0) {
-			tssContext->objectPublic[slotIndex].objectHandle = handle;
-		    }
-		    else {
-			if (tssVerbose)
-			    printf("TSS_Public_Store: Error, no slot available for handle %08x\n",
-				   handle);
-		    }
+		    if (tssVerbose)
+			printf("TSS_Public_Store: Error, no slot available for handle %08x\n",
+			       handle);
 		}
 	    }
 	    else {
@@ -2028,7 +3610,9 @@ static TPM_RC TSS_Public_Store(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	tssContext->objectPublic[slotIndex].objectPublic = *public;
+	slot->objectPublic = *public;
+	/* a cached salt key for the handle may be stale */
+	TSS_SaltKey_Invalidate(tssContext, handle, &public->publicArea);
     }
     return rc;
 }
@@ -2047,12 +3631,12 @@ static TPM_RC TSS_Public_Load(TSS_CONTEXT *tssContext,
 			      const char *string)
 {
     TPM_RC 	rc = 0;
-    size_t	slotIndex;
+    TSS_OBJECT_PUBLIC *slot = NULL;
 		
     if (rc == 0) {
 	if (string == NULL) {
 	    if (handle != 0) {
-		rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slotIndex, handle);
+		rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slot, handle);
 		if (rc != 0) {
 		    if (tssVerbose)
 			printf("TSS_Public_Load: Error, no slot found for handle %08x\n",
@@ -2076,7 +3660,7 @@ static TPM_RC TSS_Public_Load(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	*public = tssContext->objectPublic[slotIndex].objectPublic;
+	*public = slot->objectPublic;
     }
     return rc;
 }
@@ -2091,21 +3675,27 @@ static TPM_RC TSS_Public_Load(TSS_CONTEXT *tssContext,
 */
 
 static TPM_RC TSS_ObjectPublic_GetSlotForHandle(TSS_CONTEXT *tssContext,
-						size_t *slotIndex,
+						TSS_OBJECT_PUBLIC **slot,
 						TPM_HANDLE handle)
 {
-    size_t 	i;
-
-    /* search all slots for handle */
-    for (i = 0 ; i < (sizeof(tssContext->sessions) / sizeof(TSS_SESSIONS)) ; i++) {
-	if (tssContext->objectPublic[i].objectHandle == handle) {
-	    *slotIndex = i;
-	    return 0;
-	}
+    *slot = TSS_HandleTable_Find(&tssContext->objectPublic, handle);
+    if (*slot == NULL) {
+	return TSS_RC_NO_OBJECTPUBLIC_SLOT;
     }
-    return TSS_RC_NO_OBJECTPUBLIC_SLOT;
+    return 0;
 }	
 
+/* TSS_ObjectPublic_AddSlotForHandle() returns the object public slot corresponding to the handle,
+   adding an empty slot if there is none.
+*/
+
+static TPM_RC TSS_ObjectPublic_AddSlotForHandle(TSS_CONTEXT *tssContext,
+						TSS_OBJECT_PUBLIC **slot,
+						TPM_HANDLE handle)
+{
+    return TSS_HandleTable_Add(&tssContext->objectPublic, (void **)slot, handle);
+}
+
 #endif
 
 #ifdef TPM_TSS_NOFILE
@@ -2113,10 +3703,10 @@ static TPM_RC TSS_ObjectPublic_GetSlotForHandle(TSS_CONTEXT *tssContext,
 static TPM_RC TSS_ObjectPublic_DeleteData(TSS_CONTEXT *tssContext, TPM_HANDLE handle)
 {
     TPM_RC	rc = 0;
-    size_t	slotIndex;
+    TSS_OBJECT_PUBLIC *slot = NULL;
 
     if (rc == 0) {
-	rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slotIndex, handle);
+	rc = TSS_ObjectPublic_GetSlotForHandle(tssContext, &slot, handle);
 	if (rc != 0) {
 	    if (tssVerbose)
 		printf("TSS_ObjectPublic_DeleteData: Error, no slot found for handle %08x\n",
@@ -2124,7 +3714,7 @@ static TPM_RC TSS_ObjectPublic_DeleteData(TSS_CONTEXT *tssContext, TPM_HANDLE ha
 	}
     }    
     if (rc == 0) {
-	tssContext->objectPublic[slotIndex].objectHandle = TPM_RH_NULL;
+	TSS_HandleTable_Remove(&tssContext->objectPublic, handle);
     }
     return rc;
 }
@@ -2135,30 +3725,55 @@ static TPM_RC TSS_ObjectPublic_DeleteData(TSS_CONTEXT *tssContext, TPM_HANDLE ha
 /* TSS_DeleteHandle() removes retained state stored by the TSS for a handle 
  */
 
-static TPM_RC TSS_DeleteHandle(TSS_CONTEXT *tssContext,
-			       TPM_HANDLE handle)
+TPM_RC TSS_DeleteHandle(TSS_CONTEXT *tssContext,
+			TPM_HANDLE handle)
 {
     TPM_RC		rc = 0;
     TPM_HT 		handleType;
 #ifndef TPM_TSS_NOFILE
+    char		key[TSS_STORE_KEY_SIZE];
     char		filename[TPM_DATA_DIR_PATH_LENGTH];
+    int			isSession;
+    int			noFile = FALSE;
 #endif
 
     handleType = (TPM_HT) ((handle & HR_RANGE_MASK) >> HR_SHIFT);
+    TSS_SaltKey_Invalidate(tssContext, handle, NULL);
 #ifndef TPM_TSS_NOFILE
-    /* delete the Name */
+    isSession = (handleType == TPM_HT_HMAC_SESSION) || (handleType == TPM_HT_POLICY_SESSION);
+    /* remove a cached session.  A write back session may not have a session file yet. */
     if (rc == 0) {
-	sprintf(filename, "%s/h%08x.bin", tssContext->tssDataDirectory, handle);
-	if (tssVverbose) printf("TSS_DeleteHandle: delete Name file %s\n", filename);
-	rc = TSS_File_DeleteFile(filename);
+	if (isSession) {
+	    noFile = TSS_HmacSession_CacheRemove(tssContext, handle);
+	}
+    }
+    /* delete the Name, or the session state for a session, which is always a file */
+    if ((rc == 0) && !noFile) {
+	sprintf(key, "h%08x", handle);
+	if ((tssContext->tssDataStore == TSS_DATA_STORE_MMAP) && !isSession) {
+	    if (tssVverbose) printf("TSS_DeleteHandle: delete Name key %s\n", key);
+	    rc = TSS_Store_Delete(tssContext, key);
+	}
+	else {
+	    sprintf(filename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    if (tssVverbose) printf("TSS_DeleteHandle: delete Name file %s\n", filename);
+	    rc = TSS_File_DeleteFile(filename);
+	}
     }
     /* delete the public if it exists */
     if (rc == 0) {
 	if ((handleType == TPM_HT_TRANSIENT) ||
 	    (handleType == TPM_HT_PERSISTENT)) {
-	    sprintf(filename, "%s/hp%08x.bin", tssContext->tssDataDirectory, handle);
-	    if (tssVverbose) printf("TSS_DeleteHandle: delete public file %s\n", filename);
-	    TSS_File_DeleteFile(filename);
+	    sprintf(key, "hp%08x", handle);
+	    if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+		if (tssVverbose) printf("TSS_DeleteHandle: delete public key %s\n", key);
+		TSS_Store_Delete(tssContext, key);
+	    }
+	    else {
+		sprintf(filename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+		if (tssVverbose) printf("TSS_DeleteHandle: delete public file %s\n", filename);
+		TSS_File_DeleteFile(filename);
+	    }
 	}
     }
 #else
@@ -2187,7 +3802,8 @@ static TPM_RC TSS_DeleteHandle(TSS_CONTEXT *tssContext,
    because the Name returned from the TPM2_ReadPublic cannot be trusted.
 */
 
-static TPM_RC TSS_ObjectPublic_GetName(TPM2B_NAME *name,
+static TPM_RC TSS_ObjectPublic_GetName(TSS_CONTEXT *tssContext,
+				       TPM2B_NAME *name,
 				       TPMT_PUBLIC *tpmtPublic)
 {
     TPM_RC 	rc = 0;
@@ -2199,7 +3815,7 @@ static TPM_RC TSS_ObjectPublic_GetName(TPM2B_NAME *name,
     uint8_t 	*buffer = NULL;
 
     if (rc == 0) {
-	rc = TSS_Malloc(&buffer, MAX_RESPONSE_SIZE);	/* freed @1 */
+	rc = TSS_Scratch_Alloc(tssContext, (void **)&buffer, MAX_RESPONSE_SIZE);
     }
     /* marshal the TPMT_PUBLIC */
     if (rc == 0) {
@@ -2226,15 +3842,15 @@ static TPM_RC TSS_ObjectPublic_GetName(TPM2B_NAME *name,
 	/* set the size */
 	name->t.size = sizeInBytes + sizeof(TPMI_ALG_HASH);
     }
-    free(buffer);	/* @1 */
 #else
+    tssContext = tssContext;
     tpmtPublic = tpmtPublic;
     name->t.size = 0;
 #endif
     return rc;
 }
 
-/* TSS_NVPublic_Store() stores the NV public data in a file.
+/* TSS_NVPublic_Store() stores the NV public data in a file or the metadata store.
 
  */
 
@@ -2246,13 +3862,23 @@ static TPM_RC TSS_NVPublic_Store(TSS_CONTEXT *tssContext,
 				 TPMI_RH_NV_INDEX nvIndex)
 {
     TPM_RC 	rc = 0;
+    char 	key[TSS_STORE_KEY_SIZE];
     char 	nvpFilename[TPM_DATA_DIR_PATH_LENGTH];
 
     if (rc == 0) {
-	sprintf(nvpFilename, "%s/nvp%08x.bin", tssContext->tssDataDirectory, nvIndex);
-	rc = TSS_File_WriteStructure(nvPublic,
-				     (MarshalFunction_t)TSS_TPMS_NV_PUBLIC_Marshal,
-				     nvpFilename);
+	sprintf(key, "nvp%08x", nvIndex);
+	if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+	    rc = TSS_Store_WriteStructure(tssContext,
+					  nvPublic,
+					  (MarshalFunction_t)TSS_TPMS_NV_PUBLIC_Marshal,
+					  key);
+	}
+	else {
+	    sprintf(nvpFilename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    rc = TSS_File_WriteStructure(nvPublic,
+					 (MarshalFunction_t)TSS_TPMS_NV_PUBLIC_Marshal,
+					 nvpFilename);
+	}
     }
     return rc;
 }
@@ -2260,7 +3886,7 @@ static TPM_RC TSS_NVPublic_Store(TSS_CONTEXT *tssContext,
 #endif
 #endif
 
-/* TSS_NVPublic_Load() loads the NV public from a file.
+/* TSS_NVPublic_Load() loads the NV public from a file or the metadata store.
 
  */
 
@@ -2272,13 +3898,23 @@ static TPM_RC TSS_NVPublic_Load(TSS_CONTEXT *tssContext,
 				TPMI_RH_NV_INDEX nvIndex)
 {
     TPM_RC 	rc = 0;
+    char 	key[TSS_STORE_KEY_SIZE];
     char 	nvpFilename[TPM_DATA_DIR_PATH_LENGTH];
 
     if (rc == 0) {
-	sprintf(nvpFilename, "%s/nvp%08x.bin", tssContext->tssDataDirectory, nvIndex);
-	rc = TSS_File_ReadStructure(nvPublic,
-				    (UnmarshalFunction_t)TSS_TPMS_NV_PUBLIC_Unmarshalu,
-				    nvpFilename);
+	sprintf(key, "nvp%08x", nvIndex);
+	if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+	    rc = TSS_Store_ReadStructure(tssContext,
+					 nvPublic,
+					 (UnmarshalFunction_t)TSS_TPMS_NV_PUBLIC_Unmarshalu,
+					 key);
+	}
+	else {
+	    sprintf(nvpFilename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    rc = TSS_File_ReadStructure(nvPublic,
+					(UnmarshalFunction_t)TSS_TPMS_NV_PUBLIC_Unmarshalu,
+					nvpFilename);
+	}
     }
     return rc;
 }
@@ -2292,11 +3928,18 @@ static TPM_RC TSS_NVPublic_Delete(TSS_CONTEXT *tssContext,
 				  TPMI_RH_NV_INDEX nvIndex)
 {
     TPM_RC 	rc = 0;
+    char 	key[TSS_STORE_KEY_SIZE];
     char 	nvpFilename[TPM_DATA_DIR_PATH_LENGTH];
     
     if (rc == 0) {
-	sprintf(nvpFilename, "%s/nvp%08x.bin", tssContext->tssDataDirectory, nvIndex);
-	rc = TSS_File_DeleteFile(nvpFilename);
+	sprintf(key, "nvp%08x", nvIndex);
+	if (tssContext->tssDataStore == TSS_DATA_STORE_MMAP) {
+	    rc = TSS_Store_Delete(tssContext, key);
+	}
+	else {
+	    sprintf(nvpFilename, "%s/%s.bin", tssContext->tssDataDirectory, key);
+	    rc = TSS_File_DeleteFile(nvpFilename);
+	}
     }
     return rc;
 }
@@ -2315,24 +3958,18 @@ static TPM_RC TSS_NVPublic_Store(TSS_CONTEXT *tssContext,
 				 TPMI_RH_NV_INDEX nvIndex)
 {
     TPM_RC 	rc = 0;
-    size_t	slotIndex;
+    TSS_NVPUBLIC *slot = NULL;
 
     if (rc == 0) {
-	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slotIndex, nvIndex);
+	rc = TSS_NvPublic_AddSlotForHandle(tssContext, &slot, nvIndex);
 	if (rc != 0) {
-	    rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slotIndex, TPM_RH_NULL);
-	    if (rc == 0) {
-		tssContext->nvPublic[slotIndex].nvIndex = nvIndex;
-	    }
-	    else {
-		if (tssVerbose)
-		    printf("TSS_NVPublic_Store: Error, no slot available for handle %08x\n",
-			   nvIndex);
-	    }
+	    if (tssVerbose)
+		printf("TSS_NVPublic_Store: Error, no slot available for handle %08x\n",
+		       nvIndex);
 	}
     }
     if (rc == 0) {
-	tssContext->nvPublic[slotIndex].nvPublic = *nvPublic;
+	slot->nvPublic = *nvPublic;
     }
     return rc;
 }
@@ -2352,10 +3989,10 @@ static TPM_RC TSS_NVPublic_Load(TSS_CONTEXT *tssContext,
 				TPMI_RH_NV_INDEX nvIndex)
 {
     TPM_RC 	rc = 0;
-    size_t	slotIndex;
+    TSS_NVPUBLIC *slot = NULL;
 
     if (rc == 0) {
-	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slotIndex, nvIndex);
+	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slot, nvIndex);
 	if (rc != 0) {
 	    if (tssVerbose)
 		printf("TSS_NVPublic_Load: Error, no slot found for handle %08x\n",
@@ -2363,7 +4000,7 @@ static TPM_RC TSS_NVPublic_Load(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	*nvPublic = tssContext->nvPublic[slotIndex].nvPublic;
+	*nvPublic = slot->nvPublic;
     }
     return rc;
 }
@@ -2377,10 +4014,10 @@ static TPM_RC TSS_NVPublic_Delete(TSS_CONTEXT *tssContext,
 				  TPMI_RH_NV_INDEX nvIndex)
 {
     TPM_RC 	rc = 0;
-    size_t	slotIndex;
+    TSS_NVPUBLIC *slot = NULL;
     
     if (rc == 0) {
-	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slotIndex, nvIndex);
+	rc = TSS_NvPublic_GetSlotForHandle(tssContext, &slot, nvIndex);
 	if (rc != 0) {
 	    if (tssVerbose)
 		printf("TSS_NVPublic_Delete: Error, no slot found for handle %08x\n",
@@ -2388,7 +4025,7 @@ static TPM_RC TSS_NVPublic_Delete(TSS_CONTEXT *tssContext,
 	}
     }
     if (rc == 0) {
-	tssContext->nvPublic[slotIndex].nvIndex = TPM_RH_NULL;
+	TSS_HandleTable_Remove(&tssContext->nvPublic, nvIndex);
     }
     return rc;
 }
@@ -2397,27 +4034,33 @@ static TPM_RC TSS_NVPublic_Delete(TSS_CONTEXT *tssContext,
 
 #ifdef TPM_TSS_NOFILE
 
-/* TSS_NvPublic_GetSlotForHandle() finds the object public slot corresponding to the handle.
+/* TSS_NvPublic_GetSlotForHandle() finds the NV public slot corresponding to the handle.
 
    Returns non-zero if no slot is found.
 */
 
 static TPM_RC TSS_NvPublic_GetSlotForHandle(TSS_CONTEXT *tssContext,
-					    size_t *slotIndex,
+					    TSS_NVPUBLIC **slot,
 					    TPMI_RH_NV_INDEX nvIndex)
 {
-    size_t 	i;
-
-    /* search all slots for handle */
-    for (i = 0 ; i < (sizeof(tssContext->nvPublic) / sizeof(TSS_NVPUBLIC)) ; i++) {
-	if (tssContext->nvPublic[i].nvIndex == nvIndex) {
-	    *slotIndex = i;
-	    return 0;
-	}
+    *slot = TSS_HandleTable_Find(&tssContext->nvPublic, nvIndex);
+    if (*slot == NULL) {
+	return TSS_RC_NO_NVPUBLIC_SLOT;
     }
-    return TSS_RC_NO_NVPUBLIC_SLOT;
+    return 0;
 }	
 
+/* TSS_NvPublic_AddSlotForHandle() returns the NV public slot corresponding to the handle, adding
+   an empty slot if there is none.
+*/
+
+static TPM_RC TSS_NvPublic_AddSlotForHandle(TSS_CONTEXT *tssContext,
+					    TSS_NVPUBLIC **slot,
+					    TPMI_RH_NV_INDEX nvIndex)
+{
+    return TSS_HandleTable_Add(&tssContext->nvPublic, (void **)slot, nvIndex);
+}
+
 #endif
 
 /* TSS_NVPublic_GetName() calculates the Name from the TPMS_NV_PUBLIC.  The Name provides security,
@@ -2517,6 +4160,8 @@ static TPM_RC TSS_HmacSession_SetHmacKey(TSS_CONTEXT *tssContext,
       { || nonceTPMdecrypt } { || nonceTPMencrypt }
       || sessionAttributes))
     */
+    /* the keys are recalculated, discard any keyed HMAC states from a previous calculation */
+    TSS_HmacSession_FreeKeyStates(session);
     /* HMAC key is sessionKey || authValue */
     /* copy the session key to HMAC key */
     if (rc == 0) {
@@ -2655,6 +4300,36 @@ static TPM_RC TSS_HmacSession_SetHmacKey(TSS_CONTEXT *tssContext,
     }
     return rc;
 }
+
+/* TSS_HmacSession_GetKeyState() returns in keyState a keyed HMAC state for key, creating it on
+   first use.  The HMAC key and sessionValue are each used for more than one HMAC per command
+   (command and response HMAC, command and response parameter encryption, KDFa counter blocks), so
+   the key setup is done once and the state is copied for each HMAC. */
+
+static TPM_RC TSS_HmacSession_GetKeyState(void **keyState,
+					  TPMI_ALG_HASH hashAlg,
+					  const TPM2B_KEY *key)
+{
+    TPM_RC		rc = 0;
+
+    if (*keyState == NULL) {
+	rc = TSS_HMAC_KeyNew(keyState, hashAlg, key);	/* freed by
+							   TSS_HmacSession_FreeKeyStates() */
+    }
+    return rc;
+}
+
+/* TSS_HmacSession_FreeKeyStates() frees the keyed HMAC states.  They are recreated from hmacKey
+   and sessionValue on next use. */
+
+static void TSS_HmacSession_FreeKeyStates(struct TSS_HMAC_CONTEXT *session)
+{
+    TSS_HMAC_KeyFree(session->hmacKeyState);
+    session->hmacKeyState = NULL;
+    TSS_HMAC_KeyFree(session->sessionValueState);
+    session->sessionValueState = NULL;
+    return;
+}
     
 #endif	/* TPM_TSS_NOCRYPTO */
 
@@ -2805,24 +4480,29 @@ static TPM_RC TSS_HmacSession_SetHMAC(TSS_AUTH_CONTEXT *tssAuthContext,	/* autho
 		    nonceTPMEncrypt.t.size = 0;
 		}
 		/* */
+		if (rc == 0) {
+		    rc = TSS_HmacSession_GetKeyState(&session[i]->hmacKeyState,
+						     session[i]->authHashAlg,
+						     &session[i]->hmacKey);
+		}
 		if (rc == 0) {
 		    hmac.hashAlg = session[i]->authHashAlg;
-		    rc = TSS_HMAC_Generate(&hmac,				/* output hmac */
-					   &session[i]->hmacKey,		/* input key */
-					   session[i]->sizeInBytes, (uint8_t *)&cpHash.digest,
-					   /* new is nonceCaller */
-					   session[i]->nonceCaller.b.size,
-					   &session[i]->nonceCaller.b.buffer,
-					   /* old is previous nonceTPM */
-					   session[i]->nonceTPM.b.size,
-					   &session[i]->nonceTPM.b.buffer,
-					   /* nonceTPMDecrypt */
-					   nonceTPMDecrypt.b.size, nonceTPMDecrypt.b.buffer,
-					   /* nonceTPMEncrypt */
-					   nonceTPMEncrypt.b.size, nonceTPMEncrypt.b.buffer,
-					   /* 1 byte, no endian conversion */
-					   sizeof(uint8_t), &sessionAttr8,
-					   0, NULL);
+		    rc = TSS_HMAC_GenerateKeyed(&hmac,				/* output hmac */
+						session[i]->hmacKeyState,	/* input key */
+						session[i]->sizeInBytes, (uint8_t *)&cpHash.digest,
+						/* new is nonceCaller */
+						session[i]->nonceCaller.b.size,
+						&session[i]->nonceCaller.b.buffer,
+						/* old is previous nonceTPM */
+						session[i]->nonceTPM.b.size,
+						&session[i]->nonceTPM.b.buffer,
+						/* nonceTPMDecrypt */
+						nonceTPMDecrypt.b.size, nonceTPMDecrypt.b.buffer,
+						/* nonceTPMEncrypt */
+						nonceTPMEncrypt.b.size, nonceTPMEncrypt.b.buffer,
+						/* 1 byte, no endian conversion */
+						sizeof(uint8_t), &sessionAttr8,
+						0, NULL);
 		    if (tssVverbose) {
 			TSS_PrintAll("TSS_HmacSession_SetHMAC: HMAC key",
 				     session[i]->hmacKey.t.buffer, session[i]->hmacKey.t.size);
@@ -2947,18 +4627,25 @@ static TPM_RC TSS_HmacSession_Verify(TSS_AUTH_CONTEXT *tssAuthContext,	/* author
 	    TSS_PrintAll("TSS_HmacSession_Verify: response HMAC",
 			 (uint8_t *)&authResponse->hmac.t.buffer, session->sizeInBytes);
 	}
-	rc = TSS_HMAC_Verify(&actualHmac,		/* input response hmac */
-			     &session->hmacKey,		/* input HMAC key */
-			     session->sizeInBytes,
-			     /* rpHash */
-			     session->sizeInBytes, (uint8_t *)&rpHash.digest,
-			     /* new is nonceTPM */
-			     session->nonceTPM.b.size, &session->nonceTPM.b.buffer,
-			     /* old is nonceCaller */
-			     session->nonceCaller.b.size, &session->nonceCaller.b.buffer,
-			     /* 1 byte, no endian conversion */
-			     sizeof(uint8_t), &authResponse->sessionAttributes.val,
-			     0, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_HmacSession_GetKeyState(&session->hmacKeyState,
+					 session->authHashAlg,
+					 &session->hmacKey);
+    }
+    if (rc == 0) {
+	rc = TSS_HMAC_VerifyKeyed(&actualHmac,		/* input response hmac */
+				  session->hmacKeyState,	/* input HMAC key */
+				  session->sizeInBytes,
+				  /* rpHash */
+				  session->sizeInBytes, (uint8_t *)&rpHash.digest,
+				  /* new is nonceTPM */
+				  session->nonceTPM.b.size, &session->nonceTPM.b.buffer,
+				  /* old is nonceCaller */
+				  session->nonceCaller.b.size, &session->nonceCaller.b.buffer,
+				  /* 1 byte, no endian conversion */
+				  sizeof(uint8_t), &authResponse->sessionAttributes.val,
+				  0, NULL);
     }
     return rc;
 }
@@ -2986,6 +4673,7 @@ static TPM_RC TSS_HmacSession_Continue(TSS_CONTEXT *tssContext,
 	else {		/* continue clear */
 	    /* delete the session state */
 	    rc = TSS_DeleteHandle(tssContext, session->sessionHandle);
+	    TSS_Virtual_Flushed(tssContext, session->sessionHandle);
 	}
     }
     return rc;
@@ -3205,13 +4893,18 @@ static TPM_RC TSS_Command_DecryptXor(TSS_AUTH_CONTEXT *tssAuthContext,
 	if (tssVverbose)
 	    TSS_PrintAll("TSS_Command_DecryptXor: sessionValue",
 			 session->sessionValue.b.buffer, session->sessionValue.b.size);
-	rc = TSS_KDFA(mask,
-		      session->authHashAlg,
-		      &session->sessionValue.b,
-		      "XOR",
-		      &session->nonceCaller.b,
-		      &session->nonceTPM.b,
-		      paramSize * 8);
+	rc = TSS_HmacSession_GetKeyState(&session->sessionValueState,
+					 session->authHashAlg,
+					 &session->sessionValue);
+    }
+    if (rc == 0) {
+	rc = TSS_KDFA_Keyed(mask,
+			    session->authHashAlg,
+			    session->sessionValueState,
+			    "XOR",
+			    &session->nonceCaller.b,
+			    &session->nonceTPM.b,
+			    paramSize * 8);
     }
     if (rc == 0) {
 	if (tssVverbose) TSS_PrintAll("TSS_Command_DecryptXor: mask",
@@ -3289,13 +4982,18 @@ static TPM_RC TSS_Command_DecryptAes(TSS_AUTH_CONTEXT *tssAuthContext,
 	if (tssVverbose) TSS_PrintAll("TSS_Command_DecryptAes: session key",
 				      session->sessionKey.b.buffer, session->sessionKey.b.size);
 
-	rc = TSS_KDFA(&symParmString[0],
-		      session->authHashAlg,
-		      &session->sessionValue.b,
-		      "CFB",
-		      &session->nonceCaller.b,
-		      &session->nonceTPM.b,
-		      kdfaBits);
+	rc = TSS_HmacSession_GetKeyState(&session->sessionValueState,
+					 session->authHashAlg,
+					 &session->sessionValue);
+    }
+    if (rc == 0) {
+	rc = TSS_KDFA_Keyed(&symParmString[0],
+			    session->authHashAlg,
+			    session->sessionValueState,
+			    "CFB",
+			    &session->nonceCaller.b,
+			    &session->nonceTPM.b,
+			    kdfaBits);
     }
     /* copy the latter part of the kdf output to the IV */
     if (rc == 0) {
@@ -3462,13 +5160,18 @@ static TPM_RC TSS_Response_EncryptXor(TSS_AUTH_CONTEXT *tssAuthContext,
 	if (tssVverbose) printf("TSS_Response_EncryptXor: sizeInBits %04x\n", paramSize * 8);
 	if (tssVverbose) TSS_PrintAll("TSS_Response_EncryptXor: session key",
 				      session->sessionKey.b.buffer, session->sessionKey.b.size);
-	rc = TSS_KDFA(mask,
-		      session->authHashAlg,
-		      &session->sessionValue.b,
-		      "XOR",
-		      &session->nonceTPM.b,
-		      &session->nonceCaller.b,
-		      paramSize * 8);
+	rc = TSS_HmacSession_GetKeyState(&session->sessionValueState,
+					 session->authHashAlg,
+					 &session->sessionValue);
+    }
+    if (rc == 0) {
+	rc = TSS_KDFA_Keyed(mask,
+			    session->authHashAlg,
+			    session->sessionValueState,
+			    "XOR",
+			    &session->nonceTPM.b,
+			    &session->nonceCaller.b,
+			    paramSize * 8);
     }
     if (rc == 0) {
 	if (tssVverbose) TSS_PrintAll("TSS_Response_EncryptXor: mask",
@@ -3542,13 +5245,18 @@ static TPM_RC TSS_Response_EncryptAes(TSS_AUTH_CONTEXT *tssAuthContext,
 	if (tssVverbose) TSS_PrintAll("TSS_Response_EncryptAes: session key",
 				      session->sessionKey.b.buffer, session->sessionKey.b.size);
 	
-	rc = TSS_KDFA(&symParmString[0],
-		      session->authHashAlg,
-		      &session->sessionValue.b,
-		      "CFB",
-		      &session->nonceTPM.b,
-		      &session->nonceCaller.b,
-		      kdfaBits);
+	rc = TSS_HmacSession_GetKeyState(&session->sessionValueState,
+					 session->authHashAlg,
+					 &session->sessionValue);
+    }
+    if (rc == 0) {
+	rc = TSS_KDFA_Keyed(&symParmString[0],
+			    session->authHashAlg,
+			    session->sessionValueState,
+			    "CFB",
+			    &session->nonceTPM.b,
+			    &session->nonceCaller.b,
+			    kdfaBits);
     }
     /* copy the latter part of the kdf output to the IV */
     if (rc == 0) {
@@ -3597,33 +5305,11 @@ static TPM_RC TSS_Command_ChangeAuthProcessor(TSS_CONTEXT *tssContext,
 					      COMMAND_PARAMETERS *in)
 {
     TPM_RC 			rc = 0;
-    size_t 			index;
-    int 			found;
-    TSS_ChangeAuthFunction_t 	changeAuthFunction = NULL;
+    TSS_ChangeAuthFunction_t 	changeAuthFunction =
+	tssContext->tssExecuteState.descriptor->changeAuthFunction;
 
-    TPM_CC commandCode = TSS_GetCommandCode(tssContext->tssAuthContext);
-
-    /* search the table for a change authorization processing function */
-    if (rc == 0) {
-	found = FALSE;
-	for (index = 0 ; (index < (sizeof(tssTable) / sizeof(TSS_TABLE))) && !found ; index++) {
-	    if (tssTable[index].commandCode == commandCode) {
-		found = TRUE;
-		break;	/* don't increment index if found */
-	    }
-	}
-    }
-    /* found false means there is no change authorization function.  This permits the table to be
-       smaller if desired. */
-    if ((rc == 0) && found) {
-	changeAuthFunction = tssTable[index].changeAuthFunction;
-	/* there could also be an entry that is currently NULL, nothing to do */
-	if (changeAuthFunction == NULL) {
-	    found = FALSE;
-	}
-    }
-    /* call the processing function */
-    if ((rc == 0) && found) {
+    /* NULL means there is no change authorization function */
+    if ((rc == 0) && (changeAuthFunction != NULL)) {
 	rc = changeAuthFunction(tssContext, session, handleNumber, in);
     }
     return rc;
@@ -3737,60 +5423,49 @@ static TPM_RC TSS_CA_NV_UndefineSpaceSpecial(TSS_CONTEXT *tssContext,
     return rc;
 }
 
+/* TSS_GetCommandDescriptor() returns the command table entry for the command code, or NULL if the
+   command is not implemented. */
+
+static const TSS_COMMAND_DESCRIPTOR *TSS_GetCommandDescriptor(TPM_CC commandCode)
+{
+    const TSS_COMMAND_DESCRIPTOR *descriptor = NULL;
+
+    /* TPM 2.0 library commands */
+    if ((commandCode >= TPM_CC_FIRST) && (commandCode <= TPM_CC_LAST)) {
+	descriptor = &tssCommandTable[TSS_CC_INDEX(commandCode)];
+    }
+    /* vendor commands */
+    else if ((commandCode >= NTC2_CC_PreConfig) && (commandCode <= NTC2_CC_GetConfig)) {
+	descriptor = &tssCommandTable[TSS_NTC2_INDEX(commandCode)];
+    }
+    /* an unused slot has a zero command code */
+    if ((descriptor != NULL) && (descriptor->commandCode != commandCode)) {
+	descriptor = NULL;
+    }
+    return descriptor;
+}
+
 /*
   Command Pre-Processor
 */
 
 static TPM_RC TSS_Command_PreProcessor(TSS_CONTEXT *tssContext,
-				       TPM_CC commandCode,
+				       const TSS_COMMAND_DESCRIPTOR *descriptor,
 				       COMMAND_PARAMETERS *in,
 				       EXTRA_PARAMETERS *extra)
 {
     TPM_RC 			rc = 0;
-    size_t 			index;
-    int 			found;
-    TSS_PreProcessFunction_t 	preProcessFunction = NULL;
+    TSS_PreProcessFunction_t 	preProcessFunction = descriptor->preProcessFunction;
     
-    /* search the table for a pre-processing function */
-    if (rc == 0) {
-	found = FALSE;
-	for (index = 0 ; (index < (sizeof(tssTable) / sizeof(TSS_TABLE))) && !found ; index++) {
-	    if (tssTable[index].commandCode == commandCode) {
-		found = TRUE;
-		break;	/* don't increment index if found */
-	    }
-	}
-    }
-    /* found false means there is no pre-processing function.  This permits the table to be smaller
-       if desired. */
-    if ((rc == 0) && found) {
-	preProcessFunction = tssTable[index].preProcessFunction;
-	/* call the pre processing function if there is one */
-	if (preProcessFunction != NULL) {
-	    rc = preProcessFunction(tssContext, in, extra);
-	}
+    /* call the pre processing function if there is one */
+    if ((rc == 0) && (preProcessFunction != NULL)) {
+	rc = preProcessFunction(tssContext, in, extra);
     }
 #ifndef TPM_TSS_NO_PRINT
-    if ((rc == 0) && tssVverbose) {
-	found = FALSE;
-	for (index = 0 ;
-	     (index < (sizeof(tssPrintTable) / sizeof(TSS_PRINT_TABLE))) && !found ;
-	     index++) {
-	    if (tssPrintTable[index].commandCode == commandCode) {
-		found = TRUE;
-		break;	/* don't increment index if found */
-	    }
-	}
-    }
-    /* found false means there is no print function.  This permits the table to be smaller
-       if desired. */
-    if ((rc == 0) && tssVverbose && found) {
-	TSS_InPrintFunction_t inPrintFunction = tssPrintTable[index].inPrintFunction;
-	/* call the pre processing function if there is one */
-	if (inPrintFunction != NULL) {
-	    printf("TSS_Command_PreProcessor: Input parameters\n");
-	    inPrintFunction(in, 8);	/* hard code indent 8 */
-	}
+    /* call the print function if there is one */
+    if ((rc == 0) && tssVverbose && (descriptor->inPrintFunction != NULL)) {
+	printf("TSS_Command_PreProcessor: Input parameters\n");
+	descriptor->inPrintFunction(in, 8);	/* hard code indent 8 */
     }
 #endif /* TPM_TSS_NO_PRINT */
     return rc;
@@ -3846,7 +5521,7 @@ static TPM_RC TSS_PR_StartAuthSession(TSS_CONTEXT *tssContext,
     /* if the caller requests a salted session */
     if (in->tpmKey != TPM_RH_NULL) {
 #ifndef TPM_TSS_NOCRYPTO
-	TPM2B_PUBLIC		bPublic;
+	TSS_SALT_KEY		*saltKey = NULL;
 	
 	if (rc == 0) {
 	    if (extra == NULL) {
@@ -3855,31 +5530,32 @@ static TPM_RC TSS_PR_StartAuthSession(TSS_CONTEXT *tssContext,
 		rc = TSS_RC_NULL_PARAMETER;
 	    }
 	}
-	/* get the tpmKey public key */
+	/* get the tpmKey public key, cached in the TSS context */
 	if (rc == 0) {
-	    rc = TSS_Public_Load(tssContext, &bPublic, in->tpmKey, NULL);
+	    rc = TSS_SaltKey_Get(tssContext, &saltKey, in->tpmKey);
 	}
 	/* generate the salt and encrypted salt based on the asymmetric key type */
 	if (rc == 0) {
-	    switch (bPublic.publicArea.type) {
+	    switch (saltKey->public.publicArea.type) {
 #ifndef TPM_TSS_NOECC
 	      case TPM_ALG_ECC:
 		rc = TSS_ECC_Salt(&extra->salt,
 				  &in->encryptedSalt,
-				  &bPublic.publicArea);
+				  &saltKey->public.publicArea);
 		break;
 #endif	/* TPM_TSS_NOECC */
 #ifndef TPM_TSS_NORSA
 	      case TPM_ALG_RSA:
 		rc = TSS_RSA_Salt(&extra->salt,
 				  &in->encryptedSalt,
-				  &bPublic.publicArea);
+				  &saltKey->public.publicArea,
+				  saltKey->rsaKey);
 		break;
 #endif 	/* TPM_TSS_NORSA */
 	      default:
 		if (tssVerbose)
 		    printf("TSS_PR_StartAuthSession: public key type %04x not supported\n",
-			   bPublic.publicArea.type);
+			   saltKey->public.publicArea.type);
 		rc = TSS_RC_BAD_SALT_KEY;
 	    }
 	}
@@ -3894,11 +5570,13 @@ static TPM_RC TSS_PR_StartAuthSession(TSS_CONTEXT *tssContext,
 #ifndef TPM_TSS_NOCRYPTO
 #ifndef TPM_TSS_NORSA
 
-/* TSS_RSA_Salt() returns both the plaintext and excrypted salt, based on the salt key bPublic. */
+/* TSS_RSA_Salt() returns both the plaintext and excrypted salt, based on the salt key bPublic.
+   rsaKey is the public key token for publicArea. */
 
 static TPM_RC TSS_RSA_Salt(TPM2B_DIGEST 		*salt,
 			   TPM2B_ENCRYPTED_SECRET	*encryptedSalt,
-			   TPMT_PUBLIC			*publicArea)
+			   TPMT_PUBLIC			*publicArea,
+			   void				*rsaKey)
 {
     TPM_RC		rc = 0;
 
@@ -3948,20 +5626,15 @@ static TPM_RC TSS_RSA_Salt(TPM2B_DIGEST 		*salt,
     }
     /* encrypt the salt */
     if (rc == 0) {
-	/* public exponent */
-	unsigned char earr[3] = {0x01, 0x00, 0x01};
 	/* encrypt the salt with the tpmKey public key */
-	rc = TSS_RSAPublicEncrypt((uint8_t *)&encryptedSalt->t.secret,   /* encrypted data */
-				  publicArea->unique.rsa.t.size,  /* size of encrypted data buffer */
-				  (uint8_t *)&salt->t.buffer, /* decrypted data */
-				  salt->t.size,
-				  publicArea->unique.rsa.t.buffer,  /* public modulus */
-				  publicArea->unique.rsa.t.size,
-				  earr, 		/* public exponent */
-				  sizeof(earr),
-				  (unsigned char *)"SECRET",	/* encoding parameter */
-				  sizeof("SECRET"),
-				  publicArea->nameAlg);
+	rc = TSS_RSAPublicEncryptKey((uint8_t *)&encryptedSalt->t.secret,   /* encrypted data */
+				     publicArea->unique.rsa.t.size,  /* size of encrypted data buffer */
+				     (uint8_t *)&salt->t.buffer, /* decrypted data */
+				     salt->t.size,
+				     rsaKey,		/* public key token */
+				     (unsigned char *)"SECRET",	/* encoding parameter */
+				     sizeof("SECRET"),
+				     publicArea->nameAlg);
     }    
     if (rc == 0) {
 	encryptedSalt->t.size = publicArea->unique.rsa.t.size;
@@ -3973,8 +5646,171 @@ static TPM_RC TSS_RSA_Salt(TPM2B_DIGEST 		*salt,
 }
 
 #endif /* TPM_TSS_NORSA */
+
+/* TSS_SaltKey_Get() returns the cached salt key for the handle.  On a miss, it loads the public
+   area, and for an RSA key builds the public key token, replacing the least recently used entry.
+
+   A hit is used only if the stored Name of the handle still matches the entry, since another
+   process or context may have flushed and reused the handle, or persisted a different key there.
+*/
+
+static TPM_RC TSS_SaltKey_Get(TSS_CONTEXT *tssContext,
+			      TSS_SALT_KEY **saltKey,
+			      TPM_HANDLE handle)
+{
+    TPM_RC		rc = 0;
+    TSS_SALT_KEY_CACHE	*cache = tssContext->tssSaltKeys;
+    TSS_SALT_KEY	*entry = NULL;
+    TPM2B_NAME		name;
+    int			match;
+    size_t		i;
+
+    /* allocate the cache at first use */
+    if ((rc == 0) && (cache == NULL)) {
+	rc = TSS_Malloc((unsigned char **)&tssContext->tssSaltKeys,	/* freed by
+									   TSS_SaltKey_Delete() */
+			sizeof(TSS_SALT_KEY_CACHE));
+	if (rc == 0) {
+	    cache = tssContext->tssSaltKeys;
+	    for (i = 0 ; i < TSS_SALT_KEYS ; i++) {
+		cache->keys[i].handle = 0;
+		cache->keys[i].rsaKey = NULL;
+		cache->keys[i].lastUse = 0;
+	    }
+	    cache->clock = 0;
+	}
+    }
+    if (rc == 0) {
+	cache->clock++;
+	for (i = 0 ; i < TSS_SALT_KEYS ; i++) {
+	    if (cache->keys[i].handle == handle) {
+		match = (TSS_Name_Load(tssContext, &name, handle, NULL) == 0) &&
+			TSS_TPM2B_Compare(&name.b, &cache->keys[i].name.b);
+		if (match) {
+		    if (tssVverbose) printf("TSS_SaltKey_Get: handle %08x cached\n", handle);
+		    cache->keys[i].lastUse = cache->clock;
+		    *saltKey = &cache->keys[i];
+		    return rc;
+		}
+		/* the entry is stale, reload it */
+		if (tssVverbose) printf("TSS_SaltKey_Get: handle %08x Name changed\n", handle);
+		TSS_SaltKey_Free(&cache->keys[i]);
+		break;
+	    }
+	}
+    }
+    /* an unused entry has lastUse 0 */
+    if (rc == 0) {
+	entry = &cache->keys[0];
+	for (i = 1 ; i < TSS_SALT_KEYS ; i++) {
+	    if (cache->keys[i].lastUse < entry->lastUse) {
+		entry = &cache->keys[i];
+	    }
+	}
+	TSS_SaltKey_Free(entry);
+    }
+    if (rc == 0) {
+	rc = TSS_Public_Load(tssContext, &entry->public, handle, NULL);
+    }
+    /* the stored Name, which a later hit compares */
+    if (rc == 0) {
+	rc = TSS_Name_Load(tssContext, &entry->name, handle, NULL);
+    }
+#ifndef TPM_TSS_NORSA
+    if ((rc == 0) && (entry->public.publicArea.type == TPM_ALG_RSA)) {
+	/* public exponent, TSS_RSA_Salt() rejects other exponents */
+	unsigned char earr[3] = {0x01, 0x00, 0x01};
+	rc = TSS_RSAGeneratePublicTokenI(&entry->rsaKey,	/* freed by TSS_SaltKey_Free() */
+					 entry->public.publicArea.unique.rsa.t.buffer,
+					 entry->public.publicArea.unique.rsa.t.size,
+					 earr,
+					 sizeof(earr));
+    }
+#endif	/* TPM_TSS_NORSA */
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_SaltKey_Get: handle %08x loaded\n", handle);
+	entry->handle = handle;
+	entry->lastUse = cache->clock;
+	*saltKey = entry;
+    }
+    else if (entry != NULL) {
+	TSS_SaltKey_Free(entry);
+    }
+    return rc;
+}
+
+/* TSS_SaltKey_Free() frees the key token and marks the entry unused */
+
+static void TSS_SaltKey_Free(TSS_SALT_KEY *saltKey)
+{
+#ifndef TPM_TSS_NORSA
+    TSS_RsaFree(saltKey->rsaKey);
+#endif	/* TPM_TSS_NORSA */
+    saltKey->rsaKey = NULL;
+    saltKey->handle = 0;
+    saltKey->lastUse = 0;
+    return;
+}
+
 #endif /* TPM_TSS_NOCRYPTO */
 
+/* TSS_SaltKey_Invalidate() removes the cached salt key for the handle.  If publicArea is not NULL,
+   it is the public area being stored for the handle, and the entry is kept if the Name is
+   unchanged. */
+
+static void TSS_SaltKey_Invalidate(TSS_CONTEXT *tssContext,
+				   TPM_HANDLE handle,
+				   TPMT_PUBLIC *publicArea)
+{
+#ifndef TPM_TSS_NOCRYPTO
+    TPM_RC		rc = 0;
+    TSS_SALT_KEY_CACHE	*cache = tssContext->tssSaltKeys;
+    TPM2B_NAME		name;
+    size_t		i;
+
+    for (i = 0 ; (cache != NULL) && (i < TSS_SALT_KEYS) ; i++) {
+	if ((cache->keys[i].handle == handle) && (handle != 0)) {
+	    if (publicArea != NULL) {
+		rc = TSS_ObjectPublic_GetName(tssContext, &name, publicArea);
+		if ((rc == 0) &&
+		    (name.b.size == cache->keys[i].name.b.size) &&
+		    (memcmp(name.b.buffer, cache->keys[i].name.b.buffer, name.b.size) == 0)) {
+		    break;
+		}
+	    }
+	    if (tssVverbose) printf("TSS_SaltKey_Invalidate: handle %08x\n", handle);
+	    TSS_SaltKey_Free(&cache->keys[i]);
+	    break;
+	}
+    }
+#else
+    tssContext = tssContext;
+    handle = handle;
+    publicArea = publicArea;
+#endif	/* TPM_TSS_NOCRYPTO */
+    return;
+}
+
+/* TSS_SaltKey_Delete() frees the salt key cache when the TSS context is deleted */
+
+void TSS_SaltKey_Delete(TSS_CONTEXT *tssContext)
+{
+#ifndef TPM_TSS_NOCRYPTO
+    size_t		i;
+
+    if (tssContext->tssSaltKeys != NULL) {
+	for (i = 0 ; i < TSS_SALT_KEYS ; i++) {
+	    TSS_SaltKey_Free(&tssContext->tssSaltKeys->keys[i]);
+	}
+	free(tssContext->tssSaltKeys);
+	tssContext->tssSaltKeys = NULL;
+    }
+#else
+    tssContext = tssContext;
+#endif	/* TPM_TSS_NOCRYPTO */
+    return;
+}
+
 static TPM_RC TSS_PR_NV_DefineSpace(TSS_CONTEXT *tssContext,
 				    NV_DefineSpace_In *in,
 				    void *extra)
@@ -4011,32 +5847,11 @@ static TPM_RC TSS_Response_PostProcessor(TSS_CONTEXT *tssContext,
 					 EXTRA_PARAMETERS *extra)
 {
     TPM_RC 			rc = 0;
-    size_t 			index;
-    int 			found;
-    TSS_PostProcessFunction_t 	postProcessFunction = NULL;
-
-    /* search the table for a post processing function */
-    if (rc == 0) {
-	TPM_CC commandCode = TSS_GetCommandCode(tssContext->tssAuthContext);
-	found = FALSE;
-	for (index = 0 ; (index < (sizeof(tssTable) / sizeof(TSS_TABLE))) && !found ; index++) {
-	    if (tssTable[index].commandCode == commandCode) {
-		found = TRUE;
-		break;	/* don't increment index if found */
-	    }
-	}
-    }
-    /* found false means there is no post processing function.  This permits the table to be smaller
-       if desired. */
-    if ((rc == 0) && found) {
-	postProcessFunction = tssTable[index].postProcessFunction;
-	/* there could also be an entry that it currently NULL, nothing to do */
-	if (postProcessFunction == NULL) {
-	    found = FALSE;
-	}
-    }
-    /* call the function */
-    if ((rc == 0) && found) {
+    TSS_PostProcessFunction_t 	postProcessFunction =
+	tssContext->tssExecuteState.descriptor->postProcessFunction;
+
+    /* NULL means there is no post processing function */
+    if ((rc == 0) && (postProcessFunction != NULL)) {
 	rc = postProcessFunction(tssContext, in, out, extra);
     }
     return rc;
@@ -4069,7 +5884,7 @@ static TPM_RC TSS_PO_StartAuthSession(TSS_CONTEXT *tssContext,
     if (tssVverbose) printf("TSS_PO_StartAuthSession\n");
     /* allocate a TSS_HMAC_CONTEXT session context */
     if (rc == 0) {
-	rc = TSS_HmacSession_GetContext(&session);
+	rc = TSS_HmacSession_GetContext(tssContext, &session);
     }
     if (rc == 0) {
 	session->sessionHandle = out->sessionHandle;
@@ -4387,7 +6202,7 @@ static TPM_RC TSS_PO_ReadPublic(TSS_CONTEXT *tssContext,
     {
 	TPM2B_NAME name;
 	if (rc == 0) {
-	    rc = TSS_ObjectPublic_GetName(&name, &out->outPublic.publicArea);
+	    rc = TSS_ObjectPublic_GetName(tssContext, &name, &out->outPublic.publicArea);
 	}
 	if (rc == 0) {
 	    if (name.t.size != out->name.t.size) {
@@ -4529,7 +6344,7 @@ static TPM_RC TSS_PO_PolicyAuthValue(TSS_CONTEXT *tssContext,
     extra = extra;
     if (tssVverbose) printf("TSS_PO_PolicyAuthValue\n");
     if (rc == 0) {
-	rc = TSS_Malloc((unsigned char **)&session, sizeof(TSS_HMAC_CONTEXT));	/* freed @1 */
+	rc = TSS_HmacSession_GetContext(tssContext, &session);
     }
     if (rc == 0) {
 	rc = TSS_HmacSession_LoadSession(tssContext, session, in->policySession);
@@ -4539,7 +6354,7 @@ static TPM_RC TSS_PO_PolicyAuthValue(TSS_CONTEXT *tssContext,
 	session->isAuthValueNeeded = TRUE;
 	rc = TSS_HmacSession_SaveSession(tssContext, session);
     }
-    free(session);		/* @1 */
+    TSS_HmacSession_FreeContext(session);
     return rc;
 }
 
@@ -4555,7 +6370,7 @@ static TPM_RC TSS_PO_PolicyPassword(TSS_CONTEXT *tssContext,
     extra = extra;
     if (tssVverbose) printf("TSS_PO_PolicyPassword\n");
     if (rc == 0) {
-	rc = TSS_Malloc((unsigned char **)&session, sizeof(TSS_HMAC_CONTEXT));	/* freed @1 */
+	rc = TSS_HmacSession_GetContext(tssContext, &session);
     }
     if (rc == 0) {
 	rc = TSS_HmacSession_LoadSession(tssContext, session, in->policySession);
@@ -4565,7 +6380,36 @@ static TPM_RC TSS_PO_PolicyPassword(TSS_CONTEXT *tssContext,
 	session->isAuthValueNeeded = FALSE;
 	rc = TSS_HmacSession_SaveSession(tssContext, session);
     }
-    free(session);		/* @1 */
+    TSS_HmacSession_FreeContext(session);
+    return rc;
+}
+
+/* TSS_PO_PolicyRestart() clears the PolicyAuthValue and PolicyPassword state, which the TPM also
+   resets, so that a restarted session does not use the old authorization */
+
+static TPM_RC TSS_PO_PolicyRestart(TSS_CONTEXT *tssContext,
+				   PolicyRestart_In *in,
+				   void *out,
+				   void *extra)
+{
+    TPM_RC 			rc = 0;
+    struct TSS_HMAC_CONTEXT 	*session = NULL;
+
+    out = out;
+    extra = extra;
+    if (tssVverbose) printf("TSS_PO_PolicyRestart\n");
+    if (rc == 0) {
+	rc = TSS_HmacSession_GetContext(tssContext, &session);
+    }
+    if (rc == 0) {
+	rc = TSS_HmacSession_LoadSession(tssContext, session, in->sessionHandle);
+    }
+    if (rc == 0) {
+	session->isPasswordNeeded = FALSE;
+	session->isAuthValueNeeded = FALSE;
+	rc = TSS_HmacSession_SaveSession(tssContext, session);
+    }
+    TSS_HmacSession_FreeContext(session);
     return rc;
 }
 
@@ -4880,3 +6724,20 @@ static TPM_RC TSS_PO_NV_ReadLock(TSS_CONTEXT *tssContext,
     return rc;
 }
 
+/* TSS_PO_Capability_Invalidate() discards the TPM capability cache after a command that can change
+   the capabilities */
+
+static TPM_RC TSS_PO_Capability_Invalidate(TSS_CONTEXT *tssContext,
+					   void *in,
+					   void *out,
+					   void *extra)
+{
+    TPM_RC 			rc = 0;
+
+    in = in;
+    out = out;
+    extra = extra;
+    if (tssVverbose) printf("TSS_PO_Capability_Invalidate:\n");
+    TSS_Capability_Invalidate(tssContext);
+    return rc;
+}
@@ -50,6 +50,31 @@ extern "C" {
 			 EXTRA_PARAMETERS *extra,
 			 TPM_CC commandCode,
 			 va_list ap);
+    TPM_RC TSS_Execute20_Prepare(TSS_CONTEXT *tssContext,
+				 COMMAND_PARAMETERS *in,
+				 EXTRA_PARAMETERS *extra,
+				 TPM_CC commandCode,
+				 va_list ap);
+    TPM_RC TSS_Execute20_Submit(TSS_CONTEXT *tssContext);
+    TPM_RC TSS_Execute20_Complete(TSS_CONTEXT *tssContext,
+				  RESPONSE_PARAMETERS *out);
+    void TSS_Execute20_Cleanup(TSS_CONTEXT *tssContext);
+    size_t TSS_Execute20_ScratchSize(void);
+    void TSS_Capability_Delete(TSS_CONTEXT *tssContext);
+    void TSS_SessionPool_Delete(TSS_CONTEXT *tssContext);
+    void TSS_SaltKey_Delete(TSS_CONTEXT *tssContext);
+    TPM_RC TSS_Virtual_Command(TSS_CONTEXT *tssContext);
+    TPM_RC TSS_Virtual_Response(TSS_CONTEXT *tssContext);
+    void TSS_Virtual_Flushed(TSS_CONTEXT *tssContext,
+			     TPM_HANDLE handle);
+    TPM_RC TSS_Virtual_Recover(TSS_CONTEXT *tssContext, TPM_RC rc, unsigned int recoveries);
+    void TSS_Virtual_Delete(TSS_CONTEXT *tssContext);
+    TPM_RC TSS_DeleteHandle(TSS_CONTEXT *tssContext,
+			    TPM_HANDLE handle);
+#ifndef TPM_TSS_NOFILE
+    TPM_RC TSS_HmacSession_CacheFlush(TSS_CONTEXT *tssContext);
+    void TSS_HmacSession_CacheDelete(TSS_CONTEXT *tssContext);
+#endif
 
 #ifdef __cplusplus
 }
@@ -63,9 +63,6 @@
 
 #include "tssauth.h"
 
-extern int tssVerbose;
-extern int tssVverbose;
-
 /* TSS_AuthCreate() allocates and initializes a TSS_AUTH_CONTEXT */
 
 TPM_RC TSS_AuthCreate(TSS_AUTH_CONTEXT **tssAuthContext)
@@ -158,3 +155,35 @@ TPM_RC TSS_AuthExecute(TSS_CONTEXT *tssContext)
     }
     return rc;
 }
+
+/* TSS_AuthSubmit() transmits the command without waiting for the response */
+
+TPM_RC TSS_AuthSubmit(TSS_CONTEXT *tssContext)
+{
+    TPM_RC rc = 0;
+    if (tssVverbose) printf("TSS_AuthSubmit: Submitting %s\n",
+			    tssContext->tssAuthContext->commandText);
+    if (rc == 0) {
+	rc = TSS_TransmitSend(tssContext,
+			      tssContext->tssAuthContext->commandBuffer,
+			      tssContext->tssAuthContext->commandSize,
+			      tssContext->tssAuthContext->commandText);
+    }
+    return rc;
+}
+
+/* TSS_AuthReceive() receives the response to a command transmitted by TSS_AuthSubmit().  Normally
+   returns the TPM response code. */
+
+TPM_RC TSS_AuthReceive(TSS_CONTEXT *tssContext)
+{
+    TPM_RC rc = 0;
+    if (tssVverbose) printf("TSS_AuthReceive: Receiving %s\n",
+			    tssContext->tssAuthContext->commandText);
+    if (rc == 0) {
+	rc = TSS_TransmitReceive(tssContext,
+				 tssContext->tssAuthContext->responseBuffer,
+				 &tssContext->tssAuthContext->responseSize);
+    }
+    return rc;
+}
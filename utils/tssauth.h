@@ -98,5 +98,7 @@ TPM_RC TSS_GetCommandHandleCount(TSS_AUTH_CONTEXT *tssAuthContext,
 				 size_t *commandHandleCount);
 
 TPM_RC TSS_AuthExecute(TSS_CONTEXT *tssContext);
+TPM_RC TSS_AuthSubmit(TSS_CONTEXT *tssContext);
+TPM_RC TSS_AuthReceive(TSS_CONTEXT *tssContext);
 
 #endif
@@ -68,9 +68,6 @@
 
 #include "tssauth12.h"
 
-extern int tssVerbose;
-extern int tssVverbose;
-
 typedef struct MARSHAL_TABLE {
     TPM_CC 			commandCode;
     const char 			*commandText;
@@ -60,637 +60,46 @@
 #include "tssproperties.h"
 #include <ibmtss/tssresponsecode.h>
 
-#include "tssntc.h"
 #include "tssauth.h"
 #include "tssauth20.h"
 
-extern int tssVerbose;
-extern int tssVverbose;
+/* TSS_MarshalTable_Process() saves the command table marshal and unmarshal functions in the TSS
+   Authorization context */
 
-typedef struct MARSHAL_TABLE {
-    TPM_CC 			commandCode;
-    const char 			*commandText;
-    MarshalInFunction_t 	marshalInFunction;	/* marshal input command */
-    UnmarshalOutFunction_t 	unmarshalOutFunction;	/* unmarshal output response */
-    UnmarshalInFunction_t	unmarshalInFunction;	/* unmarshal input command for parameter
-							   checking */
-} MARSHAL_TABLE;
-
-static const MARSHAL_TABLE marshalTable [] = {
-				 
-    {TPM_CC_Startup, "TPM2_Startup",
-     (MarshalInFunction_t)TSS_Startup_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)Startup_In_Unmarshal},
-
-    {TPM_CC_Shutdown, "TPM2_Shutdown",
-     (MarshalInFunction_t)TSS_Shutdown_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)Shutdown_In_Unmarshal},
-
-    {TPM_CC_SelfTest, "TPM2_SelfTest",
-     (MarshalInFunction_t)TSS_SelfTest_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)SelfTest_In_Unmarshal},
-
-    {TPM_CC_IncrementalSelfTest, "TPM2_IncrementalSelfTest",
-     (MarshalInFunction_t)TSS_IncrementalSelfTest_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_IncrementalSelfTest_Out_Unmarshalu,
-     (UnmarshalInFunction_t)IncrementalSelfTest_In_Unmarshal},
-
-    {TPM_CC_GetTestResult, "TPM2_GetTestResult",
-     NULL,
-     (UnmarshalOutFunction_t)TSS_GetTestResult_Out_Unmarshalu,
-     NULL},
-
-    {TPM_CC_StartAuthSession, "TPM2_StartAuthSession",
-     (MarshalInFunction_t)TSS_StartAuthSession_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_StartAuthSession_Out_Unmarshalu,
-     (UnmarshalInFunction_t)StartAuthSession_In_Unmarshal},
-    
-    {TPM_CC_PolicyRestart, "TPM2_PolicyRestart",
-     (MarshalInFunction_t)TSS_PolicyRestart_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyRestart_In_Unmarshal},
-
-    {TPM_CC_Create, "TPM2_Create",
-     (MarshalInFunction_t)TSS_Create_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Create_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Create_In_Unmarshal},
-
-    {TPM_CC_Load, "TPM2_Load",
-     (MarshalInFunction_t)TSS_Load_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Load_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Load_In_Unmarshal},
-
-    {TPM_CC_LoadExternal, "TPM2_LoadExternal",
-     (MarshalInFunction_t)TSS_LoadExternal_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_LoadExternal_Out_Unmarshalu,
-     (UnmarshalInFunction_t)LoadExternal_In_Unmarshal},
-
-    {TPM_CC_ReadPublic, "TPM2_ReadPublic",
-     (MarshalInFunction_t)TSS_ReadPublic_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ReadPublic_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ReadPublic_In_Unmarshal},
-
-    {TPM_CC_ActivateCredential, "TPM2_ActivateCredential",
-     (MarshalInFunction_t)TSS_ActivateCredential_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ActivateCredential_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ActivateCredential_In_Unmarshal},
-
-    {TPM_CC_MakeCredential, "TPM2_MakeCredential",
-     (MarshalInFunction_t)TSS_MakeCredential_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_MakeCredential_Out_Unmarshalu,
-     (UnmarshalInFunction_t)MakeCredential_In_Unmarshal},
-
-    {TPM_CC_Unseal, "TPM2_Unseal",
-     (MarshalInFunction_t)TSS_Unseal_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Unseal_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Unseal_In_Unmarshal},
-
-    {TPM_CC_ObjectChangeAuth, "TPM2_ObjectChangeAuth",
-     (MarshalInFunction_t)TSS_ObjectChangeAuth_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ObjectChangeAuth_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ObjectChangeAuth_In_Unmarshal},
-
-    {TPM_CC_CreateLoaded, "TPM2_CreateLoaded",
-     (MarshalInFunction_t)TSS_CreateLoaded_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_CreateLoaded_Out_Unmarshalu,
-     (UnmarshalInFunction_t)CreateLoaded_In_Unmarshal},
-
-    {TPM_CC_Duplicate, "TPM2_Duplicate",
-     (MarshalInFunction_t)TSS_Duplicate_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Duplicate_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Duplicate_In_Unmarshal},
-
-    {TPM_CC_Rewrap, "TPM2_Rewrap",
-     (MarshalInFunction_t)TSS_Rewrap_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Rewrap_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Rewrap_In_Unmarshal},
-
-    {TPM_CC_Import, "TPM2_Import",
-     (MarshalInFunction_t)TSS_Import_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Import_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Import_In_Unmarshal},
-
-    {TPM_CC_RSA_Encrypt, "TPM2_RSA_Encrypt",
-     (MarshalInFunction_t)TSS_RSA_Encrypt_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_RSA_Encrypt_Out_Unmarshalu,
-     (UnmarshalInFunction_t)RSA_Encrypt_In_Unmarshal},
-
-    {TPM_CC_RSA_Decrypt, "TPM2_RSA_Decrypt",
-     (MarshalInFunction_t)TSS_RSA_Decrypt_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_RSA_Decrypt_Out_Unmarshalu,
-     (UnmarshalInFunction_t)RSA_Decrypt_In_Unmarshal},
-
-    {TPM_CC_ECDH_KeyGen, "TPM2_ECDH_KeyGen",
-     (MarshalInFunction_t)TSS_ECDH_KeyGen_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ECDH_KeyGen_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ECDH_KeyGen_In_Unmarshal},
-
-    {TPM_CC_ECDH_ZGen, "TPM2_ECDH_ZGen",
-     (MarshalInFunction_t)TSS_ECDH_ZGen_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ECDH_ZGen_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ECDH_ZGen_In_Unmarshal},
-
-    {TPM_CC_ECC_Parameters, "TPM2_ECC_Parameters",
-     (MarshalInFunction_t)TSS_ECC_Parameters_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ECC_Parameters_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ECC_Parameters_In_Unmarshal},
-
-    {TPM_CC_ZGen_2Phase, "TPM2_ZGen_2Phase",
-     (MarshalInFunction_t)TSS_ZGen_2Phase_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ZGen_2Phase_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ZGen_2Phase_In_Unmarshal},
-
-    {TPM_CC_EncryptDecrypt, "TPM2_EncryptDecrypt",
-     (MarshalInFunction_t)TSS_EncryptDecrypt_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_EncryptDecrypt_Out_Unmarshalu,
-     (UnmarshalInFunction_t)EncryptDecrypt_In_Unmarshal},
-
-    {TPM_CC_EncryptDecrypt2, "TPM2_EncryptDecrypt2",
-     (MarshalInFunction_t)TSS_EncryptDecrypt2_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_EncryptDecrypt2_Out_Unmarshalu,
-     (UnmarshalInFunction_t)EncryptDecrypt2_In_Unmarshal},
-
-    {TPM_CC_Hash, "TPM2_Hash",
-     (MarshalInFunction_t)TSS_Hash_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Hash_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Hash_In_Unmarshal},
-
-    {TPM_CC_HMAC, "TPM2_HMAC",
-     (MarshalInFunction_t)TSS_HMAC_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_HMAC_Out_Unmarshalu,
-     (UnmarshalInFunction_t)HMAC_In_Unmarshal},
-
-    {TPM_CC_GetRandom, "TPM2_GetRandom",
-     (MarshalInFunction_t)TSS_GetRandom_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_GetRandom_Out_Unmarshalu,
-     (UnmarshalInFunction_t)GetRandom_In_Unmarshal},
-
-    {TPM_CC_StirRandom, "TPM2_StirRandom",
-     (MarshalInFunction_t)TSS_StirRandom_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)StirRandom_In_Unmarshal},
-
-    {TPM_CC_HMAC_Start, "TPM2_HMAC_Start",
-     (MarshalInFunction_t)TSS_HMAC_Start_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_HMAC_Start_Out_Unmarshalu,
-     (UnmarshalInFunction_t)HMAC_Start_In_Unmarshal},
-
-    {TPM_CC_HashSequenceStart, "TPM2_HashSequenceStart",
-     (MarshalInFunction_t)TSS_HashSequenceStart_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_HashSequenceStart_Out_Unmarshalu,
-     (UnmarshalInFunction_t)HashSequenceStart_In_Unmarshal},
-
-    {TPM_CC_SequenceUpdate, "TPM2_SequenceUpdate",
-     (MarshalInFunction_t)TSS_SequenceUpdate_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)SequenceUpdate_In_Unmarshal},
-
-    {TPM_CC_SequenceComplete, "TPM2_SequenceComplete",
-     (MarshalInFunction_t)TSS_SequenceComplete_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_SequenceComplete_Out_Unmarshalu,
-     (UnmarshalInFunction_t)SequenceComplete_In_Unmarshal},
-
-    {TPM_CC_EventSequenceComplete, "TPM2_EventSequenceComplete",
-     (MarshalInFunction_t)TSS_EventSequenceComplete_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_EventSequenceComplete_Out_Unmarshalu,
-     (UnmarshalInFunction_t)EventSequenceComplete_In_Unmarshal},
-
-    {TPM_CC_Certify, "TPM2_Certify",
-     (MarshalInFunction_t)TSS_Certify_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Certify_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Certify_In_Unmarshal},
-
-    {TPM_CC_CertifyCreation, "TPM2_CertifyCreation",
-     (MarshalInFunction_t)TSS_CertifyCreation_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_CertifyCreation_Out_Unmarshalu,
-     (UnmarshalInFunction_t)CertifyCreation_In_Unmarshal},
-
-    {TPM_CC_Quote, "TPM2_Quote",
-     (MarshalInFunction_t)TSS_Quote_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Quote_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Quote_In_Unmarshal},
-
-    {TPM_CC_GetSessionAuditDigest, "TPM2_GetSessionAuditDigest",
-     (MarshalInFunction_t)TSS_GetSessionAuditDigest_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_GetSessionAuditDigest_Out_Unmarshalu,
-     (UnmarshalInFunction_t)GetSessionAuditDigest_In_Unmarshal},
-
-    {TPM_CC_GetCommandAuditDigest, "TPM2_GetCommandAuditDigest",
-     (MarshalInFunction_t)TSS_GetCommandAuditDigest_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_GetCommandAuditDigest_Out_Unmarshalu,
-     (UnmarshalInFunction_t)GetCommandAuditDigest_In_Unmarshal},
-
-    {TPM_CC_GetTime, "TPM2_GetTime",
-     (MarshalInFunction_t)TSS_GetTime_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_GetTime_Out_Unmarshalu,
-     (UnmarshalInFunction_t)GetTime_In_Unmarshal},
-
-    {TPM_CC_Commit, "TPM2_Commit",
-     (MarshalInFunction_t)TSS_Commit_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Commit_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Commit_In_Unmarshal},
-
-    {TPM_CC_EC_Ephemeral, "TPM2_EC_Ephemeral",
-     (MarshalInFunction_t)TSS_EC_Ephemeral_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_EC_Ephemeral_Out_Unmarshalu,
-     (UnmarshalInFunction_t)EC_Ephemeral_In_Unmarshal},
-
-    {TPM_CC_VerifySignature, "TPM2_VerifySignature",
-     (MarshalInFunction_t)TSS_VerifySignature_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_VerifySignature_Out_Unmarshalu,
-     (UnmarshalInFunction_t)VerifySignature_In_Unmarshal},
-
-    {TPM_CC_Sign, "TPM2_Sign",
-     (MarshalInFunction_t)TSS_Sign_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_Sign_Out_Unmarshalu,
-     (UnmarshalInFunction_t)Sign_In_Unmarshal},
-
-    {TPM_CC_SetCommandCodeAuditStatus, "TPM2_SetCommandCodeAuditStatus",
-     (MarshalInFunction_t)TSS_SetCommandCodeAuditStatus_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)SetCommandCodeAuditStatus_In_Unmarshal},
-
-    {TPM_CC_PCR_Extend, "TPM2_PCR_Extend",
-     (MarshalInFunction_t)TSS_PCR_Extend_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PCR_Extend_In_Unmarshal},
-
-    {TPM_CC_PCR_Event, "TPM2_PCR_Event",
-     (MarshalInFunction_t)TSS_PCR_Event_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_PCR_Event_Out_Unmarshalu,
-     (UnmarshalInFunction_t)PCR_Event_In_Unmarshal},
-
-    {TPM_CC_PCR_Read, "TPM2_PCR_Read",
-     (MarshalInFunction_t)TSS_PCR_Read_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_PCR_Read_Out_Unmarshalu,
-     (UnmarshalInFunction_t)PCR_Read_In_Unmarshal},
-
-    {TPM_CC_PCR_Allocate, "TPM2_PCR_Allocate",
-     (MarshalInFunction_t)TSS_PCR_Allocate_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_PCR_Allocate_Out_Unmarshalu,
-     (UnmarshalInFunction_t)PCR_Allocate_In_Unmarshal},
-
-    {TPM_CC_PCR_SetAuthPolicy, "TPM2_PCR_SetAuthPolicy",
-     (MarshalInFunction_t)TSS_PCR_SetAuthPolicy_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PCR_SetAuthPolicy_In_Unmarshal},
-
-    {TPM_CC_PCR_SetAuthValue, "TPM2_PCR_SetAuthValue",
-     (MarshalInFunction_t)TSS_PCR_SetAuthValue_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PCR_SetAuthValue_In_Unmarshal},
-
-    {TPM_CC_PCR_Reset, "TPM2_PCR_Reset",
-     (MarshalInFunction_t)TSS_PCR_Reset_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PCR_Reset_In_Unmarshal},
-
-    {TPM_CC_PolicySigned, "TPM2_PolicySigned",
-     (MarshalInFunction_t)TSS_PolicySigned_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_PolicySigned_Out_Unmarshalu,
-     (UnmarshalInFunction_t)PolicySigned_In_Unmarshal},
-
-    {TPM_CC_PolicySecret, "TPM2_PolicySecret",
-     (MarshalInFunction_t)TSS_PolicySecret_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_PolicySecret_Out_Unmarshalu,
-     (UnmarshalInFunction_t)PolicySecret_In_Unmarshal},
-
-    {TPM_CC_PolicyTicket, "TPM2_PolicyTicket",
-     (MarshalInFunction_t)TSS_PolicyTicket_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyTicket_In_Unmarshal},
-
-    {TPM_CC_PolicyOR, "TPM2_PolicyOR",
-     (MarshalInFunction_t)TSS_PolicyOR_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyOR_In_Unmarshal},
-
-    {TPM_CC_PolicyPCR, "TPM2_PolicyPCR",
-     (MarshalInFunction_t)TSS_PolicyPCR_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyPCR_In_Unmarshal},
-
-    {TPM_CC_PolicyLocality, "TPM2_PolicyLocality",
-     (MarshalInFunction_t)TSS_PolicyLocality_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyLocality_In_Unmarshal},
-
-    {TPM_CC_PolicyNV, "TPM2_PolicyNV",
-     (MarshalInFunction_t)TSS_PolicyNV_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyNV_In_Unmarshal},
-
-    {TPM_CC_PolicyAuthorizeNV, "TPM2_PolicyAuthorizeNV",
-     (MarshalInFunction_t)TSS_PolicyAuthorizeNV_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyAuthorizeNV_In_Unmarshal},
-
-    {TPM_CC_PolicyCounterTimer, "TPM2_PolicyCounterTimer",
-     (MarshalInFunction_t)TSS_PolicyCounterTimer_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyCounterTimer_In_Unmarshal},
-
-    {TPM_CC_PolicyCommandCode, "TPM2_PolicyCommandCode",
-     (MarshalInFunction_t)TSS_PolicyCommandCode_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyCommandCode_In_Unmarshal},
-
-    {TPM_CC_PolicyPhysicalPresence, "TPM2_PolicyPhysicalPresence",
-     (MarshalInFunction_t)TSS_PolicyPhysicalPresence_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyPhysicalPresence_In_Unmarshal},
-
-    {TPM_CC_PolicyCpHash, "TPM2_PolicyCpHash",
-     (MarshalInFunction_t)TSS_PolicyCpHash_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyCpHash_In_Unmarshal},
-
-    {TPM_CC_PolicyNameHash, "TPM2_PolicyNameHash",
-     (MarshalInFunction_t)TSS_PolicyNameHash_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyNameHash_In_Unmarshal},
-
-    {TPM_CC_PolicyDuplicationSelect, "TPM2_PolicyDuplicationSelect",
-     (MarshalInFunction_t)TSS_PolicyDuplicationSelect_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyDuplicationSelect_In_Unmarshal},
-
-    {TPM_CC_PolicyAuthorize, "TPM2_PolicyAuthorize",
-     (MarshalInFunction_t)TSS_PolicyAuthorize_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyAuthorize_In_Unmarshal},
-
-    {TPM_CC_PolicyAuthValue, "TPM2_PolicyAuthValue",
-     (MarshalInFunction_t)TSS_PolicyAuthValue_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyAuthValue_In_Unmarshal},
-
-    {TPM_CC_PolicyPassword, "TPM2_PolicyPassword",
-     (MarshalInFunction_t)TSS_PolicyPassword_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyPassword_In_Unmarshal},
-
-    {TPM_CC_PolicyGetDigest, "TPM2_PolicyGetDigest",
-     (MarshalInFunction_t)TSS_PolicyGetDigest_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_PolicyGetDigest_Out_Unmarshalu,
-     (UnmarshalInFunction_t)PolicyGetDigest_In_Unmarshal},
-
-    {TPM_CC_PolicyNvWritten, "TPM2_PolicyNvWritten",
-     (MarshalInFunction_t)TSS_PolicyNvWritten_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyNvWritten_In_Unmarshal},
-
-    {TPM_CC_PolicyTemplate, "TPM2_PolicyTemplate",
-     (MarshalInFunction_t)TSS_PolicyTemplate_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PolicyTemplate_In_Unmarshal},
-
-    {TPM_CC_CreatePrimary, "TPM2_CreatePrimary",
-     (MarshalInFunction_t)TSS_CreatePrimary_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_CreatePrimary_Out_Unmarshalu,
-     (UnmarshalInFunction_t)CreatePrimary_In_Unmarshal},
-
-    {TPM_CC_HierarchyControl, "TPM2_HierarchyControl",
-     (MarshalInFunction_t)TSS_HierarchyControl_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)HierarchyControl_In_Unmarshal},
-
-    {TPM_CC_SetPrimaryPolicy, "TPM2_SetPrimaryPolicy",
-     (MarshalInFunction_t)TSS_SetPrimaryPolicy_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)SetPrimaryPolicy_In_Unmarshal},
-
-    {TPM_CC_ChangePPS, "TPM2_ChangePPS",
-     (MarshalInFunction_t)TSS_ChangePPS_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)ChangePPS_In_Unmarshal},
-
-    {TPM_CC_ChangeEPS, "TPM2_ChangeEPS",
-     (MarshalInFunction_t)TSS_ChangeEPS_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)ChangeEPS_In_Unmarshal},
-
-    {TPM_CC_Clear, "TPM2_Clear",
-     (MarshalInFunction_t)TSS_Clear_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)Clear_In_Unmarshal},
-
-    {TPM_CC_ClearControl, "TPM2_ClearControl",
-     (MarshalInFunction_t)TSS_ClearControl_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)ClearControl_In_Unmarshal},
-
-    {TPM_CC_HierarchyChangeAuth, "TPM2_HierarchyChangeAuth",
-     (MarshalInFunction_t)TSS_HierarchyChangeAuth_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)HierarchyChangeAuth_In_Unmarshal},
-
-    {TPM_CC_DictionaryAttackLockReset, "TPM2_DictionaryAttackLockReset",
-     (MarshalInFunction_t)TSS_DictionaryAttackLockReset_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)DictionaryAttackLockReset_In_Unmarshal},
-
-    {TPM_CC_DictionaryAttackParameters, "TPM2_DictionaryAttackParameters",
-     (MarshalInFunction_t)TSS_DictionaryAttackParameters_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)DictionaryAttackParameters_In_Unmarshal},
-
-    {TPM_CC_PP_Commands, "TPM2_PP_Commands",
-     (MarshalInFunction_t)TSS_PP_Commands_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)PP_Commands_In_Unmarshal},
-
-    {TPM_CC_SetAlgorithmSet, "TPM2_SetAlgorithmSet",
-     (MarshalInFunction_t)TSS_SetAlgorithmSet_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)SetAlgorithmSet_In_Unmarshal},
-
-    {TPM_CC_ContextSave, "TPM2_ContextSave",
-     (MarshalInFunction_t)TSS_ContextSave_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ContextSave_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ContextSave_In_Unmarshal},
-
-    {TPM_CC_ContextLoad, "TPM2_ContextLoad",
-     (MarshalInFunction_t)TSS_ContextLoad_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_ContextLoad_Out_Unmarshalu,
-     (UnmarshalInFunction_t)ContextLoad_In_Unmarshal},
-
-    {TPM_CC_FlushContext, "TPM2_FlushContext",
-     (MarshalInFunction_t)TSS_FlushContext_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)FlushContext_In_Unmarshal},
-
-    {TPM_CC_EvictControl, "TPM2_EvictControl",
-     (MarshalInFunction_t)TSS_EvictControl_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)EvictControl_In_Unmarshal},
-
-    {TPM_CC_ReadClock, "TPM2_ReadClock",
-     NULL,
-     (UnmarshalOutFunction_t)TSS_ReadClock_Out_Unmarshalu,
-     NULL},
-
-    {TPM_CC_ClockSet, "TPM2_ClockSet",
-     (MarshalInFunction_t)TSS_ClockSet_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)ClockSet_In_Unmarshal},
-
-    {TPM_CC_ClockRateAdjust, "TPM2_ClockRateAdjust",
-     (MarshalInFunction_t)TSS_ClockRateAdjust_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)ClockRateAdjust_In_Unmarshal},
-    
-    {TPM_CC_GetCapability, "TPM2_GetCapability",
-     (MarshalInFunction_t)TSS_GetCapability_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_GetCapability_Out_Unmarshalu,
-     (UnmarshalInFunction_t)GetCapability_In_Unmarshal},
-    
-    {TPM_CC_TestParms, "TPM2_TestParms",
-     (MarshalInFunction_t)TSS_TestParms_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)TestParms_In_Unmarshal},
-
-    {TPM_CC_NV_DefineSpace, "TPM2_NV_DefineSpace",
-     (MarshalInFunction_t)TSS_NV_DefineSpace_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_DefineSpace_In_Unmarshal},
-
-    {TPM_CC_NV_UndefineSpace, "TPM2_NV_UndefineSpace",
-     (MarshalInFunction_t)TSS_NV_UndefineSpace_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_UndefineSpace_In_Unmarshal},
-
-    {TPM_CC_NV_UndefineSpaceSpecial, "TPM2_NV_UndefineSpaceSpecial",
-     (MarshalInFunction_t)TSS_NV_UndefineSpaceSpecial_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_UndefineSpaceSpecial_In_Unmarshal},
-
-    {TPM_CC_NV_ReadPublic, "TPM2_NV_ReadPublic",
-     (MarshalInFunction_t)TSS_NV_ReadPublic_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_NV_ReadPublic_Out_Unmarshalu,
-     (UnmarshalInFunction_t)NV_ReadPublic_In_Unmarshal},
-
-    {TPM_CC_NV_Write, "TPM2_NV_Write",
-     (MarshalInFunction_t)TSS_NV_Write_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_Write_In_Unmarshal},
-
-    {TPM_CC_NV_Increment, "TPM2_NV_Increment",
-     (MarshalInFunction_t)TSS_NV_Increment_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_Increment_In_Unmarshal},
-
-    {TPM_CC_NV_Extend, "TPM2_NV_Extend",
-     (MarshalInFunction_t)TSS_NV_Extend_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_Extend_In_Unmarshal},
-
-    {TPM_CC_NV_SetBits, "TPM2_NV_SetBits",
-     (MarshalInFunction_t)TSS_NV_SetBits_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_SetBits_In_Unmarshal},
-
-    {TPM_CC_NV_WriteLock, "TPM2_NV_WriteLock",
-     (MarshalInFunction_t)TSS_NV_WriteLock_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_WriteLock_In_Unmarshal},
-
-    {TPM_CC_NV_GlobalWriteLock, "TPM2_NV_GlobalWriteLock",
-     (MarshalInFunction_t)TSS_NV_GlobalWriteLock_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_GlobalWriteLock_In_Unmarshal},
-
-    {TPM_CC_NV_Read, "TPM2_NV_Read",
-     (MarshalInFunction_t)TSS_NV_Read_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_NV_Read_Out_Unmarshalu,
-     (UnmarshalInFunction_t)NV_Read_In_Unmarshal},
-
-    {TPM_CC_NV_ReadLock, "TPM2_NV_ReadLock",
-     (MarshalInFunction_t)TSS_NV_ReadLock_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_ReadLock_In_Unmarshal},
-
-    {TPM_CC_NV_ChangeAuth, "TPM2_NV_ChangeAuth",
-     (MarshalInFunction_t)TSS_NV_ChangeAuth_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)NV_ChangeAuth_In_Unmarshal},
-
-    {TPM_CC_NV_Certify, "TPM2_NV_Certify",
-     (MarshalInFunction_t)TSS_NV_Certify_In_Marshalu,
-     (UnmarshalOutFunction_t)TSS_NV_Certify_Out_Unmarshalu,
-     (UnmarshalInFunction_t)NV_Certify_In_Unmarshal},
-#ifdef TPM_TPM20
-    {NTC2_CC_PreConfig,"NTC2_CC_PreConfig",
-     (MarshalInFunction_t)TSS_NTC2_PreConfig_In_Marshalu,
-     NULL,
-     (UnmarshalInFunction_t)TSS_NTC2_PreConfig_In_Unmarshalu},
-     
-    {NTC2_CC_LockPreConfig,"NTC2_CC_LockPreConfig",
-     NULL,
-     NULL,
-     NULL},
-
-    {NTC2_CC_GetConfig,"NTC2_CC_GetConfig",
-     NULL,
-     (UnmarshalOutFunction_t)TSS_NTC2_GetConfig_Out_Unmarshalu,
-     NULL}
-#endif
-};
-
-/* TSS_MarshalTable_Process() indexes into the command marshal table, and saves the marshal and
-   unmarshal functions */
-
-static TPM_RC TSS_MarshalTable_Process(TSS_AUTH_CONTEXT *tssAuthContext,
-				       TPM_CC commandCode)
+static void TSS_MarshalTable_Process(TSS_AUTH_CONTEXT *tssAuthContext,
+				     const TSS_COMMAND_DESCRIPTOR *descriptor)
 {
-    TPM_RC rc = 0;
-    size_t index;
-    int found = FALSE;
-
-    /* get the command index in the dispatch table */
-    for (index = 0 ; index < (sizeof(marshalTable) / sizeof(MARSHAL_TABLE)) ; (index)++) {
-	if (marshalTable[index].commandCode == commandCode) {
-	    found = TRUE;
-	    break;
-	}
-    }
-    if (found) {
-	tssAuthContext->commandCode = commandCode;
-	tssAuthContext->commandText = marshalTable[index].commandText;
-	tssAuthContext->marshalInFunction = marshalTable[index].marshalInFunction;
-	tssAuthContext->unmarshalOutFunction = marshalTable[index].unmarshalOutFunction;
-	tssAuthContext->unmarshalInFunction = marshalTable[index].unmarshalInFunction;
-    }
-    else {
-	if (tssVerbose) printf("TSS_MarshalTable_Process: "
-			       "commandCode %08x not found in marshal table\n",
-			       commandCode);
-	rc = TSS_RC_COMMAND_UNIMPLEMENTED;
-    }
-    return rc;
+    tssAuthContext->commandCode = descriptor->commandCode;
+    tssAuthContext->commandText = descriptor->commandText;
+    tssAuthContext->marshalInFunction = descriptor->marshalInFunction;
+    tssAuthContext->unmarshalOutFunction = descriptor->unmarshalOutFunction;
+    tssAuthContext->unmarshalInFunction = descriptor->unmarshalInFunction;
+    return;
 }
 
 /* TSS_Marshal() marshals the input parameters into the TSS Authorization context.
 
    It also sets other member of the context in preparation for the rest of the sequence.  
+
+   'target' is caller supplied memory used to unmarshal the marshaled parameters as a validity
+   check.  If it is NULL, the parameters are not validated.
 */
 
 TPM_RC TSS_Marshal(TSS_AUTH_CONTEXT *tssAuthContext,
 		   COMMAND_PARAMETERS *in,
-		   TPM_CC commandCode)
+		   const TSS_COMMAND_DESCRIPTOR *descriptor,
+		   COMMAND_PARAMETERS *target)
 {
     TPM_RC 		rc = 0;
     TPMI_ST_COMMAND_TAG tag = TPM_ST_NO_SESSIONS;	/* default until sessions are added */
     uint8_t 		*buffer;			/* for marshaling */
     uint8_t 		*bufferu;			/* for test unmarshaling */
     uint32_t 		size;
+    TPM_CC		commandCode = descriptor->commandCode;
     
-    /* index from command code to table and save items for this command */
+    /* save items for this command */
     if (rc == 0) {
-	rc = TSS_MarshalTable_Process(tssAuthContext, commandCode);
+	TSS_MarshalTable_Process(tssAuthContext, descriptor);
     }
     /* get the number of command and response handles from the TPM table */
     if (rc == 0) {
@@ -754,22 +163,14 @@ TPM_RC TSS_Marshal(TSS_AUTH_CONTEXT *tssAuthContext,
 	}
     }
     /* unmarshal to validate the input parameters */
-    if ((rc == 0) && (tssAuthContext->unmarshalInFunction != NULL)) {
-	COMMAND_PARAMETERS *target = NULL;
+    if ((rc == 0) && (target != NULL) && (tssAuthContext->unmarshalInFunction != NULL)) {
 	TPM_HANDLE 	handles[MAX_HANDLE_NUM];
-	if (rc == 0) {
-	    rc = TSS_Malloc((unsigned char **)&target,
-			    sizeof(COMMAND_PARAMETERS));	/* freed @1 */
-	}
-	if (rc == 0) {
-	    size = sizeof(tssAuthContext->commandBuffer) -
-		   (tssAuthContext->commandHandleCount * sizeof(TPM_HANDLE));
-	    rc = tssAuthContext->unmarshalInFunction(target, &bufferu, &size, handles);
-	    if ((rc != 0) && tssVerbose) {
-		printf("TSS_Marshal: Invalid command parameter\n");
-	    }
+	size = sizeof(tssAuthContext->commandBuffer) -
+	       (tssAuthContext->commandHandleCount * sizeof(TPM_HANDLE));
+	rc = tssAuthContext->unmarshalInFunction(target, &bufferu, &size, handles);
+	if ((rc != 0) && tssVerbose) {
+	    printf("TSS_Marshal: Invalid command parameter\n");
 	}
-	free(target);		/* @1 */
     }
     /* back fill the correct commandSize */
     if (rc == 0) {
@@ -44,10 +44,44 @@
 
 #include <ibmtss/tss.h>
 #include "tssccattributes.h"
+#include "tssauth.h"
+
+struct TSS_HMAC_CONTEXT;
+
+/* functions for command pre- and post- processing and printing */
+
+typedef TPM_RC (*TSS_PreProcessFunction_t)(TSS_CONTEXT *tssContext,
+					   COMMAND_PARAMETERS *in,
+					   EXTRA_PARAMETERS *extra);
+typedef TPM_RC (*TSS_ChangeAuthFunction_t)(TSS_CONTEXT *tssContext,
+					   struct TSS_HMAC_CONTEXT *session,
+					   size_t handleNumber,
+					   COMMAND_PARAMETERS *in);
+typedef TPM_RC (*TSS_PostProcessFunction_t)(TSS_CONTEXT *tssContext,
+					    COMMAND_PARAMETERS *in,
+					    RESPONSE_PARAMETERS *out,
+					    EXTRA_PARAMETERS *extra);
+typedef void (*TSS_InPrintFunction_t)(COMMAND_PARAMETERS *in, unsigned int indent);
+
+/* The command table entry, holding everything the TSS needs to execute a command */
+
+typedef struct TSS_COMMAND_DESCRIPTOR {
+    TPM_CC 			commandCode;
+    const char 			*commandText;
+    MarshalInFunction_t 	marshalInFunction;	/* marshal input command */
+    UnmarshalOutFunction_t 	unmarshalOutFunction;	/* unmarshal output response */
+    UnmarshalInFunction_t	unmarshalInFunction;	/* unmarshal input command for parameter
+							   checking */
+    TSS_PreProcessFunction_t	preProcessFunction;
+    TSS_ChangeAuthFunction_t	changeAuthFunction;
+    TSS_PostProcessFunction_t 	postProcessFunction;
+    TSS_InPrintFunction_t	inPrintFunction;	/* NULL if TPM_TSS_NO_PRINT */
+} TSS_COMMAND_DESCRIPTOR;
 
 TPM_RC TSS_Marshal(TSS_AUTH_CONTEXT *tssAuthContext,
 		   COMMAND_PARAMETERS *in,
-		   TPM_CC commandCode);
+		   const TSS_COMMAND_DESCRIPTOR *descriptor,
+		   COMMAND_PARAMETERS *target);
 
 TPM_RC TSS_Unmarshal(TSS_AUTH_CONTEXT *tssAuthContext,
 		     RESPONSE_PARAMETERS *out);
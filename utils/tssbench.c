@@ -0,0 +1,896 @@
+/********************************************************************************/
+/*										*/
+/*			   TSS Command Benchmark				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* tssbench times TSS_Execute() for representative commands against the in process mock TPM, so
+   that the result is the TSS command path cost: marshaling, authorization, session HMAC,
+   parameter encryption, and session state storage.
+
+   For each case, it reports the wall clock time per command, the time with the mock TPM excluded,
+   and, with glibc, the number of heap allocations per command made outside the mock.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef TPM_POSIX
+#include <unistd.h>
+#endif
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tsstransmit.h>
+#include <ibmtss/tssresponsecode.h>
+
+#include "objecttemplates.h"
+#include "mocktpm.h"
+
+/* the virtualization cases use twice as many objects or sessions as the mock TPM slots */
+
+#define BENCH_VIRTUAL_SLOTS	3
+#define BENCH_VIRTUAL_COUNT	(2 * BENCH_VIRTUAL_SLOTS)
+#define BENCH_VIRTUAL_GAP	4
+
+/* the sessions and key shared by the cases */
+
+typedef struct BENCH_STATE {
+    TPM_HANDLE		primaryHandle;		/* RSA storage key, the salt key */
+    TPMI_SH_AUTH_SESSION	hmacSession;	/* unsalted, unbound */
+    TPMI_SH_AUTH_SESSION	saltedSession;	/* RSA salted, AES-128 CFB */
+    TPMI_SH_AUTH_SESSION	xorSession;	/* RSA salted, XOR */
+    TPMI_SH_AUTH_SESSION	auditSession;	/* unsalted, unbound */
+    /* a virtualization case runs in its own TSS context and mock TPM, with its own data
+       directory, since session handles repeat across mock TPMs */
+    const char		*dataDir;
+    TSS_CONTEXT		*virtualContext;
+    char		virtualDir[64];
+    TPM_HANDLE		virtualHandles[BENCH_VIRTUAL_COUNT];	/* objects or sessions */
+    size_t		virtualNext;		/* round robin index */
+} BENCH_STATE;
+
+typedef TPM_RC (*BenchFunction_t)(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+
+typedef struct BENCH_CASE {
+    const char		*name;
+    BenchFunction_t	function;
+    BenchFunction_t	setup;		/* NULL, or creates the state for the case */
+    BenchFunction_t	cleanup;
+} BENCH_CASE;
+
+static TPM_RC benchGetRandom(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchPcrExtendPw(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchPcrExtendHmac(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchHashSaltedEncrypt(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchHashThreeSessions(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchVirtualObjectsSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchVirtualObjects(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchVirtualSessionsSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchVirtualSessions(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchVirtualGapSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchVirtualGap(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchVirtualCleanup(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+
+/* The virtualization cases are last, since with -if they are skipped, and with TPM_RANDOM_SEED
+   the earlier cases must consume the same random numbers when recorded and replayed */
+
+static const BENCH_CASE benchCases [] = {
+    {"getrandom-nosession",	benchGetRandom, NULL, NULL},
+    {"pcrextend-pw",		benchPcrExtendPw, NULL, NULL},
+    {"pcrextend-hmac",		benchPcrExtendHmac, NULL, NULL},
+    {"hash-salted-encrypt",	benchHashSaltedEncrypt, NULL, NULL},
+    {"hash-three-sessions",	benchHashThreeSessions, NULL, NULL},
+    {"virtual-objects",		benchVirtualObjects,
+     benchVirtualObjectsSetup, benchVirtualCleanup},
+    {"virtual-sessions",	benchVirtualSessions,
+     benchVirtualSessionsSetup, benchVirtualCleanup},
+    {"virtual-context-gap",	benchVirtualGap,
+     benchVirtualGapSetup, benchVirtualCleanup},
+};
+
+static TPM_RC benchSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchStartSession(TSS_CONTEXT *tssContext,
+				TPMI_SH_AUTH_SESSION *sessionHandle,
+				TPMI_DH_OBJECT tpmKey,
+				TPMI_ALG_SYM algorithm);
+static TPM_RC benchCleanup(TSS_CONTEXT *tssContext, BENCH_STATE *state);
+static TPM_RC benchFlush(TSS_CONTEXT *tssContext, TPM_HANDLE handle);
+static TPM_RC benchPcrExtendSession(TSS_CONTEXT *tssContext, TPMI_SH_AUTH_SESSION sessionHandle);
+static TPM_RC benchVirtualCreate(BENCH_STATE *state,
+				 size_t objectSlots,
+				 size_t sessionSlots,
+				 uint64_t gapMax);
+static TPM_RC benchCreatePrimary(TSS_CONTEXT *tssContext, TPM_HANDLE *objectHandle);
+static TPM_RC benchTransmit(TSS_CONTEXT *tssContext,
+			    uint8_t *responseBuffer, uint32_t *read,
+			    const uint8_t *commandBuffer, uint32_t written,
+			    const char *message);
+static uint64_t benchNsec(void);
+static void printUsage(void);
+
+/* The bench transport wraps the mock TPM so that its time and allocations are excluded */
+
+static const TSS_TRANSPORT benchTransport = {
+    "mock",
+    MockTpm_Open,
+    benchTransmit,
+    NULL,
+    NULL,
+    NULL,
+    MockTpm_TransmitPlatform,
+    MockTpm_Close
+};
+
+static uint64_t mockNsec;		/* time in the mock TPM */
+static unsigned long allocCount;	/* allocations outside the mock TPM */
+static int allocCounting = FALSE;
+
+#ifdef __GLIBC__
+
+/* With glibc, the heap functions are interposed to count allocations, including those made by the
+   TSS library and the crypto library */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    if (allocCounting) allocCount++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (allocCounting) allocCount++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (allocCounting) allocCount++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+#define BENCH_COUNT_ALLOCS	TRUE
+#else
+#define BENCH_COUNT_ALLOCS	FALSE
+#endif	/* __GLIBC__ */
+
+int verbose = FALSE;
+
+int main(int argc, char *argv[])
+{
+    TPM_RC			rc = 0;
+    int				i;    	/* argc iterator */
+    TSS_CONTEXT			*tssContext = NULL;
+    BENCH_STATE			state;
+    const char			*caseName = NULL;
+    unsigned int		loops = 1000;
+    unsigned int		count;
+    size_t			c;
+    char			dataDir[] = "/tmp/tssbenchXXXXXX";
+    int				haveDataDir = FALSE;
+    uint64_t			startNsec;
+    uint64_t			totalNsec;
+    unsigned long		allocs;
+    int				mockInterface = TRUE;
+
+    setvbuf(stdout, 0, _IONBF, 0);      /* output may be going through pipe to log file */
+    TSS_SetProperty(NULL, TPM_TRACE_LEVEL, "1");
+
+    /* command line argument defaults */
+    for (i=1 ; (i<argc) && (rc == 0) ; i++) {
+	if (strcmp(argv[i],"-c") == 0) {
+	    i++;
+	    if (i < argc) {
+		caseName = argv[i];
+	    }
+	    else {
+		printf("-c option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-l") == 0) {
+	    i++;
+	    if (i < argc) {
+		loops = atoi(argv[i]);
+	    }
+	    else {
+		printf("-l option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-if") == 0) {
+	    mockInterface = FALSE;
+	}
+ 	else if (strcmp(argv[i],"-h") == 0) {
+	    printUsage();
+	}
+	else if (strcmp(argv[i],"-v") == 0) {
+	    verbose = TRUE;
+	    TSS_SetProperty(NULL, TPM_TRACE_LEVEL, "2");
+	}
+	else {
+	    printf("\n%s is not a valid option\n", argv[i]);
+	    printUsage();
+	}
+    }
+    if (loops == 0) {
+	printf("-l must be greater than zero\n");
+	printUsage();
+    }
+    /* session state files go to a private directory, removed at the end */
+    if (rc == 0) {
+	if (mkdtemp(dataDir) == NULL) {
+	    printf("tssbench: Error creating data directory %s\n", dataDir);
+	    rc = TSS_RC_FILE_OPEN;
+	}
+	else {
+	    haveDataDir = TRUE;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_RegisterTransport(&benchTransport);
+    }
+    /* Start a TSS context */
+    if (rc == 0) {
+	rc = TSS_Create(&tssContext);
+    }
+    /* -if leaves TPM_INTERFACE_TYPE to the environment, e.g. a tssmockserver */
+    if ((rc == 0) && mockInterface) {
+	rc = TSS_SetProperty(tssContext, TPM_INTERFACE_TYPE, "mock");
+    }
+    if (rc == 0) {
+	rc = TSS_SetProperty(tssContext, TPM_DATA_DIR, dataDir);
+    }
+    if (rc == 0) {
+	state.dataDir = dataDir;
+	rc = benchSetup(tssContext, &state);
+    }
+    if (rc == 0) {
+	printf("%-24s %10s %12s %12s %10s\n",
+	       "case", "ops", "ns/op", "tss ns/op", "allocs/op");
+    }
+    for (c = 0 ; (rc == 0) && (c < sizeof(benchCases) / sizeof(BENCH_CASE)) ; c++) {
+	if ((caseName != NULL) && (strcmp(caseName, benchCases[c].name) != 0)) {
+	    continue;
+	}
+	/* the virtualization cases set the mock TPM limits */
+	if ((benchCases[c].setup != NULL) && !mockInterface) {
+	    printf("%-24s skipped, needs the in process mock TPM\n", benchCases[c].name);
+	    continue;
+	}
+	if ((rc == 0) && (benchCases[c].setup != NULL)) {
+	    rc = benchCases[c].setup(tssContext, &state);
+	}
+	/* one untimed command to load the session state */
+	if (rc == 0) {
+	    rc = benchCases[c].function(tssContext, &state);
+	}
+	if (rc == 0) {
+	    mockNsec = 0;
+	    allocCount = 0;
+	    allocCounting = TRUE;
+	    startNsec = benchNsec();
+	}
+	for (count = 0 ; (rc == 0) && (count < loops) ; count++) {
+	    rc = benchCases[c].function(tssContext, &state);
+	}
+	if (rc == 0) {
+	    totalNsec = benchNsec() - startNsec;
+	    allocCounting = FALSE;
+	    allocs = allocCount;
+	    printf("%-24s %10u %12.0f %12.0f ",
+		   benchCases[c].name, loops,
+		   (double)totalNsec / loops,
+		   (double)(totalNsec - mockNsec) / loops);
+	    if (BENCH_COUNT_ALLOCS) {
+		printf("%10.1f\n", (double)allocs / loops);
+	    }
+	    else {
+		printf("%10s\n", "n/a");
+	    }
+	}
+	else {
+	    allocCounting = FALSE;
+	    printf("tssbench: case %s failed\n", benchCases[c].name);
+	}
+	if (benchCases[c].cleanup != NULL) {
+	    TPM_RC rc1 = benchCases[c].cleanup(tssContext, &state);
+	    if (rc == 0) {
+		rc = rc1;
+	    }
+	}
+    }
+    if (tssContext != NULL) {
+	TPM_RC rc1 = benchCleanup(tssContext, &state);
+	if (rc == 0) {
+	    rc = rc1;
+	}
+    }
+    {
+	TPM_RC rc1 = TSS_Delete(tssContext);
+	if (rc == 0) {
+	    rc = rc1;
+	}
+    }
+    if (haveDataDir) {
+	rmdir(dataDir);
+    }
+    if (rc == 0) {
+	if (verbose) printf("tssbench: success\n");
+    }
+    else {
+	const char *msg;
+	const char *submsg;
+	const char *num;
+	printf("tssbench: failed, rc %08x\n", rc);
+	TSS_ResponseCode_toString(&msg, &submsg, &num, rc);
+	printf("%s%s%s\n", msg, submsg, num);
+	rc = EXIT_FAILURE;
+    }
+    return rc;
+}
+
+/* benchTransmit() times the mock TPM and pauses allocation counting while it runs */
+
+static TPM_RC benchTransmit(TSS_CONTEXT *tssContext,
+			    uint8_t *responseBuffer, uint32_t *read,
+			    const uint8_t *commandBuffer, uint32_t written,
+			    const char *message)
+{
+    TPM_RC	rc = 0;
+    int		counting = allocCounting;
+    uint64_t	startNsec;
+
+    allocCounting = FALSE;
+    startNsec = benchNsec();
+    rc = MockTpm_Transmit(tssContext, responseBuffer, read, commandBuffer, written, message);
+    mockNsec += benchNsec() - startNsec;
+    allocCounting = counting;
+    return rc;
+}
+
+static uint64_t benchNsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* benchSetup() creates the RSA primary key used as the salt key and starts the sessions */
+
+static TPM_RC benchSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPM_RC			rc = 0;
+
+    state->primaryHandle = TPM_RH_NULL;
+    state->hmacSession = TPM_RH_NULL;
+    state->saltedSession = TPM_RH_NULL;
+    state->xorSession = TPM_RH_NULL;
+    state->auditSession = TPM_RH_NULL;
+    state->virtualContext = NULL;
+    if (rc == 0) {
+	rc = benchCreatePrimary(tssContext, &state->primaryHandle);
+    }
+    if (rc == 0) {
+	rc = benchStartSession(tssContext, &state->hmacSession, TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    if (rc == 0) {
+	rc = benchStartSession(tssContext, &state->saltedSession, state->primaryHandle,
+			       TPM_ALG_AES);
+    }
+    if (rc == 0) {
+	rc = benchStartSession(tssContext, &state->xorSession, state->primaryHandle,
+			       TPM_ALG_XOR);
+    }
+    if (rc == 0) {
+	rc = benchStartSession(tssContext, &state->auditSession, TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    return rc;
+}
+
+/* benchCreatePrimary() creates an RSA 2048 storage primary key */
+
+static TPM_RC benchCreatePrimary(TSS_CONTEXT *tssContext, TPM_HANDLE *objectHandle)
+{
+    TPM_RC			rc = 0;
+    CreatePrimary_In 		in;
+    CreatePrimary_Out 		out;
+    TPMA_OBJECT			addObjectAttributes;
+    TPMA_OBJECT			deleteObjectAttributes;
+
+    if (rc == 0) {
+	addObjectAttributes.val = TPMA_OBJECT_NODA;
+	deleteObjectAttributes.val = 0;
+	in.primaryHandle = TPM_RH_OWNER;
+	in.inSensitive.sensitive.userAuth.t.size = 0;
+	in.inSensitive.sensitive.data.t.size = 0;
+	in.outsideInfo.t.size = 0;
+	in.creationPCR.count = 0;
+	rc = asymPublicTemplate(&in.inPublic.publicArea,
+				addObjectAttributes, deleteObjectAttributes,
+				TYPE_ST, TPM_ALG_RSA, TPM_ECC_NONE,
+				TPM_ALG_SHA256, TPM_ALG_SHA256,
+				NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_Execute(tssContext,
+			 (RESPONSE_PARAMETERS *)&out,
+			 (COMMAND_PARAMETERS *)&in,
+			 NULL,
+			 TPM_CC_CreatePrimary,
+			 TPM_RS_PW, NULL, 0,
+			 TPM_RH_NULL, NULL, 0);
+    }
+    if (rc == 0) {
+	*objectHandle = out.objectHandle;
+    }
+    return rc;
+}
+
+static TPM_RC benchStartSession(TSS_CONTEXT *tssContext,
+				TPMI_SH_AUTH_SESSION *sessionHandle,
+				TPMI_DH_OBJECT tpmKey,
+				TPMI_ALG_SYM algorithm)
+{
+    TPM_RC			rc = 0;
+    StartAuthSession_In 	in;
+    StartAuthSession_Out 	out;
+    StartAuthSession_Extra	extra;
+
+    if (rc == 0) {
+	in.sessionType = TPM_SE_HMAC;
+	in.tpmKey = tpmKey;
+	in.encryptedSalt.b.size = 0;
+	in.bind = TPM_RH_NULL;
+	in.nonceCaller.t.size = 0;
+	in.symmetric.algorithm = algorithm;
+	in.authHash = TPM_ALG_SHA256;
+	if (algorithm == TPM_ALG_XOR) {
+	    in.symmetric.keyBits.xorr = TPM_ALG_SHA256;
+	    in.symmetric.mode.sym = TPM_ALG_NULL;
+	}
+	else if (algorithm == TPM_ALG_AES) {
+	    in.symmetric.keyBits.aes = 128;
+	    in.symmetric.mode.aes = TPM_ALG_CFB;
+	}
+	extra.bindPassword = NULL;
+	rc = TSS_Execute(tssContext,
+			 (RESPONSE_PARAMETERS *)&out,
+			 (COMMAND_PARAMETERS *)&in,
+			 (EXTRA_PARAMETERS *)&extra,
+			 TPM_CC_StartAuthSession,
+			 TPM_RH_NULL, NULL, 0);
+    }
+    if (rc == 0) {
+	*sessionHandle = out.sessionHandle;
+    }
+    return rc;
+}
+
+static TPM_RC benchCleanup(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPM_RC	rc = 0;
+    TPM_RC	rc1;
+
+    rc1 = benchFlush(tssContext, state->auditSession);
+    if (rc == 0) rc = rc1;
+    rc1 = benchFlush(tssContext, state->xorSession);
+    if (rc == 0) rc = rc1;
+    rc1 = benchFlush(tssContext, state->saltedSession);
+    if (rc == 0) rc = rc1;
+    rc1 = benchFlush(tssContext, state->hmacSession);
+    if (rc == 0) rc = rc1;
+    rc1 = benchFlush(tssContext, state->primaryHandle);
+    if (rc == 0) rc = rc1;
+    return rc;
+}
+
+static TPM_RC benchFlush(TSS_CONTEXT *tssContext, TPM_HANDLE handle)
+{
+    TPM_RC		rc = 0;
+    FlushContext_In 	in;
+
+    if (handle != TPM_RH_NULL) {
+	in.flushHandle = handle;
+	rc = TSS_Execute(tssContext,
+			 NULL,
+			 (COMMAND_PARAMETERS *)&in,
+			 NULL,
+			 TPM_CC_FlushContext,
+			 TPM_RH_NULL, NULL, 0);
+    }
+    return rc;
+}
+
+/*
+  Benchmark cases
+*/
+
+static TPM_RC benchGetRandom(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    GetRandom_In 	in;
+    GetRandom_Out 	out;
+
+    state = state;
+    in.bytesRequested = 32;
+    return TSS_Execute(tssContext,
+		       (RESPONSE_PARAMETERS *)&out,
+		       (COMMAND_PARAMETERS *)&in,
+		       NULL,
+		       TPM_CC_GetRandom,
+		       TPM_RH_NULL, NULL, 0);
+}
+
+static void benchPcrExtendIn(PCR_Extend_In *in)
+{
+    in->pcrHandle = 16;
+    in->digests.count = 1;
+    in->digests.digests[0].hashAlg = TPM_ALG_SHA256;
+    memset((uint8_t *)&in->digests.digests[0].digest, 0x5a, SHA256_DIGEST_SIZE);
+    return;
+}
+
+static TPM_RC benchPcrExtendPw(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    PCR_Extend_In 	in;
+
+    state = state;
+    benchPcrExtendIn(&in);
+    return TSS_Execute(tssContext,
+		       NULL,
+		       (COMMAND_PARAMETERS *)&in,
+		       NULL,
+		       TPM_CC_PCR_Extend,
+		       TPM_RS_PW, NULL, 0,
+		       TPM_RH_NULL, NULL, 0);
+}
+
+static TPM_RC benchPcrExtendHmac(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    return benchPcrExtendSession(tssContext, state->hmacSession);
+}
+
+static TPM_RC benchPcrExtendSession(TSS_CONTEXT *tssContext, TPMI_SH_AUTH_SESSION sessionHandle)
+{
+    PCR_Extend_In 	in;
+
+    benchPcrExtendIn(&in);
+    return TSS_Execute(tssContext,
+		       NULL,
+		       (COMMAND_PARAMETERS *)&in,
+		       NULL,
+		       TPM_CC_PCR_Extend,
+		       sessionHandle, NULL, TPMA_SESSION_CONTINUESESSION,
+		       TPM_RH_NULL, NULL, 0);
+}
+
+static void benchHashIn(Hash_In *in)
+{
+    in->data.t.size = 64;
+    memset(in->data.t.buffer, 0xa5, in->data.t.size);
+    in->hashAlg = TPM_ALG_SHA256;
+    in->hierarchy = TPM_RH_NULL;
+    return;
+}
+
+/* salted session, command and response parameter encryption */
+
+static TPM_RC benchHashSaltedEncrypt(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    Hash_In 		in;
+    Hash_Out 		out;
+
+    benchHashIn(&in);
+    return TSS_Execute(tssContext,
+		       (RESPONSE_PARAMETERS *)&out,
+		       (COMMAND_PARAMETERS *)&in,
+		       NULL,
+		       TPM_CC_Hash,
+		       state->saltedSession, NULL,
+		       TPMA_SESSION_CONTINUESESSION | TPMA_SESSION_DECRYPT | TPMA_SESSION_ENCRYPT,
+		       TPM_RH_NULL, NULL, 0);
+}
+
+/* three sessions, AES command decryption, XOR response encryption, and audit */
+
+static TPM_RC benchHashThreeSessions(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    Hash_In 		in;
+    Hash_Out 		out;
+
+    benchHashIn(&in);
+    return TSS_Execute(tssContext,
+		       (RESPONSE_PARAMETERS *)&out,
+		       (COMMAND_PARAMETERS *)&in,
+		       NULL,
+		       TPM_CC_Hash,
+		       state->saltedSession, NULL,
+		       TPMA_SESSION_CONTINUESESSION | TPMA_SESSION_DECRYPT,
+		       state->xorSession, NULL,
+		       TPMA_SESSION_CONTINUESESSION | TPMA_SESSION_ENCRYPT,
+		       state->auditSession, NULL,
+		       TPMA_SESSION_CONTINUESESSION | TPMA_SESSION_AUDIT,
+		       TPM_RH_NULL, NULL, 0);
+}
+
+/*
+  Virtualization cases, TPM_VIRTUALIZE with a mock TPM that has fewer slots than the case uses
+*/
+
+/* benchVirtualCreate() creates the TSS context for a virtualization case, with its own mock TPM
+   and data directory.  It does not record, since its commands are not replayed. */
+
+static TPM_RC benchVirtualCreate(BENCH_STATE *state,
+				 size_t objectSlots,
+				 size_t sessionSlots,
+				 uint64_t gapMax)
+{
+    TPM_RC	rc = 0;
+    size_t	i;
+
+    for (i = 0 ; i < BENCH_VIRTUAL_COUNT ; i++) {
+	state->virtualHandles[i] = TPM_RH_NULL;
+    }
+    state->virtualNext = 0;
+    if (rc == 0) {
+	if ((size_t)snprintf(state->virtualDir, sizeof(state->virtualDir), "%s/vXXXXXX",
+			     state->dataDir) >= sizeof(state->virtualDir)) {
+	    rc = TSS_RC_FILE_OPEN;
+	}
+	else if (mkdtemp(state->virtualDir) == NULL) {
+	    printf("tssbench: Error creating data directory %s\n", state->virtualDir);
+	    rc = TSS_RC_FILE_OPEN;
+	}
+	if (rc != 0) {
+	    state->virtualDir[0] = '\0';
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Create(&state->virtualContext);
+    }
+    if (rc == 0) {
+	rc = TSS_SetProperty(state->virtualContext, TPM_INTERFACE_TYPE, "mock");
+    }
+    if (rc == 0) {
+	rc = TSS_SetProperty(state->virtualContext, TPM_DATA_DIR, state->virtualDir);
+    }
+    if (rc == 0) {
+	rc = TSS_SetProperty(state->virtualContext, TPM_VIRTUALIZE, "3");
+    }
+    if (rc == 0) {
+	rc = TSS_SetProperty(state->virtualContext, TPM_RECORD_FILE, NULL);
+    }
+    if (rc == 0) {
+	rc = MockTpm_SetLimits(state->virtualContext, objectSlots, sessionSlots, gapMax);
+    }
+    return rc;
+}
+
+/* more objects than the mock TPM object slots, so that each command evicts an object and loads
+   one */
+
+static TPM_RC benchVirtualObjectsSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPM_RC	rc = 0;
+    size_t	i;
+
+    tssContext = tssContext;
+    if (rc == 0) {
+	rc = benchVirtualCreate(state, BENCH_VIRTUAL_SLOTS, BENCH_VIRTUAL_SLOTS, 0xffff);
+    }
+    for (i = 0 ; (rc == 0) && (i < BENCH_VIRTUAL_COUNT) ; i++) {
+	rc = benchCreatePrimary(state->virtualContext, &state->virtualHandles[i]);
+    }
+    return rc;
+}
+
+static TPM_RC benchVirtualObjects(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    ReadPublic_In 	in;
+    ReadPublic_Out 	out;
+
+    tssContext = tssContext;
+    in.objectHandle = state->virtualHandles[state->virtualNext];
+    state->virtualNext = (state->virtualNext + 1) % BENCH_VIRTUAL_COUNT;
+    return TSS_Execute(state->virtualContext,
+		       (RESPONSE_PARAMETERS *)&out,
+		       (COMMAND_PARAMETERS *)&in,
+		       NULL,
+		       TPM_CC_ReadPublic,
+		       TPM_RH_NULL, NULL, 0);
+}
+
+/* more sessions than the mock TPM session slots, so that each command saves a session and loads
+   one */
+
+static TPM_RC benchVirtualSessionsSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPM_RC	rc = 0;
+    size_t	i;
+
+    tssContext = tssContext;
+    if (rc == 0) {
+	rc = benchVirtualCreate(state, BENCH_VIRTUAL_SLOTS, BENCH_VIRTUAL_SLOTS, 0xffff);
+    }
+    for (i = 0 ; (rc == 0) && (i < BENCH_VIRTUAL_COUNT) ; i++) {
+	rc = benchStartSession(state->virtualContext, &state->virtualHandles[i],
+			       TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    return rc;
+}
+
+static TPM_RC benchVirtualSessions(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPMI_SH_AUTH_SESSION	sessionHandle = state->virtualHandles[state->virtualNext];
+
+    tssContext = tssContext;
+    state->virtualNext = (state->virtualNext + 1) % BENCH_VIRTUAL_COUNT;
+    return benchPcrExtendSession(state->virtualContext, sessionHandle);
+}
+
+/* The first session is saved at setup and not used again, so it becomes the oldest saved
+   session.  Each command saves the second session, advancing the context counter, until
+   TPM2_StartAuthSession() returns TPM_RC_CONTEXT_GAP and the TSS refreshes the first session.
+   The mock TPM does not report TPM_PT_CONTEXT_GAP_MAX, so the TSS does not refresh early. */
+
+static TPM_RC benchVirtualGapSetup(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPM_RC			rc = 0;
+    TPMI_SH_AUTH_SESSION	sessionHandle = TPM_RH_NULL;
+
+    tssContext = tssContext;
+    if (rc == 0) {
+	rc = benchVirtualCreate(state, BENCH_VIRTUAL_SLOTS, 2, BENCH_VIRTUAL_GAP);
+    }
+    if (rc == 0) {
+	rc = benchStartSession(state->virtualContext, &state->virtualHandles[0],
+			       TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    if (rc == 0) {
+	rc = benchStartSession(state->virtualContext, &state->virtualHandles[1],
+			       TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    /* a third session saves the least recently used, the first */
+    if (rc == 0) {
+	rc = benchStartSession(state->virtualContext, &sessionHandle,
+			       TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    if (rc == 0) {
+	rc = benchFlush(state->virtualContext, sessionHandle);
+    }
+    return rc;
+}
+
+static TPM_RC benchVirtualGap(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPM_RC			rc = 0;
+    TPMI_SH_AUTH_SESSION	sessionHandle1 = TPM_RH_NULL;
+    TPMI_SH_AUTH_SESSION	sessionHandle2 = TPM_RH_NULL;
+
+    tssContext = tssContext;
+    /* loads the second session into the free slot */
+    if (rc == 0) {
+	rc = benchPcrExtendSession(state->virtualContext, state->virtualHandles[1]);
+    }
+    /* fills the slots, then saves the second session */
+    if (rc == 0) {
+	rc = benchStartSession(state->virtualContext, &sessionHandle1,
+			       TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    if (rc == 0) {
+	rc = benchStartSession(state->virtualContext, &sessionHandle2,
+			       TPM_RH_NULL, TPM_ALG_NULL);
+    }
+    if (sessionHandle1 != TPM_RH_NULL) {
+	TPM_RC rc1 = benchFlush(state->virtualContext, sessionHandle1);
+	if (rc == 0) {
+	    rc = rc1;
+	}
+    }
+    if (sessionHandle2 != TPM_RH_NULL) {
+	TPM_RC rc1 = benchFlush(state->virtualContext, sessionHandle2);
+	if (rc == 0) {
+	    rc = rc1;
+	}
+    }
+    return rc;
+}
+
+/* benchVirtualCleanup() flushes the objects and sessions, which also removes their files, and
+   deletes the TSS context */
+
+static TPM_RC benchVirtualCleanup(TSS_CONTEXT *tssContext, BENCH_STATE *state)
+{
+    TPM_RC	rc = 0;
+    TPM_RC	rc1;
+    size_t	i;
+
+    tssContext = tssContext;
+    if (state->virtualContext != NULL) {
+	for (i = 0 ; i < BENCH_VIRTUAL_COUNT ; i++) {
+	    rc1 = benchFlush(state->virtualContext, state->virtualHandles[i]);
+	    if (rc == 0) rc = rc1;
+	}
+	rc1 = TSS_Delete(state->virtualContext);
+	if (rc == 0) rc = rc1;
+	state->virtualContext = NULL;
+    }
+    if (state->virtualDir[0] != '\0') {
+	rmdir(state->virtualDir);
+	state->virtualDir[0] = '\0';
+    }
+    return rc;
+}
+
+static void printUsage(void)
+{
+    printf("\n");
+    printf("tssbench\n");
+    printf("\n");
+    printf("Times TSS_Execute() for representative commands against an in process mock TPM\n");
+    printf("\n");
+    printf("\t[-c\tcase name (default all)]\n");
+    printf("\t[-l\tnumber of loops per case (default 1000)]\n");
+    printf("\t[-if\tuse the TPM_INTERFACE_TYPE environment variable rather than the\n");
+    printf("\t\tin process mock TPM, the mock TPM time is then included]\n");
+    printf("\n");
+    printf("\tPrints, per case, the wall clock ns per command, the ns per command\n");
+    printf("\texcluding the mock TPM, and the heap allocations per command\n");
+    printf("\texcluding the mock TPM (glibc only).\n");
+    printf("\n");
+    printf("\tCases:\n");
+    printf("\t\tgetrandom-nosession\n");
+    printf("\t\tpcrextend-pw\n");
+    printf("\t\tpcrextend-hmac\n");
+    printf("\t\thash-salted-encrypt\n");
+    printf("\t\thash-three-sessions\n");
+    printf("\t\tvirtual-objects\n");
+    printf("\t\tvirtual-sessions\n");
+    printf("\t\tvirtual-context-gap\n");
+    exit(1);	
+}
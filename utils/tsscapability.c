@@ -0,0 +1,425 @@
+/********************************************************************************/
+/*										*/
+/*			    TSS TPM Capability Cache				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* This file caches TPM capabilities in the TSS context.  See ibmtss/tsscapability.h.
+
+   Each group is loaded on first use with as many TPM2_GetCapability calls as the TPM needs to
+   page through it, so that a utility that only needs one fixed property pays one round trip, and
+   a long running application pays it once.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tsserror.h>
+#include <ibmtss/tssutils.h>
+#include <ibmtss/tsscapability.h>
+
+#include "tssproperties.h"
+#include "tss20.h"
+
+/* the cached capability groups, bits in loaded */
+#define TSS_CAPABILITY_PROPERTIES	0x01
+#define TSS_CAPABILITY_ALGORITHMS	0x02
+#define TSS_CAPABILITY_COMMANDS		0x04
+#define TSS_CAPABILITY_PCRS		0x08
+
+typedef struct TSS_CAPABILITY_CACHE {
+    unsigned int 		loaded;		/* bit mask of the loaded groups */
+    TPML_TAGGED_TPM_PROPERTY 	properties;	/* the TPM_PT_FIXED group */
+    TPML_ALG_PROPERTY 		algorithms;
+    TPML_CCA 			commands;
+    TPML_PCR_SELECTION 		pcrs;
+} TSS_CAPABILITY_CACHE;
+
+/* local prototypes */
+
+static TPM_RC TSS_Capability_Load(TSS_CONTEXT *tssContext,
+				  TSS_CAPABILITY_CACHE **cache,
+				  unsigned int group);
+static TPM_RC TSS_Capability_LoadProperties(TSS_CONTEXT *tssContext,
+					    TPML_TAGGED_TPM_PROPERTY *properties);
+static TPM_RC TSS_Capability_LoadAlgorithms(TSS_CONTEXT *tssContext,
+					    TPML_ALG_PROPERTY *algorithms);
+static TPM_RC TSS_Capability_LoadCommands(TSS_CONTEXT *tssContext,
+					  TPML_CCA *commands);
+static TPM_RC TSS_Capability_LoadPcrs(TSS_CONTEXT *tssContext,
+				      TPML_PCR_SELECTION *pcrs);
+static TPM_RC TSS_Capability_Execute(TSS_CONTEXT *tssContext,
+				     GetCapability_Out *out,
+				     TPM_CAP capability,
+				     uint32_t property,
+				     uint32_t propertyCount);
+
+/* TSS_Capability_GetProperty() returns the value of a TPM_PT_FIXED group property */
+
+TPM_RC TSS_Capability_GetProperty(TSS_CONTEXT *tssContext,
+				  TPM_PT property,
+				  uint32_t *value)
+{
+    TPM_RC			rc = 0;
+    TSS_CAPABILITY_CACHE	*cache = NULL;
+    uint32_t			i;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	if ((property < PT_FIXED) || (property >= PT_VAR)) {
+	    if (tssVerbose) printf("TSS_Capability_GetProperty: "
+				   "Error, property %08x is not a fixed property\n", property);
+	    rc = TSS_RC_NO_CAPABILITY;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Capability_Load(tssContext, &cache, TSS_CAPABILITY_PROPERTIES);
+    }
+    if (rc == 0) {
+	for (i = 0 ; i < cache->properties.count ; i++) {
+	    if (cache->properties.tpmProperty[i].property == property) {
+		*value = cache->properties.tpmProperty[i].value;
+		return rc;
+	    }
+	}
+	if (tssVverbose) printf("TSS_Capability_GetProperty: property %08x not reported\n",
+				property);
+	rc = TSS_RC_NO_CAPABILITY;
+    }
+    return rc;
+}
+
+/* TSS_Capability_GetAlgorithm() returns the attributes of an implemented algorithm */
+
+TPM_RC TSS_Capability_GetAlgorithm(TSS_CONTEXT *tssContext,
+				   TPM_ALG_ID algorithm,
+				   TPMA_ALGORITHM *algorithmAttributes)
+{
+    TPM_RC			rc = 0;
+    TSS_CAPABILITY_CACHE	*cache = NULL;
+    uint32_t			i;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	rc = TSS_Capability_Load(tssContext, &cache, TSS_CAPABILITY_ALGORITHMS);
+    }
+    if (rc == 0) {
+	for (i = 0 ; i < cache->algorithms.count ; i++) {
+	    if (cache->algorithms.algProperties[i].alg == algorithm) {
+		*algorithmAttributes = cache->algorithms.algProperties[i].algProperties;
+		return rc;
+	    }
+	}
+	if (tssVverbose) printf("TSS_Capability_GetAlgorithm: algorithm %04x not implemented\n",
+				algorithm);
+	rc = TSS_RC_NO_CAPABILITY;
+    }
+    return rc;
+}
+
+/* TSS_Capability_GetCommand() returns the attributes of an implemented command */
+
+TPM_RC TSS_Capability_GetCommand(TSS_CONTEXT *tssContext,
+				 TPM_CC commandCode,
+				 TPMA_CC *commandAttributes)
+{
+    TPM_RC			rc = 0;
+    TSS_CAPABILITY_CACHE	*cache = NULL;
+    uint32_t			i;
+    uint32_t			attributes;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	rc = TSS_Capability_Load(tssContext, &cache, TSS_CAPABILITY_COMMANDS);
+    }
+    if (rc == 0) {
+	for (i = 0 ; i < cache->commands.count ; i++) {
+	    attributes = cache->commands.commandAttributes[i].val;
+	    /* the command code is the index plus the vendor bit */
+	    if ((attributes & (TPMA_CC_COMMANDINDEX | TPMA_CC_V)) == commandCode) {
+		*commandAttributes = cache->commands.commandAttributes[i];
+		return rc;
+	    }
+	}
+	if (tssVverbose) printf("TSS_Capability_GetCommand: command %08x not implemented\n",
+				commandCode);
+	rc = TSS_RC_NO_CAPABILITY;
+    }
+    return rc;
+}
+
+/* TSS_Capability_GetPcrs() returns the current PCR allocation */
+
+TPM_RC TSS_Capability_GetPcrs(TSS_CONTEXT *tssContext,
+			      TPML_PCR_SELECTION *pcrSelection)
+{
+    TPM_RC			rc = 0;
+    TSS_CAPABILITY_CACHE	*cache = NULL;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	rc = TSS_Capability_Load(tssContext, &cache, TSS_CAPABILITY_PCRS);
+    }
+    if (rc == 0) {
+	*pcrSelection = cache->pcrs;
+    }
+    return rc;
+}
+
+/* TSS_Capability_Invalidate() discards the cached capabilities.  They are read again on next
+   use. */
+
+void TSS_Capability_Invalidate(TSS_CONTEXT *tssContext)
+{
+    if (tssContext->tssCapabilities != NULL) {
+	tssContext->tssCapabilities->loaded = 0;
+    }
+    return;
+}
+
+/* TSS_Capability_Delete() frees the capability cache.  It is called by TSS_Delete(). */
+
+void TSS_Capability_Delete(TSS_CONTEXT *tssContext)
+{
+    free(tssContext->tssCapabilities);
+    tssContext->tssCapabilities = NULL;
+    return;
+}
+
+/* TSS_Capability_Load() returns the cache with 'group' loaded, allocating the cache and reading
+   the group from the TPM if needed.  A failed load leaves the group unloaded, so that it is
+   retried on next use.
+*/
+
+static TPM_RC TSS_Capability_Load(TSS_CONTEXT *tssContext,
+				  TSS_CAPABILITY_CACHE **cache,
+				  unsigned int group)
+{
+    TPM_RC			rc = 0;
+
+    if (tssContext->tssCapabilities == NULL) {
+	rc = TSS_Malloc((unsigned char **)&tssContext->tssCapabilities,	/* freed by
+									   TSS_Capability_Delete() */
+			sizeof(TSS_CAPABILITY_CACHE));
+	if (rc == 0) {
+	    tssContext->tssCapabilities->loaded = 0;
+	}
+    }
+    if (rc == 0) {
+	*cache = tssContext->tssCapabilities;
+	if ((*cache)->loaded & group) {
+	    return rc;
+	}
+	switch (group) {
+	  case TSS_CAPABILITY_PROPERTIES:
+	    rc = TSS_Capability_LoadProperties(tssContext, &(*cache)->properties);
+	    break;
+	  case TSS_CAPABILITY_ALGORITHMS:
+	    rc = TSS_Capability_LoadAlgorithms(tssContext, &(*cache)->algorithms);
+	    break;
+	  case TSS_CAPABILITY_COMMANDS:
+	    rc = TSS_Capability_LoadCommands(tssContext, &(*cache)->commands);
+	    break;
+	  case TSS_CAPABILITY_PCRS:
+	    rc = TSS_Capability_LoadPcrs(tssContext, &(*cache)->pcrs);
+	    break;
+	  default:
+	    rc = TSS_RC_FAIL;
+	}
+    }
+    if (rc == 0) {
+	(*cache)->loaded |= group;
+    }
+    return rc;
+}
+
+/* TSS_Capability_LoadProperties() reads the TPM_PT_FIXED group.  The TPM returns the properties
+   from the requested one up, possibly running into the TPM_PT_VAR group, which is not cached. */
+
+static TPM_RC TSS_Capability_LoadProperties(TSS_CONTEXT *tssContext,
+					    TPML_TAGGED_TPM_PROPERTY *properties)
+{
+    TPM_RC			rc = 0;
+    GetCapability_Out		out;
+    TPMS_TAGGED_PROPERTY	*tpmProperty;
+    uint32_t			property = PT_FIXED;
+    uint32_t			i;
+    int				done = FALSE;
+
+    properties->count = 0;
+    while ((rc == 0) && !done) {
+	rc = TSS_Capability_Execute(tssContext, &out, TPM_CAP_TPM_PROPERTIES, property,
+				    MAX_TPM_PROPERTIES - properties->count);
+	for (i = 0 ; (rc == 0) && !done && (i < out.capabilityData.data.tpmProperties.count) ;
+	     i++) {
+	    tpmProperty = &out.capabilityData.data.tpmProperties.tpmProperty[i];
+	    if ((tpmProperty->property >= PT_VAR) ||
+		(properties->count == MAX_TPM_PROPERTIES)) {
+		done = TRUE;
+	    }
+	    else {
+		properties->tpmProperty[properties->count] = *tpmProperty;
+		properties->count++;
+		property = tpmProperty->property + 1;
+	    }
+	}
+	if ((rc != 0) || !out.moreData || (out.capabilityData.data.tpmProperties.count == 0)) {
+	    done = TRUE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Capability_LoadAlgorithms() reads the implemented algorithms */
+
+static TPM_RC TSS_Capability_LoadAlgorithms(TSS_CONTEXT *tssContext,
+					    TPML_ALG_PROPERTY *algorithms)
+{
+    TPM_RC			rc = 0;
+    GetCapability_Out		out;
+    TPMS_ALG_PROPERTY		*algProperty;
+    uint32_t			algorithm = TPM_ALG_ERROR;
+    uint32_t			i;
+    int				done = FALSE;
+
+    algorithms->count = 0;
+    while ((rc == 0) && !done) {
+	rc = TSS_Capability_Execute(tssContext, &out, TPM_CAP_ALGS, algorithm,
+				    MAX_CAP_ALGS - algorithms->count);
+	for (i = 0 ; (rc == 0) && !done && (i < out.capabilityData.data.algorithms.count) ; i++) {
+	    algProperty = &out.capabilityData.data.algorithms.algProperties[i];
+	    if (algorithms->count == MAX_CAP_ALGS) {
+		done = TRUE;
+	    }
+	    else {
+		algorithms->algProperties[algorithms->count] = *algProperty;
+		algorithms->count++;
+		algorithm = algProperty->alg + 1;
+	    }
+	}
+	if ((rc != 0) || !out.moreData || (out.capabilityData.data.algorithms.count == 0)) {
+	    done = TRUE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Capability_LoadCommands() reads the implemented commands, including vendor commands */
+
+static TPM_RC TSS_Capability_LoadCommands(TSS_CONTEXT *tssContext,
+					  TPML_CCA *commands)
+{
+    TPM_RC			rc = 0;
+    GetCapability_Out		out;
+    uint32_t			attributes;
+    uint32_t			commandCode = TPM_CC_FIRST;
+    uint32_t			i;
+    int				done = FALSE;
+
+    commands->count = 0;
+    while ((rc == 0) && !done) {
+	rc = TSS_Capability_Execute(tssContext, &out, TPM_CAP_COMMANDS, commandCode,
+				    MAX_CAP_CC - commands->count);
+	for (i = 0 ; (rc == 0) && !done && (i < out.capabilityData.data.command.count) ; i++) {
+	    attributes = out.capabilityData.data.command.commandAttributes[i].val;
+	    if (commands->count == MAX_CAP_CC) {
+		done = TRUE;
+	    }
+	    else {
+		commands->commandAttributes[commands->count] =
+		    out.capabilityData.data.command.commandAttributes[i];
+		commands->count++;
+		commandCode = (attributes & (TPMA_CC_COMMANDINDEX | TPMA_CC_V)) + 1;
+	    }
+	}
+	if ((rc != 0) || !out.moreData || (out.capabilityData.data.command.count == 0)) {
+	    done = TRUE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Capability_LoadPcrs() reads the PCR allocation, which always fits in one response */
+
+static TPM_RC TSS_Capability_LoadPcrs(TSS_CONTEXT *tssContext,
+				      TPML_PCR_SELECTION *pcrs)
+{
+    TPM_RC			rc = 0;
+    GetCapability_Out		out;
+
+    if (rc == 0) {
+	rc = TSS_Capability_Execute(tssContext, &out, TPM_CAP_PCRS, 0, 1);
+    }
+    if (rc == 0) {
+	*pcrs = out.capabilityData.data.assignedPCR;
+    }
+    return rc;
+}
+
+/* TSS_Capability_Execute() sends one TPM2_GetCapability and checks that the response is for the
+   requested capability */
+
+static TPM_RC TSS_Capability_Execute(TSS_CONTEXT *tssContext,
+				     GetCapability_Out *out,
+				     TPM_CAP capability,
+				     uint32_t property,
+				     uint32_t propertyCount)
+{
+    TPM_RC			rc = 0;
+    GetCapability_In		in;
+
+    in.capability = capability;
+    in.property = property;
+    in.propertyCount = propertyCount;
+    if (rc == 0) {
+	rc = TSS_Execute(tssContext,
+			 (RESPONSE_PARAMETERS *)out,
+			 (COMMAND_PARAMETERS *)&in,
+			 NULL,
+			 TPM_CC_GetCapability,
+			 TPM_RH_NULL, NULL, 0);
+    }
+    if (rc == 0) {
+	if (out->capabilityData.capability != capability) {
+	    if (tssVerbose) printf("TSS_Capability_Execute: "
+				   "Error, requested capability %08x, received %08x\n",
+				   capability, out->capabilityData.capability);
+	    rc = TSS_RC_MALFORMED_RESPONSE;
+	}
+    }
+    return rc;
+}
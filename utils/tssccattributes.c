@@ -50,6 +50,9 @@
 
 /* CommandCodeToCommandIndex() returns the index into the s_ccAttr table for the commandCode.
    Returns UNIMPLEMENTED_COMMAND_INDEX if the command is unimplemented.
+
+   s_ccAttr is padded, so a TPM 2.0 library command is at its offset from TPM_CC_FIRST.  The few
+   vendor commands follow the library commands and are searched.
 */
 
 /* NOTE: Marked as const function in header declaration */
@@ -58,6 +61,13 @@ COMMAND_INDEX CommandCodeToCommandIndex(TPM_CC commandCode)
 {
     COMMAND_INDEX i;
 
+    if ((commandCode >= TPM_CC_FIRST) && (commandCode <= TPM_CC_LAST)) {
+	i = (COMMAND_INDEX)(commandCode - TPM_CC_FIRST);
+	if (s_ccAttr[i].commandCode == commandCode) {
+	    return i;
+	}
+	return UNIMPLEMENTED_COMMAND_INDEX;
+    }
     /* s_ccAttr has terminating 0x0000 command code and V */
     for (i = 0 ; (s_ccAttr[i].commandCode != 0) || (s_ccAttr[i].V != 0) ; i++) {
 	if (s_ccAttr[i].commandCode == commandCode) {
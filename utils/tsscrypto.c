@@ -58,6 +58,10 @@
 #endif
 #include <openssl/rand.h>
 #include <openssl/engine.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 
 #include <ibmtss/tssresponsecode.h>
 #include <ibmtss/tssutils.h>
@@ -67,13 +71,27 @@
 #include <ibmtss/tsscryptoh.h>
 #include <ibmtss/tsscrypto.h>
 
-extern int tssVverbose;
-extern int tssVerbose;
+#include "tssproperties.h"
 
 /* local prototypes */
 
 static TPM_RC TSS_Hash_GetMd(const EVP_MD **md,
 			     TPMI_ALG_HASH hashAlg);
+static TPM_RC TSS_Cipher_Get(const EVP_CIPHER **cipher,
+			     TPM_ALG_ID symAlg,
+			     uint32_t keySizeInBits);
+static TPM_RC TSS_AES_CFB(uint8_t *dOut,
+			  uint32_t keySizeInBits,
+			  uint8_t *key,
+			  uint8_t *iv,
+			  uint32_t dInSize,
+			  uint8_t *dIn,
+			  int enc);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+static TPM_RC TSS_HMAC_FinishMac_valist(TPMT_HA *digest,
+					EVP_MAC_CTX *ctx,
+					va_list ap);
+#endif
 
 #ifndef TPM_TSS_NOECC
 
@@ -95,13 +113,70 @@ static TPM_RC TSS_BN_hex2bn(BIGNUM **bn, const char *str);
 static TPM_RC TSS_bin2bn(BIGNUM **bn, const unsigned char *bin, unsigned int bytes);
 #endif	/* TPM_TSS_NORSA */
 
+/*
+  Crypto provider table
+
+  The digest and cipher algorithms used by the TSS, indexed by TPM_ALG_ID.  TSS_Crypto_Init()
+  fetches them once and pins them for the life of the process.  With OpenSSL 3, looking up an
+  algorithm by name or passing a legacy EVP_sha256() style object does an implicit fetch, which
+  takes the provider store lock on every hash, HMAC, and cipher initialization.
+*/
+
+typedef struct TSS_CRYPTO_MD {
+    TPMI_ALG_HASH	hashAlg;
+    const char		*name;
+    const EVP_MD	*md;		/* pinned by TSS_Crypto_Init() */
+} TSS_CRYPTO_MD;
+
+static TSS_CRYPTO_MD tssCryptoMd [] = {
+#ifdef TPM_ALG_SHA1
+    {TPM_ALG_SHA1, "sha1", NULL},
+#endif
+#ifdef TPM_ALG_SHA256
+    {TPM_ALG_SHA256, "sha256", NULL},
+#endif
+#ifdef TPM_ALG_SHA384
+    {TPM_ALG_SHA384, "sha384", NULL},
+#endif
+#ifdef TPM_ALG_SHA512
+    {TPM_ALG_SHA512, "sha512", NULL},
+#endif
+};
+
+typedef struct TSS_CRYPTO_CIPHER {
+    TPM_ALG_ID		symAlg;
+    uint32_t		keySizeInBits;
+    const char		*name;
+    const EVP_CIPHER	*cipher;	/* pinned by TSS_Crypto_Init() */
+} TSS_CRYPTO_CIPHER;
+
+/* parameter encryption ciphers, always CFB mode */
+
+static TSS_CRYPTO_CIPHER tssCryptoCipher [] = {
+    {TPM_ALG_AES, 128, "aes-128-cfb", NULL},
+    {TPM_ALG_AES, 192, "aes-192-cfb", NULL},
+    {TPM_ALG_AES, 256, "aes-256-cfb", NULL},
+};
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+/* keyed HMAC states, see TSS_HMAC_KeyNew() */
+static EVP_MAC *tssCryptoHmac = NULL;		/* pinned by TSS_Crypto_Init() */
+#endif
+
 /*
   Initialization
 */
 
+/* TSS_Crypto_Init() initializes the crypto library and fills the crypto provider table.
+
+   It is called once through TSS_Library_Init().  An algorithm that cannot be fetched, e.g., SHA-1
+   under a restrictive provider configuration, is left empty and looked up by name on use.
+*/
+
 TPM_RC TSS_Crypto_Init(void)
 {
     TPM_RC		rc = 0;
+    size_t		i;
 #if 0
     int			irc;
 #endif
@@ -113,6 +188,41 @@ TPM_RC TSS_Crypto_Init(void)
     if (irc == 0) {
 	if (tssVerbose) printf("TSS_Crypto_Init: Cannot set FIPS mode\n");
     }
+#endif
+    for (i = 0 ; i < sizeof(tssCryptoMd) / sizeof(TSS_CRYPTO_MD) ; i++) {
+	if (tssCryptoMd[i].md == NULL) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+	    tssCryptoMd[i].md = EVP_MD_fetch(NULL, tssCryptoMd[i].name, NULL);	/* never freed */
+#else
+	    tssCryptoMd[i].md = EVP_get_digestbyname(tssCryptoMd[i].name);
+#endif
+	    if (tssCryptoMd[i].md == NULL) {
+		if (tssVverbose) printf("TSS_Crypto_Init: Cannot fetch digest %s\n",
+					tssCryptoMd[i].name);
+	    }
+	}
+    }
+    for (i = 0 ; i < sizeof(tssCryptoCipher) / sizeof(TSS_CRYPTO_CIPHER) ; i++) {
+	if (tssCryptoCipher[i].cipher == NULL) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+	    tssCryptoCipher[i].cipher =
+		EVP_CIPHER_fetch(NULL, tssCryptoCipher[i].name, NULL);		/* never freed */
+#else
+	    tssCryptoCipher[i].cipher = EVP_get_cipherbyname(tssCryptoCipher[i].name);
+#endif
+	    if (tssCryptoCipher[i].cipher == NULL) {
+		if (tssVverbose) printf("TSS_Crypto_Init: Cannot fetch cipher %s\n",
+					tssCryptoCipher[i].name);
+	    }
+	}
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+    if (tssCryptoHmac == NULL) {
+	tssCryptoHmac = EVP_MAC_fetch(NULL, "HMAC", NULL);		/* never freed */
+	if (tssCryptoHmac == NULL) {
+	    if (tssVverbose) printf("TSS_Crypto_Init: Cannot fetch HMAC\n");
+	}
+    }
 #endif
     return rc;
 }
@@ -121,35 +231,104 @@ TPM_RC TSS_Crypto_Init(void)
   Digests
 */
 
+/* TSS_Hash_GetMd() returns the digest method for hashAlg from the crypto provider table.
+
+   If the table was not filled, because the caller did not go through TSS_Library_Init(), the
+   digest is looked up by name.
+*/
+
 static TPM_RC TSS_Hash_GetMd(const EVP_MD **md,
 			     TPMI_ALG_HASH hashAlg)
 {
     TPM_RC		rc = 0;
-
-    if (rc == 0) {
-	switch (hashAlg) {
-#ifdef TPM_ALG_SHA1
-	  case TPM_ALG_SHA1:
-	    *md = EVP_get_digestbyname("sha1");
-	    break;
-#endif
-#ifdef TPM_ALG_SHA256	
-	  case TPM_ALG_SHA256:
-	    *md = EVP_get_digestbyname("sha256");
-	    break;
-#endif
-#ifdef TPM_ALG_SHA384
-	  case 	TPM_ALG_SHA384:
-	    *md = EVP_get_digestbyname("sha384");
+    size_t		i;
+
+    *md = NULL;
+    for (i = 0 ; i < sizeof(tssCryptoMd) / sizeof(TSS_CRYPTO_MD) ; i++) {
+	if (tssCryptoMd[i].hashAlg == hashAlg) {
+	    *md = tssCryptoMd[i].md;
+	    if (*md == NULL) {
+		*md = EVP_get_digestbyname(tssCryptoMd[i].name);
+	    }
 	    break;
-#endif
-#ifdef TPM_ALG_SHA512
-	  case 	TPM_ALG_SHA512:
-	    *md = EVP_get_digestbyname("sha512");
+	}
+    }
+    if (*md == NULL) {
+	rc = TSS_RC_BAD_HASH_ALGORITHM;
+    }
+    return rc;
+}
+
+/* TSS_Cipher_Get() returns the cipher for symAlg and keySizeInBits from the crypto provider
+   table.
+
+   If the table was not filled, the cipher is looked up by name.
+*/
+
+static TPM_RC TSS_Cipher_Get(const EVP_CIPHER **cipher,
+			     TPM_ALG_ID symAlg,
+			     uint32_t keySizeInBits)
+{
+    TPM_RC		rc = 0;
+    size_t		i;
+
+    *cipher = NULL;
+    for (i = 0 ; i < sizeof(tssCryptoCipher) / sizeof(TSS_CRYPTO_CIPHER) ; i++) {
+	if ((tssCryptoCipher[i].symAlg == symAlg) &&
+	    (tssCryptoCipher[i].keySizeInBits == keySizeInBits)) {
+	    *cipher = tssCryptoCipher[i].cipher;
+	    if (*cipher == NULL) {
+		*cipher = EVP_get_cipherbyname(tssCryptoCipher[i].name);
+	    }
 	    break;
-#endif
-	  default:
-	    rc = TSS_RC_BAD_HASH_ALGORITHM;
+	}
+    }
+    if (*cipher == NULL) {
+	rc = TSS_RC_AES_KEYGEN_FAILURE;	/* bad algorithm or key size */
+    }
+    return rc;
+}
+
+/* TSS_HMAC_Finish_valist() runs the HMAC_Update() loop over the varargs and finalizes the HMAC
+   into digest.  ctx must already be keyed.
+
+   length 0 is ignored, buffer NULL terminates list.
+*/
+
+static TPM_RC TSS_HMAC_Finish_valist(TPMT_HA *digest,
+				     HMAC_CTX *ctx,
+				     va_list ap)
+{
+    TPM_RC		rc = 0;
+    int 		irc = 0;
+    int			done = FALSE;
+    int			length;
+    uint8_t 		*buffer;
+
+    while ((rc == 0) && !done) {
+	length = va_arg(ap, int);		/* first vararg is the length */
+	buffer = va_arg(ap, unsigned char *);	/* second vararg is the array */
+	if (buffer != NULL) {			/* loop until a NULL buffer terminates */
+	    if (length < 0) {
+		if (tssVerbose) printf("TSS_HMAC_Generate: Length is negative\n");
+		rc = TSS_RC_HMAC;
+	    }
+	    else {
+		irc = HMAC_Update(ctx, buffer, length);
+		if (irc == 0) {
+		    if (tssVerbose) printf("TSS_HMAC_Generate: HMAC_Update failed\n");
+		    rc = TSS_RC_HMAC;
+		}
+	    }
+ 	}
+	else {
+	    done = TRUE;
+	}
+    }
+    if (rc == 0) {
+	irc = HMAC_Final(ctx, (uint8_t *)&digest->digest, NULL);
+	if (irc == 0) {
+	    rc = TSS_RC_HMAC;
 	}
     }
     return rc;
@@ -166,15 +345,12 @@ TPM_RC TSS_HMAC_Generate_valist(TPMT_HA *digest,		/* largest size of a digest */
 {
     TPM_RC		rc = 0;
     int 		irc = 0;
-    int			done = FALSE;
     const EVP_MD 	*md;	/* message digest method */
 #if OPENSSL_VERSION_NUMBER < 0x10100000
     HMAC_CTX 		ctx;
 #else
     HMAC_CTX 		*ctx;
 #endif
-    int			length;
-    uint8_t 		*buffer;
     
 #if OPENSSL_VERSION_NUMBER < 0x10100000
     HMAC_CTX_init(&ctx);
@@ -201,6 +377,134 @@ TPM_RC TSS_HMAC_Generate_valist(TPMT_HA *digest,		/* largest size of a digest */
 	    rc = TSS_RC_HMAC;
 	}
     }
+    if (rc == 0) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+	rc = TSS_HMAC_Finish_valist(digest, &ctx, ap);
+#else
+	rc = TSS_HMAC_Finish_valist(digest, ctx, ap);
+#endif
+    }
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+    HMAC_CTX_cleanup(&ctx);
+#else
+    HMAC_CTX_free(ctx);
+#endif
+    return rc;
+}
+
+/* TSS_HMAC_KeyNew() creates a keyed HMAC state for hashAlg and hmacKey.  The state holds the
+   digest method and the inner and outer padded key blocks, so that TSS_HMAC_GenerateKeyed_valist()
+   can calculate many HMACs under the same key without repeating the key setup.
+
+   With OpenSSL 3, the state is an EVP_MAC_CTX, since the HMAC_CTX functions are deprecated.
+
+   The state must be freed by TSS_HMAC_KeyFree().
+*/
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+
+TPM_RC TSS_HMAC_KeyNew(void **hmacState,		/* freed by TSS_HMAC_KeyFree() */
+		       TPMI_ALG_HASH hashAlg,
+		       const TPM2B_KEY *hmacKey)
+{
+    TPM_RC		rc = 0;
+    int 		irc = 0;
+    const EVP_MD 	*md;	/* message digest method */
+    EVP_MAC		*mac = tssCryptoHmac;
+    EVP_MAC_CTX		*ctx = NULL;
+    OSSL_PARAM		params[2];
+
+    if (rc == 0) {
+	rc = TSS_Hash_GetMd(&md, hashAlg);
+    }
+    /* if the table was not filled, fetch for this state only */
+    if ((rc == 0) && (mac == NULL)) {
+	mac = EVP_MAC_fetch(NULL, "HMAC", NULL);	/* freed @1 */
+	if (mac == NULL) {
+	    if (tssVerbose) printf("TSS_HMAC_KeyNew: Error fetching HMAC\n");
+	    rc = TSS_RC_HMAC;
+	}
+    }
+    if (rc == 0) {
+	ctx = EVP_MAC_CTX_new(mac);			/* freed by TSS_HMAC_KeyFree() */
+	if (ctx == NULL) {
+	    if (tssVerbose) printf("TSS_HMAC_KeyNew: Error allocating HMAC context\n");
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     (char *)EVP_MD_get0_name(md), 0);
+	params[1] = OSSL_PARAM_construct_end();
+	/* the buffer is never NULL, so an empty key is set as a key */
+	irc = EVP_MAC_init(ctx, hmacKey->b.buffer, hmacKey->b.size, params);
+	if (irc != 1) {
+	    if (tssVerbose) printf("TSS_HMAC_KeyNew: EVP_MAC_init failed\n");
+	    rc = TSS_RC_HMAC;
+	}
+    }
+    if (rc == 0) {
+	*hmacState = ctx;
+    }
+    else {
+	TSS_HMAC_KeyFree(ctx);
+    }
+    if (mac != tssCryptoHmac) {
+	EVP_MAC_free(mac);				/* @1 */
+    }
+    return rc;
+}
+
+/* TSS_HMAC_KeyFree() frees a keyed HMAC state created by TSS_HMAC_KeyNew().  The key material is
+   erased.  hmacState can be NULL. */
+
+void TSS_HMAC_KeyFree(void *hmacState)
+{
+    EVP_MAC_CTX_free(hmacState);
+    return;
+}
+
+/* TSS_HMAC_GenerateKeyed_valist() calculates an HMAC using a keyed HMAC state from
+   TSS_HMAC_KeyNew().  The state is reinitialized to its keyed starting point, without the key
+   setup or a copy, so it can be reused, but not by two threads at once.
+
+   On call, digest->hashAlg must match the hashAlg used to create the state.
+
+   length 0 is ignored, buffer NULL terminates list.
+*/
+
+TPM_RC TSS_HMAC_GenerateKeyed_valist(TPMT_HA *digest,		/* largest size of a digest */
+				     void *hmacState,
+				     va_list ap)
+{
+    TPM_RC		rc = 0;
+    int 		irc = 0;
+
+    /* a NULL key restarts the HMAC with the key already set */
+    irc = EVP_MAC_init(hmacState, NULL, 0, NULL);
+    if (irc != 1) {
+	if (tssVerbose) printf("TSS_HMAC_GenerateKeyed_valist: EVP_MAC_init failed\n");
+	rc = TSS_RC_HMAC;
+    }
+    if (rc == 0) {
+	rc = TSS_HMAC_FinishMac_valist(digest, hmacState, ap);
+    }
+    return rc;
+}
+
+/* TSS_HMAC_FinishMac_valist() is TSS_HMAC_Finish_valist() for an EVP_MAC_CTX */
+
+static TPM_RC TSS_HMAC_FinishMac_valist(TPMT_HA *digest,
+					EVP_MAC_CTX *ctx,
+					va_list ap)
+{
+    TPM_RC		rc = 0;
+    int 		irc = 0;
+    int			done = FALSE;
+    int			length;
+    uint8_t 		*buffer;
+    size_t		outLength;
+
     while ((rc == 0) && !done) {
 	length = va_arg(ap, int);		/* first vararg is the length */
 	buffer = va_arg(ap, unsigned char *);	/* second vararg is the array */
@@ -210,13 +514,9 @@ TPM_RC TSS_HMAC_Generate_valist(TPMT_HA *digest,		/* largest size of a digest */
 		rc = TSS_RC_HMAC;
 	    }
 	    else {
-#if OPENSSL_VERSION_NUMBER < 0x10100000
-		irc = HMAC_Update(&ctx, buffer, length);
-#else
-		irc = HMAC_Update(ctx, buffer, length);
-#endif
-		if (irc == 0) {
-		    if (tssVerbose) printf("TSS_HMAC_Generate: HMAC_Update failed\n");
+		irc = EVP_MAC_update(ctx, buffer, length);
+		if (irc != 1) {
+		    if (tssVerbose) printf("TSS_HMAC_Generate: EVP_MAC_update failed\n");
 		    rc = TSS_RC_HMAC;
 		}
 	    }
@@ -225,17 +525,124 @@ TPM_RC TSS_HMAC_Generate_valist(TPMT_HA *digest,		/* largest size of a digest */
 	    done = TRUE;
 	}
     }
+    if (rc == 0) {
+	irc = EVP_MAC_final(ctx, (uint8_t *)&digest->digest, &outLength, sizeof(digest->digest));
+	if (irc != 1) {
+	    rc = TSS_RC_HMAC;
+	}
+    }
+    return rc;
+}
+
+#else	/* OpenSSL before 3 */
 
+TPM_RC TSS_HMAC_KeyNew(void **hmacState,		/* freed by TSS_HMAC_KeyFree() */
+		       TPMI_ALG_HASH hashAlg,
+		       const TPM2B_KEY *hmacKey)
+{
+    TPM_RC		rc = 0;
+    int 		irc = 0;
+    const EVP_MD 	*md;	/* message digest method */
+    HMAC_CTX 		*ctx = NULL;
+    
+    if (rc == 0) {
+	rc = TSS_Hash_GetMd(&md, hashAlg);
+    }
     if (rc == 0) {
 #if OPENSSL_VERSION_NUMBER < 0x10100000
-	irc = HMAC_Final(&ctx, (uint8_t *)&digest->digest, NULL);
+	ctx = malloc(sizeof(HMAC_CTX));		/* freed by TSS_HMAC_KeyFree() */
+	if (ctx != NULL) {
+	    HMAC_CTX_init(ctx);
+	}
 #else
-	irc = HMAC_Final(ctx, (uint8_t *)&digest->digest, NULL);
+	ctx = HMAC_CTX_new();			/* freed by TSS_HMAC_KeyFree() */
+#endif
+	if (ctx == NULL) {
+	    if (tssVerbose) printf("TSS_HMAC_KeyNew: Error allocating HMAC context\n");
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	irc = HMAC_Init_ex(ctx,
+			   hmacKey->b.buffer, hmacKey->b.size,	/* HMAC key */
+			   md,					/* message digest method */
+			   NULL);
+	if (irc == 0) {
+	    if (tssVerbose) printf("TSS_HMAC_KeyNew: HMAC_Init_ex failed\n");
+	    rc = TSS_RC_HMAC;
+	}
+    }
+    if (rc == 0) {
+	*hmacState = ctx;
+    }
+    else {
+	TSS_HMAC_KeyFree(ctx);
+    }
+    return rc;
+}
+
+/* TSS_HMAC_KeyFree() frees a keyed HMAC state created by TSS_HMAC_KeyNew().  The key material is
+   erased.  hmacState can be NULL. */
+
+void TSS_HMAC_KeyFree(void *hmacState)
+{
+    if (hmacState != NULL) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+	HMAC_CTX_cleanup(hmacState);
+	free(hmacState);
+#else
+	HMAC_CTX_free(hmacState);
+#endif
+    }
+    return;
+}
+
+/* TSS_HMAC_GenerateKeyed_valist() calculates an HMAC using a keyed HMAC state from
+   TSS_HMAC_KeyNew().  The state is copied, so it is unchanged and can be reused.
+
+   On call, digest->hashAlg must match the hashAlg used to create the state.
+
+   length 0 is ignored, buffer NULL terminates list.
+*/
+
+TPM_RC TSS_HMAC_GenerateKeyed_valist(TPMT_HA *digest,		/* largest size of a digest */
+				     void *hmacState,
+				     va_list ap)
+{
+    TPM_RC		rc = 0;
+    int 		irc = 0;
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+    HMAC_CTX 		ctx;
+#else
+    HMAC_CTX 		*ctx;
+#endif
+    
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+    HMAC_CTX_init(&ctx);
+#else
+    ctx = HMAC_CTX_new();
+    if (ctx == NULL) {
+	rc = TSS_RC_OUT_OF_MEMORY;
+    }
+#endif
+    if (rc == 0) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+	irc = HMAC_CTX_copy(&ctx, hmacState);
+#else
+	irc = HMAC_CTX_copy(ctx, hmacState);
 #endif
 	if (irc == 0) {
+	    if (tssVerbose) printf("TSS_HMAC_GenerateKeyed_valist: HMAC_CTX_copy failed\n");
 	    rc = TSS_RC_HMAC;
 	}
     }
+    if (rc == 0) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+	rc = TSS_HMAC_Finish_valist(digest, &ctx, ap);
+#else
+	rc = TSS_HMAC_Finish_valist(digest, ctx, ap);
+#endif
+    }
 #if OPENSSL_VERSION_NUMBER < 0x10100000
     HMAC_CTX_cleanup(&ctx);
 #else
@@ -244,6 +651,8 @@ TPM_RC TSS_HMAC_Generate_valist(TPMT_HA *digest,		/* largest size of a digest */
     return rc;
 }
 
+#endif	/* OpenSSL before 3 */
+
 /*
   valist is int length, unsigned char *buffer pairs
   
@@ -305,11 +714,46 @@ TPM_RC TSS_Hash_Generate_valist(TPMT_HA *digest,		/* largest size of a digest */
 
 /* Random Numbers */
 
+/* The seeded generator state, see TSS_RandSeed() */
+
+static int 		tssRandSeeded = FALSE;
+static TPMT_HA 		tssRandSeedHash;	/* SHA-256 of the seed string */
+static uint32_t 	tssRandCounter;		/* next output block */
+
 TPM_RC TSS_RandBytes(unsigned char *buffer, uint32_t size)
 {
     TPM_RC 	rc = 0;
     int		irc = 0;
-
+    TPMT_HA 	block;
+    uint8_t 	counter[sizeof(uint32_t)];
+    uint32_t 	bytes;
+
+    /* seeded, output SHA-256(seed hash || counter) blocks */
+    if (tssRandSeeded) {
+	block.hashAlg = TPM_ALG_SHA256;
+	while ((rc == 0) && (size > 0)) {
+	    counter[0] = (uint8_t)(tssRandCounter >> 24);
+	    counter[1] = (uint8_t)(tssRandCounter >> 16);
+	    counter[2] = (uint8_t)(tssRandCounter >>  8);
+	    counter[3] = (uint8_t)(tssRandCounter >>  0);
+	    tssRandCounter++;
+	    rc = TSS_Hash_Generate(&block,
+				   SHA256_DIGEST_SIZE, (uint8_t *)&tssRandSeedHash.digest,
+				   sizeof(counter), counter,
+				   0, NULL);
+	    if (rc == 0) {
+		bytes = (size < SHA256_DIGEST_SIZE) ? size : SHA256_DIGEST_SIZE;
+		memcpy(buffer, (uint8_t *)&block.digest, bytes);
+		buffer += bytes;
+		size -= bytes;
+	    }
+	}
+	if (rc != 0) {
+	    if (tssVerbose) printf("TSS_RandBytes: Seeded random number generation failed\n");
+	    rc = TSS_RC_RNG_FAILURE;
+	}
+	return rc;
+    }
     irc = RAND_bytes(buffer, size);
     if (irc != 1) {
 	if (tssVerbose) printf("TSS_RandBytes: Random number generation failed\n");
@@ -318,6 +762,45 @@ TPM_RC TSS_RandBytes(unsigned char *buffer, uint32_t size)
     return rc;
 }
 
+/* TSS_RandSeed() makes TSS_RandBytes() a deterministic generator seeded by the string 'seed', so
+   that the nonces and salts in the command stream are the same in each run.  This is for
+   benchmarking and test only.  It is NEVER secure.
+
+   A NULL or empty seed restores the crypto library generator.  Setting the same seed again does
+   not restart the sequence.
+
+   The generator is global to the process and is not thread safe.  Random numbers generated inside
+   the crypto library, such as OAEP padding and the ECC ephemeral key, are not seeded.
+*/
+
+TPM_RC TSS_RandSeed(const char *seed)
+{
+    TPM_RC 	rc = 0;
+    TPMT_HA 	seedHash;
+
+    if ((seed == NULL) || (seed[0] == '\0')) {
+	tssRandSeeded = FALSE;
+	return rc;
+    }
+    if (rc == 0) {
+	seedHash.hashAlg = TPM_ALG_SHA256;
+	rc = TSS_Hash_Generate(&seedHash,
+			       (int)strlen(seed), seed,
+			       0, NULL);
+    }
+    /* reseed only when the seed changes */
+    if (rc == 0) {
+	if (!tssRandSeeded ||
+	    (memcmp((uint8_t *)&seedHash.digest, (uint8_t *)&tssRandSeedHash.digest,
+		    SHA256_DIGEST_SIZE) != 0)) {
+	    tssRandSeedHash = seedHash;
+	    tssRandCounter = 0;
+	    tssRandSeeded = TRUE;
+	}
+    }
+    return rc;
+}
+
 /*
   RSA functions
 */
@@ -450,24 +933,54 @@ TPM_RC TSS_RSAPublicEncrypt(unsigned char *encrypt_data,    /* encrypted data */
 			    TPMI_ALG_HASH halg)		/* OAEP hash algorithm */
 {
     TPM_RC  	rc = 0;
-    int         irc;
-    RSA         *rsa_pub_key = NULL;
-    unsigned char *padded_data = NULL;
+    void        *rsa_pub_key = NULL;
     
-    if (tssVverbose) printf(" TSS_RSAPublicEncrypt: Input data size %lu\n",
-			    (unsigned long)decrypt_data_size);
-    /* intermediate buffer for the decrypted but still padded data */
-    if (rc == 0) {
-        rc = TSS_Malloc(&padded_data, encrypt_data_size);               /* freed @2 */
-    }
     /* construct the OpenSSL public key object */
     if (rc == 0) {
-	rc = TSS_RSAGeneratePublicTokenI((void **)&rsa_pub_key,	/* freed @1 */
+	rc = TSS_RSAGeneratePublicTokenI(&rsa_pub_key,	/* freed @1 */
 					 narr,      	/* public modulus */
 					 nbytes,
 					 earr,      	/* public exponent */
 					 ebytes);
     }
+    if (rc == 0) {
+	rc = TSS_RSAPublicEncryptKey(encrypt_data,
+				     encrypt_data_size,
+				     decrypt_data,
+				     decrypt_data_size,
+				     rsa_pub_key,
+				     p,
+				     pl,
+				     halg);
+    }
+    TSS_RsaFree(rsa_pub_key);          /* @1 */
+    return rc;
+}
+
+/* TSS_RSAPublicEncryptKey() pads 'decrypt_data' to 'encrypt_data_size' and encrypts using the
+   public key token 'rsa_pub_key' from TSS_RSAGeneratePublicTokenI().  The caller can reuse the
+   token for many encryptions.
+*/
+
+TPM_RC TSS_RSAPublicEncryptKey(unsigned char *encrypt_data,    /* encrypted data */
+			       size_t encrypt_data_size,       /* size of encrypted data buffer */
+			       const unsigned char *decrypt_data,      /* decrypted data */
+			       size_t decrypt_data_size,
+			       void *rsa_pub_key,		/* public key token */
+			       unsigned char *p,		/* encoding parameter */
+			       int pl,
+			       TPMI_ALG_HASH halg)		/* OAEP hash algorithm */
+{
+    TPM_RC  	rc = 0;
+    int         irc;
+    unsigned char *padded_data = NULL;
+    
+    if (tssVverbose) printf(" TSS_RSAPublicEncryptKey: Input data size %lu\n",
+			    (unsigned long)decrypt_data_size);
+    /* intermediate buffer for the decrypted but still padded data */
+    if (rc == 0) {
+        rc = TSS_Malloc(&padded_data, encrypt_data_size);               /* freed @1 */
+    }
     if (rc == 0) {
 	padded_data[0] = 0x00;
 	rc = TSS_RSA_padding_add_PKCS1_OAEP(padded_data,		/* to */
@@ -480,9 +993,9 @@ TPM_RC TSS_RSAPublicEncrypt(unsigned char *encrypt_data,    /* encrypted data */
     }
     if (rc == 0) {
         if (tssVverbose)
-	    printf("  TSS_RSAPublicEncrypt: Padded data size %lu\n",
+	    printf("  TSS_RSAPublicEncryptKey: Padded data size %lu\n",
 		   (unsigned long)encrypt_data_size);
-        if (tssVverbose) TSS_PrintAll("  TPM_RSAPublicEncrypt: Padded data", padded_data,
+        if (tssVverbose) TSS_PrintAll("  TSS_RSAPublicEncryptKey: Padded data", padded_data,
 				      encrypt_data_size);
         /* encrypt with public key.  Must pad first and then encrypt because the encrypt
            call cannot specify an encoding parameter */
@@ -490,18 +1003,17 @@ TPM_RC TSS_RSAPublicEncrypt(unsigned char *encrypt_data,    /* encrypted data */
 	irc = RSA_public_encrypt(encrypt_data_size,         /* from length */
 				 padded_data,               /* from - the clear text data */
 				 encrypt_data,              /* the padded and encrypted data */
-				 rsa_pub_key,               /* key */
+				 (RSA *)rsa_pub_key,        /* key */
 				 RSA_NO_PADDING);           /* padding */
 	if (irc < 0) {
-	    if (tssVerbose) printf("TSS_RSAPublicEncrypt: Error in RSA_public_encrypt()\n");
+	    if (tssVerbose) printf("TSS_RSAPublicEncryptKey: Error in RSA_public_encrypt()\n");
 	    rc = TSS_RC_RSA_ENCRYPT;
 	}
     }
     if (rc == 0) {
-        if (tssVverbose) printf("  TSS_RSAPublicEncrypt: RSA_public_encrypt() success\n");
+        if (tssVverbose) printf("  TSS_RSAPublicEncryptKey: RSA_public_encrypt() success\n");
     }
-    TSS_RsaFree(rsa_pub_key);          /* @1 */
-    free(padded_data);                  /* @2 */
+    free(padded_data);                  /* @1 */
     return rc;
 }
 
@@ -1375,6 +1887,9 @@ TPM_RC TSS_AES_Decrypt(void *tssSessionDecKey,
     return rc;
 }
 
+/* TSS_AES_EncryptCFB() and TSS_AES_DecryptCFB() are the parameter encryption AES CFB mode.  On
+   return, iv is the chaining value for a following call. */
+
 TPM_RC TSS_AES_EncryptCFB(uint8_t	*dOut,		/* OUT: the encrypted data */
 			  uint32_t	keySizeInBits,	/* IN: key size in bits */
 			  uint8_t 	*key,           /* IN: key buffer */
@@ -1383,30 +1898,8 @@ TPM_RC TSS_AES_EncryptCFB(uint8_t	*dOut,		/* OUT: the encrypted data */
 			  uint8_t 	*dIn)		/* IN: data buffer */
 {
     TPM_RC	rc = 0;
-    int 	irc;
-    int		blockSize;
-    AES_KEY	aeskey;
-    int32_t	dSize;         /* signed version of dInSize */
-    
-    /* Create AES encryption key token */
-    if (rc == 0) {
-	irc = AES_set_encrypt_key(key, keySizeInBits, &aeskey);
-	if (irc != 0) {
-            if (tssVerbose) printf("TSS_AES_EncryptCFB: Error setting openssl AES encryption key\n");
-	    rc = TSS_RC_AES_KEYGEN_FAILURE;  /* should never occur, null pointers or bad bit size */
-	}
-    }
-    if (rc == 0) {
-	/* Encrypt the current IV into the new IV, XOR in the data, and copy to output */
-	for(dSize = (int32_t)dInSize ; dSize > 0 ; dSize -= 16, dOut += 16, dIn += 16) {
-	    /* Encrypt the current value of the IV to the intermediate value.  Store in old iv,
-	       since it's not needed anymore. */
-	    AES_encrypt(iv, iv, &aeskey);
-	    blockSize = (dSize < 16) ? dSize : 16;	/* last block can be < 16 */	
-	    TSS_XOR(dOut, dIn, iv, blockSize);
-	    memcpy(iv, dOut, blockSize);
-	}
-    }
+
+    rc = TSS_AES_CFB(dOut, keySizeInBits, key, iv, dInSize, dIn, 1);
     return rc;
 }
 
@@ -1418,29 +1911,70 @@ TPM_RC TSS_AES_DecryptCFB(uint8_t *dOut,          	/* OUT: the decrypted data */
 			  uint8_t *dIn)			/* IN: data buffer */
 {
     TPM_RC	rc = 0;
-    int 	irc;
-    uint8_t	tmp[16];
-    int		blockSize;
-    AES_KEY	aesKey;
-    int32_t	dSize;
+
+    rc = TSS_AES_CFB(dOut, keySizeInBits, key, iv, dInSize, dIn, 0);
+    return rc;
+}
+
+/* TSS_AES_CFB() encrypts (enc 1) or decrypts (enc 0) using AES CFB mode with the cipher from the
+   crypto provider table. */
+
+static TPM_RC TSS_AES_CFB(uint8_t *dOut,		/* OUT: the output data */
+			  uint32_t keySizeInBits, 	/* IN: key size in bits */
+			  uint8_t *key,           	/* IN: key buffer */
+			  uint8_t *iv,            	/* IN/OUT: IV */
+			  uint32_t dInSize,       	/* IN: data size */
+			  uint8_t *dIn,			/* IN: data buffer */
+			  int enc)			/* IN: 1 encrypt, 0 decrypt */
+{
+    TPM_RC		rc = 0;
+    int 		irc;
+    const EVP_CIPHER 	*cipher;
+    EVP_CIPHER_CTX 	*ctx = NULL;
+    int			outLength;
     
+    if (rc == 0) {
+	rc = TSS_Cipher_Get(&cipher, TPM_ALG_AES, keySizeInBits);
+	if (rc != 0) {
+            if (tssVerbose) printf("TSS_AES_CFB: Error, AES key size %u\n", keySizeInBits);
+	}
+    }
+    if (rc == 0) {
+	ctx = EVP_CIPHER_CTX_new();		/* freed @1 */
+	if (ctx == NULL) {
+            if (tssVerbose) printf("TSS_AES_CFB: Error allocating cipher context\n");
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
     /* Create AES encryption key token */
     if (rc == 0) {
-	irc = AES_set_encrypt_key(key, keySizeInBits, &aesKey);
-	if (irc != 0) {
-            if (tssVerbose) printf("TSS_AES_DecryptCFB: Error setting openssl AES encryption key\n");
+	irc = EVP_CipherInit_ex(ctx, cipher, NULL, key, iv, enc);
+	if (irc != 1) {
+            if (tssVerbose) printf("TSS_AES_CFB: Error setting openssl AES key\n");
 	    rc = TSS_RC_AES_KEYGEN_FAILURE;  /* should never occur, null pointers or bad bit size */
 	}
     }
     if (rc == 0) {
-	for (dSize = (int32_t)dInSize ; dSize > 0; dSize -= 16, dOut += 16, dIn += 16) {
-	    /* Encrypt the IV into the temp buffer */
-	    AES_encrypt(iv, tmp, &aesKey);
-	    blockSize = (dSize < 16) ? dSize : 16;	/* last block can be < 16 */	
-	    TSS_XOR(dOut, dIn, tmp, blockSize);
-	    memcpy(iv, dIn, blockSize);
+	irc = EVP_CipherUpdate(ctx, dOut, &outLength, dIn, (int)dInSize);
+	if ((irc != 1) || ((uint32_t)outLength != dInSize)) {
+            if (tssVerbose) printf("TSS_AES_CFB: Error in AES CFB\n");
+	    rc = enc ? TSS_RC_AES_ENCRYPT_FAILURE : TSS_RC_AES_DECRYPT_FAILURE;
+	}
+    }
+    /* return the chaining value */
+    if (rc == 0) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+	irc = EVP_CIPHER_CTX_get_updated_iv(ctx, iv, AES_128_BLOCK_SIZE_BYTES);
+	if (irc != 1) {
+	    rc = enc ? TSS_RC_AES_ENCRYPT_FAILURE : TSS_RC_AES_DECRYPT_FAILURE;
 	}
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000
+	memcpy(iv, EVP_CIPHER_CTX_iv(ctx), AES_128_BLOCK_SIZE_BYTES);
+#else
+	memcpy(iv, ctx->iv, AES_128_BLOCK_SIZE_BYTES);
+#endif
     }
+    EVP_CIPHER_CTX_free(ctx);		/* @1 */
     return rc;
 }
 
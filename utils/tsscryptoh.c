@@ -56,8 +56,7 @@
 #include <ibmtss/tsscryptoh.h>
 #include <ibmtss/tsscrypto.h>
 
-extern int tssVverbose;
-extern int tssVerbose;
+#include "tssproperties.h"
 
 /* local prototypes */
 
@@ -124,6 +123,56 @@ TPM_RC TSS_HMAC_Verify(TPMT_HA *expect,
     return rc;
 }
 
+/* TSS_HMAC_GenerateKeyed() is TSS_HMAC_Generate() using a keyed HMAC state from
+   TSS_HMAC_KeyNew() rather than an HMAC key.
+
+   On call, digest->hashAlg is the hash algorithm used to create the state.
+*/
+
+TPM_RC TSS_HMAC_GenerateKeyed(TPMT_HA *digest,		/* largest size of a digest */
+			      void *hmacState,
+			      ...)
+{
+    TPM_RC		rc = 0;
+    va_list		ap;
+    
+    va_start(ap, hmacState);
+    rc = TSS_HMAC_GenerateKeyed_valist(digest, hmacState, ap);
+    va_end(ap);
+    return rc;
+}
+
+/* TSS_HMAC_VerifyKeyed() is TSS_HMAC_Verify() using a keyed HMAC state from TSS_HMAC_KeyNew()
+   rather than an HMAC key.
+*/
+
+TPM_RC TSS_HMAC_VerifyKeyed(TPMT_HA *expect,
+			    void *hmacState,
+			    uint32_t sizeInBytes,
+			    ...)
+{
+    TPM_RC		rc = 0;
+    int			irc;
+    va_list		ap;
+    TPMT_HA 		actual;
+
+    actual.hashAlg = expect->hashAlg;	/* algorithm for the HMAC calculation */
+    va_start(ap, sizeInBytes);
+    if (rc == 0) {
+	rc = TSS_HMAC_GenerateKeyed_valist(&actual, hmacState, ap);
+    }
+    if (rc == 0) {
+	irc = memcmp((uint8_t *)&expect->digest, &actual.digest, sizeInBytes);
+	if (irc != 0) {
+	    TSS_PrintAll("TSS_HMAC_VerifyKeyed: calculated HMAC",
+			 (uint8_t *)&actual.digest, sizeInBytes);
+	    rc = TSS_RC_HMAC_VERIFY;
+	}
+    }
+    va_end(ap);
+    return rc;
+}
+
 /* TSS_KDFA() 11.4.9	Key Derivation Function
 
    As defined in SP800-108, the inner loop for building the key stream is:
@@ -139,6 +188,34 @@ TPM_RC TSS_KDFA(uint8_t		*keyStream,    	/* OUT: key buffer */
 		const TPM2B	*contextV,      /* IN: context V */
 		uint32_t	sizeInBits)    	/* IN: size of generated key in bits */
 
+{
+    TPM_RC	rc = 0;
+    void	*hmacState = NULL;
+
+    if (rc == 0) {
+	rc = TSS_HMAC_KeyNew(&hmacState, hashAlg,	/* freed @1 */
+			     (const TPM2B_KEY *)key);
+    }
+    if (rc == 0) {
+	rc = TSS_KDFA_Keyed(keyStream, hashAlg, hmacState,
+			    label, contextU, contextV, sizeInBits);
+    }
+    TSS_HMAC_KeyFree(hmacState);	/* @1 */
+    return rc;
+}
+
+/* TSS_KDFA_Keyed() is TSS_KDFA() using a keyed HMAC state from TSS_HMAC_KeyNew().  The HMAC key
+   setup is done once by the caller rather than once per KDFa counter block, and the state can be
+   reused for further KDFa calls with the same key. */
+
+TPM_RC TSS_KDFA_Keyed(uint8_t		*keyStream,    	/* OUT: key buffer */
+		      TPM_ALG_ID	hashAlg,       	/* IN: hash algorithm used in HMAC */
+		      void		*hmacState,	/* IN: HMAC state keyed with KI */
+		      const char	*label,		/* IN: KDFa label, NUL terminated */
+		      const TPM2B	*contextU,      /* IN: context U */
+		      const TPM2B	*contextV,      /* IN: context V */
+		      uint32_t		sizeInBits)    	/* IN: size of generated key in bits */
+
 {
     TPM_RC	rc = 0;
     uint32_t 	bytes = ((sizeInBits + 7) / 8);	/* bytes left to produce */
@@ -169,16 +246,18 @@ TPM_RC TSS_KDFA(uint8_t		*keyStream,    	/* OUT: key buffer */
 	}
 	counterNbo = htonl(counter);	/* counter for this pass in BE format */
 	    
-	rc = TSS_HMAC_Generate(&hmac,				/* largest size of an HMAC */
-			       (const TPM2B_KEY *)key,
-			       sizeof(uint32_t), &counterNbo,	/* KDFa i2 counter */
-			       strlen(label) + 1, label,	/* KDFa label, use NUL as the KDFa
+	rc = TSS_HMAC_GenerateKeyed(&hmac,			/* largest size of an HMAC */
+				    hmacState,			/* keyed once for all passes */
+				    sizeof(uint32_t), &counterNbo,	/* KDFa i2 counter */
+				    strlen(label) + 1, label,	/* KDFa label, use NUL as the KDFa
 								   00 byte */
-			       contextU->size, contextU->buffer,	/* KDFa Context */
-			       contextV->size, contextV->buffer,	/* KDFa Context */
-			       sizeof(uint32_t), &sizeInBitsNbo,	/* KDFa L2 */
-			       0, NULL);
-	memcpy(stream, &hmac.digest.tssmax, bytesThisPass);
+				    contextU->size, contextU->buffer,	/* KDFa Context */
+				    contextV->size, contextV->buffer,	/* KDFa Context */
+				    sizeof(uint32_t), &sizeInBitsNbo,	/* KDFa L2 */
+				    0, NULL);
+	if (rc == 0) {
+	    memcpy(stream, &hmac.digest.tssmax, bytesThisPass);
+	}
     }
     return rc;
 }
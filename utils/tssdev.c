@@ -46,7 +46,10 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
+#include <ibmtss/Unmarshal_fp.h>
 #include <ibmtss/tssresponsecode.h>
 #include <ibmtss/tsserror.h>
 #include <ibmtss/tssprint.h>
@@ -54,17 +57,32 @@
 
 #include "tssdev.h"
 
+/* response deadlines in milliseconds when TPM_COMMAND_TIMEOUT is auto.  These are failsafes well
+   beyond the TCG PC Client durations, not expected command times. */
+
+#ifndef TSS_DEV_TIMEOUT_SHORT
+#define TSS_DEV_TIMEOUT_SHORT	2000		/* reads, PCR, context management */
+#endif
+#ifndef TSS_DEV_TIMEOUT_MEDIUM
+#define TSS_DEV_TIMEOUT_MEDIUM	30000		/* private key operations, everything else */
+#endif
+#ifndef TSS_DEV_TIMEOUT_LONG
+#define TSS_DEV_TIMEOUT_LONG	300000		/* key generation, self test, seed changes */
+#endif
+
+/* added to the deadline through the kernel resource manager, where a command can be queued behind
+   another process's command, such as a key generation */
+
+#ifndef TSS_DEV_TIMEOUT_QUEUE
+#define TSS_DEV_TIMEOUT_QUEUE	TSS_DEV_TIMEOUT_LONG
+#endif
+
 /* local prototypes */
 
 static uint32_t TSS_Dev_Open(TSS_CONTEXT *tssContext);
 static uint32_t TSS_Dev_SendCommand(int dev_fd, const uint8_t *buffer, uint16_t length,
 				    const char *message);
-static uint32_t TSS_Dev_ReceiveResponse(int dev_fd, uint8_t *buffer, uint32_t *length);
-
-/* global configuration */
-
-extern int tssVverbose;
-extern int tssVerbose;
+static uint32_t TSS_Dev_ReceiveResponse(TSS_CONTEXT *tssContext, uint8_t *buffer, uint32_t *length);
 
 /* TSS_Dev_Transmit() transmits the command and receives the response.
 
@@ -78,6 +96,32 @@ TPM_RC TSS_Dev_Transmit(TSS_CONTEXT *tssContext,
 {
     TPM_RC rc = 0;
     
+    /* send the command to the device.  Error if the device send fails. */
+    if (rc == 0) {
+	rc = TSS_Dev_Send(tssContext, commandBuffer, written, message);
+    }
+    /* receive the response from the dev_fd.  Returns dev_fd errors, malformed response errors.
+       Else returns the TPM response code. */
+    if (rc == 0) {
+	rc = TSS_Dev_Receive(tssContext, responseBuffer, read);
+    }
+    return rc;
+}
+
+/* TSS_Dev_Send() opens the device on the first transmit and writes the command.  It does not wait
+   for the response.
+
+   It starts the response deadline, either the TPM_COMMAND_TIMEOUT value or one deduced from the
+   command code.
+*/
+
+TPM_RC TSS_Dev_Send(TSS_CONTEXT *tssContext,
+		    const uint8_t *commandBuffer, uint32_t written,
+		    const char *message)
+{
+    TPM_RC rc = 0;
+    unsigned int timeout;
+    
     /* open on first transmit */
     if (tssContext->tssFirstTransmit) {	
 	if (rc == 0) {
@@ -87,19 +131,60 @@ TPM_RC TSS_Dev_Transmit(TSS_CONTEXT *tssContext,
 	    tssContext->tssFirstTransmit = FALSE;
 	}
     }
+    if (rc == 0) {
+	if (tssContext->tssCommandTimeoutAuto) {
+	    timeout = TSS_Dev_GetTimeout(commandBuffer, written);
+	    if (tssContext->tssDevQueued) {
+		timeout += TSS_DEV_TIMEOUT_QUEUE;
+	    }
+	}
+	else {
+	    timeout = tssContext->tssCommandTimeout;
+	}
+	if (timeout != 0) {
+	    tssContext->tssDevDeadline = TSS_Dev_Now() + timeout;
+	}
+	else {
+	    tssContext->tssDevDeadline = 0;
+	}
+    }
     /* send the command to the device.  Error if the device send fails. */
     if (rc == 0) {
 	rc = TSS_Dev_SendCommand(tssContext->dev_fd, commandBuffer, written, message);
     }
-    /* receive the response from the dev_fd.  Returns dev_fd errors, malformed response errors.
-       Else returns the TPM response code. */
+    return rc;
+}
+
+/* TSS_Dev_Receive() reads the response to a command written by TSS_Dev_Send().
+
+   Can return device receive packet errors, but normally returns the TPM response code.
+*/
+
+TPM_RC TSS_Dev_Receive(TSS_CONTEXT *tssContext,
+		       uint8_t *responseBuffer, uint32_t *read)
+{
+    TPM_RC rc = 0;
+    
     if (rc == 0) {
-	rc = TSS_Dev_ReceiveResponse(tssContext->dev_fd, responseBuffer, read);
+	rc = TSS_Dev_ReceiveResponse(tssContext, responseBuffer, read);
+    }
+    /* the TPM may still be executing the command.  Closing the device discards its response, so
+       that it is not returned for the next command. */
+    if (rc == TSS_RC_COMMAND_TIMEOUT) {
+	TSS_Dev_Close(tssContext);
+	tssContext->tssFirstTransmit = TRUE;	/* force reopen on next command */
     }
     return rc;
 }
 
-/* TSS_Dev_Open() opens the TPM device (through the device driver) */
+/* TSS_Dev_Open() opens the TPM device (through the device driver)
+
+   The device is opened non-blocking so that the response wait can be bounded by poll().  A driver
+   without non-blocking support ignores the flag, and the read blocks as before.
+
+   A resource manager device, /dev/tpmrm0, is shared with other processes, so the automatic
+   deadline allows for queueing.
+*/
 
 static uint32_t TSS_Dev_Open(TSS_CONTEXT *tssContext)
 {
@@ -107,15 +192,74 @@ static uint32_t TSS_Dev_Open(TSS_CONTEXT *tssContext)
     
     if (rc == 0) {
 	if (tssVverbose) printf("TSS_Dev_Open: Opening %s\n", tssContext->tssDevice);
-	tssContext->dev_fd = open(tssContext->tssDevice, O_RDWR);
+	tssContext->dev_fd = open(tssContext->tssDevice, O_RDWR | O_NONBLOCK);
 	if (tssContext->dev_fd < 0) {
 	    if (tssVerbose) printf("TSS_Dev_Open: Error opening %s\n", tssContext->tssDevice);
 	    rc = TSS_RC_NO_CONNECTION;
 	}
     }
+    if (rc == 0) {
+	tssContext->tssDevQueued = (strstr(tssContext->tssDevice, "tpmrm") != NULL);
+    }
     return rc;
 }
 
+/* TSS_Dev_GetTimeout() returns the response deadline in milliseconds for the command in buffer.
+   It is also used by the shm transport. */
+
+unsigned int TSS_Dev_GetTimeout(const uint8_t *buffer, uint32_t length)
+{
+    TPM_CC	commandCode;
+    uint8_t	*tmpBuffer;
+    uint32_t	tmpSize;
+
+    if (length < (sizeof(TPM_ST) + sizeof(uint32_t) + sizeof(TPM_CC))) {
+	return TSS_DEV_TIMEOUT_MEDIUM;
+    }
+    /* skip the tag and size */
+    tmpBuffer = (uint8_t *)buffer + sizeof(TPM_ST) + sizeof(uint32_t);
+    tmpSize = length - (sizeof(TPM_ST) + sizeof(uint32_t));
+    if (TSS_UINT32_Unmarshalu(&commandCode, &tmpBuffer, &tmpSize) != 0) {
+	return TSS_DEV_TIMEOUT_MEDIUM;
+    }
+    switch (commandCode) {
+      case TPM_CC_CreatePrimary:
+      case TPM_CC_Create:
+      case TPM_CC_CreateLoaded:
+      case TPM_CC_SelfTest:
+      case TPM_CC_ChangeEPS:
+      case TPM_CC_ChangePPS:
+      case TPM_CC_Clear:
+	return TSS_DEV_TIMEOUT_LONG;
+      case TPM_CC_PCR_Read:
+      case TPM_CC_PCR_Extend:
+      case TPM_CC_GetCapability:
+      case TPM_CC_GetRandom:
+      case TPM_CC_GetTestResult:
+      case TPM_CC_ReadPublic:
+      case TPM_CC_NV_ReadPublic:
+      case TPM_CC_ReadClock:
+      case TPM_CC_FlushContext:
+      case TPM_CC_ContextSave:
+      case TPM_CC_ContextLoad:
+      case TPM_CC_PolicyGetDigest:
+      case TPM_CC_PolicyRestart:
+	return TSS_DEV_TIMEOUT_SHORT;
+      default:
+	return TSS_DEV_TIMEOUT_MEDIUM;
+    }
+}
+
+/* TSS_Dev_Now() returns a monotonic time in milliseconds */
+
+uint64_t TSS_Dev_Now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
 /* TSS_Dev_SendCommand() sends the TPM command buffer to the device.
 
    Returns an error if the device write fails.
@@ -149,22 +293,63 @@ static uint32_t TSS_Dev_SendCommand(int dev_fd,
 /* TSS_Dev_ReceiveResponse() reads a response buffer from the device.  'buffer' must be at least
    MAX_RESPONSE_SIZE bytes.
 
+   Waits until tssDevDeadline for the response.  Returns TSS_RC_COMMAND_TIMEOUT if it expires.
+
    Returns TPM packet error code.
 
    Validates that the packet length and the packet responseSize match 
 */
 
-static uint32_t TSS_Dev_ReceiveResponse(int dev_fd, uint8_t *buffer, uint32_t *length)
+static uint32_t TSS_Dev_ReceiveResponse(TSS_CONTEXT *tssContext, uint8_t *buffer, uint32_t *length)
 {
     uint32_t 	rc = 0;
-    int 	irc;
+    int 	irc = 0;
     uint32_t 	responseSize = 0;
     uint32_t 	responseCode = 0;
+    struct pollfd pfd;
+    int		timeout;
+    uint64_t	now;
 
     if (tssVverbose) printf("TSS_Dev_ReceiveResponse:\n");
-    /* read the TPM device */
+    /* wait for the response, then read the TPM device.  The read can still find no response if
+       the driver signals readable early, so wait again until the deadline. */
+    pfd.fd = tssContext->dev_fd;
+    pfd.events = POLLIN;
+    while (rc == 0) {
+	if (tssContext->tssDevDeadline == 0) {
+	    timeout = -1;
+	}
+	else {
+	    now = TSS_Dev_Now();
+	    if (now >= tssContext->tssDevDeadline) {
+		timeout = 0;
+	    }
+	    else {
+		timeout = (int)(tssContext->tssDevDeadline - now);
+	    }
+	}
+	irc = poll(&pfd, 1, timeout);
+	if (irc < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    if (tssVerbose) printf("TSS_Dev_ReceiveResponse: poll error %d %s\n",
+				   errno, strerror(errno));
+	    rc = TSS_RC_BAD_CONNECTION;
+	}
+	else if (irc == 0) {
+	    if (tssVerbose) printf("TSS_Dev_ReceiveResponse: Error, no response before deadline\n");
+	    rc = TSS_RC_COMMAND_TIMEOUT;
+	}
+	else {
+	    irc = read(tssContext->dev_fd, buffer, MAX_RESPONSE_SIZE);
+	    if ((irc < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+		continue;
+	    }
+	    break;
+	}
+    }
     if (rc == 0) {
-	irc = read(dev_fd, buffer, MAX_RESPONSE_SIZE);
 	if (irc <= 0) {
 	    rc = TSS_RC_BAD_CONNECTION;
 	    if (irc < 0) {
@@ -207,8 +392,30 @@ static uint32_t TSS_Dev_ReceiveResponse(int dev_fd, uint8_t *buffer, uint32_t *l
     return rc;
 }	
 
+/* TSS_Dev_GetFd() returns the device file descriptor, which becomes readable when the response is
+   available */
+
+TPM_RC TSS_Dev_GetFd(TSS_CONTEXT *tssContext, int *fd)
+{
+    TPM_RC rc = 0;
+
+    if (tssContext->tssFirstTransmit) {
+	rc = TSS_RC_NO_CONNECTION;
+    }
+    else {
+	*fd = tssContext->dev_fd;
+    }
+    return rc;
+}
+
+/* TSS_Dev_Close() closes the device, if it is open */
+
 TPM_RC TSS_Dev_Close(TSS_CONTEXT *tssContext)
 {
+    /* only close if there was an open */
+    if (tssContext->tssFirstTransmit) {
+	return 0;
+    }
     if (tssVverbose) printf("TSS_Dev_Close: Closing %s\n", tssContext->tssDevice);
     close(tssContext->dev_fd);
     return 0;
@@ -52,7 +52,15 @@ extern "C" {
 			    uint8_t *responseBuffer, uint32_t *read,
 			    const uint8_t *commandBuffer, uint32_t written,
 			    const char *message);
+    TPM_RC TSS_Dev_Send(TSS_CONTEXT *tssContext,
+			const uint8_t *commandBuffer, uint32_t written,
+			const char *message);
+    TPM_RC TSS_Dev_Receive(TSS_CONTEXT *tssContext,
+			   uint8_t *responseBuffer, uint32_t *read);
+    TPM_RC TSS_Dev_GetFd(TSS_CONTEXT *tssContext, int *fd);
     TPM_RC TSS_Dev_Close(TSS_CONTEXT *tssContext);
+    unsigned int TSS_Dev_GetTimeout(const uint8_t *buffer, uint32_t length);
+    uint64_t TSS_Dev_Now(void);
 
 #ifdef __cplusplus
 }
@@ -47,8 +47,6 @@
 #include <skiboot.h>
 #include "tssdevskiboot.h"
 
-extern int tssVerbose;
-
 TPM_RC TSS_Skiboot_Transmit(TSS_CONTEXT *tssContext,
 			    uint8_t *responseBuffer, uint32_t *read,
 			    const uint8_t *commandBuffer, uint32_t written,
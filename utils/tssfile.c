@@ -46,8 +46,7 @@
 #include <ibmtss/tssprint.h>
 #include <ibmtss/tssfile.h>
 
-extern int tssVerbose;
-extern int tssVverbose;
+#include "tssproperties.h"
 
 /* TSS_File_Open() opens the 'filename' for 'mode'
  */
@@ -0,0 +1,531 @@
+/********************************************************************************/
+/*										*/
+/*			      TSS Mock TPM Server				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* tssmockserver answers TPM commands with the mock TPM (see mocktpm.h) over the local transports,
+   so that the socunix and shm interfaces can be tested without a TPM or simulator.
+
+   -unix path	listens on a Unix domain socket for the socunix interface with TPM_SERVER_TYPE raw.
+		Clients are served one at a time.
+   -shm path	creates the shared memory file for the shm interface, see tssshm.h.  One client.
+
+   The mock TPM state, transient objects and sessions, persists across socunix connections.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tssresponsecode.h>
+
+#include "mocktpm.h"
+#include "tssshm.h"
+
+/* default bytes in each shm ring, holds one maximum size frame */
+#define MOCKSERVER_RING_SIZE	8192
+
+static TPM_RC serveUnix(TSS_CONTEXT *tssContext, const char *path, int background);
+static TPM_RC serveCommand(TSS_CONTEXT *tssContext,
+			   uint8_t *responseBuffer, uint32_t *read,
+			   const uint8_t *commandBuffer, uint32_t written);
+static TPM_RC readBytes(int fd, uint8_t *buffer, uint32_t length);
+static TPM_RC writeBytes(int fd, const uint8_t *buffer, uint32_t length);
+#ifdef __linux__
+static TPM_RC serveShm(TSS_CONTEXT *tssContext, const char *path, int background);
+static void ringCopy(uint8_t *ring, uint32_t ringSize, uint32_t offset,
+		     uint8_t *buffer, uint32_t length, int toRing);
+#endif
+static void startBackground(int background);
+static void printUsage(void);
+
+static unsigned int delay = 0;		/* milliseconds before each response */
+static unsigned long commands = 0;	/* commands to serve, 0 for no limit */
+static unsigned long corrupt = 0;	/* shm response with a bad frame length, 0 for none */
+
+int verbose = FALSE;
+
+int main(int argc, char *argv[])
+{
+    TPM_RC			rc = 0;
+    int				i;    	/* argc iterator */
+    TSS_CONTEXT			*tssContext = NULL;
+    const char			*unixPath = NULL;
+    const char			*shmPath = NULL;
+    int				background = FALSE;
+
+    setvbuf(stdout, 0, _IONBF, 0);      /* output may be going through pipe to log file */
+    TSS_SetProperty(NULL, TPM_TRACE_LEVEL, "1");
+
+    /* command line argument defaults */
+    for (i=1 ; (i<argc) && (rc == 0) ; i++) {
+	if (strcmp(argv[i],"-unix") == 0) {
+	    i++;
+	    if (i < argc) {
+		unixPath = argv[i];
+	    }
+	    else {
+		printf("-unix option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-shm") == 0) {
+	    i++;
+	    if (i < argc) {
+		shmPath = argv[i];
+	    }
+	    else {
+		printf("-shm option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-n") == 0) {
+	    i++;
+	    if (i < argc) {
+		commands = strtoul(argv[i], NULL, 0);
+	    }
+	    else {
+		printf("-n option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-delay") == 0) {
+	    i++;
+	    if (i < argc) {
+		delay = atoi(argv[i]);
+	    }
+	    else {
+		printf("-delay option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-corrupt") == 0) {
+	    i++;
+	    if (i < argc) {
+		corrupt = strtoul(argv[i], NULL, 0);
+	    }
+	    else {
+		printf("-corrupt option needs a value\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-bg") == 0) {
+	    background = TRUE;
+	}
+ 	else if (strcmp(argv[i],"-h") == 0) {
+	    printUsage();
+	}
+	else if (strcmp(argv[i],"-v") == 0) {
+	    verbose = TRUE;
+	    TSS_SetProperty(NULL, TPM_TRACE_LEVEL, "2");
+	}
+	else {
+	    printf("\n%s is not a valid option\n", argv[i]);
+	    printUsage();
+	}
+    }
+    if ((unixPath == NULL) == (shmPath == NULL)) {
+	printf("One of -unix or -shm must be specified\n");
+	printUsage();
+    }
+    /* the TSS context only holds the mock TPM state, it does not transmit */
+    if (rc == 0) {
+	rc = TSS_Create(&tssContext);
+    }
+    if (rc == 0) {
+	rc = MockTpm_Open(tssContext);
+    }
+    if (rc == 0) {
+	if (unixPath != NULL) {
+	    rc = serveUnix(tssContext, unixPath, background);
+	}
+	else {
+#ifdef __linux__
+	    rc = serveShm(tssContext, shmPath, background);
+#else
+	    printf("tssmockserver: -shm requires Linux\n");
+	    rc = TSS_RC_INSUPPORTED_INTERFACE;
+#endif
+	}
+    }
+    if (tssContext != NULL) {
+	MockTpm_Close(tssContext);
+	TSS_Delete(tssContext);
+    }
+    if (rc == 0) {
+	if (verbose) printf("tssmockserver: success\n");
+    }
+    else {
+	const char *msg;
+	const char *submsg;
+	const char *num;
+	printf("tssmockserver: failed, rc %08x\n", rc);
+	TSS_ResponseCode_toString(&msg, &submsg, &num, rc);
+	printf("%s%s%s\n", msg, submsg, num);
+	rc = EXIT_FAILURE;
+    }
+    return rc;
+}
+
+/* serveUnix() accepts socunix connections and answers raw TPM commands until the command limit
+   or an error */
+
+static TPM_RC serveUnix(TSS_CONTEXT *tssContext, const char *path, int background)
+{
+    TPM_RC		rc = 0;
+    int			listenFd = -1;
+    int			fd = -1;
+    struct sockaddr_un	addr;
+    uint8_t		commandBuffer[MAX_COMMAND_SIZE];
+    uint8_t		responseBuffer[MAX_RESPONSE_SIZE];
+    uint32_t		commandSize;
+    uint32_t		read;
+    unsigned long	count = 0;
+    /* tag, commandSize, commandCode */
+    const uint32_t	headerSize = sizeof(TPM_ST) + sizeof(uint32_t) + sizeof(TPM_CC);
+
+    if (rc == 0) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+	    printf("serveUnix: Error, path %s too long\n", path);
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    if (rc == 0) {
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((listenFd < 0) ||
+	    (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+	    (listen(listenFd, 1) != 0)) {
+	    printf("serveUnix: Error listening on %s, %s\n", path, strerror(errno));
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	startBackground(background);
+    }
+    while ((rc == 0) && ((commands == 0) || (count < commands))) {
+	if (fd < 0) {
+	    fd = accept(listenFd, NULL, NULL);
+	    if (fd < 0) {
+		printf("serveUnix: Error on accept, %s\n", strerror(errno));
+		rc = TSS_RC_BAD_CONNECTION;
+		break;
+	    }
+	}
+	/* a client that disconnects between commands is not an error */
+	if (readBytes(fd, commandBuffer, headerSize) != 0) {
+	    close(fd);
+	    fd = -1;
+	    continue;
+	}
+	commandSize = ntohl(*(uint32_t *)(commandBuffer + sizeof(TPM_ST)));
+	if ((commandSize < headerSize) || (commandSize > sizeof(commandBuffer))) {
+	    printf("serveUnix: Error, command size %u\n", commandSize);
+	    close(fd);
+	    fd = -1;
+	    continue;
+	}
+	if (readBytes(fd, commandBuffer + headerSize, commandSize - headerSize) != 0) {
+	    close(fd);
+	    fd = -1;
+	    continue;
+	}
+	rc = serveCommand(tssContext, responseBuffer, &read, commandBuffer, commandSize);
+	if (rc == 0) {
+	    if (writeBytes(fd, responseBuffer, read) != 0) {
+		close(fd);
+		fd = -1;
+	    }
+	    count++;
+	}
+    }
+    if (fd >= 0) {
+	close(fd);
+    }
+    if (listenFd >= 0) {
+	close(listenFd);
+	unlink(path);
+    }
+    return rc;
+}
+
+#ifdef __linux__
+
+/* serveShm() creates the shared memory file and answers commands from the command ring until the
+   command limit.  The waiting protocol is the one in tssshm.h, with the roles reversed. */
+
+static TPM_RC serveShm(TSS_CONTEXT *tssContext, const char *path, int background)
+{
+    TPM_RC		rc = 0;
+    int			fd = -1;
+    size_t		mapSize = sizeof(TSS_SHM) + (2 * MOCKSERVER_RING_SIZE);
+    void		*addr = MAP_FAILED;
+    TSS_SHM		*shm = NULL;
+    uint8_t		*commandRing = NULL;
+    uint8_t		*responseRing = NULL;
+    uint8_t		commandBuffer[MAX_COMMAND_SIZE];
+    uint8_t		responseBuffer[MAX_RESPONSE_SIZE];
+    uint32_t		head;
+    uint32_t		tail;
+    uint32_t		length;
+    uint32_t		read;
+    uint32_t		frameLength;
+    unsigned long	count = 0;
+
+    if (rc == 0) {
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if ((fd < 0) || (ftruncate(fd, mapSize) != 0)) {
+	    printf("serveShm: Error creating %s, %s\n", path, strerror(errno));
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	addr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+	    printf("serveShm: Error mapping %s, %s\n", path, strerror(errno));
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (fd >= 0) {
+	close(fd);
+    }
+    /* the file is zero filled, the magic is written last */
+    if (rc == 0) {
+	shm = (TSS_SHM *)addr;
+	commandRing = (uint8_t *)(shm + 1);
+	responseRing = commandRing + MOCKSERVER_RING_SIZE;
+	shm->version = TSS_SHM_VERSION;
+	shm->ringSize = MOCKSERVER_RING_SIZE;
+	__atomic_store_n(&shm->magic, TSS_SHM_MAGIC, __ATOMIC_RELEASE);
+	startBackground(background);
+    }
+    while ((rc == 0) && ((commands == 0) || (count < commands))) {
+	tail = shm->command.tail;
+	/* announce the sleep, then check again so that a command is not missed */
+	__atomic_store_n(&shm->command.waiting, TRUE, __ATOMIC_SEQ_CST);
+	while ((head = __atomic_load_n(&shm->command.head, __ATOMIC_SEQ_CST)) == tail) {
+	    syscall(SYS_futex, &shm->command.head, FUTEX_WAIT, tail, NULL, NULL, 0);
+	}
+	__atomic_store_n(&shm->command.waiting, FALSE, __ATOMIC_RELAXED);
+	ringCopy(commandRing, MOCKSERVER_RING_SIZE, tail, (uint8_t *)&length, sizeof(uint32_t),
+		 FALSE);
+	if ((length > sizeof(commandBuffer)) || (length > (head - tail - sizeof(uint32_t)))) {
+	    printf("serveShm: Error, bad command frame length %u\n", length);
+	    rc = TSS_RC_BAD_CONNECTION;
+	    break;
+	}
+	ringCopy(commandRing, MOCKSERVER_RING_SIZE, tail + sizeof(uint32_t),
+		 commandBuffer, length, FALSE);
+	__atomic_store_n(&shm->command.tail, tail + sizeof(uint32_t) + length, __ATOMIC_RELEASE);
+	rc = serveCommand(tssContext, responseBuffer, &read, commandBuffer, length);
+	/* one command is outstanding, so the response ring has room */
+	if (rc == 0) {
+	    head = shm->response.head;
+	    /* a frame length past the published data tests the client resynchronization */
+	    frameLength = read;
+	    if ((count + 1) == corrupt) {
+		frameLength += MOCKSERVER_RING_SIZE;
+	    }
+	    ringCopy(responseRing, MOCKSERVER_RING_SIZE, head, (uint8_t *)&frameLength,
+		     sizeof(uint32_t), TRUE);
+	    ringCopy(responseRing, MOCKSERVER_RING_SIZE, head + sizeof(uint32_t),
+		     responseBuffer, read, TRUE);
+	    __atomic_store_n(&shm->response.head, head + sizeof(uint32_t) + read,
+			     __ATOMIC_SEQ_CST);
+	    if (__atomic_load_n(&shm->response.waiting, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &shm->response.head, FUTEX_WAKE, 1, NULL, NULL, 0);
+	    }
+	    count++;
+	}
+    }
+    if (addr != MAP_FAILED) {
+	munmap(addr, mapSize);
+    }
+    return rc;
+}
+
+/* ringCopy() copies between a buffer and the ring at the free running offset, wrapping at the end
+   of the ring */
+
+static void ringCopy(uint8_t *ring, uint32_t ringSize, uint32_t offset,
+		     uint8_t *buffer, uint32_t length, int toRing)
+{
+    uint32_t	index = offset & (ringSize - 1);
+    uint32_t	first = ringSize - index;
+
+    if (first > length) {
+	first = length;
+    }
+    if (toRing) {
+	memcpy(ring + index, buffer, first);
+	memcpy(ring, buffer + first, length - first);
+    }
+    else {
+	memcpy(buffer, ring + index, first);
+	memcpy(buffer + first, ring, length - first);
+    }
+    return;
+}
+
+#endif	/* __linux__ */
+
+/* serveCommand() runs one command through the mock TPM, after the optional delay.  A TPM error is
+   a response, only a failure of the mock itself is returned. */
+
+static TPM_RC serveCommand(TSS_CONTEXT *tssContext,
+			   uint8_t *responseBuffer, uint32_t *read,
+			   const uint8_t *commandBuffer, uint32_t written)
+{
+    TPM_RC		rc = 0;
+    struct timespec	ts;
+
+    if (delay != 0) {
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = (delay % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+    }
+    *read = 0;
+    rc = MockTpm_Transmit(tssContext, responseBuffer, read, commandBuffer, written, NULL);
+    if (*read != 0) {
+	rc = 0;
+    }
+    return rc;
+}
+
+static TPM_RC readBytes(int fd, uint8_t *buffer, uint32_t length)
+{
+    ssize_t	nread;
+
+    while (length > 0) {
+	nread = read(fd, buffer, length);
+	if (nread <= 0) {
+	    if ((nread < 0) && (errno == EINTR)) {
+		continue;
+	    }
+	    return TSS_RC_BAD_CONNECTION;
+	}
+	buffer += nread;
+	length -= nread;
+    }
+    return 0;
+}
+
+static TPM_RC writeBytes(int fd, const uint8_t *buffer, uint32_t length)
+{
+    ssize_t	nwritten;
+
+    while (length > 0) {
+	nwritten = write(fd, buffer, length);
+	if (nwritten <= 0) {
+	    if ((nwritten < 0) && (errno == EINTR)) {
+		continue;
+	    }
+	    return TSS_RC_BAD_CONNECTION;
+	}
+	buffer += nwritten;
+	length -= nwritten;
+    }
+    return 0;
+}
+
+/* startBackground() forks when the endpoint is ready, so that a script can start the client as
+   soon as the server command returns.  The parent prints the server process ID and exits. */
+
+static void startBackground(int background)
+{
+    pid_t	pid;
+    int		fd;
+
+    if (background) {
+	pid = fork();
+	if (pid < 0) {
+	    printf("tssmockserver: Error, fork failed, %s\n", strerror(errno));
+	    exit(EXIT_FAILURE);
+	}
+	if (pid > 0) {
+	    printf("%ld\n", (long)pid);
+	    exit(0);
+	}
+	/* release the caller's output, e.g. a shell command substitution waiting for the pipe */
+	fd = open("/dev/null", O_RDWR);
+	if (fd >= 0) {
+	    dup2(fd, STDOUT_FILENO);
+	    close(fd);
+	}
+    }
+    return;
+}
+
+static void printUsage(void)
+{
+    printf("\n");
+    printf("tssmockserver\n");
+    printf("\n");
+    printf("Answers TPM commands with the mock TPM over the socunix or shm interface\n");
+    printf("\n");
+    printf("\t-unix\tUnix domain socket path (TPM_INTERFACE_TYPE socunix,\n");
+    printf("\t\tTPM_SERVER_TYPE raw, TPM_COMMAND_PATH)\n");
+    printf("\t-shm\tshared memory file to create (TPM_INTERFACE_TYPE shm,\n");
+    printf("\t\tTPM_COMMAND_PATH)\n");
+    printf("\t[-n\tnumber of commands to serve before exiting (default no limit)]\n");
+    printf("\t[-corrupt\tshm response number to send with a bad frame length\n");
+    printf("\t\t(default none)]\n");
+    printf("\t[-delay\tmilliseconds to wait before each response (default 0)]\n");
+    printf("\t[-bg\tfork into the background when ready, print the process ID]\n");
+    printf("\n");
+    exit(1);	
+}
@@ -47,7 +47,7 @@
 
 #include <ibmtss/tssprint.h>
 
-extern int tssVerbose;
+#include "tssproperties.h"
 
 #ifdef TPM_TSS_NO_PRINT
 
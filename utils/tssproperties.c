@@ -49,8 +49,17 @@
 #include <ibmtss/tsscrypto.h>
 #endif
 #include <ibmtss/tssprint.h>
+#include <ibmtss/tssutils.h>
 
 #include "tssproperties.h"
+#ifdef TSS_HAVE_RECORD
+#include "tssrecord.h"
+#endif
+
+#if defined TPM_POSIX && !defined TPM_SKIBOOT && !defined __ULTRAVISOR__
+#include <pthread.h>
+#define TSS_PTHREAD_ONCE
+#endif
 
 /* For systems where there are no environment variables, GETENV returns NULL.  This simulates the
    situation when an environment variable is not set, causing the compiled in default to be used. */
@@ -62,26 +71,57 @@
 
 /* local prototypes */
 
-static TPM_RC TSS_SetTraceLevel(const char *value);
+static void   TSS_Library_InitOnce(void);
+static TPM_RC TSS_SetTraceLevel(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetDataDirectory(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetCommandPort(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetPlatformPort(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetServerName(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetServerType(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetConnectTimeout(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetServerSelect(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetCommandPath(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetPlatformPath(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetInterfaceType(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetDevice(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetRetryCodes(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetRetryAttempts(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetRetryDelay(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetCommandTimeout(TSS_CONTEXT *tssContext, const char *value);
 static TPM_RC TSS_SetEncryptSessions(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetValidateInput(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetSessionCache(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetDataStore(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetRecordFile(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetReplayFile(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetRandomSeed(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetStats(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetStatsFile(TSS_CONTEXT *tssContext, const char *value);
+static TPM_RC TSS_SetVirtualize(TSS_CONTEXT *tssContext, const char *value);
 
 /* globals for the library */
 
-/* tracing is global to avoid passing the context into every function call */
-int tssVerbose = TRUE;		/* initial value so TSS_Properties_Init errors emit message */
-int tssVverbose = FALSE;
+/* Tracing is per thread to avoid passing the context into every function call.  The values are
+   loaded from the TSS context at each entry point by TSS_SetThreadTrace(). */
+TSS_THREAD_LOCAL int tssVerbose = TRUE;	/* initial value so TSS_Properties_Init errors emit
+					   message */
+TSS_THREAD_LOCAL int tssVverbose = FALSE;
+
+/* The trace level for new TSS contexts, from TPM_TRACE_LEVEL or TSS_SetProperty() with a NULL
+   context */
+static int tssDefaultVerbose = TRUE;
+static int tssDefaultVverbose = FALSE;
 
-/* This is a total hack to ensure that the global verbose flags are only set once.  It's used by the
-   two entry points to the TSS, TSS_Create() and TSS_SetProperty() */
+/* one time library initialization, result of TSS_Library_InitOnce() */
 
-int tssFirstCall = TRUE;
+#if defined TSS_PTHREAD_ONCE
+static pthread_once_t tssInitOnce = PTHREAD_ONCE_INIT;
+#elif defined TPM_WINDOWS
+static INIT_ONCE tssInitOnce = INIT_ONCE_STATIC_INIT;
+#else
+static int tssFirstCall = TRUE;
+#endif
+static TPM_RC tssInitRc = 0;
 
 /* defaults for global settings */
 
@@ -101,6 +141,22 @@ int tssFirstCall = TRUE;
 #define TPM_SERVER_NAME_DEFAULT		"localhost"	/* default to local machine */
 #endif
 
+#ifndef TPM_COMMAND_PATH_DEFAULT
+#define TPM_COMMAND_PATH_DEFAULT	"/tmp/tpmcommand"	/* local simulator command endpoint */
+#endif
+
+#ifndef TPM_PLATFORM_PATH_DEFAULT
+#define TPM_PLATFORM_PATH_DEFAULT	"/tmp/tpmplatform"	/* local simulator platform endpoint */
+#endif
+
+#ifndef TPM_CONNECT_TIMEOUT_DEFAULT
+#define TPM_CONNECT_TIMEOUT_DEFAULT	"5000"		/* milliseconds per address */
+#endif
+
+#ifndef TPM_SERVER_SELECT_DEFAULT
+#define TPM_SERVER_SELECT_DEFAULT	"order"		/* try the hosts in list order */
+#endif
+
 #ifndef TPM_SERVER_TYPE_DEFAULT
 #define TPM_SERVER_TYPE_DEFAULT		"mssim"		/* default to MS simulator format */
 #endif
@@ -126,26 +182,136 @@ int tssFirstCall = TRUE;
 #endif
 #endif
 
+#ifndef TPM_COMMAND_TIMEOUT_DEFAULT
+#define TPM_COMMAND_TIMEOUT_DEFAULT	"auto"		/* deadline from the command code */
+#endif
+
+#ifndef TPM_RETRY_CODES_DEFAULT
+#define TPM_RETRY_CODES_DEFAULT		"retry,yielded,testing,nvrate"
+#endif
+
+#ifndef TPM_RETRY_ATTEMPTS_DEFAULT
+#define TPM_RETRY_ATTEMPTS_DEFAULT	"4"		/* first attempt and 3 retries */
+#endif
+
+#ifndef TPM_RETRY_DELAY_DEFAULT
+#define TPM_RETRY_DELAY_DEFAULT		"50"		/* milliseconds, doubled each retry */
+#endif
+
 #ifndef TPM_ENCRYPT_SESSIONS_DEFAULT
 #define TPM_ENCRYPT_SESSIONS_DEFAULT	"1"
 #endif
 
-/* TSS_GlobalProperties_Init() sets the global verbose trace flags at the first entry points to the
-   TSS */
+#ifndef TPM_VALIDATE_INPUT_DEFAULT
+#define TPM_VALIDATE_INPUT_DEFAULT	"2"		/* always validate command parameters */
+#endif
+
+#ifndef TPM_SESSION_CACHE_DEFAULT
+#define TPM_SESSION_CACHE_DEFAULT	"0"		/* session state is shared through the file */
+#endif
+
+#ifndef TPM_STATS_DEFAULT
+#define TPM_STATS_DEFAULT		"0"		/* no TSS_Execute() statistics */
+#endif
+
+#ifndef TPM_VIRTUALIZE_DEFAULT
+#define TPM_VIRTUALIZE_DEFAULT		"0"		/* TPM transient object handles */
+#endif
+
+#ifndef TPM_DATA_STORE_DEFAULT
+#define TPM_DATA_STORE_DEFAULT		"file"		/* one file per handle */
+#endif
+
+#ifdef TPM_WINDOWS
+
+static BOOL CALLBACK TSS_Library_InitOnceWindows(PINIT_ONCE initOnce,
+						 PVOID parameter,
+						 PVOID *context);
+
+static BOOL CALLBACK TSS_Library_InitOnceWindows(PINIT_ONCE initOnce,
+						 PVOID parameter,
+						 PVOID *context)
+{
+    initOnce = initOnce;
+    parameter = parameter;
+    context = context;
+    TSS_Library_InitOnce();
+    return TRUE;
+}
+
+#endif
+
+/* TSS_Library_Init() performs the global library initialization exactly once, at the first entry
+   point to the TSS.  It is safe to call from multiple threads.
+
+   Every call returns the result of the one initialization.
+*/
+
+TPM_RC TSS_Library_Init(void)
+{
+#if defined TSS_PTHREAD_ONCE
+    pthread_once(&tssInitOnce, TSS_Library_InitOnce);
+#elif defined TPM_WINDOWS
+    InitOnceExecuteOnce(&tssInitOnce, TSS_Library_InitOnceWindows, NULL, NULL);
+#else	/* no threads */
+    if (tssFirstCall) {
+	TSS_Library_InitOnce();
+	tssFirstCall = FALSE;
+    }
+#endif
+    return tssInitRc;
+}
+
+/* TSS_Library_InitOnce() initializes the crypto library and the global properties.  It is called
+   exactly once, through TSS_Library_Init().
+*/
+
+static void TSS_Library_InitOnce(void)
+{
+    TPM_RC		rc = 0;
+
+#ifndef TPM_TSS_NOCRYPTO
+    /* crypto module initializations, crypto library specific */
+    if (rc == 0) {
+	rc = TSS_Crypto_Init();
+    }
+#endif
+    /* TSS properties that are global, not per TSS context */
+    if (rc == 0) {
+	rc = TSS_GlobalProperties_Init();
+    }
+    tssInitRc = rc;
+    return;
+}
+
+/* TSS_GlobalProperties_Init() sets the default trace level for new TSS contexts at the first entry
+   point to the TSS */
 
 TPM_RC TSS_GlobalProperties_Init(void)
 {
     TPM_RC		rc = 0;
     const char 		*value;
 
-    /* trace level is global, tssContext can be null */
+    /* a NULL tssContext sets the default */
     if (rc == 0) {
 	value = GETENV("TPM_TRACE_LEVEL");
-	rc = TSS_SetTraceLevel(value);
+	rc = TSS_SetTraceLevel(NULL, value);
     }
     return rc;
 }
 
+/* TSS_SetThreadTrace() makes the trace level of the TSS context current for the calling thread.  It
+   is called at the TSS entry points that take a TSS context.
+*/
+
+void TSS_SetThreadTrace(const TSS_CONTEXT *tssContext)
+{
+    if (tssContext != NULL) {
+	tssVerbose = tssContext->tssVerbose;
+	tssVverbose = tssContext->tssVverbose;
+    }
+    return;
+}
 
 /* TSS_Properties_Init() sets the initial TSS_CONTEXT properties based on either the environment
    variables (if set) or the defaults (if not).
@@ -158,8 +324,34 @@ TPM_RC TSS_Properties_Init(TSS_CONTEXT *tssContext)
 
     if (rc == 0) {
 	tssContext->tssAuthContext = NULL;
+	tssContext->tssVerbose = tssDefaultVerbose;
+	tssContext->tssVverbose = tssDefaultVverbose;
+	TSS_SetThreadTrace(tssContext);
 	tssContext->tssFirstTransmit = TRUE;	/* connection not opened */
+	tssContext->tssTransport = NULL;	/* transport not selected */
+	tssContext->tssTransportData = NULL;
+	/* any non-zero seed.  The context address differs between contexts and, with address
+	   randomization, between processes, so that clients do not retry in lock step. */
+	tssContext->tssRetryJitter = (uint32_t)(size_t)tssContext | 1;
 	tssContext->tpm12Command = FALSE;
+	tssContext->tssDeferredCommand = NULL;
+	tssContext->tssDeferredLength = 0;
+	tssContext->tssDeferredMessage = NULL;
+	tssContext->tssCapabilities = NULL;
+	tssContext->tssSessionPool = NULL;
+	tssContext->tssSaltKeys = NULL;
+	tssContext->tssVirtual = NULL;
+#ifdef TSS_HAVE_RECORD
+	tssContext->tssRecordFile = NULL;
+	tssContext->tssRecord = NULL;
+	tssContext->tssReplayFile = NULL;
+	tssContext->tssReplay = NULL;
+#endif
+#ifdef TSS_HAVE_STATS
+	tssContext->tssStatsEnable = FALSE;
+	tssContext->tssStatsFile = NULL;
+	tssContext->tssStats = NULL;
+#endif
 #ifdef TPM_WINDOWS
 	tssContext->sock_fd = INVALID_SOCKET;
 #endif
@@ -168,8 +360,24 @@ TPM_RC TSS_Properties_Init(TSS_CONTEXT *tssContext)
 	tssContext->sock_fd = -1;
 #endif 	/* TPM_NOSOCKET */
 #endif
+#ifndef TPM_NOSOCKET
+	tssContext->tssSocketMssim = FALSE;
+	tssContext->tssSocketRawsingle = FALSE;
+	tssContext->tssSocketKeepalive = FALSE;
+	tssContext->tssSocketUnix = FALSE;
+	tssContext->tssSocketReadStart = 0;
+	tssContext->tssSocketReadEnd = 0;
+#endif 	/* TPM_NOSOCKET */
+#ifdef TSS_HAVE_SHM
+	tssContext->tssShm = NULL;
+	tssContext->tssShmSize = 0;
+	tssContext->tssShmDeadline = 0;
+	tssContext->tssShmStale = 0;
+#endif
 #ifndef TPM_NODEV
 	tssContext->dev_fd = -1;
+	tssContext->tssDevDeadline = 0;
+	tssContext->tssDevQueued = FALSE;
 #endif /* TPM_NODEV */
 #ifdef TPM_WINDOWS
 #ifdef TPM_WINDOWS_TBSI
@@ -182,21 +390,40 @@ TPM_RC TSS_Properties_Init(TSS_CONTEXT *tssContext)
 #endif
 #endif
     }
+    /* no command in progress */
+    if (rc == 0) {
+	size_t i;
+	tssContext->tssExecuteState.phase = TSS_EXECUTE_IDLE;
+	for (i = 0 ; i < MAX_SESSION_NUM ; i++) {
+	    tssContext->tssExecuteState.authCommand[i] = NULL;
+	    tssContext->tssExecuteState.authResponse[i] = NULL;
+	    tssContext->tssExecuteState.session[i] = NULL;
+	    tssContext->tssExecuteState.names[i] = NULL;
+	}
+    }
+    /* the scratch arena is allocated by TSS_Scratch_Init() */
+    if (rc == 0) {
+	tssContext->tssScratch.buffer = NULL;
+	tssContext->tssScratch.size = 0;
+	tssContext->tssScratch.used = 0;
+    }
     /* for a minimal TSS with no file support */
 #ifdef TPM_TSS_NOFILE
+    TSS_HandleTable_Init(&tssContext->sessions, sizeof(TSS_SESSIONS));
+    TSS_HandleTable_Init(&tssContext->objectPublic, sizeof(TSS_OBJECT_PUBLIC));
+    TSS_HandleTable_Init(&tssContext->nvPublic, sizeof(TSS_NVPUBLIC));
+#else
+    /* for a TSS with file support, the session cache and the metadata store mapping */
     {
 	size_t i;
-	for (i = 0 ; i < (sizeof(tssContext->sessions) / sizeof(TSS_SESSIONS)) ; i++) {
-	    tssContext->sessions[i].sessionHandle = TPM_RH_NULL;
-	    tssContext->sessions[i].sessionData = NULL;
-	    tssContext->sessions[i].sessionDataLength = 0;
-	}
-	for (i = 0 ; i < (sizeof(tssContext->objectPublic) / sizeof(TSS_OBJECT_PUBLIC)) ; i++) {
-	    tssContext->objectPublic[i].objectHandle = TPM_RH_NULL;
-	}
-	for (i = 0 ; i < (sizeof(tssContext->nvPublic) / sizeof(TSS_NVPUBLIC)) ; i++) {
-	    tssContext->nvPublic[i].nvIndex = TPM_RH_NULL;
+	for (i = 0 ; i < (sizeof(tssContext->sessionCache) / sizeof(TSS_SESSION_CACHE)) ; i++) {
+	    tssContext->sessionCache[i].sessionHandle = TPM_RH_NULL;
+	    tssContext->sessionCache[i].sessionData = NULL;
+	    tssContext->sessionCache[i].sessionDataLength = 0;
+	    tssContext->sessionCache[i].dirty = FALSE;
+	    tssContext->sessionCache[i].inFile = FALSE;
 	}
+	tssContext->tssStore = NULL;
     }
 #endif
     /* data directory */
@@ -204,11 +431,39 @@ TPM_RC TSS_Properties_Init(TSS_CONTEXT *tssContext)
 	value = GETENV("TPM_DATA_DIR");
 	rc = TSS_SetDataDirectory(tssContext, value);
     }
+    /* backend for Names, public areas, and NV public areas */
+    if (rc == 0) {
+	value = GETENV("TPM_DATA_STORE");
+	rc = TSS_SetDataStore(tssContext, value);
+    }
     /* flag whether session state should be encrypted */
     if (rc == 0) {
 	value = GETENV("TPM_ENCRYPT_SESSIONS");
 	rc = TSS_SetEncryptSessions(tssContext, value);
     }
+    /* command parameter validation */
+    if (rc == 0) {
+	value = GETENV("TPM_VALIDATE_INPUT");
+	rc = TSS_SetValidateInput(tssContext, value);
+    }
+    /* session file sync policy */
+    if (rc == 0) {
+	value = GETENV("TPM_SESSION_CACHE");
+	rc = TSS_SetSessionCache(tssContext, value);
+    }
+    /* TPM warning retry policy */
+    if (rc == 0) {
+	value = GETENV("TPM_RETRY_CODES");
+	rc = TSS_SetRetryCodes(tssContext, value);
+    }
+    if (rc == 0) {
+	value = GETENV("TPM_RETRY_ATTEMPTS");
+	rc = TSS_SetRetryAttempts(tssContext, value);
+    }
+    if (rc == 0) {
+	value = GETENV("TPM_RETRY_DELAY");
+	rc = TSS_SetRetryDelay(tssContext, value);
+    }
     /* TPM socket command port */
     if (rc == 0) {
 	value = GETENV("TPM_COMMAND_PORT");
@@ -224,6 +479,26 @@ TPM_RC TSS_Properties_Init(TSS_CONTEXT *tssContext)
 	value = GETENV("TPM_SERVER_NAME");
 	rc = TSS_SetServerName(tssContext, value);
     }
+    /* TPM socket connect timeout */
+    if (rc == 0) {
+	value = GETENV("TPM_CONNECT_TIMEOUT");
+	rc = TSS_SetConnectTimeout(tssContext, value);
+    }
+    /* TPM socket host list order */
+    if (rc == 0) {
+	value = GETENV("TPM_SERVER_SELECT");
+	rc = TSS_SetServerSelect(tssContext, value);
+    }
+    /* TPM local command endpoint */
+    if (rc == 0) {
+	value = GETENV("TPM_COMMAND_PATH");
+	rc = TSS_SetCommandPath(tssContext, value);
+    }
+    /* TPM local simulator platform endpoint */
+    if (rc == 0) {
+	value = GETENV("TPM_PLATFORM_PATH");
+	rc = TSS_SetPlatformPath(tssContext, value);
+    }
     /* TPM socket server type */
     if (rc == 0) {
 	value = GETENV("TPM_SERVER_TYPE");
@@ -239,9 +514,309 @@ TPM_RC TSS_Properties_Init(TSS_CONTEXT *tssContext)
 	value = GETENV("TPM_DEVICE");
 	rc = TSS_SetDevice(tssContext, value);
     }
+    /* TPM device response deadline */
+    if (rc == 0) {
+	value = GETENV("TPM_COMMAND_TIMEOUT");
+	rc = TSS_SetCommandTimeout(tssContext, value);
+    }
+    /* command trace */
+    if (rc == 0) {
+	value = GETENV("TPM_RECORD_FILE");
+	rc = TSS_SetRecordFile(tssContext, value);
+    }
+    if (rc == 0) {
+	value = GETENV("TPM_REPLAY_FILE");
+	rc = TSS_SetReplayFile(tssContext, value);
+    }
+    /* TSS_Execute() phase statistics */
+    if (rc == 0) {
+	value = GETENV("TPM_STATS");
+	rc = TSS_SetStats(tssContext, value);
+    }
+    if (rc == 0) {
+	value = GETENV("TPM_STATS_FILE");
+	rc = TSS_SetStatsFile(tssContext, value);
+    }
+    /* transient object virtualization */
+    if (rc == 0) {
+	value = GETENV("TPM_VIRTUALIZE");
+	rc = TSS_SetVirtualize(tssContext, value);
+    }
+    /* The random number generator seed is global, so an unset variable does not remove a seed
+       set through another context */
+    if (rc == 0) {
+	value = GETENV("TPM_RANDOM_SEED");
+	if (value != NULL) {
+	    rc = TSS_SetRandomSeed(tssContext, value);
+	}
+    }
+    return rc;
+}
+
+/* TSS_Scratch_Init() allocates the per context scratch arena of 'size' bytes.  The arena is
+   zeroed, and is kept zeroed past 'used' by TSS_Scratch_Reset().
+*/
+
+TPM_RC TSS_Scratch_Init(TSS_CONTEXT *tssContext, size_t size)
+{
+    TPM_RC		rc = 0;
+
+    if (rc == 0) {
+	rc = TSS_Malloc(&tssContext->tssScratch.buffer, (uint32_t)size);	/* freed @1 */
+    }
+    if (rc == 0) {
+	memset(tssContext->tssScratch.buffer, 0, size);
+	tssContext->tssScratch.size = size;
+	tssContext->tssScratch.used = 0;
+    }
+    return rc;
+}
+
+/* TSS_Scratch_Alloc() returns zeroed memory of 'size' bytes from the scratch arena.  The memory
+   is valid until the next TSS_Scratch_Reset(), and must not be freed.
+*/
+
+TPM_RC TSS_Scratch_Alloc(TSS_CONTEXT *tssContext, void **buffer, size_t size)
+{
+    TPM_RC		rc = 0;
+    TSS_SCRATCH 	*scratch = &tssContext->tssScratch;
+    size_t		roundSize = TSS_SCRATCH_ROUND(size);
+
+    if (rc == 0) {
+	if (roundSize > (scratch->size - scratch->used)) {
+	    if (tssVerbose) printf("TSS_Scratch_Alloc: Error, size %lu, used %lu of %lu\n",
+				   (unsigned long)size,
+				   (unsigned long)scratch->used, (unsigned long)scratch->size);
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	*buffer = scratch->buffer + scratch->used;
+	scratch->used += roundSize;
+    }
+    return rc;
+}
+
+/* TSS_Scratch_Reset() releases all scratch arena allocations.  The used part is erased, since it
+   may have held session keys and passwords.
+*/
+
+void TSS_Scratch_Reset(TSS_CONTEXT *tssContext)
+{
+    TSS_SCRATCH 	*scratch = &tssContext->tssScratch;
+    
+    if (scratch->buffer != NULL) {
+	memset(scratch->buffer, 0, scratch->used);
+    }
+    scratch->used = 0;
+    return;
+}
+
+/* TSS_Scratch_Delete() erases and frees the scratch arena */
+
+void TSS_Scratch_Delete(TSS_CONTEXT *tssContext)
+{
+    TSS_Scratch_Reset(tssContext);
+    free(tssContext->tssScratch.buffer);	/* @1 */
+    tssContext->tssScratch.buffer = NULL;
+    tssContext->tssScratch.size = 0;
+    return;
+}
+
+#ifdef TPM_TSS_NOFILE
+
+static size_t TSS_HandleTable_Hash(TPM_HANDLE handle, size_t slots);
+static TPM_RC TSS_HandleTable_Grow(TSS_HANDLE_TABLE *table);
+
+/* TSS_HandleTable_Init() initializes an empty table of entries of 'entrySize' bytes.  No memory
+   is allocated until the first add.
+*/
+
+void TSS_HandleTable_Init(TSS_HANDLE_TABLE *table, size_t entrySize)
+{
+    table->entries = NULL;
+    table->entrySize = entrySize;
+    table->slots = 0;
+    table->count = 0;
+    return;
+}
+
+/* TSS_HandleTable_Hash() returns the home slot for the handle.  Handles within a range are
+   mostly sequential, so the bits are mixed before masking.
+*/
+
+static size_t TSS_HandleTable_Hash(TPM_HANDLE handle, size_t slots)
+{
+    uint32_t h = handle;
+
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h & (slots - 1);
+}
+
+/* TSS_HandleTable_Find() returns the entry for the handle, or NULL if there is none */
+
+void *TSS_HandleTable_Find(const TSS_HANDLE_TABLE *table, TPM_HANDLE handle)
+{
+    size_t	i;
+
+    if (table->count == 0) {
+	return NULL;
+    }
+    /* linear probe from the home slot to the first empty slot */
+    for (i = TSS_HandleTable_Hash(handle, table->slots) ;
+	 table->entries[i] != NULL ;
+	 i = (i + 1) & (table->slots - 1)) {
+	if (*(TPM_HANDLE *)table->entries[i] == handle) {
+	    return table->entries[i];
+	}
+    }
+    return NULL;
+}
+
+/* TSS_HandleTable_Grow() doubles the number of slots and rehashes the entries */
+
+static TPM_RC TSS_HandleTable_Grow(TSS_HANDLE_TABLE *table)
+{
+    TPM_RC	rc = 0;
+    void 	**entries = NULL;
+    size_t	slots;
+    size_t	i;
+    size_t	j;
+
+    if (rc == 0) {
+	slots = (table->slots == 0) ? TSS_HANDLE_TABLE_SLOTS : (table->slots * 2);
+	rc = TSS_Malloc((uint8_t **)&entries, (uint32_t)(slots * sizeof(void *)));
+    }
+    if (rc == 0) {
+	for (j = 0 ; j < slots ; j++) {
+	    entries[j] = NULL;
+	}
+	for (i = 0 ; i < table->slots ; i++) {
+	    if (table->entries[i] != NULL) {
+		j = TSS_HandleTable_Hash(*(TPM_HANDLE *)table->entries[i], slots);
+		while (entries[j] != NULL) {
+		    j = (j + 1) & (slots - 1);
+		}
+		entries[j] = table->entries[i];
+	    }
+	}
+	free(table->entries);
+	table->entries = entries;
+	table->slots = slots;
+    }
+    return rc;
+}
+
+/* TSS_HandleTable_Add() returns the entry for the handle.  If there is none, a zeroed entry is
+   added with its handle set.
+*/
+
+TPM_RC TSS_HandleTable_Add(TSS_HANDLE_TABLE *table, void **entry, TPM_HANDLE handle)
+{
+    TPM_RC	rc = 0;
+    uint8_t	*newEntry = NULL;
+    size_t	i;
+
+    *entry = TSS_HandleTable_Find(table, handle);
+    if (*entry != NULL) {
+	return rc;
+    }
+    /* keep the table at most 3/4 full so that probe sequences stay short */
+    if (rc == 0) {
+	if (((table->count + 1) * 4) > (table->slots * 3)) {
+	    rc = TSS_HandleTable_Grow(table);
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc(&newEntry, (uint32_t)table->entrySize);
+    }
+    if (rc == 0) {
+	memset(newEntry, 0, table->entrySize);
+	*(TPM_HANDLE *)newEntry = handle;
+	i = TSS_HandleTable_Hash(handle, table->slots);
+	while (table->entries[i] != NULL) {
+	    i = (i + 1) & (table->slots - 1);
+	}
+	table->entries[i] = newEntry;
+	table->count++;
+	*entry = newEntry;
+    }
     return rc;
 }
 
+/* TSS_HandleTable_Remove() erases and frees the entry for the handle, if any.  The caller frees
+   any memory that the entry points to.
+
+   Later entries in the probe sequence are shifted back, so the table never holds deleted slot
+   markers.
+*/
+
+void TSS_HandleTable_Remove(TSS_HANDLE_TABLE *table, TPM_HANDLE handle)
+{
+    size_t	mask = table->slots - 1;
+    size_t	i;
+    size_t	j;
+    size_t	home;
+
+    if (table->count == 0) {
+	return;
+    }
+    for (i = TSS_HandleTable_Hash(handle, table->slots) ;
+	 table->entries[i] != NULL ;
+	 i = (i + 1) & mask) {
+	if (*(TPM_HANDLE *)table->entries[i] == handle) {
+	    break;
+	}
+    }
+    if (table->entries[i] == NULL) {
+	return;
+    }
+    memset(table->entries[i], 0, table->entrySize);
+    free(table->entries[i]);
+    table->entries[i] = NULL;
+    table->count--;
+    /* move back any entry that can no longer be reached from its home slot */
+    for (j = (i + 1) & mask ; table->entries[j] != NULL ; j = (j + 1) & mask) {
+	home = TSS_HandleTable_Hash(*(TPM_HANDLE *)table->entries[j], table->slots);
+	/* move the entry into the hole if the hole is cyclically in [home, j) */
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    table->entries[i] = table->entries[j];
+	    table->entries[j] = NULL;
+	    i = j;
+	}
+    }
+    /* an empty table holds no memory */
+    if (table->count == 0) {
+	TSS_HandleTable_Delete(table);
+    }
+    return;
+}
+
+/* TSS_HandleTable_Delete() erases and frees all entries and the slots.  The caller frees any
+   memory that the entries point to.
+*/
+
+void TSS_HandleTable_Delete(TSS_HANDLE_TABLE *table)
+{
+    size_t	i;
+
+    for (i = 0 ; i < table->slots ; i++) {
+	if (table->entries[i] != NULL) {
+	    memset(table->entries[i], 0, table->entrySize);
+	    free(table->entries[i]);
+	}
+    }
+    free(table->entries);
+    table->entries = NULL;
+    table->slots = 0;
+    table->count = 0;
+    return;
+}
+
+#endif	/* TPM_TSS_NOFILE */
+
 /* TSS_SetProperty() sets the property to the value.
 
    The format of the property and value the same as that of the environment variable.
@@ -256,22 +831,16 @@ TPM_RC TSS_SetProperty(TSS_CONTEXT *tssContext,
     TPM_RC		rc = 0;
 
     /* at the first call to the TSS, initialize global variables */
-    if (tssFirstCall) {
-#ifndef TPM_TSS_NOCRYPTO
-	/* crypto module initializations */
-	if (rc == 0) {
-	    rc = TSS_Crypto_Init();
-	}
-#endif
-	if (rc == 0) {
-	    rc = TSS_GlobalProperties_Init();
-	}
-	tssFirstCall = FALSE;
+    if (rc == 0) {
+	rc = TSS_Library_Init();
+    }
+    if (rc == 0) {
+	TSS_SetThreadTrace(tssContext);
     }
     if (rc == 0) {
 	switch (property) {
 	  case TPM_TRACE_LEVEL:
-	    rc = TSS_SetTraceLevel(value);
+	    rc = TSS_SetTraceLevel(tssContext, value);
 	    break;
 	  case TPM_DATA_DIR:
 	    rc = TSS_SetDataDirectory(tssContext, value);
@@ -294,9 +863,60 @@ TPM_RC TSS_SetProperty(TSS_CONTEXT *tssContext,
 	  case TPM_DEVICE:
 	    rc = TSS_SetDevice(tssContext, value);
 	    break;
+	  case TPM_COMMAND_TIMEOUT:
+	    rc = TSS_SetCommandTimeout(tssContext, value);
+	    break;
 	  case TPM_ENCRYPT_SESSIONS:
 	    rc = TSS_SetEncryptSessions(tssContext, value);
 	    break;
+	  case TPM_VALIDATE_INPUT:
+	    rc = TSS_SetValidateInput(tssContext, value);
+	    break;
+	  case TPM_SESSION_CACHE:
+	    rc = TSS_SetSessionCache(tssContext, value);
+	    break;
+	  case TPM_RETRY_CODES:
+	    rc = TSS_SetRetryCodes(tssContext, value);
+	    break;
+	  case TPM_RETRY_ATTEMPTS:
+	    rc = TSS_SetRetryAttempts(tssContext, value);
+	    break;
+	  case TPM_RETRY_DELAY:
+	    rc = TSS_SetRetryDelay(tssContext, value);
+	    break;
+	  case TPM_DATA_STORE:
+	    rc = TSS_SetDataStore(tssContext, value);
+	    break;
+	  case TPM_COMMAND_PATH:
+	    rc = TSS_SetCommandPath(tssContext, value);
+	    break;
+	  case TPM_PLATFORM_PATH:
+	    rc = TSS_SetPlatformPath(tssContext, value);
+	    break;
+	  case TPM_CONNECT_TIMEOUT:
+	    rc = TSS_SetConnectTimeout(tssContext, value);
+	    break;
+	  case TPM_SERVER_SELECT:
+	    rc = TSS_SetServerSelect(tssContext, value);
+	    break;
+	  case TPM_RECORD_FILE:
+	    rc = TSS_SetRecordFile(tssContext, value);
+	    break;
+	  case TPM_REPLAY_FILE:
+	    rc = TSS_SetReplayFile(tssContext, value);
+	    break;
+	  case TPM_RANDOM_SEED:
+	    rc = TSS_SetRandomSeed(tssContext, value);
+	    break;
+	  case TPM_STATS:
+	    rc = TSS_SetStats(tssContext, value);
+	    break;
+	  case TPM_STATS_FILE:
+	    rc = TSS_SetStatsFile(tssContext, value);
+	    break;
+	  case TPM_VIRTUALIZE:
+	    rc = TSS_SetVirtualize(tssContext, value);
+	    break;
 	  default:
 	    rc = TSS_RC_BAD_PROPERTY;
 	}
@@ -304,14 +924,16 @@ TPM_RC TSS_SetProperty(TSS_CONTEXT *tssContext,
     return rc;
 }
 
-/* TSS_SetTraceLevel() sets the trace level.
+/* TSS_SetTraceLevel() sets the trace level of the TSS context and the calling thread.
+
+   A NULL tssContext sets the default for TSS contexts created afterward.
 
    0:	no printing
    1:	error printing
    2:	trace printing
 */
 
-static TPM_RC TSS_SetTraceLevel(const char *value)
+static TPM_RC TSS_SetTraceLevel(TSS_CONTEXT *tssContext, const char *value)
 {
     TPM_RC		rc = 0;
     int			irc = 0;
@@ -349,6 +971,14 @@ static TPM_RC TSS_SetTraceLevel(const char *value)
 	    tssVverbose = TRUE;
 	    break;
 	}
+	if (tssContext != NULL) {
+	    tssContext->tssVerbose = tssVerbose;
+	    tssContext->tssVverbose = tssVverbose;
+	}
+	else {
+	    tssDefaultVerbose = tssVerbose;
+	    tssDefaultVverbose = tssVverbose;
+	}
     }
     return rc;
 }
@@ -449,11 +1079,127 @@ static TPM_RC TSS_SetServerName(TSS_CONTEXT *tssContext, const char *value)
     }
     if (rc == 0) {
 	tssContext->tssServerName = value;
+	tssContext->tssServerNext = 0;
     }
     return rc;
 }
 
-static TPM_RC TSS_SetServerType(TSS_CONTEXT *tssContext, const char *value)
+/* TSS_SetConnectTimeout() sets the socket connect timeout in milliseconds for each server
+   address.  0 uses the blocking connect and the system timeout.
+*/
+
+static TPM_RC TSS_SetConnectTimeout(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+    int			irc = 0;
+
+    /* close an open connection before changing property */
+    if (rc == 0) {
+	rc = TSS_Close(tssContext);
+    }
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_CONNECT_TIMEOUT_DEFAULT;
+	}
+    }
+#if !defined(__ULTRAVISOR__) && !defined(TPM_SKIBOOT)
+    if (rc == 0) {
+	irc = sscanf(value, "%u", &tssContext->tssConnectTimeout);
+	if (irc != 1) {
+	    if (tssVerbose) printf("TSS_SetConnectTimeout: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+#else	/* disable within the ultravisor, which doesn't implement sscanf() anyway.  It's a don't
+	   care because the ultravisor does not use sockets. */
+    tssContext->tssConnectTimeout = 0;
+    irc = irc;
+#endif
+    return rc;
+}
+
+/* TSS_SetServerSelect() sets how a connection walks the TPM_SERVER_NAME host list.
+
+   order:	start at the first host, failing over to the next
+   roundrobin:	start at the host after the one used by the previous connection
+*/
+
+static TPM_RC TSS_SetServerSelect(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    /* close an open connection before changing property */
+    if (rc == 0) {
+	rc = TSS_Close(tssContext);
+    }
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_SERVER_SELECT_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	if (strcmp(value, "order") == 0) {
+	    tssContext->tssServerRoundRobin = FALSE;
+	}
+	else if (strcmp(value, "roundrobin") == 0) {
+	    tssContext->tssServerRoundRobin = TRUE;
+	}
+	else {
+	    if (tssVerbose) printf("TSS_SetServerSelect: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    if (rc == 0) {
+	tssContext->tssServerNext = 0;
+    }
+    return rc;
+}
+
+/* TSS_SetCommandPath() sets the command endpoint for the local interfaces, the Unix domain socket
+   path for socunix and the shared memory file for shm */
+
+static TPM_RC TSS_SetCommandPath(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    /* close an open connection before changing property */
+    if (rc == 0) {
+	rc = TSS_Close(tssContext);
+    }
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_COMMAND_PATH_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	tssContext->tssCommandPath = value;
+    }
+    return rc;
+}
+
+/* TSS_SetPlatformPath() sets the Unix domain socket path for the socunix simulator platform
+   commands */
+
+static TPM_RC TSS_SetPlatformPath(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    /* close an open connection before changing property */
+    if (rc == 0) {
+	rc = TSS_Close(tssContext);
+    }
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_PLATFORM_PATH_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	tssContext->tssPlatformPath = value;
+    }
+    return rc;
+}
+
+static TPM_RC TSS_SetServerType(TSS_CONTEXT *tssContext, const char *value)
 {
     TPM_RC		rc = 0;
 
@@ -510,6 +1256,49 @@ static TPM_RC TSS_SetDevice(TSS_CONTEXT *tssContext, const char *value)
     return rc;
 }
 
+/* TSS_SetCommandTimeout() sets how long the device interface waits for a response.
+
+   auto:	deduce the deadline from the command code
+   0:		wait indefinitely
+   n:		wait n milliseconds
+
+   The connection is not closed, so an application can set a deadline for a single command and
+   then restore auto.
+*/
+
+static TPM_RC TSS_SetCommandTimeout(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+    int			irc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_COMMAND_TIMEOUT_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	if (strcmp(value, "auto") == 0) {
+	    tssContext->tssCommandTimeoutAuto = TRUE;
+	    tssContext->tssCommandTimeout = 0;
+	}
+	else {
+	    tssContext->tssCommandTimeoutAuto = FALSE;
+#if !defined(__ULTRAVISOR__) && !defined(TPM_SKIBOOT)
+	    irc = sscanf(value, "%u", &tssContext->tssCommandTimeout);
+	    if (irc != 1) {
+		if (tssVerbose) printf("TSS_SetCommandTimeout: Error, value invalid\n");
+		rc = TSS_RC_BAD_PROPERTY_VALUE;
+	    }
+#else	/* disable within the ultravisor, which doesn't implement sscanf() anyway.  It's a don't
+	   care because the ultravisor does not use the device driver. */
+	    tssContext->tssCommandTimeout = 0;
+	    irc = irc;
+#endif
+	}
+    }
+    return rc;
+}
+
 static TPM_RC TSS_SetEncryptSessions(TSS_CONTEXT *tssContext, const char *value)
 {
     TPM_RC		rc = 0;
@@ -535,3 +1324,396 @@ static TPM_RC TSS_SetEncryptSessions(TSS_CONTEXT *tssContext, const char *value)
 #endif
    return rc;
 }
+
+/* TSS_SetValidateInput() sets the command parameter validation mode.
+
+   0:	no validation
+   1:	validate only when tracing is enabled
+   2:	always validate
+
+   Validation unmarshals the marshaled command parameters, catching bad caller input before the
+   command is sent to the TPM.  It costs a second pass over the parameters, which a production
+   application that trusts its input may not want.
+
+   The value is parsed without sscanf() so that it is available in the ultravisor and skiboot.
+*/
+
+static TPM_RC TSS_SetValidateInput(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_VALIDATE_INPUT_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	if (strcmp(value, "0") == 0) {
+	    tssContext->tssValidateInput = TSS_VALIDATE_NONE;
+	}
+	else if (strcmp(value, "1") == 0) {
+	    tssContext->tssValidateInput = TSS_VALIDATE_TRACE;
+	}
+	else if (strcmp(value, "2") == 0) {
+	    tssContext->tssValidateInput = TSS_VALIDATE_ALWAYS;
+	}
+	else {
+	    if (tssVerbose) printf("TSS_SetValidateInput: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_SetSessionCache() sets the session file sync policy.
+
+   0:	no cache, the session file is read and written for each command
+   1:	the session is read from the cache, the session file is written for each command
+   2:	the session file is written only by TSS_FlushSessionCache() and TSS_Delete()
+
+   With 2, other processes do not see session updates until the flush.  A TSS with no file support
+   always keeps sessions in the context, and the value has no effect.
+*/
+
+static TPM_RC TSS_SetSessionCache(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_SESSION_CACHE_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	if (strcmp(value, "0") == 0) {
+	    tssContext->tssSessionCache = TSS_SESSION_CACHE_NONE;
+	}
+	else if (strcmp(value, "1") == 0) {
+	    tssContext->tssSessionCache = TSS_SESSION_CACHE_WRITETHROUGH;
+	}
+	else if (strcmp(value, "2") == 0) {
+	    tssContext->tssSessionCache = TSS_SESSION_CACHE_WRITEBACK;
+	}
+	else {
+	    if (tssVerbose) printf("TSS_SetSessionCache: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_SetRetryCodes() sets the TPM warning response codes that TSS_Execute() retries.
+
+   The value is a comma separated list of retry, yielded, testing, and nvrate, or none.
+*/
+
+static TPM_RC TSS_SetRetryCodes(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+    const char		*end;
+    size_t		length;
+    unsigned int	codes = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_RETRY_CODES_DEFAULT;
+	}
+    }
+    if ((rc == 0) && (strcmp(value, "none") != 0)) {
+	do {
+	    end = strchr(value, ',');
+	    length = (end != NULL) ? (size_t)(end - value) : strlen(value);
+	    if ((length == 5) && (strncmp(value, "retry", length) == 0)) {
+		codes |= TSS_RETRY_RETRY;
+	    }
+	    else if ((length == 7) && (strncmp(value, "yielded", length) == 0)) {
+		codes |= TSS_RETRY_YIELDED;
+	    }
+	    else if ((length == 7) && (strncmp(value, "testing", length) == 0)) {
+		codes |= TSS_RETRY_TESTING;
+	    }
+	    else if ((length == 6) && (strncmp(value, "nvrate", length) == 0)) {
+		codes |= TSS_RETRY_NV_RATE;
+	    }
+	    else {
+		if (tssVerbose) printf("TSS_SetRetryCodes: Error, value invalid\n");
+		rc = TSS_RC_BAD_PROPERTY_VALUE;
+	    }
+	    value = end + 1;
+	} while ((rc == 0) && (end != NULL));
+    }
+    if (rc == 0) {
+	tssContext->tssRetryCodes = codes;
+    }
+    return rc;
+}
+
+/* TSS_SetRetryAttempts() sets the maximum number of times TSS_Execute() sends a command that
+   returns a retried warning.  1 disables retry.
+*/
+
+static TPM_RC TSS_SetRetryAttempts(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+    int			irc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_RETRY_ATTEMPTS_DEFAULT;
+	}
+    }
+#if !defined(__ULTRAVISOR__) && !defined(TPM_SKIBOOT)
+    if (rc == 0) {
+	irc = sscanf(value, "%u", &tssContext->tssRetryAttempts);
+	if ((irc != 1) || (tssContext->tssRetryAttempts == 0)) {
+	    if (tssVerbose) printf("TSS_SetRetryAttempts: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+#else	/* the ultravisor doesn't implement sscanf() or a sleep for the backoff */
+    tssContext->tssRetryAttempts = 1;
+    irc = irc;
+#endif
+    return rc;
+}
+
+/* TSS_SetRetryDelay() sets the backoff in milliseconds before the first retry.  Each further retry
+   doubles it.  The actual wait is a random value between half and all of the backoff.
+*/
+
+static TPM_RC TSS_SetRetryDelay(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+    int			irc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_RETRY_DELAY_DEFAULT;
+	}
+    }
+#if !defined(__ULTRAVISOR__) && !defined(TPM_SKIBOOT)
+    if (rc == 0) {
+	irc = sscanf(value, "%u", &tssContext->tssRetryDelay);
+	if (irc != 1) {
+	    if (tssVerbose) printf("TSS_SetRetryDelay: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+#else
+    tssContext->tssRetryDelay = 0;
+    irc = irc;
+#endif
+    return rc;
+}
+
+/* TSS_SetDataStore() sets the backend for Names, public areas, and NV public areas.
+
+   file:	one file per handle or context in the data directory
+   mmap:	a single memory mapped metadata store in the data directory
+
+   Session state is always stored in files.  A TSS with no file support always stores the
+   metadata in the context, and the value has no effect.
+*/
+
+static TPM_RC TSS_SetDataStore(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_DATA_STORE_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	if (strcmp(value, "file") == 0) {
+	    tssContext->tssDataStore = TSS_DATA_STORE_FILE;
+	}
+#ifdef TPM_POSIX
+	else if (strcmp(value, "mmap") == 0) {
+	    tssContext->tssDataStore = TSS_DATA_STORE_MMAP;
+	}
+#endif
+	else {
+	    if (tssVerbose) printf("TSS_SetDataStore: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_SetRecordFile() sets the file that receives a trace of each command and response, see
+   tsstransmit.h for the format.  The records are appended.  NULL, the default, records nothing.
+
+   An open trace is closed, so that a new file can be started while the connection is open.
+*/
+
+static TPM_RC TSS_SetRecordFile(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+#ifdef TSS_HAVE_RECORD
+    if (rc == 0) {
+	TSS_Record_Close(tssContext);
+	if ((value != NULL) && (value[0] == '\0')) {
+	    value = NULL;
+	}
+	tssContext->tssRecordFile = value;
+    }
+#else
+    if (value != NULL) {
+	if (tssVerbose) printf("TSS_SetRecordFile: Error, command trace not supported\n");
+	rc = TSS_RC_BAD_PROPERTY;
+    }
+#endif
+    return rc;
+}
+
+/* TSS_SetReplayFile() sets the trace file read by the replay interface type */
+
+static TPM_RC TSS_SetReplayFile(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+#ifdef TSS_HAVE_RECORD
+    /* close an open connection before changing property */
+    if (rc == 0) {
+	rc = TSS_Close(tssContext);
+    }
+    if (rc == 0) {
+	tssContext->tssReplayFile = value;
+    }
+#else
+    if (value != NULL) {
+	if (tssVerbose) printf("TSS_SetReplayFile: Error, command trace not supported\n");
+	rc = TSS_RC_BAD_PROPERTY;
+    }
+#endif
+    return rc;
+}
+
+/* TSS_SetRandomSeed() seeds the TSS random number generator, so that nonces and salts repeat from
+   run to run.  This is for benchmarking and test only.  See TSS_RandSeed().
+
+   The seed is global to the process, not to the context.  NULL restores the crypto library
+   generator.
+*/
+
+static TPM_RC TSS_SetRandomSeed(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    tssContext = tssContext;
+#ifndef TPM_TSS_NOCRYPTO
+    if (rc == 0) {
+	rc = TSS_RandSeed(value);
+    }
+#else
+    if (value != NULL) {
+	if (tssVerbose) printf("TSS_SetRandomSeed: Error, no crypto library\n");
+	rc = TSS_RC_BAD_PROPERTY;
+    }
+#endif
+    return rc;
+}
+
+/* TSS_SetStats() enables the TSS_Execute() phase statistics, see TSS_Stats_Snapshot().
+
+   0:	no statistics, the default
+   1:	time each command
+
+   Disabling keeps the statistics already gathered.
+*/
+
+static TPM_RC TSS_SetStats(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_STATS_DEFAULT;
+	}
+    }
+#ifdef TSS_HAVE_STATS
+    if (rc == 0) {
+	if (strcmp(value, "0") == 0) {
+	    tssContext->tssStatsEnable = FALSE;
+	}
+	else if (strcmp(value, "1") == 0) {
+	    tssContext->tssStatsEnable = TRUE;
+	}
+	else {
+	    if (tssVerbose) printf("TSS_SetStats: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+#else
+    tssContext = tssContext;
+    if (strcmp(value, "0") != 0) {
+	if (tssVerbose) printf("TSS_SetStats: Error, statistics not supported\n");
+	rc = TSS_RC_BAD_PROPERTY;
+    }
+#endif
+    return rc;
+}
+
+/* TSS_SetStatsFile() sets the file that receives the TSS_Execute() phase statistics at
+   TSS_Delete(), see tssstats.h for the format.  Setting a file also enables the statistics.  NULL,
+   the default, writes no file.
+
+   The statistics gathered for a previous file are written to it and discarded.
+*/
+
+static TPM_RC TSS_SetStatsFile(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+#ifdef TSS_HAVE_STATS
+    if (rc == 0) {
+	if (tssContext->tssStatsFile != NULL) {
+	    TSS_Stats_Close(tssContext);
+	}
+	if ((value != NULL) && (value[0] == '\0')) {
+	    value = NULL;
+	}
+	tssContext->tssStatsFile = value;
+    }
+#else
+    tssContext = tssContext;
+    if (value != NULL) {
+	if (tssVerbose) printf("TSS_SetStatsFile: Error, statistics not supported\n");
+	rc = TSS_RC_BAD_PROPERTY;
+    }
+#endif
+    return rc;
+}
+
+/* TSS_SetVirtualize() sets the transient object and session virtualization, see tssvirtual.c.
+
+   0:	no virtualization, the default
+   1:	TSS_VIRTUALIZE_OBJECTS, virtual object handles, with objects evicted and reloaded as needed
+   2:	TSS_VIRTUALIZE_SESSIONS, sessions saved and reloaded as needed
+   3:	both
+
+   Disabling keeps the objects and sessions already virtualized, but new ones are not.
+*/
+
+static TPM_RC TSS_SetVirtualize(TSS_CONTEXT *tssContext, const char *value)
+{
+    TPM_RC		rc = 0;
+
+    if (rc == 0) {
+	if (value == NULL) {
+	    value = TPM_VIRTUALIZE_DEFAULT;
+	}
+    }
+    if (rc == 0) {
+	if ((strlen(value) == 1) && (value[0] >= '0') && (value[0] <= '3')) {
+	    tssContext->tssVirtualize = value[0] - '0';
+	}
+	else {
+	    if (tssVerbose) printf("TSS_SetVirtualize: Error, value invalid\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    return rc;
+}
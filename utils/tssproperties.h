@@ -79,6 +79,45 @@ typedef int TSS_SOCKET_FD;
 #endif 	/* TPM_NOSOCKET */
 #endif	/* TPM_POSIX */
 
+/* The trace flags tssVerbose and tssVverbose are per thread copies of the trace level of the TSS
+   context in use by that thread.  See TSS_SetThreadTrace(). */
+
+#if defined TPM_WINDOWS
+#define TSS_THREAD_LOCAL __declspec(thread)
+#elif defined TPM_POSIX && !defined TPM_SKIBOOT && !defined __ULTRAVISOR__
+#define TSS_THREAD_LOCAL __thread
+#else
+#define TSS_THREAD_LOCAL
+#endif
+
+/* The shared memory ring transport uses the Linux futex for wakeups */
+
+#if defined TPM_POSIX && defined __linux__ && !defined TPM_SKIBOOT && !defined __ULTRAVISOR__
+#define TSS_HAVE_SHM
+#endif
+
+/* The command record and replay transports use stdio and the thread CPU clock */
+
+#if !defined TPM_SKIBOOT && !defined __ULTRAVISOR__
+#define TSS_HAVE_RECORD
+#endif
+
+/* The TSS_Execute() phase statistics use stdio and the monotonic clock */
+
+#if !defined TPM_SKIBOOT && !defined __ULTRAVISOR__
+#define TSS_HAVE_STATS
+#endif
+
+/* TPM_VIRTUALIZE flags, see tssvirtual.c */
+
+#define TSS_VIRTUALIZE_OBJECTS		0x01
+#define TSS_VIRTUALIZE_SESSIONS		0x02
+
+#ifndef TPM_NOSOCKET
+/* socket read buffer, large enough for an MS simulator response frame */
+#define TSS_SOCKET_READ_SIZE	(sizeof(uint32_t) + MAX_RESPONSE_SIZE + sizeof(uint32_t))
+#endif 	/* TPM_NOSOCKET */
+
 /* There doesn't seem to be a portable Unix MAXPATHLEN variable, so pick a large number.  The
    directory length will be (currently) 17 bytes smaller. */
 #define TPM_DATA_DIR_PATH_LENGTH 256
@@ -98,6 +137,18 @@ extern "C" {
 	uint16_t sessionDataLength;
     } TSS_SESSIONS;
 
+    /* Structure to cache session state within the context for a TSS with file support.  The
+       session data is the same plaintext marshaled TSS_HMAC_CONTEXT that is stored in the session
+       file. */
+
+    typedef struct TSS_SESSION_CACHE {
+	TPMI_SH_AUTH_SESSION sessionHandle;
+	uint8_t *sessionData;
+	uint16_t sessionDataLength;
+	int dirty;		/* TRUE if the session file is out of date */
+	int inFile;		/* TRUE if a session file exists */
+    } TSS_SESSION_CACHE;
+
     /* Structure to hold transient or persistent object data within the context */
     
     typedef struct TSS_OBJECT_PUBLIC {
@@ -114,6 +165,94 @@ extern "C" {
 	TPMS_NV_PUBLIC	nvPublic;
     } TSS_NVPUBLIC;
 
+    /* Open addressing hash table, keyed by handle, that holds the TSS_SESSIONS,
+       TSS_OBJECT_PUBLIC, or TSS_NVPUBLIC entries for a TSS with no file support.  Each entry is
+       allocated separately, so an entry pointer remains valid until the entry is removed.  The
+       slot array is allocated at the first add, doubles when it is 3/4 full, and is freed when the
+       last entry is removed.
+
+       NOTE: Each entry structure must start with its TPM_HANDLE key. */
+
+    typedef struct TSS_HANDLE_TABLE {
+	void 		**entries;	/* slots pointers, NULL for an empty slot */
+	size_t 		entrySize;	/* bytes in each entry */
+	size_t 		slots;		/* 0 or a power of 2 */
+	size_t 		count;		/* entries in use */
+    } TSS_HANDLE_TABLE;
+
+#define TSS_HANDLE_TABLE_SLOTS	16	/* initial number of slots */
+
+    /* Structure to hold the state of a TPM 2.0 command between TSS_Execute_Prepare(),
+       TSS_Execute_Submit(), and TSS_Execute_Complete().
+
+       NOTE: Keep this in sync with TSS_Execute20_Cleanup() */
+
+    typedef struct TSS_EXECUTE_STATE {
+	int 			phase;		/* TSS_EXECUTE_IDLE, PREPARED, SUBMITTED */
+	TPM_CC 			commandCode;
+	const struct TSS_COMMAND_DESCRIPTOR *descriptor;	/* command table entry */
+	COMMAND_PARAMETERS 	*in;		/* caller's parameters, held until complete */
+	EXTRA_PARAMETERS 	*extra;
+	/* the vararg parameters */
+	TPMI_SH_AUTH_SESSION 	sessionHandle[MAX_SESSION_NUM];
+	const char 		*password[MAX_SESSION_NUM];
+	unsigned int 		sessionAttributes[MAX_SESSION_NUM];
+	/* structures filled in */
+	TPMS_AUTH_COMMAND 	*authCommand[MAX_SESSION_NUM];
+	TPMS_AUTH_RESPONSE 	*authResponse[MAX_SESSION_NUM];
+	/* pointer to the above structures as used */
+	TPMS_AUTH_COMMAND 	*authC[MAX_SESSION_NUM];
+	TPMS_AUTH_RESPONSE 	*authR[MAX_SESSION_NUM];
+	/* TSS sessions */
+	struct TSS_HMAC_CONTEXT *session[MAX_SESSION_NUM];
+	TPM2B_NAME 		*names[MAX_SESSION_NUM];
+    } TSS_EXECUTE_STATE;
+
+#define TSS_EXECUTE_IDLE	0
+#define TSS_EXECUTE_PREPARED	1
+#define TSS_EXECUTE_SUBMITTED	2
+
+/* values for tssValidateInput.  Validation unmarshals the marshaled command parameters as a check
+   of the caller's input before the command is sent to the TPM. */
+
+#define TSS_VALIDATE_NONE	0	/* no validation */
+#define TSS_VALIDATE_TRACE	1	/* validate only at trace level 2 */
+#define TSS_VALIDATE_ALWAYS	2	/* always validate */
+
+/* values for tssSessionCache, the session file sync policy */
+
+#define TSS_SESSION_CACHE_NONE		0	/* no cache, read and write the file each command */
+#define TSS_SESSION_CACHE_WRITETHROUGH	1	/* read from the cache, write the file each command */
+#define TSS_SESSION_CACHE_WRITEBACK	2	/* write the file at flush or TSS_Delete() */
+
+/* bits for tssRetryCodes, the TPM warning response codes that TSS_Execute() retries */
+
+#define TSS_RETRY_RETRY		0x01	/* TPM_RC_RETRY */
+#define TSS_RETRY_YIELDED	0x02	/* TPM_RC_YIELDED */
+#define TSS_RETRY_TESTING	0x04	/* TPM_RC_TESTING */
+#define TSS_RETRY_NV_RATE	0x08	/* TPM_RC_NV_RATE */
+
+/* values for tssDataStore */
+
+#define TSS_DATA_STORE_FILE	0	/* one file per handle or context */
+#define TSS_DATA_STORE_MMAP	1	/* memory mapped metadata store, see tssstore.c */
+
+    /* Per context scratch arena for memory that lives for the duration of one command, so that the
+       command path does not call the heap.  It is allocated when the context is created and is
+       reset, erasing any secrets, at the start and end of each command.
+
+       NOTE: Keep this in sync with TSS_Scratch_Init() */
+
+    typedef struct TSS_SCRATCH {
+	uint8_t 		*buffer;
+	size_t 			size;
+	size_t 			used;		/* bytes allocated since the last reset */
+    } TSS_SCRATCH;
+
+/* round a scratch allocation up so that each allocation is suitably aligned */
+#define TSS_SCRATCH_ALIGN	16
+#define TSS_SCRATCH_ROUND(size)	(((size) + TSS_SCRATCH_ALIGN - 1) & ~((size_t)TSS_SCRATCH_ALIGN - 1))
+
     /* Context for TSS global parameters.
 
        NOTE:  Keep this in sync with TSS_Properties_Init() and TSS_Delete() */
@@ -122,12 +261,34 @@ extern "C" {
 
 	TSS_AUTH_CONTEXT *tssAuthContext;
 
+	/* trace level, loaded into the thread trace flags at each TSS entry point */
+	int tssVerbose;
+	int tssVverbose;
+
 	/* directory for persistant storage */
 	const char *tssDataDirectory;
 
+	/* backend for Names, public areas, and NV public areas, TSS_DATA_STORE_FILE or MMAP */
+	int tssDataStore;
+
 	/* encrypt saved session state */
 	int tssEncryptSessions;
 
+	/* command parameter validation, TSS_VALIDATE_NONE, TRACE, or ALWAYS */
+	int tssValidateInput;
+
+	/* session file sync policy, TSS_SESSION_CACHE_NONE, WRITETHROUGH, or WRITEBACK */
+	int tssSessionCache;
+
+	/* TPM warning retry policy, see TSS_Execute20() */
+	unsigned int tssRetryCodes;	/* TSS_RETRY_ bits */
+	unsigned int tssRetryAttempts;	/* maximum attempts, 1 for no retry */
+	unsigned int tssRetryDelay;	/* first backoff in milliseconds, doubled each retry */
+	uint32_t tssRetryJitter;	/* backoff jitter generator state */
+
+	/* virtualize transient objects and sessions, TSS_VIRTUALIZE_ flags, see tssvirtual.c */
+	int tssVirtualize;
+
 	/* saved session encryption key.  This seems to port to openssl 1.0 and 1.1, but will have to
 	   become a malloced void * for other crypto libraries. */
 #ifndef TPM_TSS_NOCRYPTO
@@ -138,34 +299,112 @@ extern "C" {
 	   structure.  Scripting will not work, and persistent objects will not work, but a single
 	   application will otherwise work. */
 #ifdef TPM_TSS_NOFILE
-	TSS_SESSIONS sessions[MAX_ACTIVE_SESSIONS];
-	TSS_OBJECT_PUBLIC objectPublic[64];
-	TSS_NVPUBLIC nvPublic[64];
+	TSS_HANDLE_TABLE sessions;		/* TSS_SESSIONS */
+	TSS_HANDLE_TABLE objectPublic;		/* TSS_OBJECT_PUBLIC */
+	TSS_HANDLE_TABLE nvPublic;		/* TSS_NVPUBLIC */
+#else
+	/* a TSS with file support caches session state to avoid reading, decrypting, encrypting,
+	   and writing the session file for each command */
+	TSS_SESSION_CACHE sessionCache[MAX_ACTIVE_SESSIONS];
+
+	/* the metadata store mapping, opened at first use */
+	struct TSS_STORE *tssStore;
 #endif
 	/* ports, host name, server (packet) type for socket interface */
 	short tssCommandPort;
 	short tssPlatformPort;
-	const char *tssServerName;
+	const char *tssServerName;	/* comma separated list of hosts */
 	const char *tssServerType;
+	unsigned int tssConnectTimeout;	/* milliseconds, 0 for the system default */
+	int tssServerRoundRobin;	/* TRUE to start each connection at the next host */
+	unsigned int tssServerNext;	/* host list index for the next connection */
+	/* command and platform endpoints for the local socunix and shm interfaces */
+	const char *tssCommandPath;
+	const char *tssPlatformPath;
 
 	/* interface type */
 	const char *tssInterfaceType;
 
 	/* device driver interface */
 	const char *tssDevice;
+	/* device response deadline */
+	unsigned int tssCommandTimeout;	/* milliseconds, 0 for no deadline */
+	int tssCommandTimeoutAuto;	/* TRUE to deduce the deadline from the command code */
+
+#ifdef TSS_HAVE_RECORD
+	/* command trace written by each transmit, see tssrecord.c */
+	const char *tssRecordFile;	/* NULL for no trace */
+	struct TSS_RECORD *tssRecord;	/* opened at the first transmit */
+	/* command trace read by the replay interface type */
+	const char *tssReplayFile;
+	struct TSS_REPLAY *tssReplay;
+#endif
+#ifdef TSS_HAVE_STATS
+	/* TSS_Execute() phase timing, see tssstats.c */
+	int tssStatsEnable;
+	const char *tssStatsFile;	/* NULL for no file */
+	struct TSS_STATS *tssStats;	/* allocated at the first timed command */
+#endif
 
 	/* TRUE for the first time through, indicates that interface open must occur */
 	int tssFirstTransmit;
+
+	/* transport selected by tssInterfaceType when the connection is opened, NULL when closed */
+	const struct TSS_TRANSPORT *tssTransport;
+	/* transport private data, see TSS_SetTransportData() */
+	void *tssTransportData;
 	int tpm12Command;		/* TRUE for TPM 1.2 command */
 
+	/* TPM 2.0 command in progress for the split prepare / submit / complete interface */
+	TSS_EXECUTE_STATE tssExecuteState;
+
+	/* TPM capabilities, see tsscapability.c, NULL until first use */
+	struct TSS_CAPABILITY_CACHE *tssCapabilities;
+
+	/* pools of started sessions, see tsssessionpool.c, NULL until first use */
+	struct TSS_SESSION_POOL *tssSessionPool;
+
+	/* salt key public areas and key tokens, see tss20.c, NULL until first use */
+	struct TSS_SALT_KEY_CACHE *tssSaltKeys;
+
+	/* virtual transient object handles, see tssvirtual.c, NULL until first use */
+	struct TSS_VIRTUAL *tssVirtual;
+
+	/* per command scratch memory */
+	TSS_SCRATCH tssScratch;
+
+	/* command deferred by TSS_TransmitSend() for interfaces that have no separate receive */
+	const uint8_t *tssDeferredCommand;
+	uint32_t tssDeferredLength;
+	const char *tssDeferredMessage;
+
 	/* socket file descriptor */
 #ifndef TPM_NOSOCKET
 	TSS_SOCKET_FD sock_fd;
+	/* server packet format, resolved from tssServerType when the connection is opened */
+	int tssSocketMssim;		/* TRUE for the MS simulator packet format */
+	int tssSocketRawsingle;		/* TRUE for a connection per command */
+	int tssSocketKeepalive;		/* TRUE to reconnect when the peer closes the connection */
+	int tssSocketUnix;		/* TRUE for a Unix domain socket */
+	/* buffered socket reader, see TSS_Socket_ReceiveBytes() */
+	uint8_t tssSocketReadBuffer[TSS_SOCKET_READ_SIZE];
+	uint32_t tssSocketReadStart;	/* next unread byte */
+	uint32_t tssSocketReadEnd;	/* end of the buffered bytes */
 #endif 	/* TPM_NOSOCKET */
 
+#ifdef TSS_HAVE_SHM
+	/* shared memory ring mapping, see tssshm.c */
+	struct TSS_SHM *tssShm;
+	size_t tssShmSize;
+	uint64_t tssShmDeadline;	/* monotonic milliseconds, 0 for no deadline */
+	uint32_t tssShmStale;		/* late responses to discard, from timed out commands */
+#endif
+
 #ifndef TPM_NODEV
 	/* Linux device file descriptor */
 	int dev_fd;
+	uint64_t tssDevDeadline;	/* monotonic milliseconds, 0 for no deadline */
+	int tssDevQueued;		/* TRUE for a resource manager shared with other processes */
 #endif /* TPM_NODEV */
 
 	/* Windows device driver handle */
@@ -181,8 +420,34 @@ extern "C" {
 #endif /* TPM_SKIBOOT */
     };
 
+    extern TSS_THREAD_LOCAL int tssVerbose;
+    extern TSS_THREAD_LOCAL int tssVverbose;
+
+    TPM_RC TSS_Library_Init(void);
     TPM_RC TSS_GlobalProperties_Init(void);
     TPM_RC TSS_Properties_Init(TSS_CONTEXT *tssContext);
+    void TSS_SetThreadTrace(const TSS_CONTEXT *tssContext);
+    TPM_RC TSS_Scratch_Init(TSS_CONTEXT *tssContext, size_t size);
+    TPM_RC TSS_Scratch_Alloc(TSS_CONTEXT *tssContext, void **buffer, size_t size);
+    void TSS_Scratch_Reset(TSS_CONTEXT *tssContext);
+    void TSS_Scratch_Delete(TSS_CONTEXT *tssContext);
+#ifdef TSS_HAVE_STATS
+    void TSS_Stats_CommandStart(TSS_CONTEXT *tssContext, TPM_CC commandCode);
+    void TSS_Stats_CommandEnd(TSS_CONTEXT *tssContext);
+    uint64_t TSS_Stats_Start(TSS_CONTEXT *tssContext);
+    void TSS_Stats_End(TSS_CONTEXT *tssContext, unsigned int phase, uint64_t start);
+    void TSS_Stats_Close(TSS_CONTEXT *tssContext);
+#else
+#define TSS_Stats_Start(tssContext)		0
+#define TSS_Stats_End(tssContext, phase, start)	((void)(start))
+#endif
+#ifdef TPM_TSS_NOFILE
+    void TSS_HandleTable_Init(TSS_HANDLE_TABLE *table, size_t entrySize);
+    void *TSS_HandleTable_Find(const TSS_HANDLE_TABLE *table, TPM_HANDLE handle);
+    TPM_RC TSS_HandleTable_Add(TSS_HANDLE_TABLE *table, void **entry, TPM_HANDLE handle);
+    void TSS_HandleTable_Remove(TSS_HANDLE_TABLE *table, TPM_HANDLE handle);
+    void TSS_HandleTable_Delete(TSS_HANDLE_TABLE *table);
+#endif
     
 #ifdef __cplusplus
 }
@@ -0,0 +1,723 @@
+/********************************************************************************/
+/*										*/
+/*		   Command Record and Replay Utilities				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* This file records each command and response to a trace file, and implements the replay
+   interface type, which answers commands from such a trace without a TPM.  See tsstransmit.h for
+   the trace format.
+
+   Recording hooks the transmit functions, so it works with any interface type, including replay.
+   Replaying a trace while recording a new one measures the TSS processing cost of each command
+   with no TPM in the loop.  See timepacket -it.
+
+   TSS_Execute() brackets the command with TSS_Record_ExecuteStart() and TSS_Record_ExecuteEnd().
+   The record is held until the end of the command, so that the TSS thread CPU time outside the
+   transport can be added.  A transmit outside TSS_Execute() is written at once, with no TSS time.
+*/
+
+#include "tssproperties.h"
+
+#ifdef TSS_HAVE_RECORD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef TPM_POSIX
+#include <netinet/in.h>
+#endif
+#ifdef TPM_WINDOWS
+#include <winsock2.h>
+#endif
+
+#include <ibmtss/tsserror.h>
+#include <ibmtss/tssprint.h>
+#include <ibmtss/tssutils.h>
+#include <ibmtss/tsstransmit.h>
+
+#include "tssrecord.h"
+
+/* the command or response header, tag, size, and command or response code */
+#define TSS_RECORD_PACKET_MIN	(sizeof(TPM_ST) + sizeof(uint32_t) + sizeof(TPM_RC))
+
+/* the recording state */
+
+typedef struct TSS_RECORD {
+    FILE 		*file;
+    uint8_t 		*buffer;	/* the record being built, header, command, response */
+    uint32_t 		length;		/* length of the held record, 0 if none */
+    unsigned int 	executeDepth;	/* TSS_Execute() nesting */
+    uint64_t 		executeCpu;	/* thread CPU time at the execute start, nsec */
+    uint64_t 		transportCpu;	/* thread CPU time in transports during the execute, nsec */
+    /* the command in flight */
+    const uint8_t 	*command;
+    uint32_t 		commandLength;
+    uint64_t 		startWall;	/* nsec */
+    uint64_t 		startCpu;	/* nsec */
+} TSS_RECORD;
+
+#define TSS_RECORD_SIZE	(TSS_RECORD_HEADER_SIZE + MAX_COMMAND_SIZE + MAX_RESPONSE_SIZE)
+
+/* one recorded command */
+
+typedef struct TSS_REPLAY_ENTRY {
+    const uint8_t 	*command;
+    uint32_t 		commandLength;
+    const uint8_t 	*response;
+    uint32_t 		responseLength;
+} TSS_REPLAY_ENTRY;
+
+/* the replay state, the trace file in memory and an index of its records */
+
+typedef struct TSS_REPLAY {
+    uint8_t 		*buffer;
+    TSS_REPLAY_ENTRY 	*entries;
+    size_t 		count;
+    size_t 		next;		/* the next entry to replay */
+    char 		positionFile[TPM_DATA_DIR_PATH_LENGTH];
+} TSS_REPLAY;
+
+/* appended to the trace file name for the replay position file */
+#define TSS_REPLAY_POSITION_SUFFIX	".pos"
+
+/* local prototypes */
+
+static TPM_RC TSS_Record_Open(TSS_CONTEXT *tssContext);
+static void TSS_Record_Write(TSS_RECORD *record, uint32_t tssUsec);
+static uint64_t TSS_Record_Wall(void);
+static uint64_t TSS_Record_Cpu(void);
+static void TSS_Record_PutUint32(uint8_t *buffer, uint32_t value);
+static uint32_t TSS_Record_GetUint32(const uint8_t *buffer);
+static TPM_RC TSS_Replay_Load(TSS_REPLAY *replay, const char *filename);
+static TSS_REPLAY_ENTRY *TSS_Replay_Find(TSS_REPLAY *replay,
+					 const uint8_t *commandBuffer);
+static void TSS_Replay_ReadPosition(TSS_REPLAY *replay);
+static void TSS_Replay_WritePosition(TSS_REPLAY *replay);
+
+/* TSS_Record_TransportStart() notes the command and the start time before the transport is
+   called.  The trace file is opened at the first command.
+*/
+
+TPM_RC TSS_Record_TransportStart(TSS_CONTEXT *tssContext,
+				 const uint8_t *commandBuffer, uint32_t written)
+{
+    TPM_RC	rc = 0;
+    TSS_RECORD	*record;
+
+    if (tssContext->tssRecordFile == NULL) {
+	return rc;
+    }
+    if (tssContext->tssRecord == NULL) {
+	rc = TSS_Record_Open(tssContext);
+    }
+    if (rc == 0) {
+	record = tssContext->tssRecord;
+	record->command = commandBuffer;
+	record->commandLength = written;
+	record->startCpu = TSS_Record_Cpu();
+	record->startWall = TSS_Record_Wall();
+    }
+    return rc;
+}
+
+/* TSS_Record_TransportEnd() builds the record after the transport returns.  Only a complete
+   response is recorded, not a transport failure.
+
+   Inside TSS_Execute(), the record is held for TSS_Record_ExecuteEnd().  A record that is already
+   held, from an earlier attempt at the same command, is written with no TSS time.
+*/
+
+void TSS_Record_TransportEnd(TSS_CONTEXT *tssContext,
+			     const uint8_t *responseBuffer, uint32_t read,
+			     TPM_RC rc)
+{
+    TSS_RECORD	*record = tssContext->tssRecord;
+    uint64_t 	endWall;
+    uint8_t	*buffer;
+
+    if ((record == NULL) || (record->command == NULL)) {
+	return;
+    }
+    endWall = TSS_Record_Wall();
+    record->transportCpu += TSS_Record_Cpu() - record->startCpu;
+    /* a transport returns the response code when it received a response */
+    if ((record->commandLength >= TSS_RECORD_PACKET_MIN) &&
+	(record->commandLength <= MAX_COMMAND_SIZE) &&
+	(read >= TSS_RECORD_PACKET_MIN) &&
+	(read <= MAX_RESPONSE_SIZE) &&
+	(rc == TSS_Record_GetUint32(responseBuffer + sizeof(TPM_ST) + sizeof(uint32_t)))) {
+
+	if (record->length != 0) {
+	    TSS_Record_Write(record, 0);
+	}
+	buffer = record->buffer;
+	TSS_Record_PutUint32(buffer, record->commandLength);
+	TSS_Record_PutUint32(buffer + sizeof(uint32_t), read);
+	TSS_Record_PutUint32(buffer + (2 * sizeof(uint32_t)),
+			     (uint32_t)((endWall - record->startWall) / 1000));
+	buffer += TSS_RECORD_HEADER_SIZE;
+	memcpy(buffer, record->command, record->commandLength);
+	buffer += record->commandLength;
+	memcpy(buffer, responseBuffer, read);
+	record->length = TSS_RECORD_HEADER_SIZE + record->commandLength + read;
+	if (record->executeDepth == 0) {
+	    TSS_Record_Write(record, 0);
+	}
+    }
+    record->command = NULL;
+    return;
+}
+
+/* TSS_Record_ExecuteStart() notes the thread CPU time at the start of TSS_Execute() */
+
+void TSS_Record_ExecuteStart(TSS_CONTEXT *tssContext)
+{
+    TSS_RECORD	*record;
+
+    if (tssContext->tssRecordFile == NULL) {
+	return;
+    }
+    if (tssContext->tssRecord == NULL) {
+	/* an open failure is reported by the transmit */
+	if (TSS_Record_Open(tssContext) != 0) {
+	    return;
+	}
+    }
+    record = tssContext->tssRecord;
+    if (record->executeDepth == 0) {
+	record->executeCpu = TSS_Record_Cpu();
+	record->transportCpu = 0;
+    }
+    record->executeDepth++;
+    return;
+}
+
+/* TSS_Record_ExecuteEnd() writes the held record with the TSS thread CPU time of the command,
+   excluding the time in the transport.
+*/
+
+void TSS_Record_ExecuteEnd(TSS_CONTEXT *tssContext)
+{
+    TSS_RECORD	*record = tssContext->tssRecord;
+    uint64_t 	tssCpu;
+
+    if ((record == NULL) || (record->executeDepth == 0)) {
+	return;
+    }
+    record->executeDepth--;
+    if ((record->executeDepth == 0) && (record->length != 0)) {
+	tssCpu = TSS_Record_Cpu() - record->executeCpu;
+	if (tssCpu > record->transportCpu) {
+	    tssCpu -= record->transportCpu;
+	}
+	else {
+	    tssCpu = 0;
+	}
+	/* 0 means not measured, so round a measured time up */
+	TSS_Record_Write(record, (uint32_t)((tssCpu + 999) / 1000));
+    }
+    return;
+}
+
+/* TSS_Record_Close() writes any held record and closes the trace file */
+
+void TSS_Record_Close(TSS_CONTEXT *tssContext)
+{
+    TSS_RECORD	*record = tssContext->tssRecord;
+
+    if (record == NULL) {
+	return;
+    }
+    if (record->length != 0) {
+	TSS_Record_Write(record, 0);
+    }
+    fclose(record->file);
+    free(record->buffer);
+    free(record);
+    tssContext->tssRecord = NULL;
+    return;
+}
+
+/* TSS_Record_Open() opens the trace file for append, and writes the file header if the file is
+   empty.
+
+   The stdio buffer holds a complete record, so that each record is one write and processes
+   sharing a trace file do not interleave within a record.
+*/
+
+static TPM_RC TSS_Record_Open(TSS_CONTEXT *tssContext)
+{
+    TPM_RC	rc = 0;
+    TSS_RECORD	*record = NULL;
+    uint8_t	header[TSS_RECORD_FILE_HEADER_SIZE];
+    long	offset = 0;
+
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)&record, sizeof(TSS_RECORD));	/* freed @1 */
+    }
+    if (rc == 0) {
+	memset(record, 0, sizeof(TSS_RECORD));
+	rc = TSS_Malloc(&record->buffer, TSS_RECORD_SIZE);		/* freed @2 */
+    }
+    if (rc == 0) {
+	record->file = fopen(tssContext->tssRecordFile, "ab");		/* closed @3 */
+	if (record->file == NULL) {
+	    if (tssVerbose) printf("TSS_Record_Open: Error opening %s\n",
+				   tssContext->tssRecordFile);
+	    rc = TSS_RC_FILE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	setvbuf(record->file, NULL, _IOFBF, TSS_RECORD_SIZE);
+	if (fseek(record->file, 0, SEEK_END) != 0) {
+	    rc = TSS_RC_FILE_SEEK;
+	}
+    }
+    if (rc == 0) {
+	offset = ftell(record->file);
+	if (offset < 0) {
+	    rc = TSS_RC_FILE_FTELL;
+	}
+    }
+    if ((rc == 0) && (offset == 0)) {
+	TSS_Record_PutUint32(header, TSS_RECORD_MAGIC);
+	TSS_Record_PutUint32(header + sizeof(uint32_t), TSS_RECORD_VERSION);
+	if ((fwrite(header, 1, sizeof(header), record->file) != sizeof(header)) ||
+	    (fflush(record->file) != 0)) {
+	    if (tssVerbose) printf("TSS_Record_Open: Error writing %s\n",
+				   tssContext->tssRecordFile);
+	    rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    if (rc == 0) {
+	tssContext->tssRecord = record;
+    }
+    else if (record != NULL) {
+	if (record->file != NULL) {
+	    fclose(record->file);		/* @3 */
+	}
+	free(record->buffer);			/* @2 */
+	free(record);				/* @1 */
+    }
+    return rc;
+}
+
+/* TSS_Record_Write() writes the held record with the TSS time.  A write failure is traced but
+   does not fail the command.
+*/
+
+static void TSS_Record_Write(TSS_RECORD *record, uint32_t tssUsec)
+{
+    TSS_Record_PutUint32(record->buffer + (3 * sizeof(uint32_t)), tssUsec);
+    if ((fwrite(record->buffer, 1, record->length, record->file) != record->length) ||
+	(fflush(record->file) != 0)) {
+	if (tssVerbose) printf("TSS_Record_Write: Error writing the command trace\n");
+    }
+    record->length = 0;
+    return;
+}
+
+/* TSS_Record_Wall() returns a monotonic time in nsec */
+
+static uint64_t TSS_Record_Wall(void)
+{
+#ifdef TPM_POSIX
+    struct timespec 	now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+#else
+    LARGE_INTEGER 	now;
+    LARGE_INTEGER 	frequency;
+
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+#endif
+}
+
+/* TSS_Record_Cpu() returns the CPU time of the calling thread in nsec */
+
+static uint64_t TSS_Record_Cpu(void)
+{
+#ifdef TPM_POSIX
+    struct timespec 	now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+#else
+    FILETIME 		creationTime;
+    FILETIME 		exitTime;
+    FILETIME 		kernelTime;
+    FILETIME 		userTime;
+    uint64_t 		kernel;
+    uint64_t 		user;
+
+    GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime);
+    kernel = ((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+    user = ((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+    return (kernel + user) * 100;	/* 100 nsec units */
+#endif
+}
+
+static void TSS_Record_PutUint32(uint8_t *buffer, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(buffer, &value, sizeof(uint32_t));
+    return;
+}
+
+static uint32_t TSS_Record_GetUint32(const uint8_t *buffer)
+{
+    uint32_t value;
+
+    memcpy(&value, buffer, sizeof(uint32_t));
+    return ntohl(value);
+}
+
+/*
+  Replay
+*/
+
+/* TSS_Replay_Open() reads the TPM_REPLAY_FILE trace when the connection is opened.
+
+   The records are replayed in order.  The position is kept in a file, the trace file name with
+   .pos appended, so that a script of many processes continues where the last process stopped.
+   Remove the position file to replay from the start.
+*/
+
+TPM_RC TSS_Replay_Open(TSS_CONTEXT *tssContext)
+{
+    TPM_RC	rc = 0;
+    TSS_REPLAY	*replay = NULL;
+
+    if (rc == 0) {
+	if (tssContext->tssReplayFile == NULL) {
+	    if (tssVerbose) printf("TSS_Replay_Open: Error, TPM_REPLAY_FILE is not set\n");
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)&replay, sizeof(TSS_REPLAY));	/* freed by
+									   TSS_Replay_Close() */
+    }
+    if (rc == 0) {
+	memset(replay, 0, sizeof(TSS_REPLAY));
+	tssContext->tssReplay = replay;
+	if ((strlen(tssContext->tssReplayFile) + sizeof(TSS_REPLAY_POSITION_SUFFIX)) >
+	    sizeof(replay->positionFile)) {
+	    if (tssVerbose) printf("TSS_Replay_Open: Error, TPM_REPLAY_FILE is too long\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    if (rc == 0) {
+	sprintf(replay->positionFile, "%s%s",
+		tssContext->tssReplayFile, TSS_REPLAY_POSITION_SUFFIX);
+	rc = TSS_Replay_Load(replay, tssContext->tssReplayFile);
+    }
+    if (rc == 0) {
+	TSS_Replay_ReadPosition(replay);
+    }
+    if (rc != 0) {
+	TSS_Replay_Close(tssContext);
+    }
+    return rc;
+}
+
+/* TSS_Replay_Transmit() returns the recorded response to the command.
+
+   The next record is replayed if it has the same command code.  Otherwise, records are skipped
+   up to the next one with the same command code.  The command need not be identical, since
+   commands that include a random value from outside the TSS, such as an OAEP salt, differ from
+   run to run.  A trace recorded with TPM_RANDOM_SEED makes most commands repeat exactly.
+
+   Returns the recorded response code.
+*/
+
+TPM_RC TSS_Replay_Transmit(TSS_CONTEXT *tssContext,
+			   uint8_t *responseBuffer, uint32_t *read,
+			   const uint8_t *commandBuffer, uint32_t written,
+			   const char *message)
+{
+    TPM_RC		rc = 0;
+    TSS_REPLAY		*replay = tssContext->tssReplay;
+    TSS_REPLAY_ENTRY	*entry = NULL;
+
+    if (message != NULL) {
+	if (tssVverbose) printf("TSS_Replay_Transmit: %s\n", message);
+    }
+    if (rc == 0) {
+	if (written < TSS_RECORD_PACKET_MIN) {
+	    if (tssVerbose) printf("TSS_Replay_Transmit: Error, command length %u\n", written);
+	    rc = TSS_RC_BAD_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	entry = TSS_Replay_Find(replay, commandBuffer);
+	if ((entry != NULL) && tssVverbose &&
+	    ((entry->commandLength != written) ||
+	     (memcmp(entry->command, commandBuffer, written) != 0))) {
+	    printf("TSS_Replay_Transmit: Command code %08x differs from the trace\n",
+		   TSS_Record_GetUint32(commandBuffer + sizeof(TPM_ST) + sizeof(uint32_t)));
+	}
+	if (entry == NULL) {
+	    if (tssVerbose) printf("TSS_Replay_Transmit: Error, command code %08x not in %s\n",
+				   TSS_Record_GetUint32(commandBuffer +
+							sizeof(TPM_ST) + sizeof(uint32_t)),
+				   tssContext->tssReplayFile);
+	    rc = TSS_RC_REPLAY_NOT_FOUND;
+	}
+    }
+    if (rc == 0) {
+	memcpy(responseBuffer, entry->response, entry->responseLength);
+	*read = entry->responseLength;
+	if (tssVverbose) TSS_PrintAll("TSS_Replay_Transmit: Response",
+				      responseBuffer, *read);
+	rc = TSS_Record_GetUint32(responseBuffer + sizeof(TPM_ST) + sizeof(uint32_t));
+    }
+    return rc;
+}
+
+/* TSS_Replay_TransmitPlatform() accepts and ignores the simulator platform commands, so that
+   scripts that power up the simulator can be replayed.
+*/
+
+TPM_RC TSS_Replay_TransmitPlatform(TSS_CONTEXT *tssContext,
+				   uint32_t command, const char *message)
+{
+    tssContext = tssContext;
+    command = command;
+    message = message;
+    return 0;
+}
+
+/* TSS_Replay_Close() saves the replay position and frees the replay trace */
+
+TPM_RC TSS_Replay_Close(TSS_CONTEXT *tssContext)
+{
+    TSS_REPLAY	*replay = tssContext->tssReplay;
+
+    if (replay != NULL) {
+	if (replay->entries != NULL) {
+	    TSS_Replay_WritePosition(replay);
+	}
+	free(replay->entries);
+	free(replay->buffer);
+	free(replay);
+	tssContext->tssReplay = NULL;
+    }
+    return 0;
+}
+
+/* TSS_Replay_Load() reads the trace file and indexes the records */
+
+static TPM_RC TSS_Replay_Load(TSS_REPLAY *replay, const char *filename)
+{
+    TPM_RC	rc = 0;
+    FILE	*file = NULL;
+    long	fileLength = 0;
+    size_t	length = 0;
+    size_t	offset;
+    uint32_t	commandLength;
+    uint32_t	responseLength;
+    size_t	pass;
+
+    if (rc == 0) {
+	file = fopen(filename, "rb");			/* closed @1 */
+	if (file == NULL) {
+	    if (tssVerbose) printf("TSS_Replay_Load: Error opening %s\n", filename);
+	    rc = TSS_RC_FILE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	if (fseek(file, 0, SEEK_END) != 0) {
+	    rc = TSS_RC_FILE_SEEK;
+	}
+    }
+    if (rc == 0) {
+	fileLength = ftell(file);
+	if ((fileLength < (long)TSS_RECORD_FILE_HEADER_SIZE) || (fileLength > 0x7fffffff)) {
+	    if (tssVerbose) printf("TSS_Replay_Load: Error, %s length %ld\n",
+				   filename, fileLength);
+	    rc = TSS_RC_FILE_FTELL;
+	}
+    }
+    /* not TSS_Malloc(), which limits the size to that of a TPM structure */
+    if (rc == 0) {
+	length = (size_t)fileLength;
+	replay->buffer = malloc(length);		/* freed by TSS_Replay_Close() */
+	if (replay->buffer == NULL) {
+	    if (tssVerbose) printf("TSS_Replay_Load: Error allocating %lu bytes\n",
+				   (unsigned long)length);
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	rewind(file);
+	if (fread(replay->buffer, 1, length, file) != length) {
+	    if (tssVerbose) printf("TSS_Replay_Load: Error reading %s\n", filename);
+	    rc = TSS_RC_FILE_READ;
+	}
+    }
+    if (file != NULL) {
+	fclose(file);					/* @1 */
+    }
+    if (rc == 0) {
+	if ((TSS_Record_GetUint32(replay->buffer) != TSS_RECORD_MAGIC) ||
+	    (TSS_Record_GetUint32(replay->buffer + sizeof(uint32_t)) != TSS_RECORD_VERSION)) {
+	    if (tssVerbose) printf("TSS_Replay_Load: Error, %s is not a version %u trace\n",
+				   filename, TSS_RECORD_VERSION);
+	    rc = TSS_RC_MALFORMED_RESPONSE;
+	}
+    }
+    /* the first pass counts and validates the records, the second fills the index */
+    for (pass = 0 ; (rc == 0) && (pass < 2) ; pass++) {
+	if (pass == 1) {
+	    if (replay->count == 0) {
+		if (tssVerbose) printf("TSS_Replay_Load: Error, %s has no records\n", filename);
+		rc = TSS_RC_MALFORMED_RESPONSE;
+		break;
+	    }
+	    replay->entries = malloc(replay->count *	/* freed by TSS_Replay_Close() */
+				     sizeof(TSS_REPLAY_ENTRY));
+	    if (replay->entries == NULL) {
+		if (tssVerbose) printf("TSS_Replay_Load: Error allocating %lu records\n",
+				       (unsigned long)replay->count);
+		rc = TSS_RC_OUT_OF_MEMORY;
+		break;
+	    }
+	    replay->count = 0;
+	}
+	for (offset = TSS_RECORD_FILE_HEADER_SIZE ; (rc == 0) && (offset < length) ; ) {
+	    if ((length - offset) < TSS_RECORD_HEADER_SIZE) {
+		rc = TSS_RC_MALFORMED_RESPONSE;
+		break;
+	    }
+	    commandLength = TSS_Record_GetUint32(replay->buffer + offset);
+	    responseLength = TSS_Record_GetUint32(replay->buffer + offset + sizeof(uint32_t));
+	    offset += TSS_RECORD_HEADER_SIZE;
+	    if ((commandLength < TSS_RECORD_PACKET_MIN) || (commandLength > MAX_COMMAND_SIZE) ||
+		(responseLength < TSS_RECORD_PACKET_MIN) || (responseLength > MAX_RESPONSE_SIZE) ||
+		((length - offset) < ((size_t)commandLength + responseLength))) {
+		rc = TSS_RC_MALFORMED_RESPONSE;
+		break;
+	    }
+	    if (pass == 1) {
+		replay->entries[replay->count].command = replay->buffer + offset;
+		replay->entries[replay->count].commandLength = commandLength;
+		replay->entries[replay->count].response = replay->buffer + offset + commandLength;
+		replay->entries[replay->count].responseLength = responseLength;
+	    }
+	    replay->count++;
+	    offset += commandLength + responseLength;
+	}
+	if ((rc == TSS_RC_MALFORMED_RESPONSE) && (tssVerbose)) {
+	    printf("TSS_Replay_Load: Error, %s record %lu is malformed\n",
+		   filename, (unsigned long)replay->count);
+	}
+    }
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_Replay_Load: %s, %lu records\n",
+				filename, (unsigned long)replay->count);
+    }
+    return rc;
+}
+
+/* TSS_Replay_Find() returns the next entry with the same command code, and advances the replay
+   position past it.  Returns NULL if there is none.
+*/
+
+static TSS_REPLAY_ENTRY *TSS_Replay_Find(TSS_REPLAY *replay,
+					 const uint8_t *commandBuffer)
+{
+    TSS_REPLAY_ENTRY	*entry;
+    size_t		i;
+    size_t		ccOffset = sizeof(TPM_ST) + sizeof(uint32_t);
+
+    for (i = replay->next ; i < replay->count ; i++) {
+	entry = &replay->entries[i];
+	if (memcmp(entry->command + ccOffset, commandBuffer + ccOffset, sizeof(TPM_CC)) == 0) {
+	    if ((i != replay->next) && tssVverbose) {
+		printf("TSS_Replay_Find: Skipped %lu records\n", (unsigned long)(i - replay->next));
+	    }
+	    replay->next = i + 1;
+	    return entry;
+	}
+    }
+    return NULL;
+}
+
+/* TSS_Replay_ReadPosition() reads the replay position left by an earlier process.  A missing or
+   out of range position starts at the first record.
+*/
+
+static void TSS_Replay_ReadPosition(TSS_REPLAY *replay)
+{
+    FILE		*file;
+    unsigned long	next = 0;
+
+    file = fopen(replay->positionFile, "r");
+    if (file != NULL) {
+	if ((fscanf(file, "%lu", &next) != 1) || (next >= replay->count)) {
+	    next = 0;
+	}
+	fclose(file);
+    }
+    replay->next = next;
+    return;
+}
+
+/* TSS_Replay_WritePosition() saves the replay position for the next process */
+
+static void TSS_Replay_WritePosition(TSS_REPLAY *replay)
+{
+    FILE		*file;
+
+    file = fopen(replay->positionFile, "w");
+    if (file != NULL) {
+	fprintf(file, "%lu\n", (unsigned long)replay->next);
+	fclose(file);
+    }
+    else {
+	if (tssVerbose) printf("TSS_Replay_WritePosition: Error opening %s\n",
+			       replay->positionFile);
+    }
+    return;
+}
+
+#endif	/* TSS_HAVE_RECORD */
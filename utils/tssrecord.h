@@ -0,0 +1,77 @@
+/********************************************************************************/
+/*										*/
+/*		   Command Record and Replay Utilities				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+#ifndef TSSRECORD_H
+#define TSSRECORD_H
+
+/* This is not a public header.  It should not be used by applications.
+
+   The trace file format is in tsstransmit.h.
+*/
+
+#include <stdint.h>
+
+#include <ibmtss/tss.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    TPM_RC TSS_Record_TransportStart(TSS_CONTEXT *tssContext,
+				     const uint8_t *commandBuffer, uint32_t written);
+    void TSS_Record_TransportEnd(TSS_CONTEXT *tssContext,
+				 const uint8_t *responseBuffer, uint32_t read,
+				 TPM_RC rc);
+    void TSS_Record_ExecuteStart(TSS_CONTEXT *tssContext);
+    void TSS_Record_ExecuteEnd(TSS_CONTEXT *tssContext);
+    void TSS_Record_Close(TSS_CONTEXT *tssContext);
+
+    TPM_RC TSS_Replay_Open(TSS_CONTEXT *tssContext);
+    TPM_RC TSS_Replay_Transmit(TSS_CONTEXT *tssContext,
+			       uint8_t *responseBuffer, uint32_t *read,
+			       const uint8_t *commandBuffer, uint32_t written,
+			       const char *message);
+    TPM_RC TSS_Replay_TransmitPlatform(TSS_CONTEXT *tssContext,
+				       uint32_t command, const char *message);
+    TPM_RC TSS_Replay_Close(TSS_CONTEXT *tssContext);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
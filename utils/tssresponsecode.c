@@ -333,6 +333,9 @@ const RC_TABLE tssTable [] = {
     {TSS_RC_MALFORMED_RESPONSE, "TSS_RC_MALFORMED_RESPONSE - A response packet was fundamentally malformed"},
     {TSS_RC_NULL_PARAMETER, "TSS_RC_NULL_PARAMETER - A required parameter was NULL"},
     {TSS_RC_NOT_IMPLEMENTED, "TSS_RC_NOT_IMPLEMENTED - TSS function is not implemented"},
+    {TSS_RC_TRANSPORT_FULL, "TSS_RC_TRANSPORT_FULL - No more transports can be registered"},
+    {TSS_RC_COMMAND_TIMEOUT, "TSS_RC_COMMAND_TIMEOUT - The TPM did not respond before the deadline"},
+    {TSS_RC_REPLAY_NOT_FOUND, "TSS_RC_REPLAY_NOT_FOUND - The command is not in the replay trace"},
     {TSS_RC_FILE_OPEN, "TSS_RC_FILE_OPEN - The file could not be opened"},
     {TSS_RC_FILE_SEEK, "TSS_RC_FILE_SEEK - A file seek failed"},
     {TSS_RC_FILE_FTELL, "TSS_RC_FILE_FTELL - A file ftell failed"},
@@ -340,6 +343,9 @@ const RC_TABLE tssTable [] = {
     {TSS_RC_FILE_CLOSE, "TSS_RC_FILE_CLOSE - A file close failed"},
     {TSS_RC_FILE_WRITE, "TSS_RC_FILE_WRITE - A file write failed"},
     {TSS_RC_FILE_REMOVE, "TSS_RC_FILE_REMOVE - A file remove failed"},
+    {TSS_RC_STORE_OPEN, "TSS_RC_STORE_OPEN - The metadata store could not be opened"},
+    {TSS_RC_STORE_NOT_FOUND, "TSS_RC_STORE_NOT_FOUND - The metadata store has no entry for the key"},
+    {TSS_RC_STORE_FULL, "TSS_RC_STORE_FULL - The metadata store has no free record"},
     {TSS_RC_RNG_FAILURE, "TSS_RC_RNG_FAILURE - The random number generator failed"},
     {TSS_RC_BAD_PWAP_NONCE, "TSS_RC_BAD_PWAP_NONCE - Bad PWAP response nonce"},
     {TSS_RC_BAD_PWAP_ATTRIBUTES, "TSS_RC_BAD_PWAP_ATTRIBUTES - Bad PWAP response attributes"},
@@ -385,9 +391,11 @@ const RC_TABLE tssTable [] = {
     {TSS_RC_KDFE_FAILED, "TSS_RC_KDFE_FAILED - KDFe function failed"},
     {TSS_RC_EC_EPHEMERAL_FAILURE, "TSS_RC_EC_EPHEMERAL_FAILURE - Failed while making or using EC ephemeral key"},
     {TSS_RC_FAIL, "TSS_RC_FAIL - TSS internal failure"},
+    {TSS_RC_COMMAND_PENDING, "TSS_RC_COMMAND_PENDING - Execute phase called out of sequence"},
     {TSS_RC_NO_SESSION_SLOT, "TSS_RC_NO_SESSION_SLOT - TSS context has no session slot for handle"},
     {TSS_RC_NO_OBJECTPUBLIC_SLOT, "TSS_RC_NO_OBJECTPUBLIC_SLOT - TSS context has no object public slot for handle"},
     {TSS_RC_NO_NVPUBLIC_SLOT, "TSS_RC_NO_NVPUBLIC_SLOT -TSS context has no NV public slot for handle"},
+    {TSS_RC_NO_CAPABILITY, "TSS_RC_NO_CAPABILITY - TPM does not report the capability"},
 };
 
 #ifdef TPM_WINDOWS
@@ -0,0 +1,374 @@
+/********************************************************************************/
+/*										*/
+/*				TSS Session Pool				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* This file keeps pools of started sessions in the TSS context.  See ibmtss/tsssessionpool.h.
+
+   The sessions are started and flushed with TSS_Execute(), so that the TSS session state is
+   created and deleted as for any other session.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tsserror.h>
+#include <ibmtss/tssutils.h>
+#include <ibmtss/tsssessionpool.h>
+
+#include "tssproperties.h"
+#include "tss20.h"
+
+#define TSS_SESSION_POOLS	4	/* initial number of pools */
+
+/* the idle sessions for one set of StartAuthSession parameters */
+
+typedef struct TSS_SESSION_POOL_ENTRY {
+    TPMI_DH_OBJECT		tpmKey;
+    TPMI_DH_ENTITY		bind;
+    TPM_SE			sessionType;
+    TPMT_SYM_DEF		symmetric;
+    TPMI_ALG_HASH		authHash;
+    unsigned int		size;		/* sessions to keep, from TSS_SessionPool_Fill() */
+    unsigned int		count;		/* idle sessions */
+    TPMI_SH_AUTH_SESSION	sessionHandle[TSS_SESSION_POOL_MAX];
+} TSS_SESSION_POOL_ENTRY;
+
+typedef struct TSS_SESSION_POOL {
+    TSS_SESSION_POOL_ENTRY	*pools;
+    size_t			count;		/* pools in use */
+    size_t			slots;		/* pools allocated */
+} TSS_SESSION_POOL;
+
+/* local prototypes */
+
+static TPM_RC TSS_SessionPool_Find(TSS_CONTEXT *tssContext,
+				   TSS_SESSION_POOL_ENTRY **pool,
+				   const StartAuthSession_In *in,
+				   int add);
+static int TSS_SessionPool_Match(const TSS_SESSION_POOL_ENTRY *pool,
+				 const StartAuthSession_In *in);
+static TPM_RC TSS_SessionPool_Start(TSS_CONTEXT *tssContext,
+				    TPMI_SH_AUTH_SESSION *sessionHandle,
+				    const StartAuthSession_In *in,
+				    const char *bindPassword);
+static TPM_RC TSS_SessionPool_FlushSession(TSS_CONTEXT *tssContext,
+					   TPMI_SH_AUTH_SESSION sessionHandle);
+
+/* TSS_SessionPool_Fill() sets the size of the pool for the 'in' parameters and starts sessions
+   until the pool holds 'size' idle sessions.  A smaller size flushes the extra idle sessions.  */
+
+TPM_RC TSS_SessionPool_Fill(TSS_CONTEXT *tssContext,
+			    const StartAuthSession_In *in,
+			    const char *bindPassword,
+			    unsigned int size)
+{
+    TPM_RC			rc = 0;
+    TSS_SESSION_POOL_ENTRY	*pool = NULL;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	if (size > TSS_SESSION_POOL_MAX) {
+	    if (tssVerbose) printf("TSS_SessionPool_Fill: Error, size %u greater than %u\n",
+				   size, TSS_SESSION_POOL_MAX);
+	    rc = TSS_RC_SESSION_NUMBER;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_SessionPool_Find(tssContext, &pool, in, TRUE);
+    }
+    if (rc == 0) {
+	pool->size = size;
+    }
+    while ((rc == 0) && (pool->count > pool->size)) {
+	pool->count--;
+	rc = TSS_SessionPool_FlushSession(tssContext, pool->sessionHandle[pool->count]);
+    }
+    while ((rc == 0) && (pool->count < pool->size)) {
+	rc = TSS_SessionPool_Start(tssContext, &pool->sessionHandle[pool->count], in, bindPassword);
+	if (rc == 0) {
+	    pool->count++;
+	}
+    }
+    return rc;
+}
+
+/* TSS_SessionPool_Get() returns an idle session for the 'in' parameters.  If the pool is empty, it
+   starts a session. */
+
+TPM_RC TSS_SessionPool_Get(TSS_CONTEXT *tssContext,
+			   TPMI_SH_AUTH_SESSION *sessionHandle,
+			   const StartAuthSession_In *in,
+			   const char *bindPassword)
+{
+    TPM_RC			rc = 0;
+    TSS_SESSION_POOL_ENTRY	*pool = NULL;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	rc = TSS_SessionPool_Find(tssContext, &pool, in, FALSE);
+    }
+    if (rc == 0) {
+	if ((pool != NULL) && (pool->count > 0)) {
+	    pool->count--;
+	    *sessionHandle = pool->sessionHandle[pool->count];
+	    if (tssVverbose) printf("TSS_SessionPool_Get: session %08x from pool\n",
+				    *sessionHandle);
+	}
+	else {
+	    if (tssVverbose) printf("TSS_SessionPool_Get: pool empty\n");
+	    rc = TSS_SessionPool_Start(tssContext, sessionHandle, in, bindPassword);
+	}
+    }
+    return rc;
+}
+
+/* TSS_SessionPool_Put() returns a session to the pool for the 'in' parameters.  A policy session
+   is restarted.  If the pool is full, or the restart fails, the session is flushed.
+*/
+
+TPM_RC TSS_SessionPool_Put(TSS_CONTEXT *tssContext,
+			   TPMI_SH_AUTH_SESSION sessionHandle,
+			   const StartAuthSession_In *in)
+{
+    TPM_RC			rc = 0;
+    TSS_SESSION_POOL_ENTRY	*pool = NULL;
+    PolicyRestart_In 		policyRestartIn;
+
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	rc = TSS_SessionPool_Find(tssContext, &pool, in, FALSE);
+    }
+    if (rc == 0) {
+	if ((pool == NULL) || (pool->count >= pool->size)) {
+	    if (tssVverbose) printf("TSS_SessionPool_Put: session %08x, pool full\n",
+				    sessionHandle);
+	    return TSS_SessionPool_FlushSession(tssContext, sessionHandle);
+	}
+    }
+    /* a trial session is also a policy session */
+    if ((rc == 0) && (in->sessionType != TPM_SE_HMAC)) {
+	policyRestartIn.sessionHandle = sessionHandle;
+	rc = TSS_Execute(tssContext,
+			 NULL,
+			 (COMMAND_PARAMETERS *)&policyRestartIn,
+			 NULL,
+			 TPM_CC_PolicyRestart,
+			 TPM_RH_NULL, NULL, 0);
+	if (rc != 0) {
+	    if (tssVerbose) printf("TSS_SessionPool_Put: Error restarting session %08x\n",
+				   sessionHandle);
+	    TSS_SessionPool_FlushSession(tssContext, sessionHandle);
+	}
+    }
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_SessionPool_Put: session %08x to pool\n", sessionHandle);
+	pool->sessionHandle[pool->count] = sessionHandle;
+	pool->count++;
+    }
+    return rc;
+}
+
+/* TSS_SessionPool_Flush() flushes the idle sessions of all pools and frees the pools.  It returns
+   the first error, but continues to flush the remaining sessions. */
+
+TPM_RC TSS_SessionPool_Flush(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+    TPM_RC		rc1;
+    TSS_SESSION_POOL	*sessionPool = tssContext->tssSessionPool;
+    size_t		i;
+    unsigned int	j;
+
+    TSS_SetThreadTrace(tssContext);
+    if (sessionPool != NULL) {
+	for (i = 0 ; i < sessionPool->count ; i++) {
+	    for (j = 0 ; j < sessionPool->pools[i].count ; j++) {
+		rc1 = TSS_SessionPool_FlushSession(tssContext,
+						   sessionPool->pools[i].sessionHandle[j]);
+		if (rc == 0) {
+		    rc = rc1;
+		}
+	    }
+	}
+	free(sessionPool->pools);
+	free(sessionPool);
+	tssContext->tssSessionPool = NULL;
+    }
+    return rc;
+}
+
+/* TSS_SessionPool_Delete() flushes the idle sessions when the TSS context is deleted.  Errors are
+   ignored. */
+
+void TSS_SessionPool_Delete(TSS_CONTEXT *tssContext)
+{
+    TSS_SessionPool_Flush(tssContext);
+    return;
+}
+
+/* TSS_SessionPool_Find() returns the pool for the 'in' parameters.  If there is none, it adds an
+   empty pool if 'add' is TRUE, else returns NULL. */
+
+static TPM_RC TSS_SessionPool_Find(TSS_CONTEXT *tssContext,
+				   TSS_SESSION_POOL_ENTRY **pool,
+				   const StartAuthSession_In *in,
+				   int add)
+{
+    TPM_RC		rc = 0;
+    TSS_SESSION_POOL	*sessionPool = tssContext->tssSessionPool;
+    size_t		i;
+
+    *pool = NULL;
+    if (sessionPool != NULL) {
+	for (i = 0 ; i < sessionPool->count ; i++) {
+	    if (TSS_SessionPool_Match(&sessionPool->pools[i], in)) {
+		*pool = &sessionPool->pools[i];
+		return rc;
+	    }
+	}
+    }
+    if (!add) {
+	return rc;
+    }
+    /* allocate the pool table at first use */
+    if ((rc == 0) && (sessionPool == NULL)) {
+	rc = TSS_Malloc((unsigned char **)&tssContext->tssSessionPool,	/* freed by
+									   TSS_SessionPool_Flush() */
+			sizeof(TSS_SESSION_POOL));
+	if (rc == 0) {
+	    sessionPool = tssContext->tssSessionPool;
+	    sessionPool->pools = NULL;
+	    sessionPool->count = 0;
+	    sessionPool->slots = 0;
+	}
+    }
+    if (rc == 0) {
+	if (sessionPool->count == sessionPool->slots) {
+	    size_t slots = (sessionPool->slots == 0) ?
+			   TSS_SESSION_POOLS : (sessionPool->slots * 2);
+	    rc = TSS_Realloc((unsigned char **)&sessionPool->pools,	/* freed by
+									   TSS_SessionPool_Flush() */
+			     (uint32_t)(slots * sizeof(TSS_SESSION_POOL_ENTRY)));
+	    if (rc == 0) {
+		sessionPool->slots = slots;
+	    }
+	}
+    }
+    if (rc == 0) {
+	*pool = &sessionPool->pools[sessionPool->count];
+	(*pool)->tpmKey = in->tpmKey;
+	(*pool)->bind = in->bind;
+	(*pool)->sessionType = in->sessionType;
+	(*pool)->symmetric = in->symmetric;
+	(*pool)->authHash = in->authHash;
+	(*pool)->size = 0;
+	(*pool)->count = 0;
+	sessionPool->count++;
+    }
+    return rc;
+}
+
+/* TSS_SessionPool_Match() returns TRUE if the pool holds sessions started with the 'in'
+   parameters.  The key size and mode are ignored for a TPM_ALG_NULL symmetric algorithm. */
+
+static int TSS_SessionPool_Match(const TSS_SESSION_POOL_ENTRY *pool,
+				 const StartAuthSession_In *in)
+{
+    int match = (pool->tpmKey == in->tpmKey) &&
+		(pool->bind == in->bind) &&
+		(pool->sessionType == in->sessionType) &&
+		(pool->authHash == in->authHash) &&
+		(pool->symmetric.algorithm == in->symmetric.algorithm);
+    if (match && (in->symmetric.algorithm != TPM_ALG_NULL)) {
+	match = (pool->symmetric.keyBits.sym == in->symmetric.keyBits.sym) &&
+		(pool->symmetric.mode.sym == in->symmetric.mode.sym);
+    }
+    return match;
+}
+
+/* TSS_SessionPool_Start() starts a session with the 'in' parameters */
+
+static TPM_RC TSS_SessionPool_Start(TSS_CONTEXT *tssContext,
+				    TPMI_SH_AUTH_SESSION *sessionHandle,
+				    const StartAuthSession_In *in,
+				    const char *bindPassword)
+{
+    TPM_RC			rc = 0;
+    StartAuthSession_In 	startAuthSessionIn;
+    StartAuthSession_Out 	startAuthSessionOut;
+    StartAuthSession_Extra	startAuthSessionExtra;
+
+    /* the preprocessor supplies the nonce and salt */
+    if (rc == 0) {
+	startAuthSessionIn = *in;
+	startAuthSessionExtra.bindPassword = bindPassword;
+	rc = TSS_Execute(tssContext,
+			 (RESPONSE_PARAMETERS *)&startAuthSessionOut,
+			 (COMMAND_PARAMETERS *)&startAuthSessionIn,
+			 (EXTRA_PARAMETERS *)&startAuthSessionExtra,
+			 TPM_CC_StartAuthSession,
+			 TPM_RH_NULL, NULL, 0);
+    }
+    if (rc == 0) {
+	*sessionHandle = startAuthSessionOut.sessionHandle;
+	if (tssVverbose) printf("TSS_SessionPool_Start: session %08x\n", *sessionHandle);
+    }
+    return rc;
+}
+
+/* TSS_SessionPool_FlushSession() flushes a session */
+
+static TPM_RC TSS_SessionPool_FlushSession(TSS_CONTEXT *tssContext,
+					   TPMI_SH_AUTH_SESSION sessionHandle)
+{
+    TPM_RC		rc = 0;
+    FlushContext_In 	flushContextIn;
+
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_SessionPool_FlushSession: session %08x\n", sessionHandle);
+	flushContextIn.flushHandle = sessionHandle;
+	rc = TSS_Execute(tssContext,
+			 NULL,
+			 (COMMAND_PARAMETERS *)&flushContextIn,
+			 NULL,
+			 TPM_CC_FlushContext,
+			 TPM_RH_NULL, NULL, 0);
+    }
+    return rc;
+}
@@ -0,0 +1,432 @@
+/********************************************************************************/
+/*										*/
+/*		Shared Memory Ring Transmit and Receive Utilities		*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* This file implements the shm interface type, a pair of shared memory rings to a cooperating
+   TPM server on the same host.  See tssshm.h for the layout and the protocol.
+
+   A command costs no system call when the server is polling the command ring and the response
+   arrives within the spin interval.  Otherwise, there is one futex wake and one futex wait.
+*/
+
+#include "tssproperties.h"
+
+#ifdef TSS_HAVE_SHM
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <arpa/inet.h>
+
+#include <ibmtss/tssresponsecode.h>
+#include <ibmtss/tsserror.h>
+#include <ibmtss/tssprint.h>
+
+#include "tssdev.h"
+#include "tssshm.h"
+
+/* the length that precedes each packet in a ring */
+#define TSS_SHM_FRAME_SIZE	sizeof(uint32_t)
+
+/* polls of the response ring before sleeping */
+#define TSS_SHM_SPIN		4096
+
+/* local prototypes */
+
+static uint32_t TSS_Shm_Open(TSS_CONTEXT *tssContext);
+static void TSS_Shm_Write(uint8_t *ring, uint32_t ringSize, uint32_t offset,
+			  const uint8_t *buffer, uint32_t length);
+static void TSS_Shm_Read(const uint8_t *ring, uint32_t ringSize, uint32_t offset,
+			 uint8_t *buffer, uint32_t length);
+static uint32_t TSS_Shm_WaitHead(TSS_SHM_RING *ring, uint32_t tail, uint32_t *head,
+				 uint64_t deadline);
+
+/* TSS_Shm_Transmit() transmits the command and receives the response.
+
+   Can return ring transmit and receive packet errors, but normally returns the TPM response code.
+*/
+
+TPM_RC TSS_Shm_Transmit(TSS_CONTEXT *tssContext,
+			uint8_t *responseBuffer, uint32_t *read,
+			const uint8_t *commandBuffer, uint32_t written,
+			const char *message)
+{
+    TPM_RC rc = 0;
+
+    if (rc == 0) {
+	rc = TSS_Shm_Send(tssContext, commandBuffer, written, message);
+    }
+    if (rc == 0) {
+	rc = TSS_Shm_Receive(tssContext, responseBuffer, read);
+    }
+    return rc;
+}
+
+/* TSS_Shm_Send() maps the shared memory on the first transmit and writes the command frame to
+   the command ring.  It does not wait for the response.
+
+   It starts the response deadline, either the TPM_COMMAND_TIMEOUT value or one deduced from the
+   command code, as for the dev interface.
+*/
+
+TPM_RC TSS_Shm_Send(TSS_CONTEXT *tssContext,
+		    const uint8_t *commandBuffer, uint32_t written,
+		    const char *message)
+{
+    TPM_RC	rc = 0;
+    TSS_SHM	*shm = NULL;
+    uint8_t	*ring = NULL;
+    uint32_t	head = 0;
+    uint32_t	tail = 0;
+    unsigned int timeout;
+
+    /* open on first transmit */
+    if (tssContext->tssFirstTransmit) {
+	if (rc == 0) {
+	    rc = TSS_Shm_Open(tssContext);
+	}
+	if (rc == 0) {
+	    tssContext->tssFirstTransmit = FALSE;
+	}
+    }
+    if (rc == 0) {
+	if (message != NULL) {
+	    if (tssVverbose) printf("TSS_Shm_Send: %s\n", message);
+	}
+	if (tssVverbose) TSS_PrintAll("TSS_Shm_Send", commandBuffer, written);
+	if (tssContext->tssCommandTimeoutAuto) {
+	    timeout = TSS_Dev_GetTimeout(commandBuffer, written);
+	}
+	else {
+	    timeout = tssContext->tssCommandTimeout;
+	}
+	if (timeout != 0) {
+	    tssContext->tssShmDeadline = TSS_Dev_Now() + timeout;
+	}
+	else {
+	    tssContext->tssShmDeadline = 0;
+	}
+	shm = tssContext->tssShm;
+	ring = (uint8_t *)(shm + 1);
+	head = shm->command.head;	/* only this side writes head */
+	tail = __atomic_load_n(&shm->command.tail, __ATOMIC_ACQUIRE);
+	/* with one command outstanding, the ring only fills if the server misbehaves */
+	if ((shm->ringSize - (head - tail)) < (TSS_SHM_FRAME_SIZE + written)) {
+	    if (tssVerbose) printf("TSS_Shm_Send: Error, command ring full\n");
+	    rc = TSS_RC_BAD_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	TSS_Shm_Write(ring, shm->ringSize, head, (uint8_t *)&written, TSS_SHM_FRAME_SIZE);
+	TSS_Shm_Write(ring, shm->ringSize, head + TSS_SHM_FRAME_SIZE, commandBuffer, written);
+	/* publish the frame, then wake the server if it is sleeping.  Both are sequentially
+	   consistent so that the server cannot miss the new head after setting waiting. */
+	__atomic_store_n(&shm->command.head, head + TSS_SHM_FRAME_SIZE + written,
+			 __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shm->command.waiting, __ATOMIC_SEQ_CST)) {
+	    syscall(SYS_futex, &shm->command.head, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+    }
+    return rc;
+}
+
+/* TSS_Shm_Receive() reads the response to a command written by TSS_Shm_Send().  'responseBuffer'
+   must be at least MAX_RESPONSE_SIZE bytes.
+
+   Can return ring receive packet errors, but normally returns the TPM response code.  Returns
+   TSS_RC_COMMAND_TIMEOUT if the response does not arrive by the deadline.
+
+   Validates that the frame length and the packet responseSize match.
+
+   The server may still answer a timed out command.  Those late responses precede the response to
+   the next command in the ring, and are discarded.
+*/
+
+TPM_RC TSS_Shm_Receive(TSS_CONTEXT *tssContext,
+		       uint8_t *responseBuffer, uint32_t *read)
+{
+    TPM_RC	rc = 0;
+    TSS_SHM	*shm = NULL;
+    uint8_t	*ring = NULL;
+    uint32_t	head = 0;
+    uint32_t	tail = 0;
+    uint32_t	length = 0;
+    uint32_t	responseSize = 0;
+    int		done = FALSE;
+
+    if (tssVverbose) printf("TSS_Shm_Receive:\n");
+    if (rc == 0) {
+	if (tssContext->tssFirstTransmit) {
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	shm = tssContext->tssShm;
+	ring = (uint8_t *)(shm + 1) + shm->ringSize;
+    }
+    while ((rc == 0) && !done) {
+	tail = shm->response.tail;	/* only this side writes tail */
+	rc = TSS_Shm_WaitHead(&shm->response, tail, &head, tssContext->tssShmDeadline);
+	/* the frame length, bounded by the caller buffer and by what the server published */
+	if (rc == 0) {
+	    length = 0;
+	    if ((head - tail) >= TSS_SHM_FRAME_SIZE) {
+		TSS_Shm_Read(ring, shm->ringSize, tail, (uint8_t *)&length, TSS_SHM_FRAME_SIZE);
+	    }
+	    if ((length > MAX_RESPONSE_SIZE) ||
+		(length > ((head - tail) - TSS_SHM_FRAME_SIZE)) ||
+		(length < (sizeof(TPM_ST) + sizeof(uint32_t) + sizeof(uint32_t)))) {
+		if (tssVerbose) printf("TSS_Shm_Receive: Error, bad frame length %u\n", length);
+		/* the frame boundaries are lost, discard everything published so that the next
+		   response starts a new frame */
+		__atomic_store_n(&shm->response.tail, head, __ATOMIC_RELEASE);
+		tssContext->tssShmStale = 0;
+		rc = TSS_RC_MALFORMED_RESPONSE;
+	    }
+	}
+	if (rc == 0) {
+	    TSS_Shm_Read(ring, shm->ringSize, tail + TSS_SHM_FRAME_SIZE, responseBuffer, length);
+	    /* release the frame to the server */
+	    __atomic_store_n(&shm->response.tail, tail + TSS_SHM_FRAME_SIZE + length,
+			     __ATOMIC_RELEASE);
+	    if (tssContext->tssShmStale > 0) {
+		if (tssVverbose) printf("TSS_Shm_Receive: Discarding a late response\n");
+		tssContext->tssShmStale--;
+	    }
+	    else {
+		done = TRUE;
+	    }
+	}
+    }
+    if (rc == 0) {
+	if (tssVverbose) TSS_PrintAll("TSS_Shm_Receive", responseBuffer, length);
+    }
+    /* the command is still outstanding at the server */
+    if (rc == TSS_RC_COMMAND_TIMEOUT) {
+	tssContext->tssShmStale++;
+    }
+    /* get responseSize from the packet */
+    if (rc == 0) {
+	responseSize = ntohl(*(uint32_t *)(responseBuffer + sizeof(TPM_ST)));
+	if (length != responseSize) {
+	    if (tssVerbose) printf("TSS_Shm_Receive: frame length %u != responseSize %u\n",
+				   length, responseSize);
+	    rc = TSS_RC_BAD_CONNECTION;
+	}
+    }
+    /* read the TPM return code from the packet */
+    if (rc == 0) {
+	rc = ntohl(*(uint32_t *)(responseBuffer + sizeof(TPM_ST) + sizeof(uint32_t)));
+	*read = responseSize;
+    }
+    if (tssVverbose) printf("TSS_Shm_Receive: rc %08x\n", rc);
+    return rc;
+}
+
+/* TSS_Shm_Open() maps the shared memory created by the server at tssCommandPath and validates the
+   header */
+
+static uint32_t TSS_Shm_Open(TSS_CONTEXT *tssContext)
+{
+    uint32_t	rc = 0;
+    int		fd = -1;
+    struct stat	sb;
+    void	*addr = MAP_FAILED;
+    TSS_SHM	*shm = NULL;
+
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_Shm_Open: Opening %s\n", tssContext->tssCommandPath);
+	fd = open(tssContext->tssCommandPath, O_RDWR);
+	if (fd < 0) {
+	    if (tssVerbose) printf("TSS_Shm_Open: Error opening %s\n",
+				   tssContext->tssCommandPath);
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	if ((fstat(fd, &sb) != 0) || ((size_t)sb.st_size < sizeof(TSS_SHM))) {
+	    if (tssVerbose) printf("TSS_Shm_Open: Error, %s too small\n",
+				   tssContext->tssCommandPath);
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	addr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+	    if (tssVerbose) printf("TSS_Shm_Open: Error mapping %s, %d %s\n",
+				   tssContext->tssCommandPath, errno, strerror(errno));
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    /* the mapping holds a reference to the file */
+    if (fd >= 0) {
+	close(fd);
+    }
+    /* the rings must hold a maximum size frame and fit in the file */
+    if (rc == 0) {
+	shm = (TSS_SHM *)addr;
+	if ((__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != TSS_SHM_MAGIC) ||
+	    (shm->version != TSS_SHM_VERSION) ||
+	    ((shm->ringSize & (shm->ringSize - 1)) != 0) ||
+	    (shm->ringSize < (TSS_SHM_FRAME_SIZE + MAX_COMMAND_SIZE)) ||
+	    (shm->ringSize < (TSS_SHM_FRAME_SIZE + MAX_RESPONSE_SIZE)) ||
+	    (((size_t)sb.st_size - sizeof(TSS_SHM)) / 2 < shm->ringSize)) {
+	    if (tssVerbose) printf("TSS_Shm_Open: Error, %s header invalid\n",
+				   tssContext->tssCommandPath);
+	    munmap(addr, sb.st_size);
+	    rc = TSS_RC_NO_CONNECTION;
+	}
+    }
+    if (rc == 0) {
+	tssContext->tssShm = shm;
+	tssContext->tssShmSize = sb.st_size;
+    }
+    return rc;
+}
+
+/* TSS_Shm_Write() copies 'length' bytes into the ring at the free running 'offset', wrapping at
+   the end of the ring */
+
+static void TSS_Shm_Write(uint8_t *ring, uint32_t ringSize, uint32_t offset,
+			  const uint8_t *buffer, uint32_t length)
+{
+    uint32_t	index = offset & (ringSize - 1);
+    uint32_t	first = ringSize - index;
+
+    if (first > length) {
+	first = length;
+    }
+    memcpy(ring + index, buffer, first);
+    memcpy(ring, buffer + first, length - first);
+    return;
+}
+
+/* TSS_Shm_Read() copies 'length' bytes out of the ring at the free running 'offset', wrapping at
+   the end of the ring */
+
+static void TSS_Shm_Read(const uint8_t *ring, uint32_t ringSize, uint32_t offset,
+			 uint8_t *buffer, uint32_t length)
+{
+    uint32_t	index = offset & (ringSize - 1);
+    uint32_t	first = ringSize - index;
+
+    if (first > length) {
+	first = length;
+    }
+    memcpy(buffer, ring + index, first);
+    memcpy(buffer + first, ring, length - first);
+    return;
+}
+
+/* TSS_Shm_WaitHead() waits until the ring head moves past 'tail', first polling and then sleeping
+   on the futex.  It returns the new head.
+
+   'deadline' is a TSS_Dev_Now() time, or 0 to wait forever.  Returns TSS_RC_COMMAND_TIMEOUT if
+   it passes, so that a dead or absent server does not hang the caller.
+*/
+
+static uint32_t TSS_Shm_WaitHead(TSS_SHM_RING *ring, uint32_t tail, uint32_t *head,
+				 uint64_t deadline)
+{
+    uint32_t	rc = 0;
+    unsigned int i;
+    long	irc;
+    uint64_t	now;
+    struct timespec timeout;
+
+    for (i = 0 ; i < TSS_SHM_SPIN ; i++) {
+	*head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (*head != tail) {
+	    return rc;
+	}
+    }
+    /* announce the sleep, then check again so that a head published before the announcement is
+       not missed */
+    __atomic_store_n(&ring->waiting, TRUE, __ATOMIC_SEQ_CST);
+    while (rc == 0) {
+	*head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+	if (*head != tail) {
+	    break;
+	}
+	/* FUTEX_WAIT takes a relative timeout */
+	if (deadline != 0) {
+	    now = TSS_Dev_Now();
+	    if (now >= deadline) {
+		if (tssVerbose) printf("TSS_Shm_WaitHead: Error, no response before deadline\n");
+		rc = TSS_RC_COMMAND_TIMEOUT;
+		break;
+	    }
+	    timeout.tv_sec = (deadline - now) / 1000;
+	    timeout.tv_nsec = ((deadline - now) % 1000) * 1000000;
+	}
+	/* sleeps only if head is still tail, so a wake after the check is not lost */
+	irc = syscall(SYS_futex, &ring->head, FUTEX_WAIT, tail,
+		      (deadline != 0) ? &timeout : NULL, NULL, 0);
+	if ((irc != 0) && (errno != EAGAIN) && (errno != EINTR) && (errno != ETIMEDOUT)) {
+	    if (tssVerbose) printf("TSS_Shm_WaitHead: futex error %d %s\n",
+				   errno, strerror(errno));
+	    rc = TSS_RC_BAD_CONNECTION;
+	}
+    }
+    __atomic_store_n(&ring->waiting, FALSE, __ATOMIC_RELAXED);
+    return rc;
+}
+
+/* TSS_Shm_Close() unmaps the shared memory, if it is mapped */
+
+TPM_RC TSS_Shm_Close(TSS_CONTEXT *tssContext)
+{
+    /* only close if there was an open */
+    if (tssContext->tssFirstTransmit) {
+	return 0;
+    }
+    if (tssVverbose) printf("TSS_Shm_Close: Closing %s\n", tssContext->tssCommandPath);
+    munmap(tssContext->tssShm, tssContext->tssShmSize);
+    tssContext->tssShm = NULL;
+    tssContext->tssShmSize = 0;
+    return 0;
+}
+
+#endif	/* TSS_HAVE_SHM */
@@ -0,0 +1,102 @@
+/********************************************************************************/
+/*										*/
+/*		Shared Memory Ring Transmit and Receive Utilities		*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* This is not a public header.  It should not be used by applications.
+
+   It also documents the shared memory layout for a cooperating local TPM server.
+
+   The server creates the file (typically under /dev/shm), sizes it to sizeof(TSS_SHM) plus two
+   rings of ringSize bytes, and initializes the header.  The command ring immediately follows the
+   header, and the response ring follows the command ring.
+
+   Each ring has a single producer and a single consumer.  head and tail are free running byte
+   counts, so the ring offset is the count modulo ringSize, which must be a power of two.  A
+   frame is a uint32_t length in host byte order followed by the TPM command or response packet.
+   The producer writes the frame and then advances head.  The consumer reads the frame and then
+   advances tail.
+
+   A consumer that finds the ring empty sets waiting, checks head again, and then sleeps in a
+   futex wait on head.  A producer that finds waiting set after advancing head issues a futex
+   wake on head.  The TSS is the producer for the command ring and the consumer for the response
+   ring, and has at most one command outstanding.
+*/
+
+#ifndef TSSSHM_H
+#define TSSSHM_H
+
+#include <stdint.h>
+
+#define TSS_SHM_MAGIC	0x54505353	/* "TPSS" */
+#define TSS_SHM_VERSION	1
+
+typedef struct TSS_SHM_RING {
+    uint32_t head;		/* bytes produced, futex word */
+    uint32_t tail;		/* bytes consumed */
+    uint32_t waiting;		/* TRUE if the consumer may be sleeping on head */
+    uint32_t reserved;
+} TSS_SHM_RING;
+
+typedef struct TSS_SHM {
+    uint32_t magic;		/* TSS_SHM_MAGIC, written last by the server */
+    uint32_t version;		/* TSS_SHM_VERSION */
+    uint32_t ringSize;		/* bytes in each ring, a power of two */
+    uint32_t reserved;
+    TSS_SHM_RING command;	/* TSS to server */
+    TSS_SHM_RING response;	/* server to TSS */
+} TSS_SHM;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    TPM_RC TSS_Shm_Transmit(TSS_CONTEXT *tssContext,
+			    uint8_t *responseBuffer, uint32_t *read,
+			    const uint8_t *commandBuffer, uint32_t written,
+			    const char *message);
+    TPM_RC TSS_Shm_Send(TSS_CONTEXT *tssContext,
+			const uint8_t *commandBuffer, uint32_t written,
+			const char *message);
+    TPM_RC TSS_Shm_Receive(TSS_CONTEXT *tssContext,
+			   uint8_t *responseBuffer, uint32_t *read);
+    TPM_RC TSS_Shm_Close(TSS_CONTEXT *tssContext);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -52,11 +52,15 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <sys/un.h>
+#include <poll.h>
 #endif
 
 #ifdef TPM_WINDOWS
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #endif
 
 #include <sys/types.h>
@@ -71,27 +75,113 @@
 
 #include "tsssocket.h"
 
+/* MS simulator command packet header, command type, locality, and length */
+#define TSS_SOCKET_HEADER_SIZE	(sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t))
+
+/* a write to a connection that the server closed returns an error rather than raising SIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define TSS_SOCKET_SEND_FLAGS	MSG_NOSIGNAL
+#else
+#define TSS_SOCKET_SEND_FLAGS	0
+#endif
+
+/* longest single entry in the TPM_SERVER_NAME host list */
+#define TSS_SOCKET_HOST_MAX	256
+
 /* local prototypes */
 
-static uint32_t TSS_Socket_Open(TSS_CONTEXT *tssContext, short port);
+static uint32_t TSS_Socket_Open(TSS_CONTEXT *tssContext, short port, const char *path);
+static unsigned int TSS_Socket_HostCount(const char *hostList);
+static int TSS_Socket_HostGet(char *host, size_t hostSize,
+			      const char *hostList, unsigned int index);
+static uint32_t TSS_Socket_OpenHost(TSS_CONTEXT *tssContext, const char *host, const char *service);
+static uint32_t TSS_Socket_Connect(TSS_CONTEXT *tssContext,
+				   const struct sockaddr *addr, int addrlen);
+#ifdef TPM_POSIX
+static uint32_t TSS_Socket_OpenUnix(TSS_CONTEXT *tssContext, const char *path);
+#endif
+static uint32_t TSS_Socket_Reopen(TSS_CONTEXT *tssContext);
+static int TSS_Socket_PeerClosed(TSS_CONTEXT *tssContext);
 static uint32_t TSS_Socket_SendCommand(TSS_CONTEXT *tssContext,
 				       const uint8_t *buffer, uint16_t length,
 				       const char *message);
 static uint32_t TSS_Socket_SendPlatform(TSS_SOCKET_FD sock_fd, uint32_t command, const char *message);
 static uint32_t TSS_Socket_ReceiveCommand(TSS_CONTEXT *tssContext, uint8_t *buffer, uint32_t *length);
-static uint32_t TSS_Socket_ReceivePlatform(TSS_SOCKET_FD sock_fd);
-static uint32_t TSS_Socket_ReceiveBytes(TSS_SOCKET_FD sock_fd, uint8_t *buffer, uint32_t nbytes);
+static uint32_t TSS_Socket_ReceivePlatform(TSS_CONTEXT *tssContext);
+static uint32_t TSS_Socket_ReceiveBytes(TSS_CONTEXT *tssContext, uint8_t *buffer, uint32_t nbytes);
 static uint32_t TSS_Socket_SendBytes(TSS_SOCKET_FD sock_fd, const uint8_t *buffer, size_t length);
-
-static uint32_t TSS_Socket_GetServerType(TSS_CONTEXT *tssContext,
-					 int *mssim,
-					 int *rawsingle);
 #ifdef TPM_WINDOWS
 static void TSS_Socket_PrintError(int err);
 #endif
     
-extern int tssVverbose;
-extern int tssVerbose;
+
+/* TSS_Socket_Select() gets the type of server packet format when the socket transport is selected,
+   so that the commands do not parse tssServerType.
+
+   Currently, the formats supported are:
+
+   mssim, raw, rawsingle, rawkeepalive
+
+   mssim TRUE  - the MS simulator packet
+   mssim FALSE - raw TPM specification Part 3 packets
+   rawsingle is the same as mssim FALSE but forces an open and cose for each command
+   rawkeepalive is the same as mssim FALSE but reconnects if the server closes the connection
+*/
+
+TPM_RC TSS_Socket_Select(TSS_CONTEXT *tssContext)
+{
+    TPM_RC 	rc = 0;
+
+    if (rc == 0) {
+	tssContext->tssSocketUnix = FALSE;
+	tssContext->tssSocketKeepalive = FALSE;
+	if ((strcmp(tssContext->tssServerType, "mssim") == 0)) {
+	    tssContext->tssSocketMssim = TRUE;
+	    tssContext->tssSocketRawsingle = FALSE;
+	}
+	else if ((strcmp(tssContext->tssServerType, "raw") == 0)) {
+	    tssContext->tssSocketMssim = FALSE;
+	    tssContext->tssSocketRawsingle = FALSE;
+	}
+	else if ((strcmp(tssContext->tssServerType, "rawsingle") == 0)) {
+	    tssContext->tssSocketMssim = FALSE;
+	    tssContext->tssSocketRawsingle = TRUE;
+	}
+	else if ((strcmp(tssContext->tssServerType, "rawkeepalive") == 0)) {
+	    tssContext->tssSocketMssim = FALSE;
+	    tssContext->tssSocketRawsingle = FALSE;
+	    tssContext->tssSocketKeepalive = TRUE;
+	}
+	else {
+	    if (tssVerbose) printf("TSS_Socket_Select: server type %s unsupported\n",
+				   tssContext->tssServerType);
+	    rc = TSS_RC_INSUPPORTED_INTERFACE;	
+	}
+    }
+    return rc;
+}
+
+#ifdef TPM_POSIX
+
+/* TSS_Socket_SelectUnix() selects a Unix domain socket to a co-located server, using the same
+   packet formats as TSS_Socket_Select().  The server endpoints are tssCommandPath and
+   tssPlatformPath rather than tssServerName and the ports.
+*/
+
+TPM_RC TSS_Socket_SelectUnix(TSS_CONTEXT *tssContext)
+{
+    TPM_RC 	rc = 0;
+
+    if (rc == 0) {
+	rc = TSS_Socket_Select(tssContext);
+    }
+    if (rc == 0) {
+	tssContext->tssSocketUnix = TRUE;
+    }
+    return rc;
+}
+
+#endif	/* TPM_POSIX */
 
 /* TSS_Socket_TransmitPlatform() transmits MS simulator platform administrative commands */
 
@@ -99,26 +189,20 @@ TPM_RC TSS_Socket_TransmitPlatform(TSS_CONTEXT *tssContext,
 				   uint32_t command, const char *message)
 {
     TPM_RC 	rc = 0;
-    int 	mssim;	/* boolean, true for MS simulator packet format, false for raw packet
-			   format */
-    int 	rawsingle = FALSE;	/* boolean, true for raw format with an open and close per
-					   command */
+
     /* open on first transmit */
     if (tssContext->tssFirstTransmit) {	
-	/* detect errors before starting, get the server packet type, MS sim or raw */
-	if (rc == 0) {
-	    rc = TSS_Socket_GetServerType(tssContext, &mssim, &rawsingle);
-	}
 	/* the platform administrative commands can only work with the simulator */
 	if (rc == 0) {
-	    if (!mssim) {
+	    if (!tssContext->tssSocketMssim) {
 		if (tssVerbose) printf("TSS_Socket_TransmitPlatform: server type %s unsupported\n",
 				       tssContext->tssServerType);
 		rc = TSS_RC_INSUPPORTED_INTERFACE;	
 	    }
 	}
 	if (rc == 0) {
-	    rc = TSS_Socket_Open(tssContext, tssContext->tssPlatformPort);
+	    rc = TSS_Socket_Open(tssContext, tssContext->tssPlatformPort,
+				 tssContext->tssPlatformPath);
 	}
 	if (rc == 0) {
 	    tssContext->tssFirstTransmit = FALSE;
@@ -128,7 +212,7 @@ TPM_RC TSS_Socket_TransmitPlatform(TSS_CONTEXT *tssContext,
 	rc = TSS_Socket_SendPlatform(tssContext->sock_fd, command, message);
     }
     if (rc == 0) {
-	rc = TSS_Socket_ReceivePlatform(tssContext->sock_fd);
+	rc = TSS_Socket_ReceivePlatform(tssContext);
     }
     return rc;
 }
@@ -146,35 +230,90 @@ TPM_RC TSS_Socket_Transmit(TSS_CONTEXT *tssContext,
 			   const char *message)
 {
     TPM_RC 	rc = 0;
-    int 	mssim;	/* boolean, true for MS simulator packet format, false for raw packet
-			   format */
-    int 	rawsingle = FALSE;	/* boolean, true for raw packet format requiring an open and
-					   close for each command */
+
+    /* send the command over the socket.  Error if the socket send fails. */
+    if (rc == 0) {
+	rc = TSS_Socket_Send(tssContext, commandBuffer, written, message);
+    }
+    /* receive the response over the socket.  Returns socket errors, malformed response errors.
+       Else returns the TPM response code. */
+    if (rc == 0) {
+	rc = TSS_Socket_Receive(tssContext, responseBuffer, read);
+    }
+    return rc;
+}
+
+/* TSS_Socket_Send() opens the socket on the first transmit and sends the TPM command.  It does not
+   wait for the response.
+
+   For rawkeepalive, a connection that the server closed while it was idle is replaced before the
+   command is written, and a send that fails, so that the command was not fully written, reconnects
+   and sends once more.
+
+   Returns an error if the open or socket send fails.
+*/
+
+TPM_RC TSS_Socket_Send(TSS_CONTEXT *tssContext,
+		       const uint8_t *commandBuffer, uint32_t written,
+		       const char *message)
+{
+    TPM_RC 	rc = 0;
 
     /* open on first transmit */
     if (tssContext->tssFirstTransmit) {	
-	/* detect errors before starting, get the server packet type, MS sim or raw */
 	if (rc == 0) {
-	    rc = TSS_Socket_GetServerType(tssContext, &mssim, &rawsingle);
-	}
-	if (rc == 0) {
-	    rc = TSS_Socket_Open(tssContext, tssContext->tssCommandPort);
+	    rc = TSS_Socket_Open(tssContext, tssContext->tssCommandPort,
+				 tssContext->tssCommandPath);
 	}
 	if (rc == 0) {
 	    tssContext->tssFirstTransmit = FALSE;
 	}
     }
+    else if (tssContext->tssSocketKeepalive && TSS_Socket_PeerClosed(tssContext)) {
+	rc = TSS_Socket_Reopen(tssContext);
+    }
+    if ((rc == 0) && tssContext->tssSocketKeepalive) {
+	/* the read buffer is empty between commands */
+	tssContext->tssSocketReadStart = 0;
+	tssContext->tssSocketReadEnd = 0;
+    }
     /* send the command over the socket.  Error if the socket send fails. */
     if (rc == 0) {
 	rc = TSS_Socket_SendCommand(tssContext, commandBuffer, written, message);
     }
+    /* the server closed the keepalive connection before the command was written */
+    if ((rc == TSS_RC_BAD_CONNECTION) && tssContext->tssSocketKeepalive) {
+	rc = TSS_Socket_Reopen(tssContext);
+	if (rc == 0) {
+	    rc = TSS_Socket_SendCommand(tssContext, commandBuffer, written, message);
+	}
+    }
+    return rc;
+}
+
+/* TSS_Socket_Receive() receives the response to a command sent by TSS_Socket_Send().
+
+   It can return socket receive packet errors, but normally returns the TPM response code.
+*/
+
+TPM_RC TSS_Socket_Receive(TSS_CONTEXT *tssContext,
+			  uint8_t *responseBuffer, uint32_t *read)
+{
+    TPM_RC 	rc = 0;
+
     /* receive the response over the socket.  Returns socket errors, malformed response errors.
        Else returns the TPM response code. */
     if (rc == 0) {
 	rc = TSS_Socket_ReceiveCommand(tssContext, responseBuffer, read);
     }
+    /* For rawkeepalive, the command was written, and the server may have run it before closing the
+       connection, so it is not resent.  The next command reconnects. */
+    if ((rc == TSS_RC_BAD_CONNECTION) && tssContext->tssSocketKeepalive) {
+	TSS_Socket_Close(tssContext);
+	tssContext->tssFirstTransmit = TRUE;
+    }
     /* rawsingle flags a close after each command */
-    if (rawsingle) {
+    if (tssContext->tssSocketRawsingle) {
 	TPM_RC rc1;
 	rc1 = TSS_Socket_Close(tssContext);
 	if (rc == 0) {
@@ -185,124 +324,461 @@ TPM_RC TSS_Socket_Transmit(TSS_CONTEXT *tssContext,
     return rc;
 }
 
-/* TSS_Socket_GetServerType() gets the type of server packet format
-
-   Currently, the formats supported are:
-
-   mssim, raw, rawsingle
+/* TSS_Socket_Reopen() replaces a connection that the rawkeepalive server closed with a new
+   connection to the command port.
 
-   mssim TRUE  - the MS simulator packet
-   mssim FALSE - raw TPM specification Part 3 packets
-   rawsingle is the same as mssim FALSE but forces an open and cose for each command
+   If the open fails, the connection is left closed and the next command tries again.
 */
 
-static uint32_t TSS_Socket_GetServerType(TSS_CONTEXT *tssContext,
-					 int *mssim,
-					 int *rawsingle)
+static uint32_t TSS_Socket_Reopen(TSS_CONTEXT *tssContext)
 {
     uint32_t 	rc = 0;
+
+    if (tssVverbose) printf("TSS_Socket_Reopen: Reconnecting %s-%s\n",
+			    tssContext->tssServerName, tssContext->tssServerType);
+    /* the server already closed its end, so a close error is a don't care */
+    TSS_Socket_Close(tssContext);
+    tssContext->tssFirstTransmit = TRUE;
     if (rc == 0) {
-	if ((strcmp(tssContext->tssServerType, "mssim") == 0)) {
-	    *mssim = TRUE;
-	    *rawsingle = FALSE;
-	}
-	else if ((strcmp(tssContext->tssServerType, "raw") == 0)) {
-	    *mssim = FALSE;
-	    *rawsingle = FALSE;
-	}
-	else if ((strcmp(tssContext->tssServerType, "rawsingle") == 0)) {
-	    *mssim = FALSE;
-	    *rawsingle = TRUE;
+	rc = TSS_Socket_Open(tssContext, tssContext->tssCommandPort,
+			     tssContext->tssCommandPath);
+    }
+    if (rc == 0) {
+	tssContext->tssFirstTransmit = FALSE;
+    }
+    return rc;
+}
+
+/* TSS_Socket_PeerClosed() returns TRUE if an idle keepalive connection can no longer carry a
+   command, because the server closed or reset it.  It does not block.
+
+   Bytes waiting on an idle connection would be read as the response to the next command, so that
+   connection is also replaced.
+*/
+
+static int TSS_Socket_PeerClosed(TSS_CONTEXT *tssContext)
+{
+    int		closed = FALSE;
+    char	peek;
+#ifdef TPM_POSIX
+    struct pollfd pfd;
+    int		irc;
+    ssize_t	nread = 0;
+
+    pfd.fd = tssContext->sock_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do {
+	irc = poll(&pfd, 1, 0);
+    } while ((irc < 0) && (errno == EINTR));
+    if ((irc > 0) && ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) != 0)) {
+	nread = recv(tssContext->sock_fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+	/* spurious wakeup, nothing to read */
+	if ((nread < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+	    closed = FALSE;
 	}
 	else {
-	    if (tssVerbose) printf("TSS_Socket_GetServerType: server type %s unsupported\n",
-				   tssContext->tssServerType);
-	    rc = TSS_RC_INSUPPORTED_INTERFACE;	
+	    closed = TRUE;
 	}
     }
+#endif
+#ifdef TPM_WINDOWS
+    fd_set	readfds;
+    struct timeval tv;
+    int		nread = 0;
+
+    FD_ZERO(&readfds);
+    FD_SET(tssContext->sock_fd, &readfds);
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    /* once readable, recv() does not block */
+    if (select(0, &readfds, NULL, NULL, &tv) > 0) {
+	nread = recv(tssContext->sock_fd, &peek, 1, MSG_PEEK);
+	closed = TRUE;
+    }
+#endif
+    if (closed) {
+	if (tssVverbose) printf("TSS_Socket_PeerClosed: Idle connection %s, reconnecting\n",
+				(nread > 0) ? "has unexpected data" : "closed by server");
+    }
+    return closed;
+}
+
+#ifdef TPM_POSIX
+
+/* TSS_Socket_GetFd() returns the socket, which becomes readable when the response is available */
+
+TPM_RC TSS_Socket_GetFd(TSS_CONTEXT *tssContext, int *fd)
+{
+    TPM_RC 	rc = 0;
+
+    if (tssContext->tssFirstTransmit) {
+	rc = TSS_RC_NO_CONNECTION;
+    }
+    else {
+	*fd = tssContext->sock_fd;
+    }
     return rc;
 }
 
-/* TSS_Socket_Open() opens the socket to the TPM Host emulation to tssServerName:port
+#endif	/* TPM_POSIX */
+
+/* TSS_Socket_Open() opens the socket to the TPM Host emulation to tssServerName:port, or to the
+   Unix domain socket path for the socunix interface
 
+   tssServerName is a comma separated list of host names or numeric IPv4 or IPv6 addresses.  Each
+   host is resolved with getaddrinfo() and each of its addresses is tried in turn, waiting at most
+   tssConnectTimeout milliseconds for each, until one connects.  With tssServerRoundRobin, the
+   walk starts at the host after the one used for the previous connection.
 */
 
-static uint32_t TSS_Socket_Open(TSS_CONTEXT *tssContext, short port)
+static uint32_t TSS_Socket_Open(TSS_CONTEXT *tssContext, short port, const char *path)
 {
+    uint32_t		rc = 0;
 #ifdef TPM_WINDOWS 
     WSADATA 		wsaData;
     int			irc;
 #endif
-    struct sockaddr_in 	serv_addr;
-    struct hostent 	*host = NULL;
+    char		service[8];
+    char		host[TSS_SOCKET_HOST_MAX];
+    unsigned int	hostCount;
+    unsigned int	hostIndex;
+    unsigned int	i;
 
+#ifdef TPM_POSIX
+    if (tssContext->tssSocketUnix) {
+	return TSS_Socket_OpenUnix(tssContext, path);
+    }
+#else
+    path = path;
+#endif
     if (tssVverbose) printf("TSS_Socket_Open: Opening %s:%hu-%s\n",
 			    tssContext->tssServerName, port, tssContext->tssServerType);
-    /* create a socket */
 #ifdef TPM_WINDOWS
     if ((irc = WSAStartup(0x202, &wsaData)) != 0) {		/* if not successful */
 	if (tssVerbose) printf("TSS_Socket_Open: Error, WSAStartup failed\n");
 	WSACleanup();
 	return TSS_RC_NO_CONNECTION;
     }
-    if ((tssContext->sock_fd = socket(AF_INET,SOCK_STREAM, 0)) == INVALID_SOCKET) {
-	if (tssVerbose) printf("TSS_Socket_Open: client socket() error: %u\n", tssContext->sock_fd);
-	return TSS_RC_NO_CONNECTION;
+#endif
+    /* discard any bytes buffered from a previous connection */
+    tssContext->tssSocketReadStart = 0;
+    tssContext->tssSocketReadEnd = 0;
+    sprintf(service, "%hu", (unsigned short)port);
+    hostCount = TSS_Socket_HostCount(tssContext->tssServerName);
+    if (tssContext->tssServerRoundRobin) {
+	hostIndex = tssContext->tssServerNext % hostCount;
     }
-#endif 
-#ifdef TPM_POSIX
-    if ((tssContext->sock_fd = socket(AF_INET,SOCK_STREAM, 0)) < 0) {
-	if (tssVerbose) printf("TSS_Socket_Open: client socket error: %d %s\n",
-			       errno,strerror(errno));
+    else {
+	hostIndex = 0;
+    }
+    /* walk the host list once, starting at hostIndex */
+    rc = TSS_RC_NO_CONNECTION;
+    for (i = 0 ; (rc != 0) && (i < hostCount) ; i++) {
+	if (TSS_Socket_HostGet(host, sizeof(host),
+			       tssContext->tssServerName, hostIndex) == 0) {
+	    rc = TSS_Socket_OpenHost(tssContext, host, service);
+	}
+	else {
+	    if (tssVerbose) printf("TSS_Socket_Open: server name error, entry %u too long\n",
+				   hostIndex);
+	}
+	if (rc == 0) {
+	    tssContext->tssServerNext = hostIndex + 1;
+	}
+	else {
+	    hostIndex = (hostIndex + 1) % hostCount;
+	}
+    }
+#ifdef TPM_WINDOWS
+    if (rc != 0) {
+	WSACleanup();
+    }
+#endif
+    return rc;
+}
+
+/* TSS_Socket_HostCount() returns the number of entries in the comma separated host list.  An
+   empty list is one empty entry, which getaddrinfo() rejects.
+*/
+
+static unsigned int TSS_Socket_HostCount(const char *hostList)
+{
+    unsigned int count = 1;
+
+    for ( ; *hostList != '\0' ; hostList++) {
+	if (*hostList == ',') {
+	    count++;
+	}
+    }
+    return count;
+}
+
+/* TSS_Socket_HostGet() copies entry index of the comma separated hostList to host, stripping
+   surrounding white space and the brackets that may surround an IPv6 address.
+
+   Returns non-zero if the entry does not fit in hostSize.
+*/
+
+static int TSS_Socket_HostGet(char *host, size_t hostSize,
+			      const char *hostList, unsigned int index)
+{
+    const char 	*start = hostList;
+    const char 	*end;
+
+    for ( ; index > 0 ; index--) {
+	start = strchr(start, ',') + 1;
+    }
+    end = strchr(start, ',');
+    if (end == NULL) {
+	end = start + strlen(start);
+    }
+    while ((start < end) && ((*start == ' ') || (*start == '\t'))) {
+	start++;
+    }
+    while ((end > start) && ((*(end-1) == ' ') || (*(end-1) == '\t'))) {
+	end--;
+    }
+    if ((end - start >= 2) && (*start == '[') && (*(end-1) == ']')) {
+	start++;
+	end--;
+    }
+    if ((size_t)(end - start) >= hostSize) {
+	return 1;
+    }
+    memcpy(host, start, end - start);
+    host[end - start] = '\0';
+    return 0;
+}
+
+/* TSS_Socket_OpenHost() resolves host:service and connects to the first address that answers.
+
+   On success, the connected socket is in tssContext->sock_fd.
+*/
+
+static uint32_t TSS_Socket_OpenHost(TSS_CONTEXT *tssContext, const char *host, const char *service)
+{
+    uint32_t		rc = TSS_RC_NO_CONNECTION;
+    int			irc;
+    struct addrinfo 	hints;
+    struct addrinfo 	*addrList = NULL;
+    struct addrinfo 	*addr;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;		/* IPv4 or IPv6 */
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;		/* only address families configured on this host */
+    irc = getaddrinfo(host, service, &hints, &addrList);
+    if (irc != 0) {
+	if (tssVerbose) printf("TSS_Socket_Open: server name error, name %s, %s\n",
+			       host, gai_strerror(irc));
 	return TSS_RC_NO_CONNECTION;
     }
+    for (addr = addrList ; (rc != 0) && (addr != NULL) ; addr = addr->ai_next) {
+	tssContext->sock_fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+#ifdef TPM_WINDOWS
+	if (tssContext->sock_fd == INVALID_SOCKET) {
+	    if (tssVerbose) printf("TSS_Socket_Open: client socket() error: %d\n",
+				   WSAGetLastError());
+	    continue;
+	}
 #endif
-    memset((char *)&serv_addr,0x0,sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-
-    /* the server host name tssServerName came from the default or an environment variable */
-    /* first assume server is dotted decimal number and call inet_addr */
-    if ((int)(serv_addr.sin_addr.s_addr = inet_addr(tssContext->tssServerName)) == -1) {
-	/* if inet_addr fails, assume server is a name and call gethostbyname to look it up */
-	/* if gethostbyname also fails */
-	if ((host = gethostbyname(tssContext->tssServerName)) == NULL) {
-	    if (tssVerbose) printf("TSS_Socket_Open: server name error, name %s\n",
-				   tssContext->tssServerName);
-	    return TSS_RC_NO_CONNECTION;
-	}
-	serv_addr.sin_family = host->h_addrtype;
-	memcpy(&serv_addr.sin_addr, host->h_addr, host->h_length);
-    }
-    /* establish the connection to the TPM server */
 #ifdef TPM_POSIX
-    if (connect(tssContext->sock_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-	if (tssVerbose) printf("TSS_Socket_Open: Error on connect to %s:%u\n",
-			       tssContext->tssServerName, port);
+	if (tssContext->sock_fd < 0) {
+	    if (tssVerbose) printf("TSS_Socket_Open: client socket error: %d %s\n",
+				   errno,strerror(errno));
+	    continue;
+	}
+#endif
+	/* the command and response are each one write, so send immediately rather than waiting
+	   to coalesce with the next write.  A failure only costs latency. */
+	{
+	    int nodelay = 1;
+	    if (setsockopt(tssContext->sock_fd, IPPROTO_TCP, TCP_NODELAY,
+			   (const char *)&nodelay, sizeof(nodelay)) != 0) {
+		if (tssVerbose) printf("TSS_Socket_Open: Warning, TCP_NODELAY not set\n");
+	    }
+	}
+	/* establish the connection to the TPM server */
+	rc = TSS_Socket_Connect(tssContext, addr->ai_addr, (int)addr->ai_addrlen);
+	if (rc != 0) {
+	    if (tssVerbose) printf("TSS_Socket_Open: Error on connect to %s:%s\n",
+				   host, service);
+#ifdef TPM_POSIX
+	    close(tssContext->sock_fd);
+#endif
+#ifdef TPM_WINDOWS
+	    closesocket(tssContext->sock_fd);
+#endif
+	}
+    }
+    freeaddrinfo(addrList);
+    return rc;
+}
+
+/* TSS_Socket_Connect() connects tssContext->sock_fd to addr.
+
+   If tssConnectTimeout is non-zero, the connect is non-blocking and fails if it does not complete
+   within tssConnectTimeout milliseconds, so that an unreachable host does not stall the caller for
+   the system TCP timeout.  The socket is returned to blocking mode for the command I/O.
+*/
+
+static uint32_t TSS_Socket_Connect(TSS_CONTEXT *tssContext,
+				   const struct sockaddr *addr, int addrlen)
+{
+    unsigned int timeout = tssContext->tssConnectTimeout;
+#ifdef TPM_POSIX
+    int		flags = 0;
+    int		irc;
+    int		err = 0;
+    socklen_t	errlen = sizeof(err);
+
+    if (timeout != 0) {
+	flags = fcntl(tssContext->sock_fd, F_GETFL, 0);
+	if ((flags < 0) ||
+	    (fcntl(tssContext->sock_fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+	    if (tssVerbose) printf("TSS_Socket_Open: Warning, connect timeout not set\n");
+	    timeout = 0;
+	}
+    }
+    irc = connect(tssContext->sock_fd, addr, addrlen);
+    if (irc < 0) {
+	err = errno;
+    }
+    if ((irc < 0) && (timeout != 0) && (err == EINPROGRESS)) {
+	struct pollfd pfd;
+	pfd.fd = tssContext->sock_fd;
+	pfd.events = POLLOUT;
+	do {
+	    irc = poll(&pfd, 1, (int)timeout);
+	} while ((irc < 0) && (errno == EINTR));
+	if (irc == 0) {
+	    err = ETIMEDOUT;
+	    irc = -1;
+	}
+	else if (irc < 0) {
+	    err = errno;
+	}
+	/* the connect completed, get its result */
+	else if (getsockopt(tssContext->sock_fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0) {
+	    err = errno;
+	    irc = -1;
+	}
+	else if (err != 0) {
+	    irc = -1;
+	}
+	else {
+	    irc = 0;
+	}
+    }
+    if ((irc == 0) && (timeout != 0)) {
+	if (fcntl(tssContext->sock_fd, F_SETFL, flags) < 0) {
+	    err = errno;
+	    irc = -1;
+	}
+    }
+    if (irc < 0) {
 	if (tssVerbose) printf("TSS_Socket_Open: client connect: error %d %s\n",
-			       errno,strerror(errno));
+			       err, strerror(err));
 	return TSS_RC_NO_CONNECTION;
     }
 #endif
 #ifdef TPM_WINDOWS
-    if (connect(tssContext->sock_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) != 0) {
-	if (tssVerbose) {
-	    int err;
-	    printf("TSS_Socket_Open: Error on connect to %s:%u\n",
-			       tssContext->tssServerName, port);
+    u_long	nonblocking = 1;
+    int		irc;
+    int		err = 0;
+
+    if (timeout != 0) {
+	if (ioctlsocket(tssContext->sock_fd, FIONBIO, &nonblocking) != 0) {
+	    if (tssVerbose) printf("TSS_Socket_Open: Warning, connect timeout not set\n");
+	    timeout = 0;
+	}
+    }
+    irc = connect(tssContext->sock_fd, addr, addrlen);
+    if (irc != 0) {
+	err = WSAGetLastError();
+    }
+    if ((irc != 0) && (timeout != 0) && (err == WSAEWOULDBLOCK)) {
+	fd_set		writefds;
+	fd_set		exceptfds;
+	struct timeval	tv;
+	FD_ZERO(&writefds);
+	FD_ZERO(&exceptfds);
+	FD_SET(tssContext->sock_fd, &writefds);
+	FD_SET(tssContext->sock_fd, &exceptfds);
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	irc = select(0, NULL, &writefds, &exceptfds, &tv);
+	if (irc == 0) {
+	    err = WSAETIMEDOUT;
+	    irc = SOCKET_ERROR;
+	}
+	else if ((irc == SOCKET_ERROR) || FD_ISSET(tssContext->sock_fd, &exceptfds)) {
+	    err = WSAECONNREFUSED;
+	    irc = SOCKET_ERROR;
+	}
+	else {
+	    irc = 0;
+	}
+    }
+    if ((irc == 0) && (timeout != 0)) {
+	nonblocking = 0;
+	if (ioctlsocket(tssContext->sock_fd, FIONBIO, &nonblocking) != 0) {
 	    err = WSAGetLastError();
+	    irc = SOCKET_ERROR;
+	}
+    }
+    if (irc != 0) {
+	if (tssVerbose) {
 	    printf("TSS_Socket_Open: client connect: error %d\n", err);
 	    TSS_Socket_PrintError(err);
 	}
 	return TSS_RC_NO_CONNECTION;
     }
 #endif
-    else {
-	/*  	printf("TSS_Socket_Open: client connect: success\n"); */
+    return 0;
+}
+
+#ifdef TPM_POSIX
+
+/* TSS_Socket_OpenUnix() opens the Unix domain socket to a co-located TPM Host emulation at path.
+
+   There is no Nagle algorithm on a Unix domain socket, so the socket options are not changed.
+*/
+
+static uint32_t TSS_Socket_OpenUnix(TSS_CONTEXT *tssContext, const char *path)
+{
+    struct sockaddr_un 	serv_addr;
+
+    if (tssVverbose) printf("TSS_Socket_OpenUnix: Opening %s-%s\n",
+			    path, tssContext->tssServerType);
+    memset((char *)&serv_addr, 0x0, sizeof(serv_addr));
+    serv_addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(serv_addr.sun_path)) {
+	if (tssVerbose) printf("TSS_Socket_OpenUnix: Error, path %s too long\n", path);
+	return TSS_RC_NO_CONNECTION;
+    }
+    strcpy(serv_addr.sun_path, path);
+    if ((tssContext->sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+	if (tssVerbose) printf("TSS_Socket_OpenUnix: client socket error: %d %s\n",
+			       errno,strerror(errno));
+	return TSS_RC_NO_CONNECTION;
+    }
+    /* discard any bytes buffered from a previous connection */
+    tssContext->tssSocketReadStart = 0;
+    tssContext->tssSocketReadEnd = 0;
+    if (connect(tssContext->sock_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+	if (tssVerbose) printf("TSS_Socket_OpenUnix: Error on connect to %s\n", path);
+	if (tssVerbose) printf("TSS_Socket_OpenUnix: client connect: error %d %s\n",
+			       errno,strerror(errno));
+	close(tssContext->sock_fd);
+	return TSS_RC_NO_CONNECTION;
     }
     return 0;
 }
 
+#endif	/* TPM_POSIX */
+
 /* TSS_Socket_SendCommand() sends the TPM command packet over the socket.
 
    The MS simulator packet is of the form:
@@ -312,6 +788,9 @@ static uint32_t TSS_Socket_Open(TSS_CONTEXT *tssContext, short port)
    length
    TPM command packet	(this is the raw packet format)
 
+   The MS simulator packet is built in one buffer and sent with one write, so that the header is
+   not held back by the Nagle algorithm waiting for the acknowledgement of the previous segment.
+
    Returns an error if the socket send fails.
 */
 
@@ -320,9 +799,8 @@ static uint32_t TSS_Socket_SendCommand(TSS_CONTEXT *tssContext,
 				       const char *message)
 {
     uint32_t 	rc = 0;
-    int 	mssim;	/* boolean, true for MS simulator packet format, false for raw packet
-			   format */
-    int 	rawsingle;
+    int 	mssim = tssContext->tssSocketMssim;	/* boolean, true for MS simulator packet
+							   format, false for raw packet format */
     
     if (message != NULL) {
 	if (tssVverbose) printf("TSS_Socket_SendCommand: %s\n", message);
@@ -332,25 +810,27 @@ static uint32_t TSS_Socket_SendCommand(TSS_CONTEXT *tssContext,
 	TSS_PrintAll("TSS_Socket_SendCommand",
 		     buffer, length);
     }
-    /* get the server packet type, MS sim or raw */
     if (rc == 0) {
-	rc = TSS_Socket_GetServerType(tssContext, &mssim, &rawsingle);
+	if (length > MAX_COMMAND_SIZE) {
+	    if (tssVerbose) printf("TSS_Socket_SendCommand: Error, length %u greater than %u\n",
+				   length, MAX_COMMAND_SIZE);
+	    rc = TSS_RC_INSUFFICIENT_BUFFER;
+	}
     }
-    /* MS simulator wants a command type, locality, length */
+    /* MS simulator wants a command type, locality, length, then the TPM command packet */
     if ((rc == 0) && mssim) {
+	uint8_t  frame[TSS_SOCKET_HEADER_SIZE + MAX_COMMAND_SIZE];
 	uint32_t commandType = htonl(TPM_SEND_COMMAND);	/* command type is network byte order */
-	rc = TSS_Socket_SendBytes(tssContext->sock_fd, (uint8_t *)&commandType, sizeof(uint32_t));
-    }
-    if ((rc == 0) && mssim) {
-	uint8_t locality = 0;
-	rc = TSS_Socket_SendBytes(tssContext->sock_fd, &locality, sizeof(uint8_t));
-    }
-    if ((rc == 0) && mssim) {
-	uint32_t lengthNbo = htonl(length);	/* length is network byte order */
-	rc = TSS_Socket_SendBytes(tssContext->sock_fd, (uint8_t *)&lengthNbo, sizeof(uint32_t));
+	uint32_t lengthNbo = htonl(length);		/* length is network byte order */
+
+	memcpy(frame, &commandType, sizeof(uint32_t));
+	frame[sizeof(uint32_t)] = 0;			/* locality 0 */
+	memcpy(frame + sizeof(uint32_t) + sizeof(uint8_t), &lengthNbo, sizeof(uint32_t));
+	memcpy(frame + TSS_SOCKET_HEADER_SIZE, buffer, length);
+	rc = TSS_Socket_SendBytes(tssContext->sock_fd, frame, TSS_SOCKET_HEADER_SIZE + length);
     }
-    /* all packet formats (types) send the TPM command packet */
-    if (rc == 0) {
+    /* the raw packet format is just the TPM command packet */
+    else if (rc == 0) {
 	rc = TSS_Socket_SendBytes(tssContext->sock_fd, buffer, length);
     }
     return rc;
@@ -394,7 +874,7 @@ static uint32_t TSS_Socket_SendBytes(TSS_SOCKET_FD sock_fd, const uint8_t *buffe
     nleft = length;
     while (nleft > 0) {
 #ifdef TPM_POSIX
-	nwritten = write(sock_fd, &buffer[offset], nleft);
+	nwritten = send(sock_fd, &buffer[offset], nleft, TSS_SOCKET_SEND_FLAGS);
 	if (nwritten < 0) {        /* error */
 	    if (tssVerbose) printf("TSS_Socket_SendBytes: write error %d\n", (int)nwritten);
 	    return TSS_RC_BAD_CONNECTION;
@@ -437,24 +917,19 @@ static uint32_t TSS_Socket_ReceiveCommand(TSS_CONTEXT *tssContext,
     uint8_t 	*bufferPtr = buffer;	/* the moving buffer */
     TPM_RC 	responseCode;
     uint32_t 	size;		/* dummy for unmarshal call */
-    int 	mssim;		/* boolean, true for MS simulator packet format, false for raw
-				   packet format */
-    int		rawsingle;
+    int 	mssim = tssContext->tssSocketMssim;	/* boolean, true for MS simulator packet
+							   format, false for raw packet format */
     TPM_RC 	acknowledgement;	/* MS sim acknowledgement */
     
-    /* get the server packet type, MS sim or raw */
-    if (rc == 0) {
-	rc = TSS_Socket_GetServerType(tssContext, &mssim, &rawsingle);
-    }
     /* read the length prepended by the simulator */
     if ((rc == 0) && mssim) {
-	rc = TSS_Socket_ReceiveBytes(tssContext->sock_fd,
+	rc = TSS_Socket_ReceiveBytes(tssContext,
 				     (uint8_t *)&responseLength, sizeof(uint32_t));
 	responseLength = ntohl(responseLength);
     }
     /* read the tag and responseSize */
     if (rc == 0) {
-	rc = TSS_Socket_ReceiveBytes(tssContext->sock_fd,
+	rc = TSS_Socket_ReceiveBytes(tssContext,
 				     bufferPtr, sizeof(TPM_ST) + sizeof(uint32_t));
     }
     /* extract the responseSize */
@@ -484,7 +959,7 @@ static uint32_t TSS_Socket_ReceiveCommand(TSS_CONTEXT *tssContext,
     }
     /* read the rest of the packet */
     if (rc == 0) {
-	rc = TSS_Socket_ReceiveBytes(tssContext->sock_fd,
+	rc = TSS_Socket_ReceiveBytes(tssContext,
 				     bufferPtr,
 				     responseSize - (sizeof(TPM_ST) + sizeof(uint32_t)));
     }
@@ -494,7 +969,7 @@ static uint32_t TSS_Socket_ReceiveCommand(TSS_CONTEXT *tssContext,
     }
     /* read the MS sim acknowledgement */
     if ((rc == 0) && mssim) {
-	rc = TSS_Socket_ReceiveBytes(tssContext->sock_fd,
+	rc = TSS_Socket_ReceiveBytes(tssContext,
 				     (uint8_t *)&acknowledgement, sizeof(uint32_t));
     }
     /* extract the TPM return code from the packet */
@@ -522,14 +997,14 @@ static uint32_t TSS_Socket_ReceiveCommand(TSS_CONTEXT *tssContext,
 
 */
 
-static uint32_t TSS_Socket_ReceivePlatform(TSS_SOCKET_FD sock_fd)
+static uint32_t TSS_Socket_ReceivePlatform(TSS_CONTEXT *tssContext)
 {
     uint32_t 	rc = 0;
     TPM_RC 	acknowledgement;
     
     /* read the MS sim acknowledgement */
     if (rc == 0) {
-	rc = TSS_Socket_ReceiveBytes(sock_fd, (uint8_t *)&acknowledgement, sizeof(uint32_t));
+	rc = TSS_Socket_ReceiveBytes(tssContext, (uint8_t *)&acknowledgement, sizeof(uint32_t));
     }
     /* if there is no other error, return the MS simulator packet acknowledgement */
     if (rc == 0) {
@@ -541,21 +1016,50 @@ static uint32_t TSS_Socket_ReceivePlatform(TSS_SOCKET_FD sock_fd)
 /* TSS_Socket_ReceiveBytes() is the low level receive function that reads the buffer over the
    socket.  'buffer' must be atleast 'nbytes'. 
 
+   Reads go through the context read buffer, so that the MS simulator length, response packet, and
+   acknowledgement typically take one system call rather than four.  A request at least as large as
+   the read buffer reads directly into 'buffer'.  The TPM sends nothing unsolicited, so the read
+   buffer is empty between commands.
+
    It handles partial reads by looping.
 
 */
 
-static uint32_t TSS_Socket_ReceiveBytes(TSS_SOCKET_FD sock_fd,
+static uint32_t TSS_Socket_ReceiveBytes(TSS_CONTEXT *tssContext,
 					uint8_t *buffer,  
 					uint32_t nbytes)
 {
     int nread = 0;
-    int nleft = 0;
+    uint32_t nleft = 0;
+    uint32_t ncopy = 0;
+    uint8_t *readBuffer;
+    uint32_t readSize;
 
     nleft = nbytes;
     while (nleft > 0) {
+	/* first consume any buffered bytes */
+	if (tssContext->tssSocketReadStart < tssContext->tssSocketReadEnd) {
+	    ncopy = tssContext->tssSocketReadEnd - tssContext->tssSocketReadStart;
+	    if (ncopy > nleft) {
+		ncopy = nleft;
+	    }
+	    memcpy(buffer, tssContext->tssSocketReadBuffer + tssContext->tssSocketReadStart, ncopy);
+	    tssContext->tssSocketReadStart += ncopy;
+	    nleft -= ncopy;
+	    buffer += ncopy;
+	    continue;
+	}
+	/* a large request reads directly, a small one refills the read buffer */
+	if (nleft >= sizeof(tssContext->tssSocketReadBuffer)) {
+	    readBuffer = buffer;
+	    readSize = nleft;
+	}
+	else {
+	    readBuffer = tssContext->tssSocketReadBuffer;
+	    readSize = sizeof(tssContext->tssSocketReadBuffer);
+	}
 #ifdef TPM_POSIX
-	nread = read(sock_fd, buffer, nleft);
+	nread = read(tssContext->sock_fd, readBuffer, readSize);
 	if (nread < 0) {       /* error */
 	    if (tssVerbose)  printf("TSS_Socket_ReceiveBytes: read error %d\n", nread);
 	    return TSS_RC_BAD_CONNECTION;
@@ -563,7 +1067,7 @@ static uint32_t TSS_Socket_ReceiveBytes(TSS_SOCKET_FD sock_fd,
 #endif
 #ifdef TPM_WINDOWS
 	/* cast for winsock.  Unix uses void * */
-	nread = recv(sock_fd, (char *)buffer, nleft, 0);
+	nread = recv(tssContext->sock_fd, (char *)readBuffer, readSize, 0);
 	if (nread == SOCKET_ERROR) {       /* error */
 	    if (tssVerbose) printf("TSS_Socket_ReceiveBytes: read error %d\n", nread);
 	    return TSS_RC_BAD_CONNECTION;
@@ -573,13 +1077,19 @@ static uint32_t TSS_Socket_ReceiveBytes(TSS_SOCKET_FD sock_fd,
 	    if (tssVerbose) printf("TSS_Socket_ReceiveBytes: read EOF\n");
 	    return TSS_RC_BAD_CONNECTION;
 	}
-	nleft -= nread;
-	buffer += nread;
+	if (readBuffer == buffer) {
+	    nleft -= nread;
+	    buffer += nread;
+	}
+	else {
+	    tssContext->tssSocketReadStart = 0;
+	    tssContext->tssSocketReadEnd = nread;
+	}
     }
     return 0;
 }
 
-/* TSS_Socket_Close() closes the socket.
+/* TSS_Socket_Close() closes the socket, if it is open.
 
    It sends the TPM_SESSION_END required by the MS simulator.
 
@@ -588,18 +1098,18 @@ static uint32_t TSS_Socket_ReceiveBytes(TSS_SOCKET_FD sock_fd,
 TPM_RC TSS_Socket_Close(TSS_CONTEXT *tssContext)
 {
     uint32_t 	rc = 0;
-    int 	mssim;	/* boolean, true for MS simulator packet format, false for raw packet
-			   format */
-    int		rawsingle = TRUE;	/* boolean, true for raw format with an open and close per
-					   command.  Initialized to suppress false gcc -O3
-					   warning. */
-    
+    int 	mssim = tssContext->tssSocketMssim;	/* boolean, true for MS simulator packet
+							   format, false for raw packet format */
+    int		rawsingle = tssContext->tssSocketRawsingle;	/* boolean, true for raw format
+								   with an open and close per
+								   command */
+
+    /* only close if there was an open */
+    if (tssContext->tssFirstTransmit) {
+	return rc;
+    }
     if (tssVverbose) printf("TSS_Socket_Close: Closing %s-%s\n",
 			    tssContext->tssServerName, tssContext->tssServerType);
-    /* get the server packet type, MS sim or raw */
-    if (rc == 0) {
-	rc = TSS_Socket_GetServerType(tssContext, &mssim, &rawsingle);
-    }
     /* the MS simulator expects a TPM_SESSION_END command before close */
     if ((rc == 0) && mssim) {
 	uint32_t commandType = htonl(TPM_SESSION_END);
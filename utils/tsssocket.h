@@ -50,12 +50,24 @@
 extern "C" {
 #endif
 
+    TPM_RC TSS_Socket_Select(TSS_CONTEXT *tssContext);
+#ifdef TPM_POSIX
+    TPM_RC TSS_Socket_SelectUnix(TSS_CONTEXT *tssContext);
+#endif
     TPM_RC TSS_Socket_TransmitPlatform(TSS_CONTEXT *tssContext,
 				       uint32_t command, const char *message);
     TPM_RC TSS_Socket_Transmit(TSS_CONTEXT *tssContext,
 			       uint8_t *responseBuffer, uint32_t *read,
 			       const uint8_t *commandBuffer, uint32_t written,
 			       const char *message);
+    TPM_RC TSS_Socket_Send(TSS_CONTEXT *tssContext,
+			   const uint8_t *commandBuffer, uint32_t written,
+			   const char *message);
+    TPM_RC TSS_Socket_Receive(TSS_CONTEXT *tssContext,
+			      uint8_t *responseBuffer, uint32_t *read);
+#ifdef TPM_POSIX
+    TPM_RC TSS_Socket_GetFd(TSS_CONTEXT *tssContext, int *fd);
+#endif
     TPM_RC TSS_Socket_Close(TSS_CONTEXT *tssContext);
 
 #ifdef __cplusplus
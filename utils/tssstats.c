@@ -0,0 +1,564 @@
+/********************************************************************************/
+/*										*/
+/*			     TSS Execute Statistics				*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* This file times the phases of TSS_Execute() and accumulates the times into per command code
+   histograms held in the TSS context.  See ibmtss/tssstats.h for the phases and the file format.
+
+   Timing is enabled by the TPM_STATS property, or by TPM_STATS_FILE, which also writes the
+   histograms at TSS_Delete().  When disabled, the cost is a NULL test per phase.
+
+   TSS_Execute() brackets the command with TSS_Stats_CommandStart() and TSS_Stats_CommandEnd().
+   The split interface starts the command in TSS_Execute_Prepare() and ends it in
+   TSS_Execute_Complete(), so the total includes the caller's time between the phases.  Phases
+   that run more than once, such as a command retried after a TPM warning, are summed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef TPM_WINDOWS
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include <ibmtss/tsserror.h>
+#include <ibmtss/tssutils.h>
+#include <ibmtss/tssstats.h>
+
+#include "tssproperties.h"
+
+/* values below this have a bucket each */
+#define TSS_HISTOGRAM_LINEAR	(2 << TSS_HISTOGRAM_SUB_BITS)
+
+#ifdef TSS_HAVE_STATS
+
+/* the statistics state */
+
+typedef struct TSS_STATS {
+    TSS_COMMAND_STATS 	*commands;
+    size_t 		count;
+    size_t 		allocated;
+    /* the command in progress */
+    TPM_CC 		commandCode;
+    uint64_t 		commandStart;	/* nsec, 0 when no command is in progress */
+    uint64_t 		phaseNsec[TSS_PHASE_COUNT];
+    unsigned int 	phaseRan;	/* bit mask of the timed phases */
+} TSS_STATS;
+
+/* the initial size of the command code array */
+#define TSS_STATS_COMMANDS_INITIAL	16
+
+/* local prototypes */
+
+static uint64_t TSS_Stats_Now(void);
+static TPM_RC TSS_Stats_Find(TSS_STATS *stats,
+			     TSS_COMMAND_STATS **command,
+			     TPM_CC commandCode);
+static void TSS_Stats_Write(TSS_STATS *stats, const char *filename);
+static uint8_t *TSS_Stats_PutUint32(uint8_t *buffer, uint32_t value);
+static uint8_t *TSS_Stats_PutUint64(uint8_t *buffer, uint64_t value);
+
+#endif	/* TSS_HAVE_STATS */
+
+static unsigned int TSS_Histogram_Index(uint64_t nsec);
+static uint64_t TSS_Histogram_BucketValue(unsigned int index);
+
+#ifdef TSS_HAVE_STATS
+
+/* TSS_Stats_CommandStart() starts timing commandCode.  The statistics state is allocated at the
+   first command.  An allocation failure is not a command failure.  The command is not timed.
+*/
+
+void TSS_Stats_CommandStart(TSS_CONTEXT *tssContext, TPM_CC commandCode)
+{
+    TPM_RC	rc = 0;
+    TSS_STATS	*stats;
+
+    if (!tssContext->tssStatsEnable && (tssContext->tssStatsFile == NULL)) {
+	return;
+    }
+    if (tssContext->tssStats == NULL) {
+	rc = TSS_Malloc((unsigned char **)&tssContext->tssStats,	/* freed by
+									   TSS_Stats_Close() */
+			sizeof(TSS_STATS));
+	if (rc != 0) {
+	    if (tssVerbose) printf("TSS_Stats_CommandStart: Error allocating statistics\n");
+	    return;
+	}
+	memset(tssContext->tssStats, 0, sizeof(TSS_STATS));
+    }
+    stats = tssContext->tssStats;
+    stats->commandCode = commandCode;
+    memset(stats->phaseNsec, 0, sizeof(stats->phaseNsec));
+    stats->phaseRan = 0;
+    stats->commandStart = TSS_Stats_Now();
+    return;
+}
+
+/* TSS_Stats_CommandEnd() records the phase times and the total time of the command in progress.
+   Only the phases that ran are recorded. */
+
+void TSS_Stats_CommandEnd(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+    TSS_STATS		*stats = tssContext->tssStats;
+    TSS_COMMAND_STATS	*command = NULL;
+    uint64_t 		totalNsec;
+    unsigned int 	phase;
+
+    if ((stats == NULL) || (stats->commandStart == 0)) {
+	return;
+    }
+    totalNsec = TSS_Stats_Now() - stats->commandStart;
+    stats->commandStart = 0;
+    if (rc == 0) {
+	rc = TSS_Stats_Find(stats, &command, stats->commandCode);
+    }
+    if (rc == 0) {
+	for (phase = 0 ; phase < TSS_PHASE_TOTAL ; phase++) {
+	    if (stats->phaseRan & (1U << phase)) {
+		TSS_Histogram_Record(&command->phases[phase], stats->phaseNsec[phase]);
+	    }
+	}
+	TSS_Histogram_Record(&command->phases[TSS_PHASE_TOTAL], totalNsec);
+    }
+    return;
+}
+
+/* TSS_Stats_Start() returns the start time of a phase, or 0 if the command is not being timed */
+
+uint64_t TSS_Stats_Start(TSS_CONTEXT *tssContext)
+{
+    if ((tssContext->tssStats == NULL) || (tssContext->tssStats->commandStart == 0)) {
+	return 0;
+    }
+    return TSS_Stats_Now();
+}
+
+/* TSS_Stats_End() adds the time since 'start', from TSS_Stats_Start(), to 'phase' of the command
+   in progress. */
+
+void TSS_Stats_End(TSS_CONTEXT *tssContext, unsigned int phase, uint64_t start)
+{
+    TSS_STATS	*stats = tssContext->tssStats;
+
+    if ((start == 0) || (stats == NULL) || (phase >= TSS_PHASE_TOTAL)) {
+	return;
+    }
+    stats->phaseNsec[phase] += TSS_Stats_Now() - start;
+    stats->phaseRan |= 1U << phase;
+    return;
+}
+
+/* TSS_Stats_Close() appends the histograms to the TPM_STATS_FILE, if set, and frees the
+   statistics state.  It is called by TSS_Delete(). */
+
+void TSS_Stats_Close(TSS_CONTEXT *tssContext)
+{
+    TSS_STATS	*stats = tssContext->tssStats;
+
+    if (stats == NULL) {
+	return;
+    }
+    if ((tssContext->tssStatsFile != NULL) && (stats->count != 0)) {
+	TSS_Stats_Write(stats, tssContext->tssStatsFile);
+    }
+    free(stats->commands);
+    free(stats);
+    tssContext->tssStats = NULL;
+    return;
+}
+
+/* TSS_Stats_Snapshot() returns a copy of the histograms of each command code timed since the
+   context was created or TSS_Stats_Reset().  'stats' is NULL and 'count' is 0 if none were
+   timed.
+*/
+
+TPM_RC TSS_Stats_Snapshot(TSS_CONTEXT *tssContext,
+			  TSS_COMMAND_STATS **stats,	/* freed by caller */
+			  size_t *count)
+{
+    TPM_RC	rc = 0;
+    TSS_STATS	*state = tssContext->tssStats;
+
+    *stats = NULL;
+    *count = 0;
+    if ((state == NULL) || (state->count == 0)) {
+	return rc;
+    }
+    if (rc == 0) {
+	*stats = malloc(state->count * sizeof(TSS_COMMAND_STATS));	/* freed by caller */
+	if (*stats == NULL) {
+	    if (tssVerbose) printf("TSS_Stats_Snapshot: Error allocating %lu command codes\n",
+				   (unsigned long)state->count);
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	memcpy(*stats, state->commands, state->count * sizeof(TSS_COMMAND_STATS));
+	*count = state->count;
+    }
+    return rc;
+}
+
+/* TSS_Stats_Reset() discards the histograms.  A command in progress is still recorded when it
+   completes. */
+
+TPM_RC TSS_Stats_Reset(TSS_CONTEXT *tssContext)
+{
+    TPM_RC	rc = 0;
+
+    if (tssContext->tssStats != NULL) {
+	tssContext->tssStats->count = 0;
+    }
+    return rc;
+}
+
+/* TSS_Stats_Now() returns a monotonic time in nsec */
+
+static uint64_t TSS_Stats_Now(void)
+{
+#ifdef TPM_POSIX
+    struct timespec 	now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+#else
+    LARGE_INTEGER 	now;
+    LARGE_INTEGER 	frequency;
+
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+#endif
+}
+
+/* TSS_Stats_Find() returns the histograms for commandCode, adding an entry if needed.  There are
+   at most a few hundred command codes, so the search is linear. */
+
+static TPM_RC TSS_Stats_Find(TSS_STATS *stats,
+			     TSS_COMMAND_STATS **command,
+			     TPM_CC commandCode)
+{
+    TPM_RC	rc = 0;
+    size_t		i;
+    size_t		allocated;
+    TSS_COMMAND_STATS	*commands;
+
+    for (i = 0 ; i < stats->count ; i++) {
+	if (stats->commands[i].commandCode == commandCode) {
+	    *command = &stats->commands[i];
+	    return rc;
+	}
+    }
+    if (stats->count == stats->allocated) {
+	if (stats->allocated == 0) {
+	    allocated = TSS_STATS_COMMANDS_INITIAL;
+	}
+	else {
+	    allocated = stats->allocated * 2;
+	}
+	/* not TSS_Realloc(), which limits the size to that of a TPM structure */
+	commands = realloc(stats->commands,		/* freed by TSS_Stats_Close() */
+			   allocated * sizeof(TSS_COMMAND_STATS));
+	if (commands != NULL) {
+	    stats->commands = commands;
+	    stats->allocated = allocated;
+	}
+	else {
+	    if (tssVerbose) printf("TSS_Stats_Find: Error allocating %lu command codes\n",
+				   (unsigned long)allocated);
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	*command = &stats->commands[stats->count];
+	memset(*command, 0, sizeof(TSS_COMMAND_STATS));
+	(*command)->commandCode = commandCode;
+	stats->count++;
+    }
+    return rc;
+}
+
+/* TSS_Stats_Write() appends a record to the statistics file.  Errors are traced but not
+   returned, since TSS_Delete() cannot act on them. */
+
+static void TSS_Stats_Write(TSS_STATS *stats, const char *filename)
+{
+    FILE 		*file = NULL;
+    /* histogram header plus every bucket */
+    uint8_t 		buffer[(8 * sizeof(uint32_t)) + (4 * sizeof(uint64_t)) +
+			       (TSS_HISTOGRAM_BUCKETS * 2 * sizeof(uint32_t))];
+    uint8_t 		*next;
+    uint8_t 		*bucketCount;
+    uint32_t 		histograms = 0;
+    uint32_t 		buckets;
+    size_t 		i;
+    unsigned int 	phase;
+    unsigned int 	b;
+    const TSS_HISTOGRAM *histogram;
+    int 		irc = 0;
+
+    for (i = 0 ; i < stats->count ; i++) {
+	for (phase = 0 ; phase < TSS_PHASE_COUNT ; phase++) {
+	    if (stats->commands[i].phases[phase].count != 0) {
+		histograms++;
+	    }
+	}
+    }
+    file = fopen(filename, "ab");
+    if (file == NULL) {
+	if (tssVerbose) printf("TSS_Stats_Write: Error opening %s\n", filename);
+	return;
+    }
+    next = TSS_Stats_PutUint32(buffer, TSS_STATS_MAGIC);
+    next = TSS_Stats_PutUint32(next, TSS_STATS_VERSION);
+    next = TSS_Stats_PutUint32(next, histograms);
+    if (fwrite(buffer, 1, next - buffer, file) != (size_t)(next - buffer)) {
+	irc = -1;
+    }
+    for (i = 0 ; (irc == 0) && (i < stats->count) ; i++) {
+	for (phase = 0 ; (irc == 0) && (phase < TSS_PHASE_COUNT) ; phase++) {
+	    histogram = &stats->commands[i].phases[phase];
+	    if (histogram->count == 0) {
+		continue;
+	    }
+	    next = TSS_Stats_PutUint32(buffer, stats->commands[i].commandCode);
+	    next = TSS_Stats_PutUint32(next, phase);
+	    next = TSS_Stats_PutUint64(next, histogram->count);
+	    next = TSS_Stats_PutUint64(next, histogram->totalNsec);
+	    next = TSS_Stats_PutUint64(next, histogram->minNsec);
+	    next = TSS_Stats_PutUint64(next, histogram->maxNsec);
+	    bucketCount = next;
+	    next += sizeof(uint32_t);
+	    for (b = 0 , buckets = 0 ; b < TSS_HISTOGRAM_BUCKETS ; b++) {
+		if (histogram->buckets[b] != 0) {
+		    next = TSS_Stats_PutUint32(next, b);
+		    next = TSS_Stats_PutUint32(next, histogram->buckets[b]);
+		    buckets++;
+		}
+	    }
+	    TSS_Stats_PutUint32(bucketCount, buckets);
+	    if (fwrite(buffer, 1, next - buffer, file) != (size_t)(next - buffer)) {
+		irc = -1;
+	    }
+	}
+    }
+    if (fclose(file) != 0) {
+	irc = -1;
+    }
+    if (irc != 0) {
+	if (tssVerbose) printf("TSS_Stats_Write: Error writing %s\n", filename);
+    }
+    return;
+}
+
+static uint8_t *TSS_Stats_PutUint32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)(value >> 0);
+    return buffer + sizeof(uint32_t);
+}
+
+static uint8_t *TSS_Stats_PutUint64(uint8_t *buffer, uint64_t value)
+{
+    buffer = TSS_Stats_PutUint32(buffer, (uint32_t)(value >> 32));
+    buffer = TSS_Stats_PutUint32(buffer, (uint32_t)value);
+    return buffer;
+}
+
+#else	/* TSS_HAVE_STATS */
+
+TPM_RC TSS_Stats_Snapshot(TSS_CONTEXT *tssContext,
+			  TSS_COMMAND_STATS **stats,
+			  size_t *count)
+{
+    tssContext = tssContext;
+    *stats = NULL;
+    *count = 0;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+TPM_RC TSS_Stats_Reset(TSS_CONTEXT *tssContext)
+{
+    tssContext = tssContext;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+#endif	/* TSS_HAVE_STATS */
+
+/* TSS_Histogram_Record() adds a time in nsec to the histogram */
+
+void TSS_Histogram_Record(TSS_HISTOGRAM *histogram, uint64_t nsec)
+{
+    if ((histogram->count == 0) || (nsec < histogram->minNsec)) {
+	histogram->minNsec = nsec;
+    }
+    if (nsec > histogram->maxNsec) {
+	histogram->maxNsec = nsec;
+    }
+    histogram->count++;
+    histogram->totalNsec += nsec;
+    histogram->buckets[TSS_Histogram_Index(nsec)]++;
+    return;
+}
+
+/* TSS_Histogram_Add() merges the source histogram into the target */
+
+void TSS_Histogram_Add(TSS_HISTOGRAM *target, const TSS_HISTOGRAM *source)
+{
+    unsigned int 	b;
+
+    if (source->count == 0) {
+	return;
+    }
+    if ((target->count == 0) || (source->minNsec < target->minNsec)) {
+	target->minNsec = source->minNsec;
+    }
+    if (source->maxNsec > target->maxNsec) {
+	target->maxNsec = source->maxNsec;
+    }
+    target->count += source->count;
+    target->totalNsec += source->totalNsec;
+    for (b = 0 ; b < TSS_HISTOGRAM_BUCKETS ; b++) {
+	target->buckets[b] += source->buckets[b];
+    }
+    return;
+}
+
+/* TSS_Histogram_Percentile() returns the time in nsec below which 'percentile' percent of the
+   recorded times fall.  The value is the top of the bucket holding that rank, limited to the
+   recorded minimum and maximum.  Returns 0 for an empty histogram.
+*/
+
+uint64_t TSS_Histogram_Percentile(const TSS_HISTOGRAM *histogram, double percentile)
+{
+    uint64_t 		rank;
+    uint64_t 		cumulative = 0;
+    uint64_t 		value = 0;
+    unsigned int 	b;
+
+    if (histogram->count == 0) {
+	return 0;
+    }
+    if (percentile >= 100.0) {
+	return histogram->maxNsec;
+    }
+    rank = (uint64_t)((percentile / 100.0) * (double)histogram->count + 0.5);
+    if (rank == 0) {
+	rank = 1;
+    }
+    for (b = 0 ; b < TSS_HISTOGRAM_BUCKETS ; b++) {
+	cumulative += histogram->buckets[b];
+	if (cumulative >= rank) {
+	    value = TSS_Histogram_BucketValue(b);
+	    break;
+	}
+    }
+    if (value > histogram->maxNsec) {
+	value = histogram->maxNsec;
+    }
+    if (value < histogram->minNsec) {
+	value = histogram->minNsec;
+    }
+    return value;
+}
+
+/* TSS_Stats_PhaseName() returns a short name for the phase */
+
+const char *TSS_Stats_PhaseName(unsigned int phase)
+{
+    static const char *phaseNames[TSS_PHASE_COUNT] = {
+	"preprocess",
+	"marshal",
+	"names",
+	"session load",
+	"hmac",
+	"encrypt",
+	"transmit",
+	"verify",
+	"decrypt",
+	"unmarshal",
+	"postprocess",
+	"session save",
+	"total"
+    };
+    if (phase >= TSS_PHASE_COUNT) {
+	return "unknown";
+    }
+    return phaseNames[phase];
+}
+
+/* TSS_Histogram_Index() returns the bucket for a time.  Above the linear range, the bucket is the
+   power of two above TSS_HISTOGRAM_SUB_BITS, times the bucket count per power of two, plus the
+   TSS_HISTOGRAM_SUB_BITS + 1 most significant bits of the value. */
+
+static unsigned int TSS_Histogram_Index(uint64_t nsec)
+{
+    unsigned int 	msb;
+    unsigned int 	shift;
+
+    if (nsec < TSS_HISTOGRAM_LINEAR) {
+	return (unsigned int)nsec;
+    }
+    for (msb = TSS_HISTOGRAM_SUB_BITS + 1 ; (nsec >> (msb + 1)) != 0 ; msb++);
+    if (msb >= TSS_HISTOGRAM_MAX_BITS) {
+	return TSS_HISTOGRAM_BUCKETS - 1;
+    }
+    shift = msb - TSS_HISTOGRAM_SUB_BITS;
+    return (shift << TSS_HISTOGRAM_SUB_BITS) + (unsigned int)(nsec >> shift);
+}
+
+/* TSS_Histogram_BucketValue() returns the largest time that falls in the bucket */
+
+static uint64_t TSS_Histogram_BucketValue(unsigned int index)
+{
+    unsigned int 	shift;
+    uint64_t 		mantissa;
+
+    if (index < TSS_HISTOGRAM_LINEAR) {
+	return index;
+    }
+    shift = (index >> TSS_HISTOGRAM_SUB_BITS) - 1;
+    mantissa = index - (shift << TSS_HISTOGRAM_SUB_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
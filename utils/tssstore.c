@@ -0,0 +1,966 @@
+/********************************************************************************/
+/*										*/
+/*			    TSS Metadata Store					*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+
+/* The metadata store is an alternative to the one file per handle persistence of Names, public
+   areas, and NV public areas.  It is selected with the TPM_DATA_STORE property.
+
+   The store is a single file tssstore.bin in the data directory, memory mapped and shared between
+   processes.  It is an open addressing hash table of fixed size records, keyed by the file name
+   stem that the file backend would use.
+
+   Readers do not lock.  Each record has a sequence number that a writer makes odd during an update.
+   A reader retries if the sequence is odd or changes during the copy.  Writers serialize with an
+   exclusive lock on the file.
+
+   For crash safety, each record has a checksum, and an updated record is written back with msync().
+   A record torn by a crash during an update fails the checksum and reads as not found, the same as
+   a missing file.  A writer forces the sequence odd and then to the next even value, so a sequence
+   left odd by a crashed writer is corrected by the next update of the record.  The metadata can be recreated
+   from the TPM, e.g. with TPM2_ReadPublic or TPM2_NV_ReadPublic.
+
+   When the table is 3/4 full, it is rebuilt into a new file, which is renamed over the old one.
+   The old file is marked as moved so that other processes remap.
+
+   The file is in native byte order.  It is intended for processes on one platform.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef TPM_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+
+#include <ibmtss/tsserror.h>
+#include <ibmtss/tssutils.h>
+
+#include "tssproperties.h"
+#include "tssstore.h"
+
+#if defined TPM_POSIX && !defined TPM_TSS_NOFILE
+
+#define TSS_STORE_FILENAME	"tssstore.bin"
+#define TSS_STORE_TMPNAME	"tssstore.tmp"
+
+#define TSS_STORE_MAGIC		0x4d535354	/* TSSM */
+#define TSS_STORE_VERSION	1
+
+/* large enough for the largest marshaled TPM2B_PUBLIC */
+#define TSS_STORE_DATA_SIZE	1024
+
+/* initial number of records, must be a power of 2 */
+#define TSS_STORE_SLOTS		256
+
+/* number of times a reader retries a record that is being updated */
+#define TSS_STORE_RETRIES	1000
+
+/* record states */
+
+#define TSS_STORE_EMPTY		0	/* never used, terminates a search */
+#define TSS_STORE_USED		1
+#define TSS_STORE_DELETED	2	/* deleted, does not terminate a search */
+
+#define TSS_STORE_BARRIER()	__sync_synchronize()
+
+/* file header, followed by 'slots' records */
+
+typedef struct {
+    uint32_t 		magic;
+    uint32_t 		version;
+    uint32_t 		slots;		/* number of records, a power of 2 */
+    uint32_t 		count;		/* records that are used or deleted */
+    volatile uint32_t 	moved;		/* TRUE when replaced by a rebuilt file */
+    uint32_t 		reserved[11];
+} TSS_STORE_HEADER;
+
+typedef struct {
+    volatile uint32_t	sequence;	/* odd while a write is in progress */
+    uint32_t 		state;		/* TSS_STORE_EMPTY, USED, DELETED */
+    uint32_t 		checksum;	/* over the key, length, and data */
+    uint16_t 		length;		/* bytes of data */
+    uint16_t 		reserved;
+    char 		key[TSS_STORE_KEY_SIZE];
+    uint8_t 		data[TSS_STORE_DATA_SIZE];
+} TSS_STORE_RECORD;
+
+/* the per context mapping of the store */
+
+struct TSS_STORE {
+    int 		fd;
+    uint8_t 		*map;
+    size_t 		mapSize;
+    TSS_STORE_HEADER 	*header;
+    TSS_STORE_RECORD 	*records;
+};
+
+/* local prototypes */
+
+static TPM_RC TSS_Store_Open(TSS_CONTEXT *tssContext);
+static TPM_RC TSS_Store_Map(struct TSS_STORE *store,
+			    const char *filename);
+static void   TSS_Store_Unmap(struct TSS_STORE *store);
+static TPM_RC TSS_Store_Create(int fd, uint32_t slots);
+static TPM_RC TSS_Store_Lock(TSS_CONTEXT *tssContext);
+static void   TSS_Store_Unlock(TSS_CONTEXT *tssContext);
+static TPM_RC TSS_Store_Rebuild(TSS_CONTEXT *tssContext);
+static void   TSS_Store_Sync(struct TSS_STORE *store,
+			     const TSS_STORE_RECORD *record);
+static int    TSS_Store_Snapshot(TSS_STORE_RECORD *copy,
+				 const TSS_STORE_RECORD *record);
+static TPM_RC TSS_Store_Find(struct TSS_STORE *store,
+			     uint32_t *index,
+			     int *found,
+			     const char *key);
+static uint32_t TSS_Store_Hash(const uint8_t *data, size_t length, uint32_t hash);
+static uint32_t TSS_Store_Checksum(const TSS_STORE_RECORD *record);
+
+/* TSS_Store_WriteBuffer() stores 'data' under 'key', replacing any existing entry.
+ */
+
+TPM_RC TSS_Store_WriteBuffer(TSS_CONTEXT *tssContext,
+			     const uint8_t *data,
+			     uint16_t length,
+			     const char *key)
+{
+    TPM_RC 		rc = 0;
+    int 		locked = FALSE;
+    uint32_t 		index;
+    int 		found = FALSE;
+    TSS_STORE_RECORD 	*record;
+
+    if (rc == 0) {
+	if ((length > TSS_STORE_DATA_SIZE) || (strlen(key) >= TSS_STORE_KEY_SIZE)) {
+	    if (tssVerbose) printf("TSS_Store_WriteBuffer: Error, key %s data too large %u\n",
+				   key, length);
+	    rc = TSS_RC_INSUFFICIENT_BUFFER;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Store_Lock(tssContext);
+    }
+    if (rc == 0) {
+	locked = TRUE;
+	rc = TSS_Store_Find(tssContext->tssStore, &index, &found, key);
+    }
+    /* a new key in an empty record grows the table, rebuild if it would be too full */
+    if ((rc == 0) && !found) {
+	TSS_STORE_HEADER *header = tssContext->tssStore->header;
+	if ((tssContext->tssStore->records[index].state == TSS_STORE_EMPTY) &&
+	    ((header->count + 1) * 4 > header->slots * 3)) {
+	    rc = TSS_Store_Rebuild(tssContext);
+	    if (rc == 0) {
+		rc = TSS_Store_Find(tssContext->tssStore, &index, &found, key);
+	    }
+	}
+    }
+    if (rc == 0) {
+	record = &tssContext->tssStore->records[index];
+	if (record->state == TSS_STORE_EMPTY) {
+	    tssContext->tssStore->header->count++;
+	}
+	/* odd sequence marks the update in progress for readers.  Force odd rather than increment,
+	   so that a sequence left odd by a writer that crashed does not invert the parity. */
+	record->sequence = record->sequence | 1;
+	TSS_STORE_BARRIER();
+	memset(record->key, 0, sizeof(record->key));
+	strcpy(record->key, key);
+	memcpy(record->data, data, length);
+	record->length = length;
+	record->checksum = TSS_Store_Checksum(record);
+	record->state = TSS_STORE_USED;
+	TSS_STORE_BARRIER();
+	record->sequence = (record->sequence | 1) + 1;
+	TSS_Store_Sync(tssContext->tssStore, record);
+    }
+    if (locked) {
+	TSS_Store_Unlock(tssContext);
+    }
+    return rc;
+}
+
+/* TSS_Store_ReadBuffer() reads the data stored under 'key' into 'data', which has 'maxLength'
+   bytes.
+
+   Returns TSS_RC_STORE_NOT_FOUND if there is no valid entry for the key.
+*/
+
+TPM_RC TSS_Store_ReadBuffer(TSS_CONTEXT *tssContext,
+			    uint8_t *data,
+			    uint16_t *length,
+			    uint16_t maxLength,
+			    const char *key)
+{
+    TPM_RC 		rc = 0;
+    uint32_t 		index;
+    int 		found = FALSE;
+    TSS_STORE_RECORD 	copy;
+
+    if (rc == 0) {
+	rc = TSS_Store_Open(tssContext);
+    }
+    if (rc == 0) {
+	rc = TSS_Store_Find(tssContext->tssStore, &index, &found, key);
+    }
+    if (rc == 0) {
+	if (found) {
+	    found = TSS_Store_Snapshot(&copy, &tssContext->tssStore->records[index]);
+	}
+	/* check again, the record may have changed since the search */
+	if (!found ||
+	    (copy.state != TSS_STORE_USED) ||
+	    (strcmp(copy.key, key) != 0)) {
+	    if (tssVverbose) printf("TSS_Store_ReadBuffer: key %s not found\n", key);
+	    rc = TSS_RC_STORE_NOT_FOUND;
+	}
+    }
+    if (rc == 0) {
+	if (copy.length > maxLength) {
+	    if (tssVerbose) printf("TSS_Store_ReadBuffer: Error, key %s data size %u too large\n",
+				   key, copy.length);
+	    rc = TSS_RC_INSUFFICIENT_BUFFER;
+	}
+    }
+    if (rc == 0) {
+	memcpy(data, copy.data, copy.length);
+	*length = copy.length;
+    }
+    return rc;
+}
+
+/* TSS_Store_Delete() deletes the entry stored under 'key'.
+
+   Returns TSS_RC_STORE_NOT_FOUND if there is no entry for the key.
+*/
+
+TPM_RC TSS_Store_Delete(TSS_CONTEXT *tssContext,
+			const char *key)
+{
+    TPM_RC 		rc = 0;
+    int 		locked = FALSE;
+    uint32_t 		index;
+    int 		found = FALSE;
+    TSS_STORE_RECORD 	*record;
+
+    if (rc == 0) {
+	rc = TSS_Store_Lock(tssContext);
+    }
+    if (rc == 0) {
+	locked = TRUE;
+	rc = TSS_Store_Find(tssContext->tssStore, &index, &found, key);
+    }
+    if (rc == 0) {
+	if (!found) {
+	    rc = TSS_RC_STORE_NOT_FOUND;
+	}
+    }
+    /* the deleted record remains in the search chain until the next rebuild */
+    if (rc == 0) {
+	record = &tssContext->tssStore->records[index];
+	record->sequence = record->sequence | 1;
+	TSS_STORE_BARRIER();
+	record->state = TSS_STORE_DELETED;
+	memset(record->data, 0, record->length);
+	record->length = 0;
+	TSS_STORE_BARRIER();
+	record->sequence = (record->sequence | 1) + 1;
+	TSS_Store_Sync(tssContext->tssStore, record);
+    }
+    if (locked) {
+	TSS_Store_Unlock(tssContext);
+    }
+    return rc;
+}
+
+/* TSS_Store_WriteStructure() marshals the structure using "marshalFunction", and then stores it
+   under 'key'.
+*/
+
+TPM_RC TSS_Store_WriteStructure(TSS_CONTEXT *tssContext,
+				void *structure,
+				MarshalFunction_t marshalFunction,
+				const char *key)
+{
+    TPM_RC 	rc = 0;
+    uint16_t	written = 0;
+    uint8_t	*buffer = NULL;		/* for the free */
+
+    if (rc == 0) {
+	rc = TSS_Structure_Marshal(&buffer,	/* freed @1 */
+				   &written,
+				   structure,
+				   marshalFunction);
+    }
+    if (rc == 0) {
+	rc = TSS_Store_WriteBuffer(tssContext, buffer, written, key);
+    }
+    free(buffer);	/* @1 */
+    return rc;
+}
+
+/* TSS_Store_ReadStructure() reads the data stored under 'key' and unmarshals it using
+   "unmarshalFunction".
+*/
+
+TPM_RC TSS_Store_ReadStructure(TSS_CONTEXT *tssContext,
+			       void *structure,
+			       UnmarshalFunction_t unmarshalFunction,
+			       const char *key)
+{
+    TPM_RC 	rc = 0;
+    uint8_t	buffer[TSS_STORE_DATA_SIZE];
+    uint8_t	*buffer1 = buffer;	/* for unmarshaling */
+    uint16_t	length;
+
+    if (rc == 0) {
+	rc = TSS_Store_ReadBuffer(tssContext, buffer, &length, sizeof(buffer), key);
+    }
+    if (rc == 0) {
+	uint32_t ilength = length;
+	rc = unmarshalFunction(structure, &buffer1, &ilength);
+    }
+    return rc;
+}
+
+/* TSS_Store_ReadStructureFlag() is TSS_Store_ReadStructure() for unmarshal functions with an
+   allowNull flag.
+*/
+
+TPM_RC TSS_Store_ReadStructureFlag(TSS_CONTEXT *tssContext,
+				   void *structure,
+				   UnmarshalFunctionFlag_t unmarshalFunction,
+				   BOOL allowNull,
+				   const char *key)
+{
+    TPM_RC 	rc = 0;
+    uint8_t	buffer[TSS_STORE_DATA_SIZE];
+    uint8_t	*buffer1 = buffer;	/* for unmarshaling */
+    uint16_t	length;
+
+    if (rc == 0) {
+	rc = TSS_Store_ReadBuffer(tssContext, buffer, &length, sizeof(buffer), key);
+    }
+    if (rc == 0) {
+	uint32_t ilength = length;
+	rc = unmarshalFunction(structure, &buffer1, &ilength, allowNull);
+    }
+    return rc;
+}
+
+/* TSS_Store_Read2B() reads the data stored under 'key' into the TPM2B buffer, which has
+   'targetSize' bytes.
+*/
+
+TPM_RC TSS_Store_Read2B(TSS_CONTEXT *tssContext,
+			TPM2B *tpm2b,
+			uint16_t targetSize,
+			const char *key)
+{
+    TPM_RC 	rc = 0;
+    uint16_t	length;
+
+    if (rc == 0) {
+	rc = TSS_Store_ReadBuffer(tssContext, tpm2b->buffer, &length, targetSize, key);
+    }
+    if (rc == 0) {
+	tpm2b->size = length;
+    }
+    return rc;
+}
+
+/* TSS_Store_Close() unmaps the store and frees the context mapping.
+ */
+
+void TSS_Store_Close(TSS_CONTEXT *tssContext)
+{
+    if (tssContext->tssStore != NULL) {
+	TSS_Store_Unmap(tssContext->tssStore);
+	free(tssContext->tssStore);
+	tssContext->tssStore = NULL;
+    }
+    return;
+}
+
+/* TSS_Store_Open() maps the store at first use.  If another process rebuilt the store, it maps
+   the new file.
+
+   The store is in the data directory at the time of the first use.
+*/
+
+static TPM_RC TSS_Store_Open(TSS_CONTEXT *tssContext)
+{
+    TPM_RC 	rc = 0;
+    char 	filename[TPM_DATA_DIR_PATH_LENGTH];
+
+    /* the common case, already mapped */
+    if ((tssContext->tssStore != NULL) && !tssContext->tssStore->header->moved) {
+	return 0;
+    }
+    if (rc == 0) {
+	if (tssContext->tssStore == NULL) {
+	    rc = TSS_Malloc((uint8_t **)&tssContext->tssStore, sizeof(struct TSS_STORE));
+	    if (rc == 0) {
+		tssContext->tssStore->fd = -1;
+		tssContext->tssStore->map = NULL;
+	    }
+	}
+	else {
+	    if (tssVverbose) printf("TSS_Store_Open: Remap rebuilt store\n");
+	    TSS_Store_Unmap(tssContext->tssStore);
+	}
+    }
+    if (rc == 0) {
+	sprintf(filename, "%s/%s", tssContext->tssDataDirectory, TSS_STORE_FILENAME);
+	rc = TSS_Store_Map(tssContext->tssStore, filename);
+	if (rc != 0) {
+	    free(tssContext->tssStore);
+	    tssContext->tssStore = NULL;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Store_Map() opens or creates the store file and maps it.
+ */
+
+static TPM_RC TSS_Store_Map(struct TSS_STORE *store,
+			    const char *filename)
+{
+    TPM_RC 		rc = 0;
+    int 		irc;
+    struct stat 	statBuf;
+    TSS_STORE_HEADER 	header;
+    ssize_t 		readLength;
+    
+    if (rc == 0) {
+	store->fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (store->fd < 0) {
+	    if (tssVerbose) printf("TSS_Store_Map: Error opening %s, %s\n",
+				   filename, strerror(errno));
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    /* lock while a new file is initialized */
+    if (rc == 0) {
+	irc = flock(store->fd, LOCK_EX);
+	if (irc != 0) {
+	    if (tssVerbose) printf("TSS_Store_Map: Error locking %s, %s\n",
+				   filename, strerror(errno));
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	irc = fstat(store->fd, &statBuf);
+	if (irc != 0) {
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	if (statBuf.st_size == 0) {
+	    if (tssVverbose) printf("TSS_Store_Map: Create %s\n", filename);
+	    rc = TSS_Store_Create(store->fd, TSS_STORE_SLOTS);
+	}
+    }
+    if (rc == 0) {
+	readLength = pread(store->fd, &header, sizeof(header), 0);
+	if ((readLength != sizeof(header)) ||
+	    (header.magic != TSS_STORE_MAGIC) ||
+	    (header.version != TSS_STORE_VERSION)) {
+	    if (tssVerbose) printf("TSS_Store_Map: Error, %s is not a metadata store\n", filename);
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    if (store->fd >= 0) {
+	flock(store->fd, LOCK_UN);
+    }
+    if (rc == 0) {
+	store->mapSize = sizeof(TSS_STORE_HEADER) +
+			 ((size_t)header.slots * sizeof(TSS_STORE_RECORD));
+	store->map = mmap(NULL, store->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+	if (store->map == MAP_FAILED) {
+	    if (tssVerbose) printf("TSS_Store_Map: Error mapping %s, %s\n",
+				   filename, strerror(errno));
+	    store->map = NULL;
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	store->header = (TSS_STORE_HEADER *)store->map;
+	store->records = (TSS_STORE_RECORD *)(store->map + sizeof(TSS_STORE_HEADER));
+    }
+    if ((rc != 0) && (store->fd >= 0)) {
+	close(store->fd);
+	store->fd = -1;
+    }
+    return rc;
+}
+
+/* TSS_Store_Unmap() unmaps and closes the store file.  Closing the file releases any lock.
+ */
+
+static void TSS_Store_Unmap(struct TSS_STORE *store)
+{
+    if (store->map != NULL) {
+	munmap(store->map, store->mapSize);
+	store->map = NULL;
+    }
+    if (store->fd >= 0) {
+	close(store->fd);
+	store->fd = -1;
+    }
+    return;
+}
+
+/* TSS_Store_Create() initializes an empty store file with 'slots' empty records.
+ */
+
+static TPM_RC TSS_Store_Create(int fd, uint32_t slots)
+{
+    TPM_RC 		rc = 0;
+    int 		irc;
+    TSS_STORE_HEADER 	header;
+    ssize_t 		writeLength;
+
+    /* the extended file reads as zeros, which is TSS_STORE_EMPTY */
+    if (rc == 0) {
+	irc = ftruncate(fd, sizeof(TSS_STORE_HEADER) + ((off_t)slots * sizeof(TSS_STORE_RECORD)));
+	if (irc != 0) {
+	    if (tssVerbose) printf("TSS_Store_Create: Error sizing store, %s\n", strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    if (rc == 0) {
+	memset(&header, 0, sizeof(header));
+	header.magic = TSS_STORE_MAGIC;
+	header.version = TSS_STORE_VERSION;
+	header.slots = slots;
+	header.count = 0;
+	header.moved = FALSE;
+	writeLength = pwrite(fd, &header, sizeof(header), 0);
+	if (writeLength != sizeof(header)) {
+	    if (tssVerbose) printf("TSS_Store_Create: Error writing header\n");
+	    rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Store_Lock() maps the store if necessary and locks it for a writer.  If another process
+   rebuilt the store while this process waited for the lock, it locks the new file.
+*/
+
+static TPM_RC TSS_Store_Lock(TSS_CONTEXT *tssContext)
+{
+    TPM_RC 	rc = 0;
+    int 	irc;
+    int 	done = FALSE;
+
+    while ((rc == 0) && !done) {
+	rc = TSS_Store_Open(tssContext);
+	if (rc == 0) {
+	    irc = flock(tssContext->tssStore->fd, LOCK_EX);
+	    if (irc != 0) {
+		if (tssVerbose) printf("TSS_Store_Lock: Error locking store, %s\n",
+				       strerror(errno));
+		rc = TSS_RC_STORE_OPEN;
+	    }
+	}
+	if (rc == 0) {
+	    done = !tssContext->tssStore->header->moved;
+	    if (!done) {
+		flock(tssContext->tssStore->fd, LOCK_UN);
+	    }
+	}
+    }
+    return rc;
+}
+
+static void TSS_Store_Unlock(TSS_CONTEXT *tssContext)
+{
+    flock(tssContext->tssStore->fd, LOCK_UN);
+    return;
+}
+
+/* TSS_Store_Rebuild() copies the valid records into a new file, sized so that it is at most half
+   full, and renames it over the store.  Deleted and torn records are dropped.
+
+   The caller holds the lock.  On return, the lock is held on the new file.
+*/
+
+static TPM_RC TSS_Store_Rebuild(TSS_CONTEXT *tssContext)
+{
+    TPM_RC 		rc = 0;
+    int 		irc;
+    struct TSS_STORE 	*oldStore = tssContext->tssStore;
+    struct TSS_STORE 	newStore;
+    char 		filename[TPM_DATA_DIR_PATH_LENGTH];
+    char 		tmpFilename[TPM_DATA_DIR_PATH_LENGTH];
+    uint32_t 		live = 0;
+    uint32_t 		slots;
+    uint32_t 		i;
+    uint32_t 		index;
+    int 		found;
+
+    newStore.fd = -1;
+    newStore.map = NULL;
+    sprintf(filename, "%s/%s", tssContext->tssDataDirectory, TSS_STORE_FILENAME);
+    sprintf(tmpFilename, "%s/%s", tssContext->tssDataDirectory, TSS_STORE_TMPNAME);
+    /* size for the live records plus the new one */
+    if (rc == 0) {
+	for (i = 0 ; i < oldStore->header->slots ; i++) {
+	    if (oldStore->records[i].state == TSS_STORE_USED) {
+		live++;
+	    }
+	}
+	for (slots = TSS_STORE_SLOTS ; (live + 1) * 2 > slots ; slots *= 2);
+	if (tssVverbose) printf("TSS_Store_Rebuild: %u records, %u slots\n", live, slots);
+    }
+    /* the lock on the old file prevents a concurrent rebuild */
+    if (rc == 0) {
+	newStore.fd = open(tmpFilename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (newStore.fd < 0) {
+	    if (tssVerbose) printf("TSS_Store_Rebuild: Error opening %s, %s\n",
+				   tmpFilename, strerror(errno));
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Store_Create(newStore.fd, slots);
+    }
+    if (rc == 0) {
+	newStore.mapSize = sizeof(TSS_STORE_HEADER) + ((size_t)slots * sizeof(TSS_STORE_RECORD));
+	newStore.map = mmap(NULL, newStore.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    newStore.fd, 0);
+	if (newStore.map == MAP_FAILED) {
+	    newStore.map = NULL;
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	newStore.header = (TSS_STORE_HEADER *)newStore.map;
+	newStore.records = (TSS_STORE_RECORD *)(newStore.map + sizeof(TSS_STORE_HEADER));
+    }
+    /* copy the valid records */
+    for (i = 0 ; (rc == 0) && (i < oldStore->header->slots) ; i++) {
+	TSS_STORE_RECORD *record = &oldStore->records[i];
+	if ((record->state == TSS_STORE_USED) &&
+	    (record->checksum == TSS_Store_Checksum(record))) {
+	    rc = TSS_Store_Find(&newStore, &index, &found, record->key);
+	    if (rc == 0) {
+		memcpy(&newStore.records[index], record, sizeof(TSS_STORE_RECORD));
+		newStore.records[index].sequence = 0;
+		newStore.header->count++;
+	    }
+	}
+    }
+    /* make the new file durable before it replaces the old one */
+    if (rc == 0) {
+	irc = msync(newStore.map, newStore.mapSize, MS_SYNC);
+	if (irc != 0) {
+	    rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    if (rc == 0) {
+	irc = flock(newStore.fd, LOCK_EX);
+	if (irc != 0) {
+	    rc = TSS_RC_STORE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	irc = rename(tmpFilename, filename);
+	if (irc != 0) {
+	    if (tssVerbose) printf("TSS_Store_Rebuild: Error renaming %s, %s\n",
+				   tmpFilename, strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    /* other processes remap when they see the old file moved */
+    if (rc == 0) {
+	oldStore->header->moved = TRUE;
+	TSS_STORE_BARRIER();
+	TSS_Store_Unmap(oldStore);
+	*oldStore = newStore;
+    }
+    else {
+	TSS_Store_Unmap(&newStore);
+	remove(tmpFilename);
+    }
+    return rc;
+}
+
+/* TSS_Store_Find() searches for 'key'.
+
+   If found, 'index' is the record for the key.  If not found, 'index' is the first deleted or empty
+   record in the search chain, where the key can be added.
+
+   Returns TSS_RC_STORE_FULL if the key is not found and there is no free record.
+*/
+
+static TPM_RC TSS_Store_Find(struct TSS_STORE *store,
+			     uint32_t *index,
+			     int *found,
+			     const char *key)
+{
+    TPM_RC 		rc = 0;
+    uint32_t 		mask = store->header->slots - 1;
+    uint32_t 		i;
+    uint32_t 		probe;
+    int 		haveFree = FALSE;
+    TSS_STORE_RECORD 	*record;
+
+    *found = FALSE;
+    probe = TSS_Store_Hash((const uint8_t *)key, strlen(key), 2166136261U) & mask;
+    for (i = 0 ; i <= mask ; i++, probe = (probe + 1) & mask) {
+	record = &store->records[probe];
+	/* a reader may race a writer here, TSS_Store_ReadBuffer() checks the snapshot */
+	if (record->state == TSS_STORE_USED) {
+	    if (strncmp(record->key, key, TSS_STORE_KEY_SIZE) == 0) {
+		*index = probe;
+		*found = TRUE;
+		break;
+	    }
+	}
+	else {
+	    if (!haveFree) {
+		*index = probe;
+		haveFree = TRUE;
+	    }
+	    if (record->state == TSS_STORE_EMPTY) {
+		break;
+	    }
+	}
+    }
+    if (!*found && !haveFree) {
+	rc = TSS_RC_STORE_FULL;
+    }
+    return rc;
+}
+
+/* TSS_Store_Sync() writes the pages holding an updated record back to the file, so that the
+   record survives a system crash, not just a process crash.  A failure is traced but not
+   returned, since the update is already visible to other processes.
+*/
+
+static void TSS_Store_Sync(struct TSS_STORE *store,
+			   const TSS_STORE_RECORD *record)
+{
+    int 	irc;
+    size_t 	pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t 	start = (size_t)((const uint8_t *)record - store->map);
+    size_t 	end = start + sizeof(TSS_STORE_RECORD);
+
+    start -= start % pageSize;		/* msync() requires a page aligned address */
+    irc = msync(store->map + start, end - start, MS_SYNC);
+    if (irc != 0) {
+	if (tssVerbose) printf("TSS_Store_Sync: Error, msync failed, %s\n", strerror(errno));
+    }
+    return;
+}
+
+/* TSS_Store_Snapshot() copies a record that may be concurrently updated by another process.
+
+   Returns TRUE if the copy is consistent and, for a used record, the checksum is valid.
+*/
+
+static int TSS_Store_Snapshot(TSS_STORE_RECORD *copy,
+			      const TSS_STORE_RECORD *record)
+{
+    uint32_t 	sequence;
+    int 	i;
+
+    for (i = 0 ; i < TSS_STORE_RETRIES ; i++) {
+	sequence = record->sequence;
+	TSS_STORE_BARRIER();
+	/* even sequence, not being updated */
+	if ((sequence & 1) == 0) {
+	    memcpy(copy, (const void *)record, sizeof(TSS_STORE_RECORD));
+	    TSS_STORE_BARRIER();
+	    if (record->sequence == sequence) {
+		break;
+	    }
+	}
+	sched_yield();
+    }
+    /* if the writer never finished, it probably crashed, and the checksum decides */
+    if (i == TSS_STORE_RETRIES) {
+	memcpy(copy, (const void *)record, sizeof(TSS_STORE_RECORD));
+    }
+    copy->key[TSS_STORE_KEY_SIZE - 1] = '\0';
+    if (copy->state == TSS_STORE_USED) {
+	if ((copy->length > TSS_STORE_DATA_SIZE) ||
+	    (copy->checksum != TSS_Store_Checksum(copy))) {
+	    if (tssVerbose) printf("TSS_Store_Snapshot: Error, key %s record is corrupt\n",
+				   copy->key);
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
+
+/* TSS_Store_Hash() is the FNV-1a hash, used for the table index and the record checksum.
+ */
+
+static uint32_t TSS_Store_Hash(const uint8_t *data, size_t length, uint32_t hash)
+{
+    size_t i;
+
+    for (i = 0 ; i < length ; i++) {
+	hash ^= data[i];
+	hash *= 16777619U;
+    }
+    return hash;
+}
+
+static uint32_t TSS_Store_Checksum(const TSS_STORE_RECORD *record)
+{
+    uint32_t 	hash = 2166136261U;
+    uint16_t 	length = record->length;
+
+    if (length > TSS_STORE_DATA_SIZE) {
+	length = TSS_STORE_DATA_SIZE;
+    }
+    hash = TSS_Store_Hash((const uint8_t *)record->key, sizeof(record->key), hash);
+    hash = TSS_Store_Hash((const uint8_t *)&record->length, sizeof(record->length), hash);
+    hash = TSS_Store_Hash(record->data, length, hash);
+    return hash;
+}
+
+#else	/* TPM_POSIX && !TPM_TSS_NOFILE */
+
+/* The metadata store requires memory mapped files.  TSS_SetProperty() rejects it on other
+   platforms, and a TSS with no file support does not use it, so these are not reached. */
+
+TPM_RC TSS_Store_WriteBuffer(TSS_CONTEXT *tssContext,
+			     const uint8_t *data,
+			     uint16_t length,
+			     const char *key)
+{
+    tssContext = tssContext;
+    data = data;
+    length = length;
+    key = key;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+TPM_RC TSS_Store_ReadBuffer(TSS_CONTEXT *tssContext,
+			    uint8_t *data,
+			    uint16_t *length,
+			    uint16_t maxLength,
+			    const char *key)
+{
+    tssContext = tssContext;
+    data = data;
+    length = length;
+    maxLength = maxLength;
+    key = key;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+TPM_RC TSS_Store_WriteStructure(TSS_CONTEXT *tssContext,
+				void *structure,
+				MarshalFunction_t marshalFunction,
+				const char *key)
+{
+    tssContext = tssContext;
+    structure = structure;
+    marshalFunction = marshalFunction;
+    key = key;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+TPM_RC TSS_Store_ReadStructure(TSS_CONTEXT *tssContext,
+			       void *structure,
+			       UnmarshalFunction_t unmarshalFunction,
+			       const char *key)
+{
+    tssContext = tssContext;
+    structure = structure;
+    unmarshalFunction = unmarshalFunction;
+    key = key;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+TPM_RC TSS_Store_ReadStructureFlag(TSS_CONTEXT *tssContext,
+				   void *structure,
+				   UnmarshalFunctionFlag_t unmarshalFunction,
+				   BOOL allowNull,
+				   const char *key)
+{
+    tssContext = tssContext;
+    structure = structure;
+    unmarshalFunction = unmarshalFunction;
+    allowNull = allowNull;
+    key = key;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+TPM_RC TSS_Store_Read2B(TSS_CONTEXT *tssContext,
+			TPM2B *tpm2b,
+			uint16_t targetSize,
+			const char *key)
+{
+    tssContext = tssContext;
+    tpm2b = tpm2b;
+    targetSize = targetSize;
+    key = key;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+TPM_RC TSS_Store_Delete(TSS_CONTEXT *tssContext,
+			const char *key)
+{
+    tssContext = tssContext;
+    key = key;
+    return TSS_RC_NOT_IMPLEMENTED;
+}
+
+void TSS_Store_Close(TSS_CONTEXT *tssContext)
+{
+    tssContext = tssContext;
+    return;
+}
+
+#endif	/* TPM_POSIX && !TPM_TSS_NOFILE */
@@ -0,0 +1,92 @@
+/********************************************************************************/
+/*										*/
+/*			    TSS Metadata Store					*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+
+/* This is an internal TSS file, subject to change.  Applications should not include it. */
+
+#ifndef TSSSTORE_H
+#define TSSSTORE_H
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tssutils.h>
+
+/* The metadata store key is the file name stem that the file backend uses, e.g. h80000001 or
+   hp<hash of context>.  The longest is a 2 character prefix, a 64 character SHA-256 string, and
+   the nul terminator. */
+
+#define TSS_STORE_KEY_SIZE	72
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    TPM_RC TSS_Store_WriteBuffer(TSS_CONTEXT *tssContext,
+				 const uint8_t *data,
+				 uint16_t length,
+				 const char *key);
+    TPM_RC TSS_Store_ReadBuffer(TSS_CONTEXT *tssContext,
+				uint8_t *data,
+				uint16_t *length,
+				uint16_t maxLength,
+				const char *key);
+    TPM_RC TSS_Store_WriteStructure(TSS_CONTEXT *tssContext,
+				    void *structure,
+				    MarshalFunction_t marshalFunction,
+				    const char *key);
+    TPM_RC TSS_Store_ReadStructure(TSS_CONTEXT *tssContext,
+				   void *structure,
+				   UnmarshalFunction_t unmarshalFunction,
+				   const char *key);
+    TPM_RC TSS_Store_ReadStructureFlag(TSS_CONTEXT *tssContext,
+				       void *structure,
+				       UnmarshalFunctionFlag_t unmarshalFunction,
+				       BOOL allowNull,
+				       const char *key);
+    TPM_RC TSS_Store_Read2B(TSS_CONTEXT *tssContext,
+			    TPM2B *tpm2b,
+			    uint16_t targetSize,
+			    const char *key);
+    TPM_RC TSS_Store_Delete(TSS_CONTEXT *tssContext,
+			    const char *key);
+    void TSS_Store_Close(TSS_CONTEXT *tssContext);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -97,12 +97,6 @@ static uint32_t TSS_Tbsi_SubmitCommand(TBS_HCONTEXT hContext,
 static void TSS_Tbsi_GetTBSError(const char *prefix,
 				 TBS_RESULT rc);
 
-
-/* global configuration */
-
-extern int tssVverbose;
-extern int tssVerbose;
-
 /* TSS_Tbsi_Transmit() transmits the command and receives the response. 'responseBuffer' must be at
    least MAX_RESPONSE_SIZE bytes.
 
@@ -243,6 +237,11 @@ static uint32_t TSS_Tbsi_SubmitCommand(TBS_HCONTEXT hContext,
 TPM_RC TSS_Tbsi_Close(TSS_CONTEXT *tssContext)
 {
     TPM_RC rc = 0;
+
+    /* only close if there was an open */
+    if (tssContext->tssFirstTransmit) {
+	return rc;
+    }
     if (tssVverbose) printf("TSS_Tbsi_Close: Closing connection\n");
     rc = Tbsip_Context_Close(tssContext->hContext);
     return rc;
@@ -56,6 +56,14 @@
 #endif
 #endif /* TPM_NODEV */
 
+#ifdef TSS_HAVE_SHM
+#include "tssshm.h"
+#endif
+
+#ifdef TSS_HAVE_RECORD
+#include "tssrecord.h"
+#endif
+
 #ifdef TPM_SKIBOOT
 #include "tssdevskiboot.h"
 #endif /* TPM_SKIBOOT */
@@ -68,11 +76,209 @@
 
 #include <ibmtss/tsstransmit.h>
 
-extern int tssVverbose;
-extern int tssVerbose;
+/* The transports are selected by tssInterfaceType when the connection is opened, so that the
+   command path calls through the TSS_CONTEXT transport rather than comparing strings. */
+
+/* built in transports, terminated by a NULL interface type */
+
+static const TSS_TRANSPORT tssTransports[] = {
+#ifndef TPM_NOSOCKET
+    {"socsim",
+     TSS_Socket_Select,
+     TSS_Socket_Transmit,
+     TSS_Socket_Send,
+     TSS_Socket_Receive,
+#ifdef TPM_POSIX
+     TSS_Socket_GetFd,
+#else
+     NULL,
+#endif
+     TSS_Socket_TransmitPlatform,
+     TSS_Socket_Close},
+#ifdef TPM_POSIX
+    /* socsim framing over a Unix domain socket to a co-located server */
+    {"socunix",
+     TSS_Socket_SelectUnix,
+     TSS_Socket_Transmit,
+     TSS_Socket_Send,
+     TSS_Socket_Receive,
+     TSS_Socket_GetFd,
+     TSS_Socket_TransmitPlatform,
+     TSS_Socket_Close},
+#endif
+#endif	/* TPM_NOSOCKET */
+#ifdef TSS_HAVE_SHM
+    /* shared memory rings to a co-located server */
+    {"shm",
+     NULL,
+     TSS_Shm_Transmit,
+     TSS_Shm_Send,
+     TSS_Shm_Receive,
+     NULL,
+     NULL,
+     TSS_Shm_Close},
+#endif
+#if !defined TPM_NODEV && defined TPM_POSIX
+    /* transmit through Linux device driver */
+    {"dev",
+     NULL,
+     TSS_Dev_Transmit,
+     TSS_Dev_Send,
+     TSS_Dev_Receive,
+     TSS_Dev_GetFd,
+     NULL,
+     TSS_Dev_Close},
+#endif
+#if defined TPM_WINDOWS && defined TPM_WINDOWS_TBSI
+    /* transmit through Windows TBSI */
+    {"dev",
+     NULL,
+     TSS_Tbsi_Transmit,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     TSS_Tbsi_Close},
+#endif
+#ifdef TPM_SKIBOOT
+    /* transmit through Skiboot */
+    {"skiboot",
+     NULL,
+     TSS_Skiboot_Transmit,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL},
+#endif /* TPM_SKIBOOT */
+#ifdef TSS_HAVE_RECORD
+    /* responses from a TPM_RECORD_FILE trace, no TPM */
+    {"replay",
+     TSS_Replay_Open,
+     TSS_Replay_Transmit,
+     NULL,
+     NULL,
+     NULL,
+     TSS_Replay_TransmitPlatform,
+     TSS_Replay_Close},
+#endif
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+/* transports registered by the application */
+
+#define TSS_TRANSPORT_MAX 8
+
+static const TSS_TRANSPORT *tssTransportRegistry[TSS_TRANSPORT_MAX];
+static size_t tssTransportCount = 0;
 
 /* local prototypes */
 
+static TPM_RC TSS_Transport_Open(TSS_CONTEXT *tssContext);
+
+/* TSS_RegisterTransport() registers an application transport.  It is selected when the
+   TPM_INTERFACE_TYPE property matches its interfaceType, and takes precedence over a built in
+   transport of the same name.  Registering a name again replaces the previous transport.
+
+   The transport structure must remain valid while it is registered.  Registration is not
+   synchronized with other threads, so register transports before creating the contexts that use
+   them.
+*/
+
+TPM_RC TSS_RegisterTransport(const TSS_TRANSPORT *transport)
+{
+    TPM_RC 	rc = 0;
+    size_t	i;
+
+    if (rc == 0) {
+	if ((transport == NULL) ||
+	    (transport->interfaceType == NULL) ||
+	    (transport->transmit == NULL)) {
+	    if (tssVerbose) printf("TSS_RegisterTransport: Error, missing interface type or transmit\n");
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    /* replace a transport with the same name */
+    if (rc == 0) {
+	for (i = 0 ; i < tssTransportCount ; i++) {
+	    if (strcmp(tssTransportRegistry[i]->interfaceType, transport->interfaceType) == 0) {
+		tssTransportRegistry[i] = transport;
+		return rc;
+	    }
+	}
+    }
+    if (rc == 0) {
+	if (tssTransportCount >= TSS_TRANSPORT_MAX) {
+	    if (tssVerbose) printf("TSS_RegisterTransport: Error, cannot register %s\n",
+				   transport->interfaceType);
+	    rc = TSS_RC_TRANSPORT_FULL;
+	}
+    }
+    if (rc == 0) {
+	tssTransportRegistry[tssTransportCount] = transport;
+	tssTransportCount++;
+    }
+    return rc;
+}
+
+/* TSS_SetTransportData() saves a transport private pointer in the context, typically the
+   connection state of an application transport.  The TSS does not use or free it.
+*/
+
+TPM_RC TSS_SetTransportData(TSS_CONTEXT *tssContext, void *transportData)
+{
+    tssContext->tssTransportData = transportData;
+    return 0;
+}
+
+/* TSS_GetTransportData() returns the pointer saved by TSS_SetTransportData() */
+
+void *TSS_GetTransportData(TSS_CONTEXT *tssContext)
+{
+    return tssContext->tssTransportData;
+}
+
+/* TSS_Transport_Open() selects the transport for tssInterfaceType, if one is not already selected,
+   and calls its open function.
+*/
+
+static TPM_RC TSS_Transport_Open(TSS_CONTEXT *tssContext)
+{
+    TPM_RC 			rc = 0;
+    const TSS_TRANSPORT		*transport = NULL;
+    size_t			i;
+
+    /* already open */
+    if (tssContext->tssTransport != NULL) {
+	return rc;
+    }
+    if (rc == 0) {
+	for (i = 0 ; (transport == NULL) && (i < tssTransportCount) ; i++) {
+	    if (strcmp(tssTransportRegistry[i]->interfaceType,
+		       tssContext->tssInterfaceType) == 0) {
+		transport = tssTransportRegistry[i];
+	    }
+	}
+	for (i = 0 ; (transport == NULL) && (tssTransports[i].interfaceType != NULL) ; i++) {
+	    if (strcmp(tssTransports[i].interfaceType, tssContext->tssInterfaceType) == 0) {
+		transport = &tssTransports[i];
+	    }
+	}
+	if (transport == NULL) {
+	    if (tssVerbose) printf("TSS_Transport_Open: device %s unsupported\n",
+				   tssContext->tssInterfaceType);
+	    rc = TSS_RC_INSUPPORTED_INTERFACE;	
+	}
+    }
+    if ((rc == 0) && (transport->open != NULL)) {
+	rc = transport->open(tssContext);
+    }
+    if (rc == 0) {
+	tssContext->tssTransport = transport;
+    }
+    return rc;
+}
+
 /* TSS_TransmitPlatform() transmits an administrative out of band command to the TPM.
 
    Supported by the simulator, not the TPM device.
@@ -82,24 +288,19 @@ TPM_RC TSS_TransmitPlatform(TSS_CONTEXT *tssContext, uint32_t command, const cha
 {
     TPM_RC rc = 0;
 
-#ifndef TPM_NOSOCKET
-    if ((strcmp(tssContext->tssInterfaceType, "socsim") == 0)) {
-	rc = TSS_Socket_TransmitPlatform(tssContext, command, message);
-    }
-    else
-#else
-    command = command;
-    message = message;
-#endif
-    if ((strcmp(tssContext->tssInterfaceType, "dev") == 0)) {
-	if (tssVerbose) printf("TSS_TransmitPlatform: device %s unsupported\n",
-			       tssContext->tssInterfaceType);
-	rc = TSS_RC_INSUPPORTED_INTERFACE;	
+    TSS_SetThreadTrace(tssContext);
+    if (rc == 0) {
+	rc = TSS_Transport_Open(tssContext);
     }
-    else {
-	if (tssVerbose) printf("TSS_TransmitPlatform: device %s unsupported\n",
-			       tssContext->tssInterfaceType);
-	rc = TSS_RC_INSUPPORTED_INTERFACE;	
+    if (rc == 0) {
+	if (tssContext->tssTransport->transmitPlatform != NULL) {
+	    rc = tssContext->tssTransport->transmitPlatform(tssContext, command, message);
+	}
+	else {
+	    if (tssVerbose) printf("TSS_TransmitPlatform: device %s unsupported\n",
+				   tssContext->tssInterfaceType);
+	    rc = TSS_RC_INSUPPORTED_INTERFACE;	
+	}
     }
     return rc;
 }
@@ -115,53 +316,118 @@ TPM_RC TSS_Transmit(TSS_CONTEXT *tssContext,
 {
     TPM_RC rc = 0;
 
-#ifndef TPM_NOSOCKET
-    if ((strcmp(tssContext->tssInterfaceType, "socsim") == 0)) {
-	rc = TSS_Socket_Transmit(tssContext,
-				 responseBuffer, read,
-				 commandBuffer, written,
-				 message);
+    if (rc == 0) {
+	rc = TSS_Transport_Open(tssContext);
+    }
+#ifdef TSS_HAVE_RECORD
+    if (rc == 0) {
+	rc = TSS_Record_TransportStart(tssContext, commandBuffer, written);
     }
-    else
-#endif
-	
-    if ((strcmp(tssContext->tssInterfaceType, "dev") == 0)) {
-#ifndef TPM_NODEV
-#ifdef TPM_POSIX	/* transmit through Linux device driver */
-	rc = TSS_Dev_Transmit(tssContext,
-			      responseBuffer, read,
-			      commandBuffer, written,
-			      message);
 #endif
+    if (rc == 0) {
+	rc = tssContext->tssTransport->transmit(tssContext,
+						responseBuffer, read,
+						commandBuffer, written,
+						message);
+#ifdef TSS_HAVE_RECORD
+	TSS_Record_TransportEnd(tssContext, responseBuffer, *read, rc);
 #endif
+    }
+    return rc;
+}
 
-#ifdef TPM_WINDOWS	/* transmit through Windows TBSI */
-#ifdef TPM_WINDOWS_TBSI
-	rc = TSS_Tbsi_Transmit(tssContext,
-			       responseBuffer, read,
-			       commandBuffer, written,
-			       message);
-#else
-	if (tssVerbose) printf("TSS_Transmit: device %s unsupported\n",
-			       tssContext->tssInterfaceType);
-	rc = TSS_RC_INSUPPORTED_INTERFACE;	
+/* TSS_TransmitSend() transmits a TPM command packet without waiting for the response.
+   TSS_TransmitReceive() must be called to receive the response.
+
+   The command buffer must remain valid until TSS_TransmitReceive() returns.  Transports that
+   cannot separate the send and receive (Windows TBSI, skiboot) defer the entire exchange to
+   TSS_TransmitReceive().
+*/
+
+TPM_RC TSS_TransmitSend(TSS_CONTEXT *tssContext,
+			const uint8_t *commandBuffer, uint32_t written,
+			const char *message)
+{
+    TPM_RC rc = 0;
+
+    tssContext->tssDeferredCommand = NULL;
+    if (rc == 0) {
+	rc = TSS_Transport_Open(tssContext);
+    }
+    if (rc == 0) {
+	if (tssContext->tssTransport->send != NULL) {
+#ifdef TSS_HAVE_RECORD
+	    rc = TSS_Record_TransportStart(tssContext, commandBuffer, written);
 #endif
+	    if (rc == 0) {
+		rc = tssContext->tssTransport->send(tssContext, commandBuffer, written, message);
+	    }
+	}
+	else {
+	    /* no separate receive, save the command for TSS_TransmitReceive() */
+	    tssContext->tssDeferredCommand = commandBuffer;
+	    tssContext->tssDeferredLength = written;
+	    tssContext->tssDeferredMessage = message;
+	}
+    }
+    return rc;
+}
+
+/* TSS_TransmitReceive() receives the response to a command sent by TSS_TransmitSend().
+
+   It can return transmit and receive packet errors, but normally returns the TPM response code.
+*/
+
+TPM_RC TSS_TransmitReceive(TSS_CONTEXT *tssContext,
+			   uint8_t *responseBuffer, uint32_t *read)
+{
+    TPM_RC rc = 0;
+
+    if (tssContext->tssDeferredCommand != NULL) {
+	rc = TSS_Transmit(tssContext,
+			  responseBuffer, read,
+			  tssContext->tssDeferredCommand, tssContext->tssDeferredLength,
+			  tssContext->tssDeferredMessage);
+	tssContext->tssDeferredCommand = NULL;
+    }
+    else if (tssContext->tssTransport == NULL) {
+	if (tssVerbose) printf("TSS_TransmitReceive: Error, connection not open\n");
+	rc = TSS_RC_NO_CONNECTION;
+    }
+    else if (tssContext->tssTransport->receive != NULL) {
+	rc = tssContext->tssTransport->receive(tssContext, responseBuffer, read);
+#ifdef TSS_HAVE_RECORD
+	TSS_Record_TransportEnd(tssContext, responseBuffer, *read, rc);
 #endif
     }
-    else
-    if (strcmp(tssContext->tssInterfaceType, "skiboot") == 0) {
-#ifdef TPM_SKIBOOT	/* transmit through Skiboot */
-	rc = TSS_Skiboot_Transmit(tssContext, responseBuffer, read,
-				  commandBuffer, written, message);
-#else
-	if (tssVerbose) printf("TSS_Transmit: device %s unsupported\n",
+    else {
+	if (tssVerbose) printf("TSS_TransmitReceive: device %s unsupported\n",
 			       tssContext->tssInterfaceType);
-	rc = TSS_RC_INSUPPORTED_INTERFACE;
-#endif // TPM_SKIBOOT
+	rc = TSS_RC_INSUPPORTED_INTERFACE;	
+    }
+    return rc;
+}
+
+/* TSS_TransmitGetFd() returns the file descriptor that becomes readable when the response to a
+   command sent by TSS_TransmitSend() is available.  The caller can poll() or epoll() on it before
+   calling TSS_Execute_Complete().
+
+   Returns TSS_RC_INSUPPORTED_INTERFACE if the interface has no such descriptor, or TSS_RC_NO_CONNECTION
+   if the connection is not open.
+*/
+
+TPM_RC TSS_TransmitGetFd(TSS_CONTEXT *tssContext, int *fd)
+{
+    TPM_RC rc = 0;
+
+    *fd = -1;
+    if (tssContext->tssTransport == NULL) {
+	rc = TSS_RC_NO_CONNECTION;
+    }
+    else if (tssContext->tssTransport->getFd != NULL) {
+	rc = tssContext->tssTransport->getFd(tssContext, fd);
     }
     else {
-	if (tssVerbose) printf("TSS_Transmit: device %s unsupported\n",
-			       tssContext->tssInterfaceType);
 	rc = TSS_RC_INSUPPORTED_INTERFACE;	
     }
     return rc;
@@ -174,46 +440,12 @@ TPM_RC TSS_Close(TSS_CONTEXT *tssContext)
     TPM_RC rc = 0;
 
     /* only close if there was an open */
-    if (!tssContext->tssFirstTransmit) {
-#ifndef TPM_NOSOCKET
-	if ((strcmp(tssContext->tssInterfaceType, "socsim") == 0)) {
-	    rc = TSS_Socket_Close(tssContext);
-	}
-	else
-#endif
-        if ((strcmp(tssContext->tssInterfaceType, "dev") == 0)) {
-#ifndef TPM_NODEV
-#ifdef TPM_POSIX	/* transmit through Linux device driver */
-	    rc = TSS_Dev_Close(tssContext);
-#endif
-#endif
-
-#ifdef TPM_WINDOWS	/* transmit through Windows TBSI */
-#ifdef TPM_WINDOWS_TBSI
-	    rc = TSS_Tbsi_Close(tssContext);
-#else
-	    if (tssVerbose) printf("TSS_Transmit: device %s unsupported\n",
-				   tssContext->tssInterfaceType);
-	    rc = TSS_RC_INSUPPORTED_INTERFACE;	
-#endif
-#endif
-	}
-	else
-	if ((strcmp(tssContext->tssInterfaceType, "skiboot") == 0)) {
-#ifdef TPM_SKIBOOT
-	    rc = 0;
-#else
-	    if (tssVerbose) printf("TSS_Transmit: device %s unsupported\n",
-				   tssContext->tssInterfaceType);
-	    rc = TSS_RC_INSUPPORTED_INTERFACE;
-#endif // TPM_SKIBOOT
-	}
-	else {
-	    if (tssVerbose) printf("TSS_Transmit: device %s unsupported\n",
-				   tssContext->tssInterfaceType);
-	    rc = TSS_RC_INSUPPORTED_INTERFACE;	
+    if (tssContext->tssTransport != NULL) {
+	if (tssContext->tssTransport->close != NULL) {
+	    rc = tssContext->tssTransport->close(tssContext);
 	}
-	tssContext->tssFirstTransmit = TRUE;
+	tssContext->tssTransport = NULL;
     }
+    tssContext->tssFirstTransmit = TRUE;
     return rc;
 }
@@ -54,6 +54,8 @@
 #include <ibmtss/tsserror.h>
 #include <ibmtss/tssprint.h>
 
+#include "tssproperties.h"
+
 /* the TSS context must be larger when files are not used, since TSS object and NV state is held in
    the volatile context.  The major factor is the number of TSS_OBJECT_PUBLIC slots.  See
    tssproperties.c */
@@ -63,9 +65,6 @@
 #define TSS_ALLOC_MAX  0x10000  /* 64k bytes */
 #endif
 
-extern int tssVerbose;
-extern int tssVverbose;
-
 /* TSS_Malloc() is a general purpose wrapper around malloc()
  */
 
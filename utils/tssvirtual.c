@@ -0,0 +1,961 @@
+/********************************************************************************/
+/*										*/
+/*		      TSS Transient Object Virtualization			*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2019.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* This file virtualizes transient object and session slots, see TPM_VIRTUALIZE.
+
+   A TPM holds only a few transient objects and loaded sessions, typically 3 of each.
+
+   Objects: When virtualization is enabled, each transient object handle that the TPM returns,
+   from TPM2_Load, TPM2_CreatePrimary, etc., is replaced with a virtual handle that stays valid
+   until the object is flushed.  When the TPM returns TPM_RC_OBJECT_MEMORY, the least recently
+   used object is saved with TPM2_ContextSave and flushed, and the command is run again.  An
+   evicted object is loaded with TPM2_ContextLoad when a command next uses it, and the command is
+   sent with the new TPM handle.
+
+   The Names and public areas are stored under the virtual handle, so they need no update when
+   the TPM handle changes.  Handles are not included in the cpHash or rpHash, so the handles are
+   replaced in the marshaled command after the authorizations are added, and in the response
+   before it is unmarshaled.
+
+   The context of a loaded object is not changed by use, so it is saved once and reloaded as
+   often as needed.  A sequence object changes with each update and is saved at each eviction.
+
+   Sessions: A session keeps its handle when it is saved and loaded, so no handle is replaced.
+   When the TPM returns TPM_RC_SESSION_MEMORY, the least recently used session is saved, which
+   also removes it from TPM memory, and the command is run again.  A saved session is loaded when
+   a command next uses it.  A session context can be loaded only once, so it is saved at each
+   eviction.
+
+   The TPM limits the difference between the oldest saved session context and the newest,
+   TPM_PT_CONTEXT_GAP_MAX.  After each session save, a saved session older than half the gap is
+   loaded and saved again to give it a new context sequence.  If the TPM returns
+   TPM_RC_CONTEXT_GAP anyway, the oldest saved session is refreshed and the command is run again.
+
+   The save, load, and flush commands are marshaled here and sent with TSS_Transmit(), because
+   they run while a command is prepared in the TSS authorization context.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ibmtss/tss.h>
+#include <ibmtss/tsserror.h>
+#include <ibmtss/tssutils.h>
+#include <ibmtss/tssmarshal.h>
+#include <ibmtss/Unmarshal_fp.h>
+#include <ibmtss/tsstransmit.h>
+
+#include "tssproperties.h"
+#include "tss20.h"
+
+/* The virtual handles are allocated from a range that a TPM does not use for its own transient
+   handles, and that is below the range used by the Linux kernel resource manager. */
+
+#define TSS_VIRTUAL_HANDLE_FIRST	0x80fe0000
+#define TSS_VIRTUAL_HANDLE_COUNT	0x00010000
+#define TSS_VIRTUAL_IS_VIRTUAL(handle)	(((handle) & 0xffff0000) == TSS_VIRTUAL_HANDLE_FIRST)
+#define TSS_VIRTUAL_IS_SESSION(handle)	((((handle) & HR_RANGE_MASK) == HR_HMAC_SESSION) || \
+					 (((handle) & HR_RANGE_MASK) == HR_POLICY_SESSION))
+
+#define TSS_VIRTUAL_EVICTED		0	/* realHandle of an entry that is not loaded */
+#define TSS_VIRTUAL_HEADER_SIZE		(sizeof(TPM_ST) + sizeof(uint32_t) + sizeof(TPM_CC))
+#define TSS_VIRTUAL_OBJECTS		8	/* initial number of table entries */
+#define TSS_VIRTUAL_GAP_DEFAULT		0xffff	/* if TPM_PT_CONTEXT_GAP_MAX cannot be read */
+
+/* An object or session.  For a session, virtualHandle is the session handle. */
+
+typedef struct TSS_VIRTUAL_OBJECT {
+    TPM_HANDLE 		virtualHandle;
+    TPM_HANDLE 		realHandle;	/* TPM handle, TSS_VIRTUAL_EVICTED when not loaded */
+    uint64_t 		lastUse;	/* clock of the last command that used the entry */
+    int 		session;	/* TRUE for a session */
+    int 		reusable;	/* TRUE if the saved context remains valid after a load */
+    TPMS_CONTEXT 	*context;	/* saved context, NULL until the first eviction */
+} TSS_VIRTUAL_OBJECT;
+
+typedef struct TSS_VIRTUAL {
+    TSS_VIRTUAL_OBJECT 	*objects;
+    size_t 		count;		/* entries in use */
+    size_t 		slots;		/* entries allocated */
+    TPM_HANDLE 		nextHandle;	/* next virtual handle to try */
+    /* incremented for each command.  Entries used by the current command have lastUse equal to
+       the clock and are not evicted. */
+    uint64_t 		clock;
+    uint32_t 		gapMax;		/* TPM_PT_CONTEXT_GAP_MAX, 0 until read */
+    uint64_t 		newest;		/* context sequence of the latest session save */
+    uint8_t 		commandBuffer[MAX_COMMAND_SIZE];
+    uint8_t 		responseBuffer[MAX_RESPONSE_SIZE];
+} TSS_VIRTUAL;
+
+/* local prototypes */
+
+static TPM_RC TSS_Virtual_Get(TSS_CONTEXT *tssContext,
+			      TSS_VIRTUAL **virtual);
+static TSS_VIRTUAL_OBJECT *TSS_Virtual_Find(TSS_VIRTUAL *virtual,
+					    TPM_HANDLE virtualHandle);
+static TPM_RC TSS_Virtual_Add(TSS_VIRTUAL *virtual,
+			      TPM_HANDLE *virtualHandle,
+			      TPM_HANDLE realHandle,
+			      int session,
+			      int reusable);
+static void TSS_Virtual_Remove(TSS_VIRTUAL *virtual,
+			       TPM_HANDLE realHandle);
+static TPM_RC TSS_Virtual_MapHandle(TSS_CONTEXT *tssContext,
+				    TSS_VIRTUAL *virtual,
+				    uint8_t *handleBuffer);
+static TPM_RC TSS_Virtual_Use(TSS_CONTEXT *tssContext,
+			      TSS_VIRTUAL *virtual,
+			      TPM_HANDLE *handle);
+static TPM_RC TSS_Virtual_Load(TSS_CONTEXT *tssContext,
+			       TSS_VIRTUAL *virtual,
+			       TSS_VIRTUAL_OBJECT *object);
+static TPM_RC TSS_Virtual_EvictLru(TSS_CONTEXT *tssContext,
+				   TSS_VIRTUAL *virtual,
+				   int session);
+static TPM_RC TSS_Virtual_EvictObject(TSS_CONTEXT *tssContext,
+				      TSS_VIRTUAL *virtual,
+				      TSS_VIRTUAL_OBJECT *object);
+static TPM_RC TSS_Virtual_Regularize(TSS_CONTEXT *tssContext,
+				     TSS_VIRTUAL *virtual);
+static TPM_RC TSS_Virtual_CheckGap(TSS_CONTEXT *tssContext,
+				   TSS_VIRTUAL *virtual,
+				   uint64_t newest);
+static TSS_VIRTUAL_OBJECT *TSS_Virtual_OldestSaved(TSS_VIRTUAL *virtual);
+static TPM_RC TSS_Virtual_GetGapMax(TSS_CONTEXT *tssContext,
+				    TSS_VIRTUAL *virtual);
+static TPM_RC TSS_Virtual_ContextSave(TSS_CONTEXT *tssContext,
+				      TSS_VIRTUAL *virtual,
+				      TPMS_CONTEXT *context,
+				      TPM_HANDLE saveHandle);
+static TPM_RC TSS_Virtual_ContextLoad(TSS_CONTEXT *tssContext,
+				      TSS_VIRTUAL *virtual,
+				      TPM_HANDLE *loadedHandle,
+				      const TPMS_CONTEXT *context);
+static TPM_RC TSS_Virtual_FlushContext(TSS_CONTEXT *tssContext,
+				       TSS_VIRTUAL *virtual,
+				       TPM_HANDLE flushHandle);
+static TPM_RC TSS_Virtual_Transmit(TSS_CONTEXT *tssContext,
+				   TSS_VIRTUAL *virtual,
+				   TPM_CC commandCode,
+				   uint8_t **buffer,
+				   uint32_t *size,
+				   const char *message);
+
+/* TSS_Virtual_Command() is called after the command authorizations are added.  It loads any
+   evicted object or saved session that the command uses, and replaces each virtual handle in the
+   marshaled command with the TPM handle.
+
+   TPM2_FlushContext takes the handle as a parameter rather than in the handle area, but it is
+   also the first value after the header.
+*/
+
+TPM_RC TSS_Virtual_Command(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+    TSS_AUTH_CONTEXT	*tssAuthContext = tssContext->tssAuthContext;
+    TSS_EXECUTE_STATE 	*state = &tssContext->tssExecuteState;
+    TSS_VIRTUAL		*virtual = tssContext->tssVirtual;
+    size_t		commandHandleCount;
+    size_t		i;
+    TPM_HANDLE		sessionHandle;
+    uint8_t		*handleBuffer = tssAuthContext->commandBuffer + TSS_VIRTUAL_HEADER_SIZE;
+
+    /* nothing has been virtualized */
+    if (virtual == NULL) {
+	return rc;
+    }
+    /* the entries used by this command are not evicted while the command is processed */
+    virtual->clock++;
+    if (rc == 0) {
+	rc = TSS_GetCommandHandleCount(tssAuthContext, &commandHandleCount);
+    }
+    if (rc == 0) {
+	if (TSS_GetCommandCode(tssAuthContext) == TPM_CC_FlushContext) {
+	    commandHandleCount = 1;
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < commandHandleCount) ; i++) {
+	rc = TSS_Virtual_MapHandle(tssContext, virtual, handleBuffer + (i * sizeof(TPM_HANDLE)));
+    }
+    /* the authorization sessions, whose handles do not change */
+    for (i = 0 ; (rc == 0) && (i < MAX_SESSION_NUM) &&
+	     (state->sessionHandle[i] != TPM_RH_NULL) ; i++) {
+	if (state->sessionHandle[i] != TPM_RS_PW) {
+	    sessionHandle = state->sessionHandle[i];
+	    rc = TSS_Virtual_Use(tssContext, virtual, &sessionHandle);
+	}
+    }
+    return rc;
+}
+
+/* TSS_Virtual_MapHandle() replaces the virtual handle at handleBuffer with the TPM handle.  Other
+   handles are not changed. */
+
+static TPM_RC TSS_Virtual_MapHandle(TSS_CONTEXT *tssContext,
+				    TSS_VIRTUAL *virtual,
+				    uint8_t *handleBuffer)
+{
+    TPM_RC		rc = 0;
+    TPM_HANDLE		handle;
+    TPM_HANDLE		virtualHandle;
+    uint8_t		*buffer = handleBuffer;
+    uint32_t		size = sizeof(TPM_HANDLE);
+    uint16_t		written = 0;
+
+    if (rc == 0) {
+	rc = TSS_TPM_HANDLE_Unmarshalu(&handle, &buffer, &size);
+    }
+    if (rc == 0) {
+	virtualHandle = handle;
+	rc = TSS_Virtual_Use(tssContext, virtual, &handle);
+    }
+    if ((rc == 0) && (handle != virtualHandle)) {
+	if (tssVverbose) printf("TSS_Virtual_MapHandle: handle %08x is TPM handle %08x\n",
+				virtualHandle, handle);
+	buffer = handleBuffer;
+	rc = TSS_TPM_HANDLE_Marshalu(&handle, &written, &buffer, NULL);
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Use() marks the object or session as used by the current command, loads it if
+   needed, and returns its TPM handle.  A handle that is not in the table is returned unchanged,
+   and is left for the TPM to accept or reject. */
+
+static TPM_RC TSS_Virtual_Use(TSS_CONTEXT *tssContext,
+			      TSS_VIRTUAL *virtual,
+			      TPM_HANDLE *handle)
+{
+    TPM_RC		rc = 0;
+    TSS_VIRTUAL_OBJECT	*object = NULL;
+
+    if (!TSS_VIRTUAL_IS_VIRTUAL(*handle) && !TSS_VIRTUAL_IS_SESSION(*handle)) {
+	return rc;
+    }
+    object = TSS_Virtual_Find(virtual, *handle);
+    if (object == NULL) {
+	if (tssVverbose) printf("TSS_Virtual_Use: handle %08x not virtualized\n", *handle);
+	return rc;
+    }
+    object->lastUse = virtual->clock;
+    if (rc == 0) {
+	if (object->realHandle == TSS_VIRTUAL_EVICTED) {
+	    rc = TSS_Virtual_Load(tssContext, virtual, object);
+	}
+    }
+    if (rc == 0) {
+	*handle = object->realHandle;
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Response() is called after the response authorizations are verified.
+
+   It removes the objects flushed by the command from the table, and a session that the caller
+   saved, since the caller now manages its context.
+
+   If object virtualization is enabled, it replaces a transient object handle in the response with
+   a new virtual handle.  If session virtualization is enabled, it adds a new session to the table.
+*/
+
+TPM_RC TSS_Virtual_Response(TSS_CONTEXT *tssContext)
+{
+    TPM_RC		rc = 0;
+    TSS_AUTH_CONTEXT	*tssAuthContext = tssContext->tssAuthContext;
+    TSS_VIRTUAL		*virtual = NULL;
+    TPM_CC		commandCode = TSS_GetCommandCode(tssAuthContext);
+    TPM_HANDLE		handle;
+    TPM_HANDLE		virtualHandle;
+    TPM_HT		handleType;
+    int			reusable;
+    uint8_t		*buffer;
+    uint32_t		size;
+    uint16_t		written = 0;
+
+    /* the flushed or saved handle, now the TPM handle, is the first value after the header */
+    if ((tssContext->tssVirtual != NULL) &&
+	((commandCode == TPM_CC_FlushContext) ||
+	 (commandCode == TPM_CC_SequenceComplete) ||
+	 (commandCode == TPM_CC_EventSequenceComplete) ||
+	 (commandCode == TPM_CC_ContextSave))) {
+	if (rc == 0) {
+	    buffer = tssAuthContext->commandBuffer + TSS_VIRTUAL_HEADER_SIZE;
+	    /* TPM2_EventSequenceComplete has the PCR handle first */
+	    if (commandCode == TPM_CC_EventSequenceComplete) {
+		buffer += sizeof(TPM_HANDLE);
+	    }
+	    size = sizeof(TPM_HANDLE);
+	    rc = TSS_TPM_HANDLE_Unmarshalu(&handle, &buffer, &size);
+	}
+	if (rc == 0) {
+	    /* saving an object leaves it loaded */
+	    if ((commandCode != TPM_CC_ContextSave) || TSS_VIRTUAL_IS_SESSION(handle)) {
+		TSS_Virtual_Remove(tssContext->tssVirtual, handle);
+	    }
+	}
+    }
+    /* only a response with a handle is virtualized */
+    if ((rc == 0) && (tssAuthContext->responseHandleCount == 0)) {
+	return rc;
+    }
+    if (rc == 0) {
+	buffer = tssAuthContext->responseBuffer + TSS_VIRTUAL_HEADER_SIZE;
+	size = sizeof(TPM_HANDLE);
+	rc = TSS_TPM_HANDLE_Unmarshalu(&handle, &buffer, &size);
+    }
+    if (rc == 0) {
+	handleType = (TPM_HT) ((handle & HR_RANGE_MASK) >> HR_SHIFT);
+	if (!((handleType == TPM_HT_TRANSIENT) &&
+	      (tssContext->tssVirtualize & TSS_VIRTUALIZE_OBJECTS)) &&
+	    !(((handleType == TPM_HT_HMAC_SESSION) || (handleType == TPM_HT_POLICY_SESSION)) &&
+	      (tssContext->tssVirtualize & TSS_VIRTUALIZE_SESSIONS))) {
+	    return rc;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Virtual_Get(tssContext, &virtual);
+    }
+    if (rc == 0) {
+	if (handleType == TPM_HT_TRANSIENT) {
+	    /* sequence objects and contexts loaded by the caller are saved at each eviction */
+	    reusable = (commandCode == TPM_CC_Load) ||
+		       (commandCode == TPM_CC_LoadExternal) ||
+		       (commandCode == TPM_CC_CreatePrimary) ||
+		       (commandCode == TPM_CC_CreateLoaded);
+	    rc = TSS_Virtual_Add(virtual, &virtualHandle, handle, FALSE, reusable);
+	}
+	/* a session keeps its handle */
+	else if (TSS_Virtual_Find(virtual, handle) == NULL) {
+	    rc = TSS_Virtual_Add(virtual, &handle, handle, TRUE, FALSE);
+	    return rc;
+	}
+	else {
+	    return rc;
+	}
+    }
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_Virtual_Response: TPM handle %08x is handle %08x\n",
+				handle, virtualHandle);
+	buffer = tssAuthContext->responseBuffer + TSS_VIRTUAL_HEADER_SIZE;
+	rc = TSS_TPM_HANDLE_Marshalu(&virtualHandle, &written, &buffer, NULL);
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Flushed() removes a session that the TPM flushed because continueSession was
+   clear */
+
+void TSS_Virtual_Flushed(TSS_CONTEXT *tssContext,
+			 TPM_HANDLE handle)
+{
+    if (tssContext->tssVirtual != NULL) {
+	TSS_Virtual_Remove(tssContext->tssVirtual, handle);
+    }
+    return;
+}
+
+/* TSS_Virtual_Recover() makes room for a command that failed with 'rc':
+
+   TPM_RC_OBJECT_MEMORY - evicts the least recently used object that the command does not use
+   TPM_RC_SESSION_MEMORY - saves the least recently used session that the command does not use
+   TPM_RC_CONTEXT_GAP - refreshes the oldest saved session
+
+   'recoveries' is the number of times the command has already been run again.  Each recovery
+   evicts an entry or refreshes a saved session, so a command that still fails after twice the
+   number of entries is not making progress, and 'rc' is returned.
+
+   Returns 0 if the command should be run again, otherwise 'rc' or another error.
+*/
+
+TPM_RC TSS_Virtual_Recover(TSS_CONTEXT *tssContext, TPM_RC rc, unsigned int recoveries)
+{
+    TSS_VIRTUAL		*virtual = tssContext->tssVirtual;
+
+    if ((virtual != NULL) && (recoveries >= (2 * virtual->count))) {
+	if (tssVerbose) printf("TSS_Virtual_Recover: Error, rc %08x after %u recoveries\n",
+			       rc, recoveries);
+	return rc;
+    }
+    if (virtual != NULL) {
+	switch (rc) {
+	  case TPM_RC_OBJECT_MEMORY:
+	    rc = TSS_Virtual_EvictLru(tssContext, virtual, FALSE);
+	    break;
+	  case TPM_RC_SESSION_MEMORY:
+	    rc = TSS_Virtual_EvictLru(tssContext, virtual, TRUE);
+	    break;
+	  case TPM_RC_CONTEXT_GAP:
+	    rc = TSS_Virtual_Regularize(tssContext, virtual);
+	    break;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Delete() flushes the loaded objects, whose virtual handles are not usable outside
+   the TSS context, and the sessions, whose saved contexts are lost, and frees the table.  Flush
+   errors are traced and otherwise ignored.
+
+   Since the raw flush bypasses the TSS_Execute() post processing, the state that the TSS retains
+   for each virtual handle, including session state and keys, is deleted here.  It is called
+   before the session cache is written back, so that flushed sessions are not written. */
+
+void TSS_Virtual_Delete(TSS_CONTEXT *tssContext)
+{
+    TSS_VIRTUAL		*virtual = tssContext->tssVirtual;
+    size_t		i;
+
+    if (virtual != NULL) {
+	for (i = 0 ; i < virtual->count ; i++) {
+	    /* a saved session is flushed by its handle */
+	    if (virtual->objects[i].session) {
+		TSS_Virtual_FlushContext(tssContext, virtual, virtual->objects[i].virtualHandle);
+	    }
+	    else if (virtual->objects[i].realHandle != TSS_VIRTUAL_EVICTED) {
+		TSS_Virtual_FlushContext(tssContext, virtual, virtual->objects[i].realHandle);
+	    }
+	    TSS_DeleteHandle(tssContext, virtual->objects[i].virtualHandle);
+	    free(virtual->objects[i].context);
+	}
+	free(virtual->objects);
+	free(virtual);
+	tssContext->tssVirtual = NULL;
+    }
+    return;
+}
+
+/* TSS_Virtual_Get() returns the table, allocating it at first use */
+
+static TPM_RC TSS_Virtual_Get(TSS_CONTEXT *tssContext,
+			      TSS_VIRTUAL **virtual)
+{
+    TPM_RC		rc = 0;
+
+    if (tssContext->tssVirtual == NULL) {
+	rc = TSS_Malloc((unsigned char **)&tssContext->tssVirtual,	/* freed by
+									   TSS_Virtual_Delete() */
+			sizeof(TSS_VIRTUAL));
+	if (rc == 0) {
+	    tssContext->tssVirtual->objects = NULL;
+	    tssContext->tssVirtual->count = 0;
+	    tssContext->tssVirtual->slots = 0;
+	    tssContext->tssVirtual->nextHandle = TSS_VIRTUAL_HANDLE_FIRST;
+	    tssContext->tssVirtual->clock = 0;
+	    tssContext->tssVirtual->gapMax = 0;
+	    tssContext->tssVirtual->newest = 0;
+	}
+    }
+    if (rc == 0) {
+	*virtual = tssContext->tssVirtual;
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Find() returns the entry for the virtual handle, or NULL */
+
+static TSS_VIRTUAL_OBJECT *TSS_Virtual_Find(TSS_VIRTUAL *virtual,
+					    TPM_HANDLE virtualHandle)
+{
+    size_t		i;
+
+    for (i = 0 ; i < virtual->count ; i++) {
+	if (virtual->objects[i].virtualHandle == virtualHandle) {
+	    return &virtual->objects[i];
+	}
+    }
+    return NULL;
+}
+
+/* TSS_Virtual_Add() adds an entry for a loaded object or session.  For an object, it returns a
+   new virtual handle.  For a session, virtualHandle is an input, the session handle. */
+
+static TPM_RC TSS_Virtual_Add(TSS_VIRTUAL *virtual,
+			      TPM_HANDLE *virtualHandle,
+			      TPM_HANDLE realHandle,
+			      int session,
+			      int reusable)
+{
+    TPM_RC		rc = 0;
+    TSS_VIRTUAL_OBJECT	*object;
+
+    if (rc == 0) {
+	if (virtual->count >= TSS_VIRTUAL_HANDLE_COUNT) {
+	    if (tssVerbose) printf("TSS_Virtual_Add: Error, out of virtual handles\n");
+	    rc = TPM_RC_OBJECT_HANDLES;
+	}
+    }
+    if (rc == 0) {
+	if (virtual->count == virtual->slots) {
+	    size_t slots = (virtual->slots == 0) ? TSS_VIRTUAL_OBJECTS : (virtual->slots * 2);
+	    rc = TSS_Realloc((unsigned char **)&virtual->objects,	/* freed by
+									   TSS_Virtual_Delete() */
+			     (uint32_t)(slots * sizeof(TSS_VIRTUAL_OBJECT)));
+	    if (rc == 0) {
+		virtual->slots = slots;
+	    }
+	}
+    }
+    /* the next virtual handle that is not in use, wrapping within the range */
+    if ((rc == 0) && !session) {
+	while (TSS_Virtual_Find(virtual, virtual->nextHandle) != NULL) {
+	    virtual->nextHandle = TSS_VIRTUAL_HANDLE_FIRST +
+				  ((virtual->nextHandle + 1) & (TSS_VIRTUAL_HANDLE_COUNT - 1));
+	}
+	*virtualHandle = virtual->nextHandle;
+	virtual->nextHandle = TSS_VIRTUAL_HANDLE_FIRST +
+			      ((virtual->nextHandle + 1) & (TSS_VIRTUAL_HANDLE_COUNT - 1));
+    }
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_Virtual_Add: handle %08x\n", *virtualHandle);
+	object = &virtual->objects[virtual->count];
+	object->virtualHandle = *virtualHandle;
+	object->realHandle = realHandle;
+	object->lastUse = virtual->clock;
+	object->session = session;
+	object->reusable = reusable;
+	object->context = NULL;
+	virtual->count++;
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Remove() removes the entry for a loaded object or a session, if there is one.  A
+   saved session is found by its handle. */
+
+static void TSS_Virtual_Remove(TSS_VIRTUAL *virtual,
+			       TPM_HANDLE realHandle)
+{
+    size_t		i;
+
+    for (i = 0 ; i < virtual->count ; i++) {
+	if ((virtual->objects[i].realHandle == realHandle) ||
+	    (virtual->objects[i].session && (virtual->objects[i].virtualHandle == realHandle))) {
+	    if (tssVverbose) printf("TSS_Virtual_Remove: handle %08x\n",
+				    virtual->objects[i].virtualHandle);
+	    free(virtual->objects[i].context);
+	    virtual->count--;
+	    virtual->objects[i] = virtual->objects[virtual->count];
+	    break;
+	}
+    }
+    return;
+}
+
+/* TSS_Virtual_Load() loads an evicted object or saved session, evicting others of the same kind
+   as needed to make room */
+
+static TPM_RC TSS_Virtual_Load(TSS_CONTEXT *tssContext,
+			       TSS_VIRTUAL *virtual,
+			       TSS_VIRTUAL_OBJECT *object)
+{
+    TPM_RC		rc = 0;
+    TPM_RC		memoryRc = object->session ? TPM_RC_SESSION_MEMORY : TPM_RC_OBJECT_MEMORY;
+
+    if (tssVverbose) printf("TSS_Virtual_Load: handle %08x\n", object->virtualHandle);
+    do {
+	rc = TSS_Virtual_ContextLoad(tssContext, virtual, &object->realHandle, object->context);
+    } while ((rc == memoryRc) && (TSS_Virtual_EvictLru(tssContext, virtual, object->session) == 0));
+    if (rc != 0) {
+	object->realHandle = TSS_VIRTUAL_EVICTED;
+	if (tssVerbose) printf("TSS_Virtual_Load: Error loading handle %08x\n",
+			       object->virtualHandle);
+    }
+    return rc;
+}
+
+/* TSS_Virtual_EvictLru() evicts the least recently used loaded object or session that the
+   current command does not use.
+
+   Returns TPM_RC_OBJECT_MEMORY or TPM_RC_SESSION_MEMORY if there is none.
+*/
+
+static TPM_RC TSS_Virtual_EvictLru(TSS_CONTEXT *tssContext,
+				   TSS_VIRTUAL *virtual,
+				   int session)
+{
+    TPM_RC		rc = 0;
+    TSS_VIRTUAL_OBJECT	*object = NULL;
+    size_t		i;
+
+    for (i = 0 ; i < virtual->count ; i++) {
+	if ((virtual->objects[i].session == session) &&
+	    (virtual->objects[i].realHandle != TSS_VIRTUAL_EVICTED) &&
+	    (virtual->objects[i].lastUse != virtual->clock) &&
+	    ((object == NULL) || (virtual->objects[i].lastUse < object->lastUse))) {
+	    object = &virtual->objects[i];
+	}
+    }
+    if (rc == 0) {
+	if (object == NULL) {
+	    if (tssVverbose) printf("TSS_Virtual_EvictLru: Nothing to evict\n");
+	    rc = session ? TPM_RC_SESSION_MEMORY : TPM_RC_OBJECT_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Virtual_EvictObject(tssContext, virtual, object);
+    }
+    return rc;
+}
+
+/* TSS_Virtual_EvictObject() saves the context if needed and flushes an object.  Saving a session
+   removes it from TPM memory. */
+
+static TPM_RC TSS_Virtual_EvictObject(TSS_CONTEXT *tssContext,
+				      TSS_VIRTUAL *virtual,
+				      TSS_VIRTUAL_OBJECT *object)
+{
+    TPM_RC		rc = 0;
+    int			save = (object->context == NULL) || !object->reusable;
+
+    if (tssVverbose) printf("TSS_Virtual_EvictObject: handle %08x TPM handle %08x\n",
+			    object->virtualHandle, object->realHandle);
+    if ((rc == 0) && (object->context == NULL)) {
+	rc = TSS_Malloc((unsigned char **)&object->context,	/* freed by TSS_Virtual_Remove() */
+			sizeof(TPMS_CONTEXT));
+    }
+    if ((rc == 0) && save) {
+	rc = TSS_Virtual_ContextSave(tssContext, virtual, object->context, object->realHandle);
+	/* refresh the oldest saved session and try once more */
+	if ((rc == TPM_RC_CONTEXT_GAP) && object->session) {
+	    rc = TSS_Virtual_Regularize(tssContext, virtual);
+	    if (rc == 0) {
+		rc = TSS_Virtual_ContextSave(tssContext, virtual,
+					     object->context, object->realHandle);
+	    }
+	}
+	/* do not reuse a partial context */
+	if (rc != 0) {
+	    free(object->context);
+	    object->context = NULL;
+	}
+    }
+    if ((rc == 0) && !object->session) {
+	rc = TSS_Virtual_FlushContext(tssContext, virtual, object->realHandle);
+    }
+    if (rc == 0) {
+	object->realHandle = TSS_VIRTUAL_EVICTED;
+    }
+    /* the session slot just freed is used to refresh old saved sessions */
+    if ((rc == 0) && object->session) {
+	rc = TSS_Virtual_CheckGap(tssContext, virtual, object->context->sequence);
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Regularize() loads the oldest saved session and saves it again, which gives it a
+   new context sequence.  It needs a free session slot.
+
+   Returns TPM_RC_CONTEXT_GAP if there is no saved session, or if the oldest saved session is
+   already the latest session saved, so that a refresh cannot narrow the gap.
+*/
+
+static TPM_RC TSS_Virtual_Regularize(TSS_CONTEXT *tssContext,
+				     TSS_VIRTUAL *virtual)
+{
+    TPM_RC		rc = 0;
+    TSS_VIRTUAL_OBJECT	*object = TSS_Virtual_OldestSaved(virtual);
+
+    if (rc == 0) {
+	if (object == NULL) {
+	    if (tssVverbose) printf("TSS_Virtual_Regularize: No saved session\n");
+	    rc = TPM_RC_CONTEXT_GAP;
+	}
+	else if (object->context->sequence == virtual->newest) {
+	    if (tssVverbose) printf("TSS_Virtual_Regularize: handle %08x is already the newest\n",
+				    object->virtualHandle);
+	    rc = TPM_RC_CONTEXT_GAP;
+	}
+    }
+    if (rc == 0) {
+	if (tssVverbose) printf("TSS_Virtual_Regularize: handle %08x sequence %llu\n",
+				object->virtualHandle,
+				(unsigned long long)object->context->sequence);
+	rc = TSS_Virtual_ContextLoad(tssContext, virtual, &object->realHandle, object->context);
+	if (rc != 0) {
+	    object->realHandle = TSS_VIRTUAL_EVICTED;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Virtual_ContextSave(tssContext, virtual, object->context, object->realHandle);
+	/* the session is loaded, with no saved context */
+	if (rc != 0) {
+	    free(object->context);
+	    object->context = NULL;
+	}
+    }
+    if (rc == 0) {
+	object->realHandle = TSS_VIRTUAL_EVICTED;
+    }
+    return rc;
+}
+
+/* TSS_Virtual_CheckGap() refreshes the saved sessions whose context sequence is more than half of
+   TPM_PT_CONTEXT_GAP_MAX older than 'newest', the sequence of the latest save. */
+
+static TPM_RC TSS_Virtual_CheckGap(TSS_CONTEXT *tssContext,
+				   TSS_VIRTUAL *virtual,
+				   uint64_t newest)
+{
+    TPM_RC		rc = 0;
+    TSS_VIRTUAL_OBJECT	*object;
+    size_t		i;
+
+    if (rc == 0) {
+	rc = TSS_Virtual_GetGapMax(tssContext, virtual);
+    }
+    /* each refresh makes the session the newest, so each session is refreshed at most once */
+    for (i = 0 ; (rc == 0) && (i < virtual->count) ; i++) {
+	object = TSS_Virtual_OldestSaved(virtual);
+	if ((object == NULL) || ((newest - object->context->sequence) <= (virtual->gapMax / 2))) {
+	    break;
+	}
+	rc = TSS_Virtual_Regularize(tssContext, virtual);
+	if (rc == 0) {
+	    newest = object->context->sequence;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Virtual_OldestSaved() returns the saved session with the oldest context sequence, or
+   NULL */
+
+static TSS_VIRTUAL_OBJECT *TSS_Virtual_OldestSaved(TSS_VIRTUAL *virtual)
+{
+    TSS_VIRTUAL_OBJECT	*object = NULL;
+    size_t		i;
+
+    for (i = 0 ; i < virtual->count ; i++) {
+	if (virtual->objects[i].session &&
+	    (virtual->objects[i].realHandle == TSS_VIRTUAL_EVICTED) &&
+	    (virtual->objects[i].context != NULL) &&
+	    ((object == NULL) ||
+	     (virtual->objects[i].context->sequence < object->context->sequence))) {
+	    object = &virtual->objects[i];
+	}
+    }
+    return object;
+}
+
+/* TSS_Virtual_GetGapMax() reads TPM_PT_CONTEXT_GAP_MAX at first use.  This does not use the
+   capability cache, which sends the command through TSS_Execute(). */
+
+static TPM_RC TSS_Virtual_GetGapMax(TSS_CONTEXT *tssContext,
+				    TSS_VIRTUAL *virtual)
+{
+    TPM_RC		rc = 0;
+    GetCapability_In 	in;
+    GetCapability_Out 	out;
+    uint16_t		written = 0;
+    uint8_t		*buffer = virtual->commandBuffer + TSS_VIRTUAL_HEADER_SIZE;
+    uint32_t		size = sizeof(virtual->commandBuffer) - TSS_VIRTUAL_HEADER_SIZE;
+
+    if (virtual->gapMax != 0) {
+	return rc;
+    }
+    if (rc == 0) {
+	in.capability = TPM_CAP_TPM_PROPERTIES;
+	in.property = TPM_PT_CONTEXT_GAP_MAX;
+	in.propertyCount = 1;
+	rc = TSS_GetCapability_In_Marshalu(&in, &written, &buffer, &size);
+    }
+    if (rc == 0) {
+	rc = TSS_Virtual_Transmit(tssContext, virtual, TPM_CC_GetCapability,
+				  &buffer, &size, "TPM2_GetCapability");
+    }
+    if (rc == 0) {
+	rc = TSS_GetCapability_Out_Unmarshalu(&out, TPM_ST_NO_SESSIONS, &buffer, &size);
+    }
+    if ((rc == 0) &&
+	(out.capabilityData.capability == TPM_CAP_TPM_PROPERTIES) &&
+	(out.capabilityData.data.tpmProperties.count > 0) &&
+	(out.capabilityData.data.tpmProperties.tpmProperty[0].property ==
+	 TPM_PT_CONTEXT_GAP_MAX)) {
+	virtual->gapMax = out.capabilityData.data.tpmProperties.tpmProperty[0].value;
+    }
+    /* a TPM that does not report the property is not refreshed early */
+    if (virtual->gapMax == 0) {
+	if (tssVverbose) printf("TSS_Virtual_GetGapMax: using default\n");
+	virtual->gapMax = TSS_VIRTUAL_GAP_DEFAULT;
+    }
+    if (tssVverbose) printf("TSS_Virtual_GetGapMax: %u\n", virtual->gapMax);
+    return 0;
+}
+
+/* TSS_Virtual_ContextSave() sends TPM2_ContextSave */
+
+static TPM_RC TSS_Virtual_ContextSave(TSS_CONTEXT *tssContext,
+				      TSS_VIRTUAL *virtual,
+				      TPMS_CONTEXT *context,
+				      TPM_HANDLE saveHandle)
+{
+    TPM_RC		rc = 0;
+    ContextSave_In	in;
+    ContextSave_Out	out;
+    uint16_t		written = 0;
+    uint8_t		*buffer = virtual->commandBuffer + TSS_VIRTUAL_HEADER_SIZE;
+    uint32_t		size = sizeof(virtual->commandBuffer) - TSS_VIRTUAL_HEADER_SIZE;
+
+    if (rc == 0) {
+	in.saveHandle = saveHandle;
+	rc = TSS_ContextSave_In_Marshalu(&in, &written, &buffer, &size);
+    }
+    if (rc == 0) {
+	rc = TSS_Virtual_Transmit(tssContext, virtual, TPM_CC_ContextSave,
+				  &buffer, &size, "TPM2_ContextSave");
+    }
+    if (rc == 0) {
+	rc = TSS_ContextSave_Out_Unmarshalu(&out, TPM_ST_NO_SESSIONS, &buffer, &size);
+    }
+    if (rc == 0) {
+	*context = out.context;
+	if (TSS_VIRTUAL_IS_SESSION(saveHandle)) {
+	    virtual->newest = out.context.sequence;
+	}
+    }
+    return rc;
+}
+
+/* TSS_Virtual_ContextLoad() sends TPM2_ContextLoad */
+
+static TPM_RC TSS_Virtual_ContextLoad(TSS_CONTEXT *tssContext,
+				      TSS_VIRTUAL *virtual,
+				      TPM_HANDLE *loadedHandle,
+				      const TPMS_CONTEXT *context)
+{
+    TPM_RC		rc = 0;
+    ContextLoad_Out	out;
+    uint16_t		written = 0;
+    uint8_t		*buffer = virtual->commandBuffer + TSS_VIRTUAL_HEADER_SIZE;
+    uint32_t		size = sizeof(virtual->commandBuffer) - TSS_VIRTUAL_HEADER_SIZE;
+
+    if (rc == 0) {
+	rc = TSS_TPMS_CONTEXT_Marshalu(context, &written, &buffer, &size);
+    }
+    if (rc == 0) {
+	rc = TSS_Virtual_Transmit(tssContext, virtual, TPM_CC_ContextLoad,
+				  &buffer, &size, "TPM2_ContextLoad");
+    }
+    if (rc == 0) {
+	rc = TSS_ContextLoad_Out_Unmarshalu(&out, TPM_ST_NO_SESSIONS, &buffer, &size);
+    }
+    if (rc == 0) {
+	*loadedHandle = out.loadedHandle;
+    }
+    return rc;
+}
+
+/* TSS_Virtual_FlushContext() sends TPM2_FlushContext */
+
+static TPM_RC TSS_Virtual_FlushContext(TSS_CONTEXT *tssContext,
+				       TSS_VIRTUAL *virtual,
+				       TPM_HANDLE flushHandle)
+{
+    TPM_RC		rc = 0;
+    FlushContext_In	in;
+    uint16_t		written = 0;
+    uint8_t		*buffer = virtual->commandBuffer + TSS_VIRTUAL_HEADER_SIZE;
+    uint32_t		size = sizeof(virtual->commandBuffer) - TSS_VIRTUAL_HEADER_SIZE;
+
+    if (rc == 0) {
+	in.flushHandle = flushHandle;
+	rc = TSS_FlushContext_In_Marshalu(&in, &written, &buffer, &size);
+    }
+    if (rc == 0) {
+	rc = TSS_Virtual_Transmit(tssContext, virtual, TPM_CC_FlushContext,
+				  &buffer, &size, "TPM2_FlushContext");
+    }
+    if (rc != 0) {
+	if (tssVerbose) printf("TSS_Virtual_FlushContext: Error flushing handle %08x\n",
+			       flushHandle);
+    }
+    return rc;
+}
+
+/* TSS_Virtual_Transmit() adds the header to the command parameters marshaled after
+   TSS_VIRTUAL_HEADER_SIZE in the command buffer and sends the command.  On input, 'buffer' points
+   past the marshaled parameters.  On output, it points to the response parameters, and 'size' is
+   the size of the response parameters.
+
+   These commands have no sessions.
+*/
+
+static TPM_RC TSS_Virtual_Transmit(TSS_CONTEXT *tssContext,
+				   TSS_VIRTUAL *virtual,
+				   TPM_CC commandCode,
+				   uint8_t **buffer,
+				   uint32_t *size,
+				   const char *message)
+{
+    TPM_RC		rc = 0;
+    TPM_ST		tag = TPM_ST_NO_SESSIONS;
+    uint32_t		commandSize = (uint32_t)(*buffer - virtual->commandBuffer);
+    uint32_t		responseSize = 0;
+    uint16_t		written = 0;
+    uint8_t		*header = virtual->commandBuffer;
+
+    if (rc == 0) {
+	rc = TSS_UINT16_Marshalu(&tag, &written, &header, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT32_Marshalu(&commandSize, &written, &header, NULL);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT32_Marshalu(&commandCode, &written, &header, NULL);
+    }
+    /* normally returns the TPM response code */
+    if (rc == 0) {
+	rc = TSS_Transmit(tssContext,
+			  virtual->responseBuffer, &responseSize,
+			  virtual->commandBuffer, commandSize,
+			  message);
+    }
+    if (rc == 0) {
+	if (responseSize < TSS_VIRTUAL_HEADER_SIZE) {
+	    if (tssVerbose) printf("TSS_Virtual_Transmit: Error, response size %u\n",
+				   responseSize);
+	    rc = TSS_RC_MALFORMED_RESPONSE;
+	}
+    }
+    if (rc == 0) {
+	*buffer = virtual->responseBuffer + TSS_VIRTUAL_HEADER_SIZE;
+	*size = responseSize - TSS_VIRTUAL_HEADER_SIZE;
+    }
+    return rc;
+}